@@ -0,0 +1,477 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : hdd_async.c
+//  Description   : This is the asynchronous request queue of the file IO
+//                  layer.  Submitted requests go on a ring that a pool of
+//                  worker threads takes them from, each worker carries a
+//                  request out with the positional or vectored file call
+//                  on its own pooled server connection and puts the
+//                  result on the completion ring.  The eventfd is written
+//                  when the completion ring stops being empty and cleared
+//                  when it is emptied, and workers and reapers are only
+//                  woken when there is something for them.
+//
+//  Author         : Chuyang Zhang
+//  Last Modified  : 2017/12/1
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+// Project Includes
+#include <hdd_async.h>
+#include <hdd_file_io.h>
+#include <cmpsc311_log.h>
+#include <hdd_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define HDD_ASYNC_UNIT_TEST_SIZE (256 * 1024)
+#define HDD_ASYNC_UNIT_TEST_REQUESTS 64
+#define HDD_ASYNC_UNIT_TEST_LENGTH 3000
+
+// The queue, both rings hold depth entries so neither can overflow while
+// at most depth requests are outstanding
+typedef struct {
+	pthread_mutex_t lock;	// guards everything below
+	pthread_cond_t work;	// signalled when a request is submitted or on stop
+	pthread_cond_t done;	// signalled when a request completes
+	HddAsyncRequest *sq;	// the submitted requests
+	HddAsyncCompletion *cq;	// the completions
+	uint32_t depth;	// entries of each ring
+	uint32_t sqHead, sqCount;	// the oldest submitted request, and how many
+	uint32_t cqHead, cqCount;	// the oldest completion, and how many
+	uint32_t outstanding;	// submitted and not yet reaped
+	uint32_t idle;	// workers waiting for a request
+	uint32_t wanted;	// completions a waiting reaper needs, 0 if none waits
+	pthread_t workers[HDD_ASYNC_MAX_WORKERS];
+	uint32_t workerCount;
+	int efd;	// the eventfd, -1 when the queue is not started
+	int stop;	// the workers are to exit
+} HddAsyncQueue;
+
+HddAsyncQueue asyncQueue = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+	.efd = -1,
+};
+
+//
+// Functions
+
+// carry out one request with the file call it names
+static int32_t asyncExecute(HddAsyncRequest *req) {
+	switch (req->op) {
+	case HDD_ASYNC_READ:
+		return(hdd_pread(req->fh, req->buf, req->len, req->off));
+	case HDD_ASYNC_WRITE:
+		return(hdd_pwrite(req->fh, req->buf, req->len, req->off));
+	case HDD_ASYNC_READV:
+		return(hdd_readv(req->fh, (HddIoSegment *)req->buf, req->len));
+	case HDD_ASYNC_WRITEV:
+		return(hdd_writev(req->fh, (HddIoSegment *)req->buf, req->len));
+	case HDD_ASYNC_FSYNC:
+		return(hdd_fsync(req->fh));
+	}
+	hdd_log(LOG_ERROR_LEVEL, "HDD_ASYNC : bad request [%d].", req->op);
+	return(-1);
+}
+
+// carry out the oldest submitted request and post its completion, called
+// with the lock held (it is dropped while the request is carried out)
+static void asyncRunOne(HddAsyncQueue *q) {
+	HddAsyncRequest req;
+	int32_t result;
+	uint64_t one = 1;
+
+	req = q->sq[q->sqHead];
+	q->sqHead = (q->sqHead + 1) % q->depth;
+	q->sqCount--;
+	pthread_mutex_unlock(&q->lock);
+
+	result = asyncExecute(&req);
+
+	// Post the completion, the eventfd is only written when the ring stops being empty
+	pthread_mutex_lock(&q->lock);
+	q->cq[(q->cqHead + q->cqCount) % q->depth].tag = req.tag;
+	q->cq[(q->cqHead + q->cqCount) % q->depth].result = result;
+	if (q->cqCount++ == 0 && write(q->efd, &one, sizeof(one)) != sizeof(one)) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_ASYNC : eventfd write failed.");
+	}
+	if (q->wanted > 0 && q->cqCount >= q->wanted) {	// wake the reaper only once it has enough
+		pthread_cond_broadcast(&q->done);
+	}
+}
+
+// a worker, takes requests off the submission ring until the queue stops
+static void * asyncWorker(void *arg) {
+	HddAsyncQueue *q = &asyncQueue;
+
+	pthread_mutex_lock(&q->lock);
+	while (1) {
+		if (q->sqCount == 0 && !q->stop) {	// going idle, give the connection back first
+			pthread_mutex_unlock(&q->lock);
+			hdd_io_idle();
+			pthread_mutex_lock(&q->lock);
+		}
+		while (q->sqCount == 0 && !q->stop) {
+			q->idle++;
+			pthread_cond_wait(&q->work, &q->lock);
+			q->idle--;
+		}
+		if (q->sqCount == 0) {	// stopped and nothing left
+			break;
+		}
+		asyncRunOne(q);
+	}
+	pthread_mutex_unlock(&q->lock);
+	hdd_io_idle();
+	return(NULL);
+}
+
+// take up to max completions off the ring, called with the lock held; the
+// eventfd is cleared once the ring is empty so it stays readable until then
+static int asyncReap(HddAsyncQueue *q, HddAsyncCompletion *comps, int max) {
+	uint64_t count;
+	int n = 0;
+
+	while (n < max && q->cqCount > 0) {
+		comps[n++] = q->cq[q->cqHead];
+		q->cqHead = (q->cqHead + 1) % q->depth;
+		q->cqCount--;
+		q->outstanding--;
+	}
+	if (n > 0 && q->cqCount == 0 && read(q->efd, &count, sizeof(count)) != sizeof(count)) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_ASYNC : eventfd read failed.");
+	}
+	return(n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_async_init
+// Description  : Create the rings and the eventfd and start the workers.
+//                Each worker binds its own connection while it carries out
+//                a request, so up to workers requests reach the server at
+//                once if the client pool has the connections for them.
+//
+// Inputs       : workers - the number of worker threads (1 to HDD_ASYNC_MAX_WORKERS)
+//                depth - the most requests outstanding (1 to HDD_ASYNC_MAX_DEPTH)
+// Outputs      : 0 if successful, -1 if failure
+
+int hdd_async_init(uint32_t workers, uint32_t depth) {
+	HddAsyncQueue *q = &asyncQueue;
+
+	if (workers == 0 || workers > HDD_ASYNC_MAX_WORKERS || depth == 0 || depth > HDD_ASYNC_MAX_DEPTH) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_ASYNC : bad queue [%u workers, depth %u].", workers, depth);
+		return(-1);
+	}
+	if (q->efd != -1) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_ASYNC : queue already started.");
+		return(-1);
+	}
+
+	q->sq = malloc(depth * sizeof(HddAsyncRequest));
+	q->cq = malloc(depth * sizeof(HddAsyncCompletion));
+	q->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (q->sq == NULL || q->cq == NULL || q->efd == -1) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_ASYNC : failure creating the queue.");
+		hdd_async_close();
+		return(-1);
+	}
+	q->depth = depth;
+	q->sqHead = q->sqCount = q->cqHead = q->cqCount = q->outstanding = 0;
+	q->idle = q->wanted = 0;
+	q->stop = 0;
+	for (q->workerCount = 0; q->workerCount < workers; q->workerCount++) {
+		if (pthread_create(&q->workers[q->workerCount], NULL, asyncWorker, NULL)) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD_ASYNC : failed to start worker %u.", q->workerCount);
+			hdd_async_close();
+			return(-1);
+		}
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_async_close
+// Description  : Let the workers carry out the submitted requests, stop
+//                them and release the queue.  Completions not reaped are
+//                dropped.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int hdd_async_close(void) {
+	HddAsyncQueue *q = &asyncQueue;
+	uint32_t i;
+
+	pthread_mutex_lock(&q->lock);
+	q->stop = 1;
+	pthread_cond_broadcast(&q->work);
+	pthread_mutex_unlock(&q->lock);
+	for (i = 0; i < q->workerCount; i++) {
+		pthread_join(q->workers[i], NULL);
+	}
+	q->workerCount = 0;
+
+	if (q->efd != -1) {
+		close(q->efd);
+	}
+	free(q->sq);
+	free(q->cq);
+	q->sq = NULL;
+	q->cq = NULL;
+	q->efd = -1;
+	q->depth = q->sqCount = q->cqCount = q->outstanding = 0;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_async_submit
+// Description  : Queue a request for the workers.  The request is copied,
+//                its buffer is the caller's until the completion is reaped.
+//
+// Inputs       : req - the request
+// Outputs      : 0 if successful, -1 if the queue is full or not started
+
+int hdd_async_submit(HddAsyncRequest *req) {
+	HddAsyncQueue *q = &asyncQueue;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->efd == -1 || q->stop || q->outstanding >= q->depth) {
+		pthread_mutex_unlock(&q->lock);
+		return(-1);
+	}
+	q->sq[(q->sqHead + q->sqCount) % q->depth] = *req;
+	q->sqCount++;
+	q->outstanding++;
+	if (q->idle > q->sqCount - 1) {	// a worker is free to take it
+		pthread_cond_signal(&q->work);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_async_poll
+// Description  : Reap the completions that are waiting, without waiting
+//
+// Inputs       : comps - where the completions are put
+//                max - the most to reap
+// Outputs      : the number reaped
+
+int hdd_async_poll(HddAsyncCompletion *comps, int max) {
+	HddAsyncQueue *q = &asyncQueue;
+	int n;
+
+	pthread_mutex_lock(&q->lock);
+	n = (q->efd == -1) ? 0 : asyncReap(q, comps, max);
+	pthread_mutex_unlock(&q->lock);
+	return(n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_async_wait
+// Description  : Reap completions, waiting until min of them are waiting.
+//                The wait is cut to the outstanding requests so it always
+//                ends.  While no worker has taken a submitted request the
+//                caller carries it out itself instead of sleeping, which
+//                saves two thread switches for requests that do not block.
+//
+// Inputs       : comps - where the completions are put
+//                max - the most to reap
+//                min - the fewest to wait for
+// Outputs      : the number reaped
+
+int hdd_async_wait(HddAsyncCompletion *comps, int max, int min) {
+	HddAsyncQueue *q = &asyncQueue;
+	int n, ran = 0;
+
+	if (min > max) {
+		min = max;
+	}
+	pthread_mutex_lock(&q->lock);
+	if ((uint32_t)min > q->outstanding) {
+		min = q->outstanding;
+	}
+	while (q->cqCount < (uint32_t)min) {
+		if (q->sqCount > 0) {	// rather than sleep, carry out a request the workers have not taken
+			asyncRunOne(q);
+			ran = 1;
+			continue;
+		}
+		q->wanted = min;
+		pthread_cond_wait(&q->done, &q->lock);
+		q->wanted = 0;
+	}
+	n = (q->efd == -1) ? 0 : asyncReap(q, comps, max);
+	pthread_mutex_unlock(&q->lock);
+	if (ran) {	// the caller goes back to its own work holding no connection
+		hdd_io_idle();
+	}
+	return(n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_async_eventfd
+// Description  : Get the eventfd of the queue.  It is readable while
+//                completions are waiting and is cleared by reaping all of
+//                them, it is not to be read by the caller.
+//
+// Inputs       : none
+// Outputs      : the file descriptor, -1 if the queue is not started
+
+int hdd_async_eventfd(void) {
+	return(asyncQueue.efd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_async_outstanding
+// Description  : Get the number of requests submitted and not yet reaped
+//
+// Inputs       : none
+// Outputs      : the number of requests
+
+uint32_t hdd_async_outstanding(void) {
+	uint32_t n;
+
+	pthread_mutex_lock(&asyncQueue.lock);
+	n = asyncQueue.outstanding;
+	pthread_mutex_unlock(&asyncQueue.lock);
+	return(n);
+}
+
+// check the eventfd of the queue is readable exactly when completions wait
+static int checkEventfd(int expected) {
+	struct pollfd pfd = { .fd = hdd_async_eventfd(), .events = POLLIN };
+
+	return ((poll(&pfd, 1, 0) == 1) != expected) ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hddAsyncUnitTest
+// Description  : Write a file, then keep reads of it and writes of a
+//                second file in flight at once and check the results, the
+//                tags, the eventfd and a full queue.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int hddAsyncUnitTest(void) {
+
+	// Local variables
+	HddAsyncRequest req;
+	HddAsyncCompletion comps[HDD_ASYNC_UNIT_TEST_REQUESTS];
+	HddIoSegment segs[2];
+	char *data, *bufs;
+	int16_t fh, wfh;
+	int i, n, reaped, ret = 0;
+
+	// Format, mount and write the file to read, start the queue
+	data = malloc(HDD_ASYNC_UNIT_TEST_SIZE);
+	bufs = malloc(HDD_ASYNC_UNIT_TEST_REQUESTS * HDD_ASYNC_UNIT_TEST_LENGTH);
+	for (i=0; i<HDD_ASYNC_UNIT_TEST_SIZE; i++) {
+		data[i] = (char)getRandomValue(0, 0xff);
+	}
+	if (hdd_format() || hdd_mount() || ((fh = hdd_open("async_read.txt")) == -1) || ((wfh = hdd_open("async_write.txt")) == -1) ||
+		(hdd_write(fh, data, HDD_ASYNC_UNIT_TEST_SIZE) != HDD_ASYNC_UNIT_TEST_SIZE) || hdd_fsync(fh) ||
+		hdd_async_init(4, HDD_ASYNC_UNIT_TEST_REQUESTS)) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_ASYNC_UNIT_TEST : failure setting up the file.");
+		return(-1);
+	}
+	if (checkEventfd(0)) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_ASYNC_UNIT_TEST : eventfd readable with nothing completed.");
+		ret = -1;
+	}
+
+	// Fill the queue with reads at random positions and a vectored write, then one more must not fit
+	for (i=0; (i<HDD_ASYNC_UNIT_TEST_REQUESTS - 1) && (ret == 0); i++) {
+		req.op = HDD_ASYNC_READ;
+		req.fh = fh;
+		req.off = getRandomValue(0, HDD_ASYNC_UNIT_TEST_SIZE - HDD_ASYNC_UNIT_TEST_LENGTH);
+		req.len = HDD_ASYNC_UNIT_TEST_LENGTH;
+		req.buf = &bufs[i * HDD_ASYNC_UNIT_TEST_LENGTH];
+		req.tag = ((uint64_t)req.off << 32) | i;
+		ret = hdd_async_submit(&req);
+	}
+	segs[0].off = 0;
+	segs[0].len = HDD_ASYNC_UNIT_TEST_LENGTH;
+	segs[0].buf = data;
+	segs[1].off = HDD_ASYNC_UNIT_TEST_LENGTH;
+	segs[1].len = HDD_ASYNC_UNIT_TEST_LENGTH;
+	segs[1].buf = &data[HDD_ASYNC_UNIT_TEST_LENGTH];
+	req.op = HDD_ASYNC_WRITEV;
+	req.fh = wfh;
+	req.len = 2;
+	req.buf = segs;
+	req.tag = (uint64_t)-1;
+	if ((ret == 0) && (hdd_async_submit(&req) || (hdd_async_submit(&req) != -1))) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_ASYNC_UNIT_TEST : queue of %d requests not filled exactly.", HDD_ASYNC_UNIT_TEST_REQUESTS);
+		ret = -1;
+	}
+
+	// Reap them all, checking each read against the file by its tag
+	for (reaped=0; (reaped < HDD_ASYNC_UNIT_TEST_REQUESTS) && (ret == 0); reaped += n) {
+		n = hdd_async_wait(comps, HDD_ASYNC_UNIT_TEST_REQUESTS, 1);
+		for (i=0; (i<n) && (ret == 0); i++) {
+			if (comps[i].tag == (uint64_t)-1) {
+				ret = (comps[i].result == 2 * HDD_ASYNC_UNIT_TEST_LENGTH) ? 0 : -1;
+			} else if ((comps[i].result != HDD_ASYNC_UNIT_TEST_LENGTH) ||
+				memcmp(&bufs[(comps[i].tag & 0xffffffff) * HDD_ASYNC_UNIT_TEST_LENGTH], &data[comps[i].tag >> 32], HDD_ASYNC_UNIT_TEST_LENGTH)) {
+				ret = -1;
+			}
+		}
+		if (ret) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD_ASYNC_UNIT_TEST : bad completion [tag %lx, result %d].",
+				(unsigned long)comps[i-1].tag, comps[i-1].result);
+		}
+	}
+	if ((ret == 0) && (hdd_async_outstanding() != 0 || hdd_async_poll(comps, 1) != 0 || checkEventfd(0))) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_ASYNC_UNIT_TEST : requests left over after reaping them all.");
+		ret = -1;
+	}
+
+	// The eventfd signals a completion, and the written file reads back
+	req.op = HDD_ASYNC_READ;
+	req.fh = wfh;
+	req.off = 0;
+	req.len = 2 * HDD_ASYNC_UNIT_TEST_LENGTH;
+	req.buf = bufs;
+	req.tag = 7;
+	if ((ret == 0) && hdd_async_submit(&req) == 0) {
+		struct pollfd pfd = { .fd = hdd_async_eventfd(), .events = POLLIN };
+
+		if ((poll(&pfd, 1, -1) != 1) || checkEventfd(1) || (hdd_async_poll(comps, 1) != 1) || (comps[0].tag != 7) ||
+			(comps[0].result != 2 * HDD_ASYNC_UNIT_TEST_LENGTH) || memcmp(bufs, data, 2 * HDD_ASYNC_UNIT_TEST_LENGTH)) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD_ASYNC_UNIT_TEST : eventfd completion or written file wrong.");
+			ret = -1;
+		}
+	}
+
+	// Stop the queue and clean up
+	hdd_async_close();
+	free(data);
+	free(bufs);
+	if (hdd_close(fh) || hdd_close(wfh) || hdd_unmount()) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_ASYNC_UNIT_TEST : failure closing the files.");
+		return(-1);
+	}
+	if (ret == 0) {
+		hdd_log(LOG_INFO_LEVEL, "HDD_ASYNC_UNIT_TEST : async tests completed successfully.");
+	}
+	return(ret);
+}
@@ -0,0 +1,79 @@
+#ifndef HDD_ASYNC_INCLUDED
+#define HDD_ASYNC_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : hdd_async.h
+//  Description    : This is the interface for submitting file reads and
+//                   writes without waiting for them.  Requests carry a tag
+//                   of the caller and their completions are polled or
+//                   waited for, an eventfd is readable while completions
+//                   are waiting so the queue can join an epoll loop.
+//
+//  Author         : Chuyang Zhang
+//  Last Modified  : 2017/12/1
+//
+
+// Include files
+#include <stdint.h>
+
+// Defines
+#define HDD_ASYNC_MAX_DEPTH 1024    // Most requests submitted and not yet reaped
+#define HDD_ASYNC_MAX_WORKERS 64    // Most threads carrying out requests
+
+// The file operations of a request
+typedef enum {
+	HDD_ASYNC_READ   = 0,  // hdd_pread of len bytes at off into buf
+	HDD_ASYNC_WRITE  = 1,  // hdd_pwrite of len bytes at off from buf
+	HDD_ASYNC_READV  = 2,  // hdd_readv of len segments, buf is the HddIoSegment array
+	HDD_ASYNC_WRITEV = 3,  // hdd_writev of len segments, buf is the HddIoSegment array
+	HDD_ASYNC_FSYNC  = 4,  // hdd_fsync
+} HddAsyncOpcode;
+
+// A submitted request
+typedef struct {
+	uint8_t   op;      // The HddAsyncOpcode
+	int16_t   fh;      // The file handle
+	uint32_t  off;     // The position in the file
+	int32_t   len;     // The bytes, or segments
+	void     *buf;     // The bytes, or segments, owned by the caller until completion
+	uint64_t  tag;     // The caller's, returned with the completion
+} HddAsyncRequest;
+
+// A completed request
+typedef struct {
+	uint64_t  tag;     // The tag of the request
+	int32_t   result;  // What the file call returned
+} HddAsyncCompletion;
+
+//
+// Asynchronous IO interface
+
+int hdd_async_init(uint32_t workers, uint32_t depth);
+	// Start the queue, at most depth requests outstanding carried out by workers threads
+
+int hdd_async_close(void);
+	// Wait for the outstanding requests and stop the queue (completions are dropped)
+
+int hdd_async_submit(HddAsyncRequest *req);
+	// Queue a request, -1 if the queue is full or not started
+
+int hdd_async_poll(HddAsyncCompletion *comps, int max);
+	// Reap up to max completions without waiting, the number reaped
+
+int hdd_async_wait(HddAsyncCompletion *comps, int max, int min);
+	// Reap up to max completions, waiting for min of them (at most the outstanding)
+
+int hdd_async_eventfd(void);
+	// The eventfd readable while completions wait, -1 if the queue is not started
+
+uint32_t hdd_async_outstanding(void);
+	// The requests submitted and not yet reaped
+
+//
+// Unit testing for the module
+
+int hddAsyncUnitTest(void);
+	// Perform a test of the asynchronous queue
+
+#endif
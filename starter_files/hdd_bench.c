@@ -0,0 +1,1340 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : hdd_bench.c
+//  Description   : This is the benchmark program for the HDD client stack.
+//                  It drives the file IO interface against a running HDD
+//                  server and reports the cost of each scenario.
+//
+//   Author : Chuyang Zhang
+//   Last Modified : 2017/12/1
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+
+// Project Includes
+#include <hdd_driver.h>
+#include <hdd_network.h>
+#include <hdd_file_io.h>
+#include <hdd_workload.h>
+#include <hdd_stats.h>
+#include <hdd_slab.h>
+#include <hdd_cache.h>
+#include <cmpsc311_log.h>
+#include <hdd_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define HDD_BENCH_ARGUMENTS "hvl:s:c:q:n:a:p:dkriu:o:B:T:"
+#define HDD_BENCH_CHUNK_SIZE 4096
+#define HDD_BENCH_MIN_FILE_SIZE 1024
+#define HDD_BENCH_MAX_FILE_SIZE (64 * 1024 * 1024)
+#define HDD_BENCH_SMALL_BLOCK 64
+#define HDD_BENCH_SMALL_OPS 20000
+#define HDD_BENCH_THREAD_FILES 8
+#define HDD_BENCH_THREAD_FILE_SIZE (2 * 1024 * 1024)
+#define HDD_BENCH_READ_SIZE 0x10000
+#define HDD_BENCH_LATENCY_OPS 5000
+#define HDD_BENCH_URING_BLOCKS 64
+#define HDD_BENCH_SEED 311
+#define HDD_BENCH_SUITE_BLOCK 4096
+#define HDD_BENCH_APPEND_SIZE (16 * 1024 * 1024)
+#define HDD_BENCH_RANDOM_FILE_SIZE (16 * 1024 * 1024)
+#define HDD_BENCH_RANDOM_CACHE_BLOCKS 64	// a quarter of the random file, so most ops reach the device
+#define HDD_BENCH_RANDOM_OPS 131072
+#define HDD_BENCH_SCAN_FILE_SIZE (16 * 1024 * 1024)
+#define HDD_BENCH_SCAN_STRIDE (0x10000 + HDD_BENCH_SUITE_BLOCK)	// a new extent every read
+#define HDD_BENCH_CHURN_FILES 4096
+#define HDD_BENCH_CHURN_MAX_SIZE 1024
+#define HDD_BENCH_MAX_RESULTS 16
+#define HDD_BENCH_SUITE_RUNS 5
+#define HDD_BENCH_DEFAULT_THRESHOLD 10.0
+#define USAGE \
+	"USAGE: hdd_bench [-h] [-v] [-l <logfile>] [-s <scenario>] [-c <sz>] [-q <depth>] [-n <conns>] [-a <ip addr|unix:path|loopback>] [-d] [-k] [-r] [-i] [-u <path>] [-p <port>]\n" \
+	"                 [-o <results>] [-B <baseline>] [-T <percent>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -s - run only the named scenario (default all)\n" \
+	"    -c - size of the client block cache in blocks (default 1024)\n" \
+	"    -q - number of block requests kept in flight to the server (default 16)\n" \
+	"    -n - most connections to the server (default 1, the server must serve them at once)\n" \
+	"    -a - IP address of server to connect to, or unix:<path> for a Unix-domain socket.\n" \
+	"         loopback[:<file>] runs an in-process store instead, saved to <file> (default hdd_store.svd).\n" \
+	"    -d - set TCP_NODELAY on the server connections.\n" \
+	"    -k - ACK server responses at once (TCP_QUICKACK), for a server that holds them until ACKed (the shipped hdd_server)\n" \
+	"    -r - the server implements ranged block requests (hdd_ref_server, not the shipped hdd_server)\n" \
+	"    -i - carry the server requests over io_uring (blocking sockets where it is unavailable)\n" \
+	"    -u - also measure the server Unix-domain socket <path> in the latency scenario\n" \
+	"    -p - port number of server to connect to.\n" \
+	"    -o - write the suite results to <results> (a later run's baseline)\n" \
+	"    -B - compare the suite results with <baseline>, fail on a regression\n" \
+	"    -T - the ops/sec drop (percent) counted as a regression (default 10)\n" \
+	"\n" \
+	"scenarios:\n" \
+	"    filesize - append files from 1 KB to 64 MB, cost should grow linearly\n" \
+	"    transport - create/read/overwrite/delete 64 byte blocks, reports ops/sec\n" \
+	"    threads - read 8 files from 1 to 8 threads, reports how throughput scales\n" \
+	"    latency - one 64 byte read at a time over each transport, reports usecs per op\n" \
+	"    uring - 64 byte reads and overwrites over blocking sockets and io_uring at queue\n" \
+	"            depths 1, 8 and 64, reports ops/sec\n" \
+	"    suite - the fixed-seed matrix below, reports ops/sec, MB/s and latency percentiles\n" \
+	"            of the fastest of 5 runs of each\n" \
+	"      append - append a 16 MB file in 4 KB writes\n" \
+	"      overwrite - 4 KB writes at random block offsets of a 16 MB file (64 block cache)\n" \
+	"      randread - 4 KB reads at random block offsets of a 16 MB file (cold 64 block cache)\n" \
+	"      churn - create, write (up to 1 KB) and close 4096 small files\n" \
+	"      workloads - replay workload-one.txt, workload-two.txt and workload-three.txt\n" \
+	"\n" \
+
+// A benchmark scenario
+typedef struct {
+	const char *name;      // The name used to select the scenario
+	int       (*run)(void); // The function that runs it
+	int         suite;     // Part of the suite matrix
+} HddBenchScenario;
+
+// The result of a suite scenario, as written with -o and compared with -B
+typedef struct {
+	char     name[32];     // The scenario (or workload) name
+	double   opsPerSec;    // The operations per second
+	double   mbPerSec;     // The payload MB per second
+	double   p50;          // The median latency (usecs)
+	double   p99;          // The 99th percentile latency (usecs)
+	double   secs;         // The time taken
+	double   wirePerOp;    // The bytes sent and received per operation
+	double   heapPerOp;    // The buffers taken from the heap per operation
+	double   aheadHit;     // The percent of read-ahead blocks that were read
+	double   aheadWaste;   // The KB read ahead and never read
+	HddStatsSummary sum;   // The latencies of the operations
+} HddBenchResult;
+
+//
+// Functional Prototypes
+
+int bench_file_size( void );
+int bench_transport( void );
+int bench_threads( void );
+void * bench_reader( void *arg );
+int bench_latency( void );
+int bench_round_trips( const char *name );
+int bench_uring( void );
+int bench_pipelined( uint32_t depth );
+int bench_append( void );
+int bench_overwrite( void );
+int bench_random_read( void );
+int bench_scan( void );
+int bench_churn( void );
+int bench_workloads( void );
+void benchPrintResults( void );
+void benchReset( void );
+int benchWriteResults( const char *path );
+int benchCompareResults( const char *path, double threshold );
+
+// The files read by one thread of the threads scenario
+typedef struct {
+	int first;    // The first file of the thread
+	int stride;   // The distance to its next file
+	int result;   // 0 if the files were read, -1 on failure
+} HddBenchReader;
+
+// A Unix-domain socket measured by the latency scenario (-u)
+char *benchUnixPath = NULL;
+
+// The client queue depth (-q), restored after the uring scenario
+uint32_t benchDepth = HDD_CLIENT_DEFAULT_DEPTH;
+uint32_t benchCacheBlocks = HDD_DEFAULT_CACHE_SIZE;	// the cache size of the other scenarios
+
+// The results of the suite scenarios run
+HddBenchResult benchResults[HDD_BENCH_MAX_RESULTS];
+int benchResultCount = 0;
+uint64_t benchHeapAllocs = 0;	// the slab heap allocations when the run started
+HddCachePrefetchStats benchAhead;	// the read-ahead statistics when the run started
+
+// The scenario table
+HddBenchScenario scenarios[] = {
+	{ "filesize", bench_file_size, 0 },
+	{ "transport", bench_transport, 0 },
+	{ "threads", bench_threads, 0 },
+	{ "latency", bench_latency, 0 },
+	{ "uring", bench_uring, 0 },
+	{ "append", bench_append, 1 },
+	{ "overwrite", bench_overwrite, 1 },
+	{ "randread", bench_random_read, 1 },
+	{ "scan", bench_scan, 1 },
+	{ "churn", bench_churn, 1 },
+	{ "workloads", bench_workloads, 1 },
+	{ NULL, NULL, 0 }
+};
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : elapsedTime
+// Description  : get the number of seconds between two times
+//
+// Inputs       : start - the starting time
+//                end - the ending time
+// Outputs      : the elapsed seconds
+
+double elapsedTime( struct timeval *start, struct timeval *end ) {
+	return( (double)compareTimes(start, end) / 1000000.0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchCommand
+// Description  : build a block command for the transport benchmark
+//
+// Inputs       : op - the opcode
+//                size - the block size
+//                bid - the block id
+// Outputs      : the command
+
+HddBitCmd benchCommand( uint8_t op, uint32_t size, HddBlockID bid ) {
+	return( ((uint64_t)op << 62) | ((uint64_t)size << 36) | bid );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchRandom
+// Description  : the next value of a fixed-seed generator, so the suite
+//                makes the same requests on every run
+//
+// Inputs       : seed - the generator state (updated)
+// Outputs      : a pseudo-random value from 0 to 0x7fff
+
+uint32_t benchRandom( uint32_t *seed ) {
+	*seed = *seed * 1103515245 + 12345;
+	return( (*seed >> 16) & 0x7fff );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchReset
+// Description  : start the measured part of a suite scenario, clearing the
+//                statistics and noting the slab heap allocations and the
+//                read-ahead statistics so far
+//
+// Inputs       : none
+// Outputs      : none
+
+void benchReset( void ) {
+
+	// Local variables
+	HddSlabStats slab;
+
+	hdd_stats_reset();
+	hdd_slab_stats( &slab );
+	benchHeapAllocs = slab.heapAllocs;
+	hdd_cache_prefetch_stats( &benchAhead );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchReport
+// Description  : keep the result of a suite scenario run from the latency
+//                histograms of the operations it recorded, a scenario run
+//                more than once keeps its fastest run
+//
+// Inputs       : name - the scenario name
+//                first, last - the statistics the operations were recorded in
+//                bytes - the payload bytes moved
+//                secs - the time taken
+// Outputs      : none
+
+void benchReport( const char *name, HddStatsId first, HddStatsId last, uint64_t bytes, double secs ) {
+
+	// Local variables
+	HddBenchResult res, *kept;
+	uint64_t sent, received;
+	HddCachePrefetchStats ahead;
+	HddSlabStats slab;
+	int i;
+
+	snprintf( res.name, sizeof(res.name), "%s", name );
+	hdd_stats_summary( first, last, &res.sum );
+	res.secs = secs;
+	res.opsPerSec = res.sum.count / secs;
+	res.mbPerSec = bytes / secs / (1024 * 1024);
+	res.p50 = res.sum.p50 / 1e3;
+	res.p99 = res.sum.p99 / 1e3;
+	hdd_stats_bytes( &sent, &received );
+	res.wirePerOp = (res.sum.count > 0) ? (double)(sent + received) / res.sum.count : 0.0;
+	hdd_slab_stats( &slab );
+	res.heapPerOp = (res.sum.count > 0) ? (double)(slab.heapAllocs - benchHeapAllocs) / res.sum.count : 0.0;
+	hdd_cache_prefetch_stats( &ahead );
+	res.aheadHit = (ahead.blocks > benchAhead.blocks) ?
+		100.0 * (ahead.hits - benchAhead.hits) / (ahead.blocks - benchAhead.blocks) : 0.0;
+	res.aheadWaste = (ahead.wastedBytes - benchAhead.wastedBytes) / 1024.0;
+
+	for (i=0; (i<benchResultCount) && strcmp(benchResults[i].name, name); i++);
+	if ( i == HDD_BENCH_MAX_RESULTS ) {
+		return;
+	}
+	kept = &benchResults[i];
+	if ( i == benchResultCount ) {
+		benchResultCount ++;
+	} else if ( kept->opsPerSec >= res.opsPerSec ) {
+		return;
+	}
+	*kept = res;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchPrintResults
+// Description  : print the suite results
+//
+// Inputs       : none
+// Outputs      : none
+
+void benchPrintResults( void ) {
+
+	// Local variables
+	HddBenchResult *res;
+	int i;
+
+	printf( "%-14s %8s %8s %10s %8s %9s %9s %9s %9s %9s %10s %8s %8s %9s\n", "scenario", "ops", "secs", "ops/sec",
+		"MB/s", "p50 us", "p90 us", "p99 us", "p999 us", "max us", "wire B/op", "heap/op", "ra hit%", "ra waste" );
+	for (i=0; i<benchResultCount; i++) {
+		res = &benchResults[i];
+		printf( "%-14s %8lu %8.3f %10.0f %8.2f %9.1f %9.1f %9.1f %9.1f %9.1f %10.0f %8.3f %8.1f %7.0fKB\n", res->name,
+			(unsigned long)res->sum.count, res->secs, res->opsPerSec, res->mbPerSec, res->p50,
+			res->sum.p90 / 1e3, res->p99, res->sum.p999 / 1e3, res->sum.max / 1e3, res->wirePerOp,
+			res->heapPerOp, res->aheadHit, res->aheadWaste );
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchFillFile
+// Description  : open a file and write it sequentially to a size
+//
+// Inputs       : name - the file name
+//                size - the bytes to write
+//                chunk - a HDD_BENCH_SUITE_BLOCK sized buffer to write
+// Outputs      : the open file descriptor, -1 if failure
+
+int16_t benchFillFile( char *name, uint32_t size, char *chunk ) {
+
+	// Local variables
+	uint32_t written;
+	int16_t fd;
+
+	if ( (fd = hdd_open(name)) == -1 ) {
+		hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : open of %s failed.", name );
+		return( -1 );
+	}
+	for (written=0; written<size; written+=HDD_BENCH_SUITE_BLOCK) {
+		if ( hdd_write(fd, chunk, HDD_BENCH_SUITE_BLOCK) != HDD_BENCH_SUITE_BLOCK ) {
+			hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : write of %s failed at %u bytes.", name, written );
+			return( -1 );
+		}
+	}
+	return( fd );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the HDD benchmark
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0, i, run, ran = 0;
+	uint32_t queue_depth = HDD_CLIENT_DEFAULT_DEPTH, connections, cache_size;
+	char *scenario = NULL, *results = NULL, *baseline = NULL;
+	double threshold = HDD_BENCH_DEFAULT_THRESHOLD;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, HDD_BENCH_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 's': // Select a scenario
+			scenario = optarg;
+			break;
+
+		case 'c': // Set the cache size
+			if ( (sscanf(optarg, "%u", &cache_size) != 1) || set_hdd_cache_size(cache_size) ) {
+				hdd_log( LOG_ERROR_LEVEL, "Bad  cache size [%s]", optarg );
+				return(-1);
+			}
+			benchCacheBlocks = cache_size;
+			break;
+
+		case 'q': // Set the client queue depth
+			if ( (sscanf(optarg, "%u", &queue_depth) != 1) || hdd_client_set_depth(queue_depth) ) {
+				hdd_log( LOG_ERROR_LEVEL, "Bad  queue depth [%s]", optarg );
+				return(-1);
+			}
+			benchDepth = queue_depth;
+			break;
+
+		case 'n': // Set the number of server connections
+			if ( (sscanf(optarg, "%u", &connections) != 1) || hdd_client_set_connections(connections) ) {
+				hdd_log( LOG_ERROR_LEVEL, "Bad  connection count [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'a': // Get the IP address
+			if ( hdd_client_check_address(optarg) ) {
+				hdd_log( LOG_ERROR_LEVEL, "Bad  IP address [%s]", optarg );
+				return(-1);
+			}
+			hdd_network_address = (unsigned char *)strdup(optarg);
+			break;
+
+		case 'd': // Disable Nagle on TCP connections
+			hdd_network_nodelay = 1;
+			break;
+
+		case 'k': // ACK the server responses at once
+			hdd_network_quickack = 1;
+			break;
+
+		case 'r': // Send ranged block requests
+			hdd_network_ranged = 1;
+			break;
+
+		case 'i': // Carry the requests over io_uring
+			hdd_network_uring = 1;
+			break;
+
+		case 'u': // A Unix-domain socket for the latency scenario
+			benchUnixPath = optarg;
+			break;
+
+case 'p': // Set the network port number
+			if ( sscanf(optarg, "%hu", &hdd_network_port) != 1 ) {
+				hdd_log( LOG_ERROR_LEVEL, "Bad  port number [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'o': // Write the suite results
+			results = optarg;
+			break;
+
+		case 'B': // Compare with a baseline
+			baseline = optarg;
+			break;
+
+		case 'T': // Set the regression threshold
+			if ( (sscanf(optarg, "%lf", &threshold) != 1) || (threshold < 0) ) {
+				hdd_log( LOG_ERROR_LEVEL, "Bad  regression threshold [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	if ( verbose ) {
+		enableLogLevels( LOG_INFO_LEVEL );
+	}
+
+	// Run the selected scenarios
+	for (i=0; scenarios[i].name != NULL; i++) {
+		if ( (scenario != NULL) && (strcmp(scenario, scenarios[i].name) != 0) &&
+			((strcmp(scenario, "suite") != 0) || ! scenarios[i].suite) ) {
+			continue;
+		}
+		ran ++;
+		for (run=0; run<(scenarios[i].suite ? HDD_BENCH_SUITE_RUNS : 1); run++) {
+			if ( scenarios[i].run() ) {
+				hdd_log( LOG_ERROR_LEVEL, "HDD benchmark [%s] failed.", scenarios[i].name );
+				return( -1 );
+			}
+		}
+	}
+	if ( ran == 0 ) {
+		fprintf( stderr, "Unknown scenario [%s], use -h to see usage, aborting.\n", scenario );
+		return( -1 );
+	}
+
+	// Print, save and check the suite results
+	if ( benchResultCount > 0 ) {
+		benchPrintResults();
+	}
+	if ( (results != NULL) && benchWriteResults(results) ) {
+		return( -1 );
+	}
+	if ( (baseline != NULL) && benchCompareResults(baseline, threshold) ) {
+		return( -1 );
+	}
+
+	// Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_file_size
+// Description  : Append a file in fixed chunks up to sizes from 1 KB to
+//                64 MB and report the time per byte, which should stay flat
+//                as the file grows.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_file_size( void ) {
+
+	// Local variables
+	struct timeval start, end;
+	char chunk[HDD_BENCH_CHUNK_SIZE];
+	uint64_t size, written;
+	int32_t count;
+	int16_t fd;
+	double secs;
+
+	memset( chunk, 'x', HDD_BENCH_CHUNK_SIZE );
+	printf( "%-10s %12s %10s %12s %10s\n", "scenario", "bytes", "secs", "ns/byte", "MB/s" );
+	for (size=HDD_BENCH_MIN_FILE_SIZE; size<=HDD_BENCH_MAX_FILE_SIZE; size*=4) {
+
+		// Time a fresh file system with one file appended to the size
+		gettimeofday( &start, NULL );
+		if ( hdd_format() || hdd_mount() || ((fd = hdd_open("bench.dat")) == -1) ) {
+			hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : setup failed for size %lu.", size );
+			return( -1 );
+		}
+		for (written=0; written<size; written+=count) {
+			count = (size-written < HDD_BENCH_CHUNK_SIZE) ? size-written : HDD_BENCH_CHUNK_SIZE;
+			if ( hdd_write(fd, chunk, count) != count ) {
+				hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : append failed at %lu bytes.", written );
+				return( -1 );
+			}
+		}
+		if ( hdd_close(fd) || hdd_unmount() ) {
+			hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : close/unmount failed for size %lu.", size );
+			return( -1 );
+		}
+		gettimeofday( &end, NULL );
+
+		secs = elapsedTime( &start, &end );
+		printf( "%-10s %12lu %10.3f %12.2f %10.2f\n", "filesize", size, secs,
+			secs * 1e9 / size, size / secs / (1024 * 1024) );
+	}
+
+	// Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_transport
+// Description  : Drive small block operations straight through the client
+//                transport at the configured queue depth and report the
+//                operations per second of each kind.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_transport( void ) {
+
+	// Local variables
+	const uint8_t ops[] = { HDD_BLOCK_CREATE, HDD_BLOCK_READ, HDD_BLOCK_OVERWRITE, HDD_BLOCK_DELETE };
+	const char *names[] = { "create", "read", "overwrite", "delete" };
+	struct timeval start, end;
+	char block[HDD_BENCH_SMALL_BLOCK], *rbufs;
+	HddBlockID *bids;
+	HddBitResp resp;
+	HddBitCmd cmd;
+	int32_t tag;
+	int i, k, submitted, failed = 0;
+	double secs;
+
+	if ( hdd_format() ) {
+		hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : format failed." );
+		return( -1 );
+	}
+	bids = calloc( HDD_BENCH_SMALL_OPS, sizeof(HddBlockID) );
+	rbufs = malloc( (size_t)HDD_CLIENT_MAX_DEPTH * HDD_BENCH_SMALL_BLOCK );
+	memset( block, 'x', HDD_BENCH_SMALL_BLOCK );
+
+	printf( "%-10s %10s %8s %10s %12s\n", "scenario", "op", "ops", "secs", "ops/sec" );
+	for (k=0; k<4; k++) {
+		gettimeofday( &start, NULL );
+		for (i=submitted=0; i<HDD_BENCH_SMALL_OPS || hdd_client_pending()>0; ) {
+			cmd = benchCommand( ops[k], (ops[k] == HDD_BLOCK_DELETE) ? 0 : HDD_BENCH_SMALL_BLOCK,
+				(ops[k] == HDD_BLOCK_CREATE || i >= HDD_BENCH_SMALL_OPS) ? 0 : bids[i] );
+			if ( (i < HDD_BENCH_SMALL_OPS) && hdd_client_ready(cmd) ) {
+				// Reads land in a slot owned by the tag until completion
+				tag = hdd_client_submit( cmd, (ops[k] == HDD_BLOCK_READ) ?
+					&rbufs[(i % HDD_CLIENT_MAX_DEPTH) * HDD_BENCH_SMALL_BLOCK] : block );
+				if ( tag == -1 ) {
+					failed = 1;
+					break;
+				}
+				i++;
+				continue;
+			}
+			if ( (tag = hdd_client_complete(&resp)) == -1 || ((resp >> 32) & 0x1) ) {
+				failed = 1;
+				break;
+			}
+			if ( ops[k] == HDD_BLOCK_CREATE ) {
+				bids[submitted] = resp & 0xffffffff;
+			}
+			submitted++;
+		}
+		gettimeofday( &end, NULL );
+		if ( failed ) {
+			hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : %s of small blocks failed.", names[k] );
+			free( bids );
+			free( rbufs );
+			return( -1 );
+		}
+
+		secs = elapsedTime( &start, &end );
+		printf( "%-10s %10s %8d %10.3f %12.0f\n", "transport", names[k], HDD_BENCH_SMALL_OPS, secs,
+			HDD_BENCH_SMALL_OPS / secs );
+	}
+
+	// Clean up the device, return successfully
+	free( bids );
+	free( rbufs );
+	return( hdd_unmount() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_threads
+// Description  : Write a set of files, then read all of them back (with a
+//                cold cache) from 1, 2, 4 and 8 threads and report the
+//                throughput at each thread count.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_threads( void ) {
+
+	// Local variables
+	HddBenchReader readers[HDD_BENCH_THREAD_FILES];
+	pthread_t tid[HDD_BENCH_THREAD_FILES];
+	struct timeval start, end;
+	char name[32], *chunk;
+	int threads, i, ret = 0;
+	uint64_t written;
+	int16_t fd;
+	double secs, base = 0;
+
+	// Write the files
+	chunk = malloc( HDD_BENCH_READ_SIZE );
+	memset( chunk, 'x', HDD_BENCH_READ_SIZE );
+	if ( hdd_format() || hdd_mount() ) {
+		hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : setup failed." );
+		free( chunk );
+		return( -1 );
+	}
+	for (i=0; i<HDD_BENCH_THREAD_FILES; i++) {
+		snprintf( name, sizeof(name), "bench%d.dat", i );
+		if ( (fd = hdd_open(name)) == -1 ) {
+			free( chunk );
+			return( -1 );
+		}
+		for (written=0; written<HDD_BENCH_THREAD_FILE_SIZE; written+=HDD_BENCH_READ_SIZE) {
+			if ( hdd_write(fd, chunk, HDD_BENCH_READ_SIZE) != HDD_BENCH_READ_SIZE ) {
+				free( chunk );
+				return( -1 );
+			}
+		}
+		if ( hdd_close(fd) ) {
+			free( chunk );
+			return( -1 );
+		}
+	}
+	free( chunk );
+	if ( hdd_unmount() ) {
+		return( -1 );
+	}
+
+	// Read them back at each thread count, mounting empties the cache
+	printf( "%-10s %8s %10s %10s %10s\n", "scenario", "threads", "secs", "MB/s", "speedup" );
+	for (threads=1; (threads<=HDD_BENCH_THREAD_FILES) && (ret == 0); threads*=2) {
+		if ( hdd_mount() ) {
+			return( -1 );
+		}
+		gettimeofday( &start, NULL );
+		for (i=0; i<threads; i++) {
+			readers[i].first = i;
+			readers[i].stride = threads;
+			pthread_create( &tid[i], NULL, bench_reader, &readers[i] );
+		}
+		for (i=0; i<threads; i++) {
+			pthread_join( tid[i], NULL );
+			if ( readers[i].result ) {
+				ret = -1;
+			}
+		}
+		gettimeofday( &end, NULL );
+		if ( hdd_unmount() || ret ) {
+			hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : threaded read failed with %d threads.", threads );
+			return( -1 );
+		}
+
+		secs = elapsedTime( &start, &end );
+		if ( threads == 1 ) {
+			base = secs;
+		}
+		printf( "%-10s %8d %10.3f %10.2f %10.2f\n", "threads", threads, secs,
+			(double)HDD_BENCH_THREAD_FILES * HDD_BENCH_THREAD_FILE_SIZE / secs / (1024 * 1024), base / secs );
+	}
+
+	// Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_reader
+// Description  : Read every file of a bench_threads thread to the end
+//
+// Inputs       : arg - the HddBenchReader of the thread
+// Outputs      : NULL (the result is left in the reader structure)
+
+void * bench_reader( void *arg ) {
+
+	// Local variables
+	HddBenchReader *rd = arg;
+	char name[32], *buf;
+	int32_t len;
+	int16_t fd;
+	int i;
+
+	rd->result = 0;
+	buf = malloc( HDD_BENCH_READ_SIZE );
+	for (i=rd->first; (i<HDD_BENCH_THREAD_FILES) && (rd->result == 0); i+=rd->stride) {
+		snprintf( name, sizeof(name), "bench%d.dat", i );
+		if ( (fd = hdd_open(name)) == -1 ) {
+			rd->result = -1;
+			break;
+		}
+		while ( (len = hdd_read(fd, buf, HDD_BENCH_READ_SIZE)) > 0 );
+		if ( (len == -1) || hdd_close(fd) ) {
+			rd->result = -1;
+		}
+	}
+	free( buf );
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compareLatency
+// Description  : qsort comparison of two round trip times
+//
+// Inputs       : a, b - the times being compared
+// Outputs      : <0, 0, >0 as a is below, equal or above b
+
+int compareLatency( const void *a, const void *b ) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return( (x > y) - (x < y) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_round_trips
+// Description  : time single 64 byte reads (one request on the wire at a
+//                time) against the configured server endpoint and print
+//                the latency distribution.
+//
+// Inputs       : name - the transport name printed in the report
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_round_trips( const char *name ) {
+
+	// Local variables
+	char block[HDD_BENCH_SMALL_BLOCK];
+	struct timeval start, end;
+	double *usecs, total = 0;
+	HddBitResp resp;
+	HddBlockID bid;
+	int i;
+
+	if ( hdd_format() ) {
+		hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : format over %s failed.", name );
+		return( -1 );
+	}
+	memset( block, 'x', HDD_BENCH_SMALL_BLOCK );
+	resp = hdd_client_operation( benchCommand(HDD_BLOCK_CREATE, HDD_BENCH_SMALL_BLOCK, 0), block );
+	if ( (resp >> 32) & 0x1 ) {
+		hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : block create over %s failed.", name );
+		return( -1 );
+	}
+	bid = resp & 0xffffffff;
+
+	usecs = malloc( HDD_BENCH_LATENCY_OPS * sizeof(double) );
+	for (i=0; i<HDD_BENCH_LATENCY_OPS; i++) {
+		gettimeofday( &start, NULL );
+		resp = hdd_client_operation( benchCommand(HDD_BLOCK_READ, HDD_BENCH_SMALL_BLOCK, bid), block );
+		gettimeofday( &end, NULL );
+		if ( (resp >> 32) & 0x1 ) {
+			hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : block read over %s failed.", name );
+			free( usecs );
+			return( -1 );
+		}
+		usecs[i] = (double)compareTimes( &start, &end );
+		total += usecs[i];
+	}
+	qsort( usecs, HDD_BENCH_LATENCY_OPS, sizeof(double), compareLatency );
+	printf( "%-10s %12s %8d %10.1f %10.1f %10.1f\n", "latency", name, HDD_BENCH_LATENCY_OPS,
+		total / HDD_BENCH_LATENCY_OPS, usecs[HDD_BENCH_LATENCY_OPS / 2],
+		usecs[(HDD_BENCH_LATENCY_OPS * 99) / 100] );
+	free( usecs );
+	return( hdd_unmount() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_latency
+// Description  : Compare the per operation latency of the transports: the
+//                configured endpoint (with and without TCP_NODELAY when it
+//                is TCP, or the in-process loopback store) and the
+//                Unix-domain socket given with -u.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_latency( void ) {
+
+	// Local variables
+	unsigned char *address = hdd_network_address;
+	int nodelay = hdd_network_nodelay, ret = 0;
+	char unixAddress[256];
+
+	printf( "%-10s %12s %8s %10s %10s %10s\n", "scenario", "transport", "ops", "avg us", "p50 us", "p99 us" );
+	if ( (address != NULL) && (strncmp((char *)address, HDD_UNIX_PREFIX, strlen(HDD_UNIX_PREFIX)) == 0) ) {
+		ret = bench_round_trips( "unix" );
+	} else if ( (address != NULL) && (strncmp((char *)address, HDD_LOOPBACK_ADDRESS, strlen(HDD_LOOPBACK_ADDRESS)) == 0) ) {
+		ret = bench_round_trips( "loopback" );
+	} else {
+		hdd_network_nodelay = 0;
+		ret = bench_round_trips( "tcp" );
+		hdd_network_nodelay = 1;
+		ret = ret || bench_round_trips( "tcp-nodelay" );
+		hdd_network_nodelay = nodelay;
+	}
+
+	if ( (ret == 0) && (benchUnixPath != NULL) ) {
+		snprintf( unixAddress, sizeof(unixAddress), "%s%s", HDD_UNIX_PREFIX, benchUnixPath );
+		hdd_network_address = (unsigned char *)unixAddress;
+		ret = bench_round_trips( "unix" );
+		hdd_network_address = address;
+	}
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_pipelined
+// Description  : read and overwrite 64 byte blocks through the client
+//                transport, keeping depth requests in flight, and print the
+//                operations per second of each under the backend that
+//                carried them.
+//
+// Inputs       : depth - the queue depth
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_pipelined( uint32_t depth ) {
+
+	// Local variables
+	const uint8_t ops[] = { HDD_BLOCK_READ, HDD_BLOCK_OVERWRITE };
+	const char *names[] = { "read", "overwrite" };
+	char block[HDD_BENCH_SMALL_BLOCK], *rbufs, transport[16];
+	HddBlockID bids[HDD_BENCH_URING_BLOCKS];
+	struct timeval start, end;
+	HddBitResp resp;
+	HddBitCmd cmd;
+	int i, k, failed = 0;
+	double secs;
+
+	if ( hdd_format() ) {
+		hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : format failed." );
+		return( -1 );
+	}
+	snprintf( transport, sizeof(transport), "%s", hdd_client_transport() );	// uring may fall back to sockets
+	memset( block, 'x', HDD_BENCH_SMALL_BLOCK );
+	for (i=0; i<HDD_BENCH_URING_BLOCKS; i++) {
+		resp = hdd_client_operation( benchCommand(HDD_BLOCK_CREATE, HDD_BENCH_SMALL_BLOCK, 0), block );
+		if ( (resp >> 32) & 0x1 ) {
+			hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : block create over %s failed.", transport );
+			return( -1 );
+		}
+		bids[i] = resp & 0xffffffff;
+	}
+	rbufs = malloc( (size_t)HDD_CLIENT_MAX_DEPTH * HDD_BENCH_SMALL_BLOCK );
+
+	for (k=0; k<2; k++) {
+		gettimeofday( &start, NULL );
+		for (i=0; i<HDD_BENCH_SMALL_OPS || hdd_client_pending()>0; ) {
+			cmd = benchCommand( ops[k], HDD_BENCH_SMALL_BLOCK, bids[i % HDD_BENCH_URING_BLOCKS] );
+			if ( (i < HDD_BENCH_SMALL_OPS) && hdd_client_ready(cmd) ) {
+				if ( hdd_client_submit(cmd, (ops[k] == HDD_BLOCK_READ) ?
+					&rbufs[(i % HDD_CLIENT_MAX_DEPTH) * HDD_BENCH_SMALL_BLOCK] : block) == -1 ) {
+					failed = 1;
+					break;
+				}
+				i++;
+				continue;
+			}
+			if ( (hdd_client_complete(&resp) == -1) || ((resp >> 32) & 0x1) ) {
+				failed = 1;
+				break;
+			}
+		}
+		gettimeofday( &end, NULL );
+		if ( failed ) {
+			hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : %s over %s failed.", names[k], transport );
+			free( rbufs );
+			return( -1 );
+		}
+
+		secs = elapsedTime( &start, &end );
+		printf( "%-10s %10s %6u %10s %8d %10.3f %12.0f\n", "uring", transport, depth, names[k],
+			HDD_BENCH_SMALL_OPS, secs, HDD_BENCH_SMALL_OPS / secs );
+	}
+
+	// Clean up the device, return successfully
+	free( rbufs );
+	return( hdd_unmount() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_uring
+// Description  : Compare the blocking socket backend with the io_uring
+//                backend at queue depths 1, 8 and 64.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_uring( void ) {
+
+	// Local variables
+	const uint32_t depths[] = { 1, 8, 64 };
+	int uring = hdd_network_uring, i, ret = 0;
+
+	if ( (hdd_network_address != NULL) &&
+		(strncmp((char *)hdd_network_address, HDD_LOOPBACK_ADDRESS, strlen(HDD_LOOPBACK_ADDRESS)) == 0) ) {
+		printf( "uring: the loopback store has no transport to compare, skipped\n" );
+		return( 0 );
+	}
+
+	printf( "%-10s %10s %6s %10s %8s %10s %12s\n", "scenario", "transport", "depth", "op", "ops", "secs", "ops/sec" );
+	for (i=0; (i<3) && (ret == 0); i++) {
+		hdd_client_set_depth( depths[i] );
+		hdd_network_uring = 0;
+		ret = bench_pipelined( depths[i] );
+		hdd_network_uring = 1;
+		ret = ret || bench_pipelined( depths[i] );
+	}
+	hdd_network_uring = uring;
+	hdd_client_set_depth( benchDepth );
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_append
+// Description  : Append a 16 MB file in 4 KB writes on a fresh file system
+//                and report the cost of each write.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_append( void ) {
+
+	// Local variables
+	char chunk[HDD_BENCH_SUITE_BLOCK];
+	uint64_t begin, start;
+	uint32_t written;
+	int16_t fd;
+
+	memset( chunk, 'a', HDD_BENCH_SUITE_BLOCK );
+	if ( hdd_format() || hdd_mount() || ((fd = hdd_open("append.dat")) == -1) ) {
+		hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : append setup failed." );
+		return( -1 );
+	}
+
+	benchReset();
+	begin = hdd_stats_now();
+	for (written=0; written<HDD_BENCH_APPEND_SIZE; written+=HDD_BENCH_SUITE_BLOCK) {
+		start = hdd_stats_now();
+		if ( hdd_write(fd, chunk, HDD_BENCH_SUITE_BLOCK) != HDD_BENCH_SUITE_BLOCK ) {
+			hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : append failed at %u bytes.", written );
+			return( -1 );
+		}
+		hdd_stats_record( HDD_STATS_WRITE, start );
+	}
+	if ( hdd_close(fd) || hdd_unmount() ) {
+		return( -1 );
+	}
+	benchReport( "append", HDD_STATS_WRITE, HDD_STATS_WRITE, HDD_BENCH_APPEND_SIZE,
+		(hdd_stats_now() - begin) / 1e9 );
+
+	// Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_overwrite
+// Description  : Write 4 KB blocks at random (fixed seed) block offsets of a
+//                16 MB file through a cache holding a quarter of it and
+//                report the cost of each seek and write.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_overwrite( void ) {
+
+	// Local variables
+	char chunk[HDD_BENCH_SUITE_BLOCK];
+	uint32_t seed = HDD_BENCH_SEED, block;
+	uint64_t begin, start;
+	int16_t fd;
+	int i;
+
+	memset( chunk, 'o', HDD_BENCH_SUITE_BLOCK );
+	if ( set_hdd_cache_size(HDD_BENCH_RANDOM_CACHE_BLOCKS) || hdd_format() || hdd_mount() ||
+		((fd = benchFillFile("random.dat", HDD_BENCH_RANDOM_FILE_SIZE, chunk)) == -1) ) {
+		hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : overwrite setup failed." );
+		return( -1 );
+	}
+
+	benchReset();
+	begin = hdd_stats_now();
+	for (i=0; i<HDD_BENCH_RANDOM_OPS; i++) {
+		block = benchRandom( &seed ) % (HDD_BENCH_RANDOM_FILE_SIZE / HDD_BENCH_SUITE_BLOCK);
+		start = hdd_stats_now();
+		if ( hdd_seek(fd, block * HDD_BENCH_SUITE_BLOCK) ||
+			(hdd_write(fd, chunk, HDD_BENCH_SUITE_BLOCK) != HDD_BENCH_SUITE_BLOCK) ) {
+			hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : overwrite of block %u failed.", block );
+			return( -1 );
+		}
+		hdd_stats_record( HDD_STATS_WRITEAT, start );
+	}
+	if ( hdd_close(fd) || hdd_unmount() || set_hdd_cache_size(benchCacheBlocks) ) {
+		return( -1 );
+	}
+	benchReport( "overwrite", HDD_STATS_WRITEAT, HDD_STATS_WRITEAT,
+		(uint64_t)HDD_BENCH_RANDOM_OPS * HDD_BENCH_SUITE_BLOCK, (hdd_stats_now() - begin) / 1e9 );
+
+	// Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_random_read
+// Description  : Read 4 KB blocks at random (fixed seed) block offsets of a
+//                16 MB file through a cache holding a quarter of it,
+//                remounted so the cache starts cold, and report the cost of
+//                each seek and read.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_random_read( void ) {
+
+	// Local variables
+	char chunk[HDD_BENCH_SUITE_BLOCK];
+	uint32_t seed = HDD_BENCH_SEED, block;
+	uint64_t begin, start;
+	int16_t fd;
+	int i;
+
+	memset( chunk, 'r', HDD_BENCH_SUITE_BLOCK );
+	if ( set_hdd_cache_size(HDD_BENCH_RANDOM_CACHE_BLOCKS) || hdd_format() || hdd_mount() ||
+		((fd = benchFillFile("random.dat", HDD_BENCH_RANDOM_FILE_SIZE, chunk)) == -1) ||
+		hdd_close(fd) || hdd_unmount() || hdd_mount() || ((fd = hdd_open("random.dat")) == -1) ) {
+		hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : random read setup failed." );
+		return( -1 );
+	}
+
+	benchReset();
+	begin = hdd_stats_now();
+	for (i=0; i<HDD_BENCH_RANDOM_OPS; i++) {
+		block = benchRandom( &seed ) % (HDD_BENCH_RANDOM_FILE_SIZE / HDD_BENCH_SUITE_BLOCK);
+		start = hdd_stats_now();
+		if ( hdd_seek(fd, block * HDD_BENCH_SUITE_BLOCK) ||
+			(hdd_read(fd, chunk, HDD_BENCH_SUITE_BLOCK) != HDD_BENCH_SUITE_BLOCK) ) {
+			hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : read of block %u failed.", block );
+			return( -1 );
+		}
+		hdd_stats_record( HDD_STATS_READ, start );
+	}
+	if ( hdd_close(fd) || hdd_unmount() || set_hdd_cache_size(benchCacheBlocks) ) {
+		return( -1 );
+	}
+	benchReport( "randread", HDD_STATS_READ, HDD_STATS_READ,
+		(uint64_t)HDD_BENCH_RANDOM_OPS * HDD_BENCH_SUITE_BLOCK, (hdd_stats_now() - begin) / 1e9 );
+
+	// Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_scan
+// Description  : Read a 16 MB file from a cold cache in 4 KB reads, once
+//                sequentially and once striding to a new extent on every
+//                read, and report the cost of each read (the scans the
+//                read-ahead follows).
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_scan( void ) {
+
+	// Local variables
+	const char *names[2] = { "seqread", "strideread" };
+	uint32_t strides[2] = { HDD_BENCH_SUITE_BLOCK, HDD_BENCH_SCAN_STRIDE };
+	char chunk[HDD_BENCH_SUITE_BLOCK];
+	uint64_t begin, start, bytes;
+	uint32_t pos;
+	int16_t fd;
+	int s;
+
+	memset( chunk, 's', HDD_BENCH_SUITE_BLOCK );
+	if ( hdd_format() || hdd_mount() ||
+		((fd = benchFillFile("scan.dat", HDD_BENCH_SCAN_FILE_SIZE, chunk)) == -1) ||
+		hdd_close(fd) || hdd_unmount() ) {
+		hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : scan setup failed." );
+		return( -1 );
+	}
+
+	for (s=0; s<2; s++) {
+		if ( hdd_mount() || ((fd = hdd_open("scan.dat")) == -1) ) {	// remounted, so the cache is cold
+			hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : scan open failed." );
+			return( -1 );
+		}
+		benchReset();
+		begin = hdd_stats_now();
+		for (pos=0, bytes=0; pos+HDD_BENCH_SUITE_BLOCK<=HDD_BENCH_SCAN_FILE_SIZE; pos+=strides[s]) {
+			start = hdd_stats_now();
+			if ( hdd_seek(fd, pos) || (hdd_read(fd, chunk, HDD_BENCH_SUITE_BLOCK) != HDD_BENCH_SUITE_BLOCK) ) {
+				hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : scan read at %u failed.", pos );
+				return( -1 );
+			}
+			hdd_stats_record( HDD_STATS_READ, start );
+			bytes += HDD_BENCH_SUITE_BLOCK;
+		}
+		if ( hdd_close(fd) || hdd_unmount() ) {
+			return( -1 );
+		}
+		benchReport( names[s], HDD_STATS_READ, HDD_STATS_READ, bytes, (hdd_stats_now() - begin) / 1e9 );
+	}
+
+	// Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_churn
+// Description  : Create, write (a fixed-seed size up to 1 KB) and close many
+//                small files and report the cost of each file.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_churn( void ) {
+
+	// Local variables
+	char chunk[HDD_BENCH_CHURN_MAX_SIZE], name[32];
+	uint32_t seed = HDD_BENCH_SEED;
+	uint64_t begin, start, bytes = 0;
+	int32_t size;
+	int16_t fd;
+	int i;
+
+	memset( chunk, 'c', HDD_BENCH_CHURN_MAX_SIZE );
+	if ( hdd_format() || hdd_mount() ) {
+		hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : churn setup failed." );
+		return( -1 );
+	}
+
+	benchReset();
+	begin = hdd_stats_now();
+	for (i=0; i<HDD_BENCH_CHURN_FILES; i++) {
+		snprintf( name, sizeof(name), "churn%d.dat", i );
+		size = benchRandom( &seed ) % HDD_BENCH_CHURN_MAX_SIZE + 1;
+		start = hdd_stats_now();
+		if ( ((fd = hdd_open(name)) == -1) || (hdd_write(fd, chunk, size) != size) || hdd_close(fd) ) {
+			hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : churn of %s failed.", name );
+			return( -1 );
+		}
+		hdd_stats_record( HDD_STATS_WRITE, start );
+		bytes += size;
+	}
+	if ( hdd_unmount() ) {
+		return( -1 );
+	}
+	benchReport( "churn", HDD_STATS_WRITE, HDD_STATS_WRITE, bytes, (hdd_stats_now() - begin) / 1e9 );
+
+	// Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_workloads
+// Description  : Replay the shipped workloads in order (workload-one formats
+//                the device, the others build on it) and report the cost of
+//                their commands.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_workloads( void ) {
+
+	// Local variables
+	const char *names[] = { "workload-one", "workload-two", "workload-three" };
+	char path[64];
+	HddWorkload wl;
+	uint64_t begin, bytes;
+	uint32_t i;
+	int w, ret;
+
+	for (w=0; w<3; w++) {
+		snprintf( path, sizeof(path), "%s.txt", names[w] );
+		if ( hdd_workload_load(&wl, path) ) {
+			hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : cannot load workload %s.", path );
+			return( -1 );
+		}
+		for (i=bytes=0; i<wl.count; i++) {
+			if ( (wl.ops[i].op == HDD_WL_WRITEAT) || (wl.ops[i].op == HDD_WL_WRITE) || (wl.ops[i].op == HDD_WL_READ) ) {
+				bytes += wl.ops[i].len;
+			}
+		}
+
+		benchReset();
+		begin = hdd_stats_now();
+		ret = hdd_workload_replay( &wl );
+		hdd_workload_free( &wl );
+		if ( ret ) {
+			hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : replay of workload %s failed.", path );
+			return( -1 );
+		}
+		benchReport( names[w], HDD_STATS_FORMAT, HDD_STATS_READ, bytes, (hdd_stats_now() - begin) / 1e9 );
+	}
+
+	// Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchWriteResults
+// Description  : Write the suite results, one scenario per line:
+//                name ops/sec MB/s p50-usecs p99-usecs
+//
+// Inputs       : path - the results file
+// Outputs      : 0 if successful, -1 if failure
+
+int benchWriteResults( const char *path ) {
+
+	// Local variables
+	FILE *fp;
+	int i;
+
+	if ( (fp = fopen(path, "w")) == NULL ) {
+		hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : failed to create results [%s].", path );
+		return( -1 );
+	}
+	for (i=0; i<benchResultCount; i++) {
+		fprintf( fp, "%s %.1f %.3f %.1f %.1f\n", benchResults[i].name, benchResults[i].opsPerSec,
+			benchResults[i].mbPerSec, benchResults[i].p50, benchResults[i].p99 );
+	}
+	if ( fclose(fp) ) {
+		hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : failed to write results [%s].", path );
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchCompareResults
+// Description  : Compare the suite results with a baseline (written by -o)
+//                and report each scenario's change in ops/sec.  A scenario
+//                more than threshold percent slower is a regression.
+//
+// Inputs       : path - the baseline file
+//                threshold - the percent drop counted as a regression
+// Outputs      : 0 if nothing regressed, -1 on a regression or failure
+
+int benchCompareResults( const char *path, double threshold ) {
+
+	// Local variables
+	HddBenchResult base;
+	double change;
+	int i, regressed = 0;
+	FILE *fp;
+
+	if ( (fp = fopen(path, "r")) == NULL ) {
+		hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : cannot open baseline [%s].", path );
+		return( -1 );
+	}
+	printf( "%-14s %12s %12s %8s\n", "scenario", "base ops/s", "ops/s", "change" );
+	while ( fscanf(fp, "%31s %lf %lf %lf %lf", base.name, &base.opsPerSec, &base.mbPerSec,
+			&base.p50, &base.p99) == 5 ) {
+		for (i=0; (i<benchResultCount) && strcmp(base.name, benchResults[i].name); i++);
+		if ( (i == benchResultCount) || (base.opsPerSec <= 0) ) {
+			continue;
+		}
+		change = (benchResults[i].opsPerSec - base.opsPerSec) * 100.0 / base.opsPerSec;
+		printf( "%-14s %12.0f %12.0f %7.1f%%%s\n", base.name, base.opsPerSec, benchResults[i].opsPerSec,
+			change, (change < -threshold) ? "  REGRESSION" : "" );
+		if ( change < -threshold ) {
+			regressed ++;
+		}
+	}
+	fclose( fp );
+
+	if ( regressed ) {
+		hdd_log( LOG_ERROR_LEVEL, "HDD_BENCH : %d scenario(s) regressed more than %.1f%% against [%s].",
+			regressed, threshold, path );
+		return( -1 );
+	}
+	return( 0 );
+}
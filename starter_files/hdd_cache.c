@@ -0,0 +1,720 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : hdd_cache.c
+//  Description    : This is the client-side block cache for the HDD file
+//                   system.  Blocks are indexed by block ID and evicted in
+//                   least recently used (LRU) order once the cache is full.
+//                   Blocks and lines are hdd_slab buffers and the index is
+//                   chained through the lines, so a warm cache recycles
+//                   its memory instead of allocating.  Readers may hold a
+//                   block without copying it, a line that is replaced,
+//                   updated or dropped while held leaves the old block
+//                   with its readers (copy-on-write).
+//
+//  Author         : Chuyang Zhang
+//  Last Modified  : 2017/12/1
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Project Includes
+#include <hdd_cache.h>
+#include <cmpsc311_log.h>
+#include <hdd_log.h>
+#include <cmpsc311_util.h>
+#include <hdd_slab.h>
+
+// Defines
+#define HDD_CACHE_MIN_HASH_BITS 8
+#define HDD_CACHE_MAX_HASH_BITS 16
+#define HDD_CACHE_UNIT_TEST_ITERATIONS 4096
+#define HDD_CACHE_UNIT_TEST_BLOCKS 64
+
+// A single cache line (one device block)
+typedef struct hdd_cache_line {
+	HddBlockID bid;	// block id of the cached block
+	uint32_t size;	// size of the cached block
+	int prefetched;	// read ahead and not read since
+	int filled;	// read on a miss and not looked up since (the miss was counted)
+	uint32_t views;	// readers holding the block (view_hdd_cache)
+	int orphaned;	// no longer cached, freed when the last view is released
+	void *data;	// block contents
+	struct hdd_cache_line *prev;	// next more recently used line
+	struct hdd_cache_line *next;	// next less recently used line
+	struct hdd_cache_line *chain;	// next line in the same index bucket
+} HddCacheLine;
+
+uint32_t cacheMaxBlocks = HDD_DEFAULT_CACHE_SIZE;	// capacity in blocks
+uint32_t cacheBlocks = 0;	// number of lines in use
+int cacheInit = 0;	// is the cache initialized
+HddCacheLine **cacheIndex = NULL;	// block id -> cache line, chained buckets
+uint32_t cacheIndexShift = 32;	// 32 - log2(buckets)
+HddCacheLine *cacheHead = NULL;	// most recently used line
+HddCacheLine *cacheTail = NULL;	// least recently used line
+pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;	// guards the lines, index and statistics
+
+// Cache statistics
+unsigned long cacheHits = 0;
+unsigned long cacheMisses = 0;
+unsigned long cacheInserts = 0;
+unsigned long cacheEvictions = 0;
+
+// Read-ahead statistics (kept across init and close)
+HddCachePrefetchStats cachePrefetch;
+HddCachePrefetchStats prefetchAtInit;	// cachePrefetch when the cache was set up, close reports the difference
+
+// function that helps to accomplish the tasks
+///////////////////////////////////////////////////////////////////////////////
+// the index bucket of a block (multiplicative hash, top bits)
+HddCacheLine **cacheBucket(HddBlockID bid){
+	return &cacheIndex[(uint32_t)(bid * 2654435761u) >> cacheIndexShift];
+}
+
+HddCacheLine *findCacheLine(HddBlockID bid){
+	HddCacheLine *line;
+
+	for(line = *cacheBucket(bid); line != NULL && line->bid != bid; line = line->chain);
+	return line;
+}
+
+void unindexCacheLine(HddCacheLine *line){
+	HddCacheLine **link;
+
+	for(link = cacheBucket(line->bid); *link != line; link = &(*link)->chain);
+	*link = line->chain;
+}
+
+void unlinkCacheLine(HddCacheLine *line){
+
+	if(line->prev != NULL){
+		line->prev->next = line->next;
+	}
+	else{
+		cacheHead = line->next;
+	}
+	if(line->next != NULL){
+		line->next->prev = line->prev;
+	}
+	else{
+		cacheTail = line->prev;
+	}
+	line->prev = line->next = NULL;
+
+}
+
+void pushCacheLine(HddCacheLine *line){
+
+	line->prev = NULL;
+	line->next = cacheHead;
+	if(cacheHead != NULL){
+		cacheHead->prev = line;
+	}
+	cacheHead = line;
+	if(cacheTail == NULL){
+		cacheTail = line;
+	}
+
+}
+
+// find a line and make it the most recently used, counting the hit or miss
+HddCacheLine *lookupCacheLine(HddBlockID bid){
+	HddCacheLine *line;
+
+	if(!cacheInit){
+		return NULL;
+	}
+	line = findCacheLine(bid);
+	if(line == NULL){
+		cacheMisses++;
+		return NULL;
+	}
+	if(line->filled){	// the lookup the block was read for
+		line->filled = 0;
+	}
+	else{
+		cacheHits++;
+	}
+	if(line->prefetched){	// the read-ahead paid off
+		cachePrefetch.hits++;
+		line->prefetched = 0;
+	}
+	if(line != cacheHead){
+		unlinkCacheLine(line);
+		pushCacheLine(line);
+	}
+	return line;
+}
+
+// take a line out of the cache, a line still held by views is kept for
+// them until the last one is released
+void freeCacheLine(HddCacheLine *line){
+
+	if(line->prefetched){	// read ahead for nothing
+		cachePrefetch.wastedBytes += line->size;
+		line->prefetched = 0;
+	}
+	unlinkCacheLine(line);
+	unindexCacheLine(line);
+	cacheBlocks--;
+	if(line->views > 0){
+		line->orphaned = 1;
+		return;
+	}
+	hdd_slab_free(line->data);
+	hdd_slab_free(line);
+
+}
+
+// add a line for a block that is not cached, evicting the least recently
+// used line if the cache is full (buf is given back on failure)
+HddCacheLine *addCacheLine(HddBlockID bid, void *buf, uint32_t size){
+	HddCacheLine *line;
+
+	if(cacheBlocks >= cacheMaxBlocks){	// evict the least recently used line
+		hdd_log(LOG_INFO_LEVEL, "HDD cache : evicting block [%u]", cacheTail->bid);
+		freeCacheLine(cacheTail);
+		cacheEvictions++;
+	}
+
+	line = hdd_slab_alloc(sizeof(HddCacheLine));
+	if(line == NULL){
+		hdd_log(LOG_ERROR_LEVEL, "HDD cache : failed to add block [%u]", bid);
+		hdd_slab_free(buf);
+		return NULL;
+	}
+	line->bid = bid;
+	line->size = size;
+	line->prefetched = 0;
+	line->filled = 0;
+	line->views = 0;
+	line->orphaned = 0;
+	line->data = buf;
+	line->chain = *cacheBucket(bid);
+	*cacheBucket(bid) = line;
+	pushCacheLine(line);
+	cacheBlocks++;
+	cacheInserts++;
+	return line;
+}
+
+// give a line held by views a copy of its block in a new line, the views
+// keep the old one (NULL if the copy could not be made, the block is then
+// no longer cached)
+HddCacheLine *unshareCacheLine(HddCacheLine *line){
+	HddBlockID bid = line->bid;
+	uint32_t size = line->size;
+	void *buf;
+
+	buf = hdd_slab_alloc(size);
+	if(buf != NULL){
+		memcpy(buf, line->data, size);
+	}
+	freeCacheLine(line);	// makes room, so the add evicts nothing
+	return (buf != NULL) ? addCacheLine(bid, buf, size) : NULL;
+}
+
+//
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_hdd_cache_size
+// Description  : set the maximum number of blocks held by the cache, this
+//                takes effect on the next init_hdd_cache.
+//
+// Inputs       : max_blocks - the number of cache lines (at least 1)
+// Outputs      : 0 on success or -1 on failure
+//
+int set_hdd_cache_size(uint32_t max_blocks) {
+	if(cacheInit){	// cannot resize a live cache
+		hdd_log(LOG_ERROR_LEVEL, "HDD cache : cannot resize an initialized cache.");
+		return -1;
+	}
+	if(max_blocks == 0){	// the file layer reads blocks through the cache
+		hdd_log(LOG_ERROR_LEVEL, "HDD cache : cache must hold at least one block.");
+		return -1;
+	}
+	cacheMaxBlocks = max_blocks;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : init_hdd_cache
+// Description  : initialize the cache, any blocks already in the cache are
+//                dropped (e.g., after the device is formatted).
+//
+// Inputs       : void
+// Outputs      : 0 on success or -1 on failure
+//
+int init_hdd_cache(void) {
+	uint16_t bits = HDD_CACHE_MIN_HASH_BITS;
+
+	pthread_mutex_lock(&cacheLock);
+	if(cacheInit){	// already set up, just drop the contents
+		while(cacheHead != NULL){
+			freeCacheLine(cacheHead);
+		}
+		pthread_mutex_unlock(&cacheLock);
+		return 0;
+	}
+
+	while((bits < HDD_CACHE_MAX_HASH_BITS) && (((uint32_t)1 << bits) < cacheMaxBlocks)){
+		bits++;
+	}
+	if((cacheIndex = calloc((size_t)1 << bits, sizeof(HddCacheLine *))) == NULL){
+		hdd_log(LOG_ERROR_LEVEL, "HDD cache : failed to create cache index.");
+		pthread_mutex_unlock(&cacheLock);
+		return -1;
+	}
+	cacheIndexShift = 32 - bits;
+	cacheHead = cacheTail = NULL;
+	cacheBlocks = 0;
+	prefetchAtInit = cachePrefetch;
+	cacheInit = 1;
+	pthread_mutex_unlock(&cacheLock);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : close_hdd_cache
+// Description  : log the cache statistics and free all of the cache lines
+//
+// Inputs       : void
+// Outputs      : 0 on success or -1 on failure
+//
+int close_hdd_cache(void) {
+	uint64_t ahead, hits;
+
+	pthread_mutex_lock(&cacheLock);
+	if(!cacheInit){
+		pthread_mutex_unlock(&cacheLock);
+		return 0;
+	}
+
+	hdd_log(LOG_OUTPUT_LEVEL, "HDD cache : %lu hits, %lu misses, %lu inserts, %lu evictions (%u/%u blocks)",
+		cacheHits, cacheMisses, cacheInserts, cacheEvictions, cacheBlocks, cacheMaxBlocks);
+
+	while(cacheHead != NULL){
+		freeCacheLine(cacheHead);
+	}
+	ahead = cachePrefetch.blocks - prefetchAtInit.blocks;	// since this cache was set up
+	hits = cachePrefetch.hits - prefetchAtInit.hits;
+	if(ahead > 0){
+		hdd_log(LOG_OUTPUT_LEVEL, "HDD cache : %lu blocks read ahead, %.1f%% read, %lu bytes wasted",
+			ahead, 100.0 * hits / ahead, cachePrefetch.wastedBytes - prefetchAtInit.wastedBytes);
+	}
+	free(cacheIndex);
+	cacheIndex = NULL;
+	cacheHits = cacheMisses = cacheInserts = cacheEvictions = 0;
+	cacheInit = 0;
+	pthread_mutex_unlock(&cacheLock);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : put_hdd_cache
+// Description  : put a block into the cache, replacing any older copy.  The
+//                cache takes ownership of the buffer and will give it back
+//                to the slab when the line is evicted or deleted.
+//
+// Inputs       : bid - the block id
+//                buf - the block contents (from hdd_slab_alloc)
+//                size - the size of the block
+// Outputs      : 0 on success or -1 on failure (buf is freed either way)
+//
+int put_hdd_cache(HddBlockID bid, void *buf, uint32_t size) {
+	HddCacheLine *line;
+
+	pthread_mutex_lock(&cacheLock);
+	if(!cacheInit || (bid == HDD_NO_BLOCK)){	// nothing to cache into
+		hdd_slab_free(buf);
+		pthread_mutex_unlock(&cacheLock);
+		return (cacheInit ? 0 : -1);
+	}
+
+	line = findCacheLine(bid);
+	if(line != NULL && line->views > 0){	// its readers keep the old contents
+		freeCacheLine(line);
+		line = NULL;
+	}
+	if(line != NULL){	// replace the contents of an existing line
+		if(line->data != buf){
+			hdd_slab_free(line->data);
+		}
+		line->data = buf;
+		line->size = size;
+		line->prefetched = 0;
+		line->filled = 0;
+		unlinkCacheLine(line);
+		pushCacheLine(line);
+		pthread_mutex_unlock(&cacheLock);
+		return 0;
+	}
+
+	line = addCacheLine(bid, buf, size);
+	pthread_mutex_unlock(&cacheLock);
+	return (line != NULL) ? 0 : -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fill_hdd_cache
+// Description  : put a block that was read because it was missing into the
+//                cache (see put_hdd_cache).  The miss is counted here, when
+//                the block was checked with probe_hdd_cache, and the lookup
+//                that then reads it is not counted as a hit.
+//
+// Inputs       : bid - the block id
+//                buf - the block contents (from hdd_slab_alloc)
+//                size - the size of the block
+// Outputs      : 0 on success or -1 on failure (buf is freed either way)
+//
+int fill_hdd_cache(HddBlockID bid, void *buf, uint32_t size) {
+	HddCacheLine *line;
+	int ret;
+
+	ret = put_hdd_cache(bid, buf, size);
+	pthread_mutex_lock(&cacheLock);
+	if(ret == 0 && (line = findCacheLine(bid)) != NULL){
+		cacheMisses++;
+		line->filled = 1;
+	}
+	pthread_mutex_unlock(&cacheLock);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : prefetch_hdd_cache
+// Description  : put a block that was read ahead into the cache, unless the
+//                block is already cached.  It counts as a read-ahead hit if
+//                it is read before it is evicted, and as wasted bytes if not
+//                (or if it is not cached at all).
+//
+// Inputs       : bid - the block id
+//                buf - the block contents (from hdd_slab_alloc), NULL if the
+//                      read-ahead was dropped and is only counted
+//                size - the size of the block
+// Outputs      : 0 if cached, -1 if not (buf is given back)
+//
+int prefetch_hdd_cache(HddBlockID bid, void *buf, uint32_t size) {
+	HddCacheLine *line;
+
+	pthread_mutex_lock(&cacheLock);
+	cachePrefetch.blocks++;
+	if(buf == NULL || !cacheInit || (bid == HDD_NO_BLOCK) || findCacheLine(bid) != NULL){
+		cachePrefetch.wastedBytes += size;
+		pthread_mutex_unlock(&cacheLock);
+		hdd_slab_free(buf);
+		return -1;
+	}
+	if((line = addCacheLine(bid, buf, size)) != NULL){
+		line->prefetched = 1;
+	}
+	pthread_mutex_unlock(&cacheLock);
+	return (line != NULL) ? 0 : -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : probe_hdd_cache
+// Description  : check if a block is cached, without counting a hit or a
+//                miss or making it the most recently used line
+//
+// Inputs       : bid - the block id
+// Outputs      : 1 if cached, 0 if not
+//
+int probe_hdd_cache(HddBlockID bid) {
+	int ret;
+
+	pthread_mutex_lock(&cacheLock);
+	ret = cacheInit && findCacheLine(bid) != NULL;
+	pthread_mutex_unlock(&cacheLock);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_cache_prefetch_stats
+// Description  : get the read-ahead statistics, counted since the program
+//                started (they are not cleared by init or close)
+//
+// Inputs       : stats - where to put them
+// Outputs      : none
+//
+void hdd_cache_prefetch_stats(HddCachePrefetchStats *stats) {
+	pthread_mutex_lock(&cacheLock);
+	*stats = cachePrefetch;
+	pthread_mutex_unlock(&cacheLock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : full_hdd_cache
+// Description  : check if the cache holds as many blocks as it can, so
+//                caching another block evicts one
+//
+// Inputs       : void
+// Outputs      : 1 if full, 0 if there is room
+//
+int full_hdd_cache(void) {
+	return (__atomic_load_n(&cacheBlocks, __ATOMIC_RELAXED) >= cacheMaxBlocks);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : get_hdd_cache
+// Description  : look up a block in the cache, making it the most recently
+//                used line.  The returned pointer is owned by the cache and
+//                is valid until the next put or delete, threads sharing the
+//                cache should use copy_hdd_cache instead.
+//
+// Inputs       : bid - the block id
+//                size - set to the size of the block (may be NULL)
+// Outputs      : pointer to the block contents, or NULL on a miss
+//
+void * get_hdd_cache(HddBlockID bid, uint32_t *size) {
+	HddCacheLine *line;
+
+	pthread_mutex_lock(&cacheLock);
+	line = lookupCacheLine(bid);
+	if(line != NULL && size != NULL){
+		*size = line->size;
+	}
+	pthread_mutex_unlock(&cacheLock);
+	return (line != NULL) ? line->data : NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : view_hdd_cache
+// Description  : look up a block in the cache and hold it for reading, making
+//                it the most recently used line.  The block stays valid and
+//                unchanged until release_hdd_cache: a put, update or delete
+//                of the block meanwhile leaves the held copy to the reader.
+//
+// Inputs       : bid - the block id
+//                size - set to the size of the block (may be NULL)
+//                ref - set to the hold, given to release_hdd_cache
+// Outputs      : pointer to the block contents (read-only), or NULL on a miss
+//
+const void * view_hdd_cache(HddBlockID bid, uint32_t *size, void **ref) {
+	HddCacheLine *line;
+
+	pthread_mutex_lock(&cacheLock);
+	line = lookupCacheLine(bid);
+	if(line != NULL){
+		line->views++;
+		if(size != NULL){
+			*size = line->size;
+		}
+	}
+	pthread_mutex_unlock(&cacheLock);
+	*ref = line;
+	return (line != NULL) ? line->data : NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : release_hdd_cache
+// Description  : release a block held by view_hdd_cache, freeing it if it
+//                was dropped from the cache while held and this was the last
+//                hold.
+//
+// Inputs       : ref - the hold
+// Outputs      : none
+//
+void release_hdd_cache(void *ref) {
+	HddCacheLine *line = ref;
+
+	if(line == NULL){
+		return;
+	}
+	pthread_mutex_lock(&cacheLock);
+	if(--line->views == 0 && line->orphaned){
+		hdd_slab_free(line->data);
+		hdd_slab_free(line);
+	}
+	pthread_mutex_unlock(&cacheLock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : copy_hdd_cache
+// Description  : copy part of a cached block out of the cache, making it the
+//                most recently used line.  The copy is made under the cache
+//                lock so it is safe while other threads use the cache.
+//
+// Inputs       : bid - the block id
+//                offset - the first byte of the block to copy
+//                length - the number of bytes to copy
+//                dst - where to copy them
+// Outputs      : 0 if copied, -1 on a miss (or if the block is too small)
+//
+int copy_hdd_cache(HddBlockID bid, uint32_t offset, uint32_t length, void *dst) {
+	HddCacheLine *line;
+	int ret = -1;
+
+	pthread_mutex_lock(&cacheLock);
+	line = lookupCacheLine(bid);
+	if(line != NULL && offset + length <= line->size){
+		memcpy(dst, (char *)line->data + offset, length);
+		ret = 0;
+	}
+	pthread_mutex_unlock(&cacheLock);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : update_hdd_cache
+// Description  : copy bytes over part of a cached block (e.g., after a ranged
+//                overwrite of the block on the device), making it the most
+//                recently used line.  Made under the cache lock like
+//                copy_hdd_cache.
+//
+// Inputs       : bid - the block id
+//                offset - the first byte of the block to replace
+//                length - the number of bytes to replace
+//                src - the new bytes
+// Outputs      : 0 if updated, -1 on a miss (or if the block is too small)
+//
+int update_hdd_cache(HddBlockID bid, uint32_t offset, uint32_t length, void *src) {
+	HddCacheLine *line;
+	int ret = -1;
+
+	pthread_mutex_lock(&cacheLock);
+	line = lookupCacheLine(bid);
+	if(line != NULL && offset + length <= line->size && line->views > 0){	// copy it, the readers keep the old one
+		line = unshareCacheLine(line);
+	}
+	if(line != NULL && offset + length <= line->size){
+		memcpy((char *)line->data + offset, src, length);
+		ret = 0;
+	}
+	pthread_mutex_unlock(&cacheLock);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : delete_hdd_cache
+// Description  : remove a block from the cache
+//
+// Inputs       : bid - the block id
+// Outputs      : 0 if removed, -1 if it was not cached
+//
+int delete_hdd_cache(HddBlockID bid) {
+	HddCacheLine *line;
+
+	pthread_mutex_lock(&cacheLock);
+	line = cacheInit ? findCacheLine(bid) : NULL;
+	if(line != NULL){
+		freeCacheLine(line);
+	}
+	pthread_mutex_unlock(&cacheLock);
+	return (line != NULL) ? 0 : -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hddCacheUnitTest
+// Description  : Perform a test of the cache against a mirrored model of the
+//                blocks, checking contents and the LRU bound.
+//
+// Inputs       : None
+// Outputs      : 0 if successful or -1 if failure
+
+int hddCacheUnitTest(void) {
+
+	// Local variables
+	uint8_t model[HDD_CACHE_UNIT_TEST_BLOCKS+1];
+	uint32_t savedSize = cacheMaxBlocks, size, i;
+	HddBlockID bid;
+	uint8_t *blk;
+	const uint8_t *view, *view2;
+	void *ref, *ref2;
+
+	// Start with a small cache so that evictions happen
+	if (close_hdd_cache() || set_hdd_cache_size(HDD_CACHE_UNIT_TEST_BLOCKS/4) || init_hdd_cache()) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_CACHE_UNIT_TEST : failed to initialize cache.");
+		return(-1);
+	}
+	memset(model, 0x0, sizeof(model));
+
+	for (i=0; i<HDD_CACHE_UNIT_TEST_ITERATIONS; i++) {
+		bid = getRandomValue(1, HDD_CACHE_UNIT_TEST_BLOCKS);
+		switch (getRandomValue(0, 2)) {
+
+		case 0: // Insert a block filled with a random byte
+			model[bid] = getRandomValue(1, 0xff);
+			size = getRandomValue(1, 256);
+			blk = hdd_slab_alloc(size);
+			memset(blk, model[bid], size);
+			if (put_hdd_cache(bid, blk, size)) {
+				hdd_log(LOG_ERROR_LEVEL, "HDD_CACHE_UNIT_TEST : put failed [%u].", bid);
+				return(-1);
+			}
+			break;
+
+		case 1: // Look up a block, contents must match the last put
+			blk = get_hdd_cache(bid, &size);
+			if ((blk != NULL) && ((model[bid] == 0) || (blk[0] != model[bid]) || (blk[size-1] != model[bid]))) {
+				hdd_log(LOG_ERROR_LEVEL, "HDD_CACHE_UNIT_TEST : stale block [%u].", bid);
+				return(-1);
+			}
+			break;
+
+		case 2: // Delete a block
+			delete_hdd_cache(bid);
+			model[bid] = 0;
+			if (get_hdd_cache(bid, NULL) != NULL) {
+				hdd_log(LOG_ERROR_LEVEL, "HDD_CACHE_UNIT_TEST : deleted block still cached [%u].", bid);
+				return(-1);
+			}
+			break;
+		}
+
+		if (cacheBlocks > cacheMaxBlocks) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD_CACHE_UNIT_TEST : cache overflow [%u>%u].", cacheBlocks, cacheMaxBlocks);
+			return(-1);
+		}
+	}
+
+	// A held block keeps its contents through an update, a replace and a delete
+	blk = hdd_slab_alloc(64);
+	memset(blk, 0x11, 64);
+	if (put_hdd_cache(1, blk, 64) || ((view = view_hdd_cache(1, &size, &ref)) == NULL) || (size != 64)) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_CACHE_UNIT_TEST : view failed.");
+		return(-1);
+	}
+	memset(model, 0x22, 64);
+	update_hdd_cache(1, 0, 64, model);
+	if ((view[0] != 0x11) || (view[63] != 0x11) || (copy_hdd_cache(1, 0, 1, &model[64]) != 0) || (model[64] != 0x22)) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_CACHE_UNIT_TEST : update of a held block not copied on write.");
+		return(-1);
+	}
+	view2 = view_hdd_cache(1, NULL, &ref2);
+	blk = hdd_slab_alloc(64);
+	memset(blk, 0x33, 64);
+	put_hdd_cache(1, blk, 64);
+	delete_hdd_cache(1);
+	if ((view2 == NULL) || (view2[0] != 0x22) || (view[0] != 0x11) || (get_hdd_cache(1, NULL) != NULL)) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_CACHE_UNIT_TEST : held block changed by a replace or delete.");
+		return(-1);
+	}
+	release_hdd_cache(ref);
+	release_hdd_cache(ref2);
+
+	// Restore the configured size, return successfully
+	close_hdd_cache();
+	set_hdd_cache_size(savedSize);
+	hdd_log(LOG_INFO_LEVEL, "HDD_CACHE_UNIT_TEST : cache tests completed successfully.");
+	return(0);
+}
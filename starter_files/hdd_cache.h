@@ -0,0 +1,84 @@
+#ifndef HDD_CACHE_INCLUDED
+#define HDD_CACHE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : hdd_cache.h
+//  Description    : This is the interface for the client-side block cache
+//                   that sits between the file IO layer and the HDD device.
+//
+//  Author         : Chuyang Zhang
+//  Last Modified  : 2017/12/1
+//
+
+// Include files
+#include <stdint.h>
+
+// Project include files
+#include <hdd_driver.h>
+
+// Defines
+#define HDD_DEFAULT_CACHE_SIZE 1024 // Default number of cache lines (blocks)
+
+// The read-ahead statistics
+typedef struct {
+	uint64_t blocks;       // Blocks read ahead
+	uint64_t hits;         // Of those, read from the cache before being evicted
+	uint64_t wastedBytes;  // Bytes read ahead and never read (dropped or evicted)
+} HddCachePrefetchStats;
+
+//
+// Cache interface
+
+int set_hdd_cache_size(uint32_t max_blocks);
+	// Set the maximum number of blocks held in the cache (before init)
+
+int init_hdd_cache(void);
+	// Initialize the cache, dropping any blocks it currently holds
+
+int close_hdd_cache(void);
+	// Log the cache statistics and release all of the cached blocks
+
+int put_hdd_cache(HddBlockID bid, void *buf, uint32_t size);
+	// Put a block in the cache, the cache takes ownership of buf (an hdd_slab buffer)
+
+int fill_hdd_cache(HddBlockID bid, void *buf, uint32_t size);
+	// Put a block read on a miss in the cache, counting the miss (its next lookup is not a hit), takes buf
+
+int prefetch_hdd_cache(HddBlockID bid, void *buf, uint32_t size);
+	// Put a block that was read ahead in the cache (if not cached already), takes buf
+
+int probe_hdd_cache(HddBlockID bid);
+	// Check if a block is cached without touching the statistics or LRU order
+
+void hdd_cache_prefetch_stats(HddCachePrefetchStats *stats);
+	// Get the read-ahead hit and waste statistics
+
+int full_hdd_cache(void);
+	// Check if the cache is full, so a put would evict a block
+
+void * get_hdd_cache(HddBlockID bid, uint32_t *size);
+	// Get a block from the cache, NULL if not present
+
+const void * view_hdd_cache(HddBlockID bid, uint32_t *size, void **ref);
+	// Hold a block in the cache for reading without copying, NULL if not present
+
+void release_hdd_cache(void *ref);
+	// Release a block held by view_hdd_cache
+
+int copy_hdd_cache(HddBlockID bid, uint32_t offset, uint32_t length, void *dst);
+	// Copy part of a block out of the cache (thread safe), -1 if not present
+
+int update_hdd_cache(HddBlockID bid, uint32_t offset, uint32_t length, void *src);
+	// Copy part of a block into the cache (thread safe), -1 if not present
+
+int delete_hdd_cache(HddBlockID bid);
+	// Remove a block from the cache (e.g., when deleted on the device)
+
+//
+// Unit testing for the module
+
+int hddCacheUnitTest(void);
+	// Perform a test of the cache implementation
+
+#endif
@@ -11,131 +11,1091 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 // Project Include Files
 #include <hdd_network.h>
 #include <cmpsc311_log.h>
+#include <hdd_log.h>
 #include <cmpsc311_util.h>
 #include <hdd_driver.h>
+#include <hdd_stats.h>
+#include <hdd_store.h>
 
+// Defines
+#define HDD_URING_ENTRIES 8	// submission queue entries, a frame is a write and a read
+#define HDD_URING_STAGE_BUFFER 0	// the registered buffers, the stage and the receive frame
+#define HDD_URING_RX_BUFFER 1
+
+// A request sent to the server whose response has not been read yet
+typedef struct {
+	int32_t tag;	// tag handed back to the submitter
+	HddBitCmd cmd;	// the command sent
+	HddBitCmd wire;	// the command in network byte order, sent from here
+	uint32_t offset;	// the start of a HDD_RANGE request in the block
+	uint64_t range;	// the range word in network byte order, sent from here
+	void *buf;	// where a READ response is stored
+	uint64_t start;	// when it was submitted (for the latency statistics)
+	HddBitResp resp;	// the response, for backends that answer right away
+} HddClientRequest;
+
+// A backend carries the requests of a connection to a block store, which
+// answers them in the order they are sent.  The socket backend talks to an
+// HDD server, the uring backend to the same servers through io_uring, and
+// the loopback backend to an in-process store.
+struct HddConnection;
+typedef struct {
+	const char *name;	// the name of the backend
+	int (*open)(struct HddConnection *c);	// connect to the store
+	void (*close)(struct HddConnection *c);	// disconnect, dropping anything queued
+	int (*send)(struct HddConnection *c, HddClientRequest *req);	// queue a request
+	int (*receive)(struct HddConnection *c, HddClientRequest *req, HddBitResp *resp);	// the response of the oldest request
+	int (*flush)(struct HddConnection *c);	// pass on the queued requests without waiting
+} HddClientBackend;
+
+// The io_uring of a connection of the uring backend.  The stage and the
+// receive frame of the connection are registered with the ring, so the
+// kernel does not map them on every request.
+typedef struct HddUring {
+	int fd;	// the ring
+	void *sqRing, *cqRing;	// the mapped submission and completion rings
+	size_t sqRingSize, cqRingSize;
+	struct io_uring_sqe *sqes;	// the mapped submission queue entries
+	size_t sqesSize;
+	unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+	unsigned *cqHead, *cqTail, *cqMask;
+	struct io_uring_cqe *cqes;
+	char stage[HDD_CLIENT_FRAME_SIZE];	// the frame being sent, when it fits
+} HddUring;
+
+// A connection to the server.  The server answers the requests on a
+// connection in the order they are sent, so responses are matched to the
+// oldest request in the in-flight queue.  Requests are gathered into an IO
+// vector and sent with one writev when a response is needed, responses are
+// read with readv straight into the caller's buffer with any following
+// responses landing in rxFrame.
+typedef struct HddConnection {
+	const HddClientBackend *backend;	// carries the requests, set while connected
+	int sockfd;	// socket, valid while connected
+	int quickack;	// a TCP socket and -k, responses are ACKed right away
+	int connected;	// has a connection to the server
+	int busy;	// bound to a thread
+	HddClientRequest inflight[HDD_CLIENT_MAX_DEPTH];	// the in-flight queue
+	uint32_t inflightHead;	// oldest request in the queue
+	uint32_t inflightCount;	// requests in the queue
+	uint32_t inflightBytes;	// response data expected for the queued requests
+	int32_t nextTag;	// tag of the next request
+	struct iovec txVector[3 * HDD_CLIENT_MAX_DEPTH];	// commands, ranges and blocks not yet sent
+	int txCount;	// entries in txVector
+	char rxFrame[HDD_CLIENT_FRAME_SIZE];	// data received but not yet consumed
+	uint32_t rxStart, rxEnd;	// unconsumed bytes of rxFrame
+	HddUring *ring;	// the io_uring of the uring backend
+} HddConnection;
 
 int hdd_network_shutdown = 0;		//shut down
 unsigned char *hdd_network_address = NULL;	//address of the network server
 unsigned short hdd_network_port = 0;	//Port of the network server
-int sockfd = -1;	//initialized to -1
+int hdd_network_nodelay = 0;	//set TCP_NODELAY on TCP connections
+int hdd_network_quickack = 0;	//set TCP_QUICKACK on TCP connections for each batch sent
+int hdd_network_ranged = 0;	//the server implements HDD_RANGE requests
+int hdd_network_uring = 0;	//carry socket requests over io_uring
+uint32_t clientDepth = HDD_CLIENT_DEFAULT_DEPTH;	// most requests in flight
+
+// The connection pool, connection 0 carries the device commands (INIT,
+// FORMAT, SAVE_AND_CLOSE) and the others are opened as threads need them
+HddConnection pool[HDD_CLIENT_MAX_CONNECTIONS];
+uint32_t poolOpen = 1;	// connections in use (connection 0 always is)
+uint32_t poolSize = 1;	// most connections to open
+pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t poolFree = PTHREAD_COND_INITIALIZER;	// signalled when a connection is released
+
+// The in-process store of the loopback backend, setup by the first connection
+HddStore loopbackStore;
+pthread_once_t loopbackOnce = PTHREAD_ONCE_INIT;
+int loopbackReady = 0;
+
+// The connection bound to the calling thread
+__thread HddConnection *conn = NULL;
+__thread int connHolds = 0;	// nested hdd_client_acquire calls
+__thread int connImplicit = 0;	// bound by a submit rather than hdd_client_acquire
+
+// function that helps to accomplish the tasks
+///////////////////////////////////////////////////////////////////////////////
+// connect to the configured server, over TCP or a Unix-domain socket
+int socketOpen(HddConnection *c){
+	const char *addr = (hdd_network_address != NULL) ? (const char *)hdd_network_address : HDD_DEFAULT_IP;
+	struct sockaddr_in caddr;
+	struct sockaddr_un uaddr;
+	struct sockaddr *saddr;
+	socklen_t slen;
+	int unixPath = (strncmp(addr, HDD_UNIX_PREFIX, strlen(HDD_UNIX_PREFIX)) == 0);
+	int on = 1;
+
+	if(unixPath){	// unix:<path> names a Unix-domain socket
+		addr += strlen(HDD_UNIX_PREFIX);
+		if(addr[0] == '\0' || strlen(addr) >= sizeof(uaddr.sun_path)){
+			printf("bad unix socket path [%s]\n", addr);
+			return(-1);
+		}
+		memset(&uaddr, 0, sizeof(uaddr));
+		uaddr.sun_family = AF_UNIX;
+		strcpy(uaddr.sun_path, addr);
+		saddr = (struct sockaddr *)&uaddr;
+		slen = sizeof(uaddr);
+	}else{
+		memset(&caddr, 0, sizeof(caddr));
+		caddr.sin_family = AF_INET;
+		caddr.sin_port = htons((hdd_network_port != 0) ? hdd_network_port : HDD_DEFAULT_PORT);
+		if(inet_aton(addr, &(caddr.sin_addr)) == 0){
+			printf("bad server address [%s]\n", addr);
+			return(-1);
+		}
+		saddr = (struct sockaddr *)&caddr;
+		slen = sizeof(caddr);
+	}
+	c->sockfd = socket(unixPath ? PF_UNIX : PF_INET, SOCK_STREAM, 0);	//create socket 
+	if(c->sockfd == -1){	//check during the creation
+		printf("failed when create socket [%s]\n", strerror(errno));
+		return(-1);
+	}
+	if(!unixPath && hdd_network_nodelay &&
+		setsockopt(c->sockfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) == -1){	// send the small headers right away
+		printf("failed when set TCP_NODELAY [%s]\n", strerror(errno));
+		close(c->sockfd);
+		return(-1);
+	}
+	if(connect(c->sockfd, saddr, slen) == -1){	//check if the connection is correct
+		printf("failed when connect socket [%s]\n", strerror(errno));
+		close(c->sockfd);
+		return(-1);
+	}
+	c->quickack = hdd_network_quickack && !unixPath;
+	return 0;
+}
+
+// close the socket of a connection
+void socketClose(HddConnection *c){
+	close(c->sockfd);
+}
+
+// write a whole IO vector, retrying short writes and interrupted calls
+int sendVector(int sockfd, struct iovec *vec, int count){
+	ssize_t ret;
+
+	while(count > 0){
+		ret = writev(sockfd, vec, count);	// at most 3 entries per request in flight
+		if(ret < 0 && errno == EINTR){
+			continue;
+		}
+		if(ret <= 0){
+			printf("failed when write socket [%s]\n", strerror(errno));
+			return(-1);
+		}
+		while(count > 0 && (size_t)ret >= vec->iov_len){	// skip what was written
+			ret -= vec->iov_len;
+			vec++;
+			count--;
+		}
+		if(count > 0){
+			vec->iov_base = (char *)vec->iov_base + ret;
+			vec->iov_len -= ret;
+		}
+	}
+	return 0;
+}
+
+// ACK the responses right away (-k), the shipped server holds its small
+// responses until the earlier ones are ACKed and the kernel drops the option
+// after a few ACKs, so it is set again before each wait for a response
+void armQuickAck(HddConnection *c){
+	int on = 1;
+
+	if(c->quickack && setsockopt(c->sockfd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on)) == -1){
+		printf("failed when set TCP_QUICKACK [%s]\n", strerror(errno));
+		c->quickack = 0;	// carry on with delayed ACKs
+	}
+}
+
+// send the gathered requests
+int flushFrame(HddConnection *c){
+	int count = c->txCount, i;
+	uint64_t bytes = 0;
+
+	for(i = 0; i < count; i++){
+		bytes += c->txVector[i].iov_len;
+	}
+	c->txCount = 0;
+	hdd_stats_add_bytes(bytes, 0);
+	return sendVector(c->sockfd, c->txVector, count);
+}
 
+// add data to the IO vector of the frame
+void frameData(HddConnection *c, void *buf, uint32_t length){
+	c->txVector[c->txCount].iov_base = buf;
+	c->txVector[c->txCount].iov_len = length;
+	c->txCount++;
+}
+
+// read length bytes into buf, anything the server has already sent after
+// them is kept in rxFrame for the next responses
+int recvFramed(HddConnection *c, void *buf, uint32_t length){
+	struct msghdr msg;
+	struct iovec vec[2];
+	uint32_t bytes;
+	ssize_t ret;
+
+	while(length > 0){
+		if(c->rxStart < c->rxEnd){	// buffered data first
+			bytes = (c->rxEnd - c->rxStart < length) ? c->rxEnd - c->rxStart : length;
+			memcpy(buf, &c->rxFrame[c->rxStart], bytes);
+			c->rxStart += bytes;
+			buf = (char *)buf + bytes;
+			length -= bytes;
+			continue;
+		}
+		vec[0].iov_base = buf;
+		vec[0].iov_len = length;
+		vec[1].iov_base = c->rxFrame;
+		vec[1].iov_len = HDD_CLIENT_FRAME_SIZE;
+		if(c->quickack){	// only a read that would block waits on our ACK
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = vec;
+			msg.msg_iovlen = 2;
+			ret = recvmsg(c->sockfd, &msg, MSG_DONTWAIT);
+			if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+				armQuickAck(c);
+				ret = readv(c->sockfd, vec, 2);
+			}
+		}
+		else{
+			ret = readv(c->sockfd, vec, 2);
+		}
+		if(ret < 0 && errno == EINTR){
+			continue;
+		}
+		if(ret <= 0){
+			printf("failed when read socket [%s]\n", (ret == 0) ? "connection closed" : strerror(errno));
+			return(-1);
+		}
+		hdd_stats_add_bytes(0, ret);
+		if((size_t)ret <= length){
+			buf = (char *)buf + ret;
+			length -= ret;
+		}
+		else{	// the rest belongs to later responses
+			c->rxStart = 0;
+			c->rxEnd = ret - length;
+			length = 0;
+		}
+	}
+	return 0;
+}
+
+// bytes of data sent with a command
+uint32_t requestBytes(HddBitCmd cmd);
+
+// gather a request into the frame, it is sent when a response is needed
+int socketSend(HddConnection *c, HddClientRequest *req){
+	frameData(c, &req->wire, sizeof(HddBitCmd));
+	if(((req->cmd >> 33) & 0x7) == HDD_RANGE){	// the range word follows the command
+		frameData(c, &req->range, HDD_NET_RANGE_SIZE);
+	}
+	if(requestBytes(req->cmd) > 0){	// the block of a create or overwrite
+		frameData(c, req->buf, requestBytes(req->cmd));
+	}
+	return 0;
+}
+
+// send what is gathered without waiting for a response
+int socketFlush(HddConnection *c){
+	return (c->txCount > 0) ? flushFrame(c) : 0;
+}
+
+// send what is gathered and read the response, and the block of a READ
+int socketReceive(HddConnection *c, HddClientRequest *req, HddBitResp *resp){
+	HddBitResp network_response;
+
+	if(flushFrame(c) || recvFramed(c, &network_response, HDD_NET_HEADER_SIZE)){
+		return(-1);
+	}
+	*resp = ntohll64(network_response);
+	if(((*resp >> 62) & 0x3) == HDD_BLOCK_READ){	// check if needs to receive buffer as well
+		return recvFramed(c, req->buf, (*resp >> 36) & 0x3ffffff);
+	}
+	return 0;
+}
+
+// setup the loopback store, saved to the file named by loopback:<file>
+void loopbackSetup(void){
+	const char *addr = (const char *)hdd_network_address;
+	const char *path = (strlen(addr) > strlen(HDD_LOOPBACK_ADDRESS)) ? addr + strlen(HDD_LOOPBACK_ADDRESS) + 1 : NULL;
+
+	loopbackReady = (hdd_store_init(&loopbackStore, path) == 0);
+}
+
+// connect to the in-process store
+int loopbackOpen(HddConnection *c){
+	pthread_once(&loopbackOnce, loopbackSetup);
+	if(!loopbackReady){
+		printf("failed to setup the loopback store\n");
+		return(-1);
+	}
+	c->sockfd = -1;
+	return 0;
+}
+
+// nothing to release, the store outlives its connections
+void loopbackClose(HddConnection *c){
+}
 
+// carry out a request right away, the response waits in the queue entry
+int loopbackSend(HddConnection *c, HddClientRequest *req){
+	req->resp = hdd_store_execute(&loopbackStore, req->cmd, req->offset, req->buf);
+	return 0;
+}
+
+// the response of a request carried out when it was sent
+int loopbackReceive(HddConnection *c, HddClientRequest *req, HddBitResp *resp){
+	*resp = req->resp;
+	return 0;
+}
+
+// nothing is queued, requests are carried out when they are sent
+int loopbackFlush(HddConnection *c){
+	return 0;
+}
+
+// The blocking backend the uring backend falls back to
+extern const HddClientBackend socketBackend;
+
+// unmap and close what was setup of a ring
+void uringTeardown(HddUring *r){
+	if(r->sqes != NULL && r->sqes != MAP_FAILED){
+		munmap(r->sqes, r->sqesSize);
+	}
+	if(r->cqRing != NULL && r->cqRing != MAP_FAILED && r->cqRing != r->sqRing){
+		munmap(r->cqRing, r->cqRingSize);
+	}
+	if(r->sqRing != NULL && r->sqRing != MAP_FAILED){
+		munmap(r->sqRing, r->sqRingSize);
+	}
+	if(r->fd >= 0){
+		close(r->fd);
+	}
+}
+
+// create the ring of a connection and register its stage and receive frame
+int uringSetup(HddConnection *c, HddUring *r){
+	struct io_uring_params params;
+	struct iovec bufs[2];
+
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_COOP_TASKRUN;	// completions are only waited for, no need to interrupt
+	r->fd = syscall(__NR_io_uring_setup, HDD_URING_ENTRIES, &params);
+	if(r->fd < 0 && errno == EINVAL){	// older kernels
+		memset(&params, 0, sizeof(params));
+		r->fd = syscall(__NR_io_uring_setup, HDD_URING_ENTRIES, &params);
+	}
+	if(r->fd < 0){
+		return(-1);
+	}
+	r->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	r->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP){	// both rings in one mapping
+		r->sqRingSize = r->cqRingSize = (r->sqRingSize > r->cqRingSize) ? r->sqRingSize : r->cqRingSize;
+	}
+	r->sqRing = mmap(NULL, r->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if(r->sqRing == MAP_FAILED){
+		return(-1);
+	}
+	r->cqRing = (params.features & IORING_FEAT_SINGLE_MMAP) ? r->sqRing :
+		mmap(NULL, r->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	if(r->cqRing == MAP_FAILED){
+		return(-1);
+	}
+	r->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if(r->sqes == MAP_FAILED){
+		return(-1);
+	}
+	r->sqHead = (unsigned *)((char *)r->sqRing + params.sq_off.head);
+	r->sqTail = (unsigned *)((char *)r->sqRing + params.sq_off.tail);
+	r->sqMask = (unsigned *)((char *)r->sqRing + params.sq_off.ring_mask);
+	r->sqArray = (unsigned *)((char *)r->sqRing + params.sq_off.array);
+	r->cqHead = (unsigned *)((char *)r->cqRing + params.cq_off.head);
+	r->cqTail = (unsigned *)((char *)r->cqRing + params.cq_off.tail);
+	r->cqMask = (unsigned *)((char *)r->cqRing + params.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)r->cqRing + params.cq_off.cqes);
+
+	bufs[HDD_URING_STAGE_BUFFER].iov_base = r->stage;
+	bufs[HDD_URING_STAGE_BUFFER].iov_len = HDD_CLIENT_FRAME_SIZE;
+	bufs[HDD_URING_RX_BUFFER].iov_base = c->rxFrame;
+	bufs[HDD_URING_RX_BUFFER].iov_len = HDD_CLIENT_FRAME_SIZE;
+	return (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS, bufs, 2) < 0) ? -1 : 0;
+}
+
+// connect to the server and setup the ring, falling back to the blocking
+// socket backend where io_uring is not available
+int uringOpen(HddConnection *c){
+	static int warned = 0;
+	int err;
+
+	if(socketOpen(c)){
+		return(-1);
+	}
+	c->ring = calloc(1, sizeof(HddUring));
+	if(c->ring == NULL){
+		err = ENOMEM;
+	}
+	else{
+		c->ring->fd = -1;
+		err = uringSetup(c, c->ring) ? errno : 0;
+	}
+	if(err){
+		if(!warned){	// once, every connection falls back the same way
+			hdd_log(LOG_WARNING_LEVEL, "HDD client : io_uring unavailable [%s], using blocking sockets.", strerror(err));
+			warned = 1;
+		}
+		if(c->ring != NULL){
+			uringTeardown(c->ring);
+			free(c->ring);
+			c->ring = NULL;
+		}
+		c->backend = &socketBackend;
+	}
+	return 0;
+}
+
+// close the ring and the socket of a connection
+void uringClose(HddConnection *c){
+	uringTeardown(c->ring);
+	free(c->ring);
+	c->ring = NULL;
+	socketClose(c);
+}
+
+// queue a submission, linked to the next one when link is set
+void uringQueue(HddUring *r, uint8_t opcode, int fd, void *addr, uint32_t len, int buffer, int link, uint64_t data){
+	unsigned tail = *r->sqTail, idx = tail & *r->sqMask;
+	struct io_uring_sqe *sqe = &r->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)addr;
+	sqe->len = len;
+	sqe->buf_index = (buffer >= 0) ? buffer : 0;
+	sqe->flags = link ? IOSQE_IO_LINK : 0;
+	sqe->user_data = data;
+	r->sqArray[idx] = idx;
+	__atomic_store_n(r->sqTail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// submit the queued entries and wait for count completions, the result of
+// each is stored at its user data
+int uringWait(HddUring *r, int count, int32_t *results){
+	struct io_uring_cqe *cqe;
+	unsigned head, pending;
+	int done = 0;
+	long ret;
+
+	while(done < count){
+		head = *r->cqHead;
+		while(head != __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE)){	// reap what has completed
+			cqe = &r->cqes[head & *r->cqMask];
+			results[cqe->user_data] = cqe->res;
+			head++;
+			done++;
+		}
+		__atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+		if(done == count){
+			break;
+		}
+		pending = *r->sqTail - __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE);
+		ret = syscall(__NR_io_uring_enter, r->fd, pending, count - done, IORING_ENTER_GETEVENTS, NULL, 0);
+		if(ret < 0 && errno != EINTR){
+			printf("failed when enter io_uring [%s]\n", strerror(errno));
+			return(-1);
+		}
+	}
+	return 0;
+}
+
+// send the gathered requests with one write, copied into the registered
+// stage when the frame fits (blocks too) and from where they are when it
+// does not.  When read is set a read of the responses into rxFrame is
+// linked behind it, so the frame and its response take one io_uring_enter.
+// A short write breaks the link, the rest is then sent (and read) the
+// blocking way.
+int uringFlushFrame(HddConnection *c, int read){
+	HddUring *r = c->ring;
+	int32_t results[2];
+	uint64_t bytes = 0, sent;
+	uint32_t staged, unread;
+	int count = c->txCount, i;
+
+	for(i = 0; i < count; i++){
+		bytes += c->txVector[i].iov_len;
+	}
+	armQuickAck(c);
+	if(bytes <= HDD_CLIENT_FRAME_SIZE){
+		for(i = 0, staged = 0; i < count; i++){
+			memcpy(&r->stage[staged], c->txVector[i].iov_base, c->txVector[i].iov_len);
+			staged += c->txVector[i].iov_len;
+		}
+		uringQueue(r, IORING_OP_WRITE_FIXED, c->sockfd, r->stage, bytes, HDD_URING_STAGE_BUFFER, read, 0);
+	}
+	else{
+		uringQueue(r, IORING_OP_WRITEV, c->sockfd, c->txVector, count, -1, read, 0);
+	}
+	if(read){	// the responses land after what is left in rxFrame
+		unread = c->rxEnd - c->rxStart;
+		memmove(c->rxFrame, &c->rxFrame[c->rxStart], unread);
+		c->rxStart = 0;
+		c->rxEnd = unread;
+		uringQueue(r, IORING_OP_READ_FIXED, c->sockfd, &c->rxFrame[unread], HDD_CLIENT_FRAME_SIZE - unread,
+			HDD_URING_RX_BUFFER, 0, 1);
+	}
+	c->txCount = 0;
+	if(uringWait(r, 1 + read, results)){
+		return(-1);
+	}
+
+	if(results[0] < 0){
+		printf("failed when write socket [%s]\n", strerror(-results[0]));
+		return(-1);
+	}
+	hdd_stats_add_bytes(bytes, 0);
+	if((sent = results[0]) < bytes){	// skip what was written and send the rest
+		for(i = 0; sent >= c->txVector[i].iov_len; i++){
+			sent -= c->txVector[i].iov_len;
+		}
+		c->txVector[i].iov_base = (char *)c->txVector[i].iov_base + sent;
+		c->txVector[i].iov_len -= sent;
+		if(sendVector(c->sockfd, &c->txVector[i], count - i)){
+			return(-1);
+		}
+	}
+	if(read && results[1] != -ECANCELED){	// a cancelled read is left to recvFramed
+		if(results[1] <= 0){
+			printf("failed when read socket [%s]\n", (results[1] == 0) ? "connection closed" : strerror(-results[1]));
+			return(-1);
+		}
+		hdd_stats_add_bytes(0, results[1]);
+		c->rxEnd += results[1];
+	}
+	return 0;
+}
+
+// the gathered requests are sent as the socket backend gathers them
+int uringSend(HddConnection *c, HddClientRequest *req){
+	return socketSend(c, req);
+}
+
+// send what is gathered without waiting for a response
+int uringFlush(HddConnection *c){
+	return (c->txCount > 0) ? uringFlushFrame(c, 0) : 0;
+}
+
+// send what is gathered together with a read of the responses, then take
+// the response (and the block of a READ) from rxFrame
+int uringReceive(HddConnection *c, HddClientRequest *req, HddBitResp *resp){
+	HddBitResp network_response;
+	int read = (c->rxEnd - c->rxStart < HDD_NET_HEADER_SIZE);
+
+	if(((c->txCount > 0 || read) && uringFlushFrame(c, read)) ||
+		recvFramed(c, &network_response, HDD_NET_HEADER_SIZE)){
+		return(-1);
+	}
+	*resp = ntohll64(network_response);
+	if(((*resp >> 62) & 0x3) == HDD_BLOCK_READ){	// check if needs to receive buffer as well
+		return recvFramed(c, req->buf, (*resp >> 36) & 0x3ffffff);
+	}
+	return 0;
+}
+
+// The backends
+const HddClientBackend socketBackend = { "socket", socketOpen, socketClose, socketSend, socketReceive, socketFlush };
+const HddClientBackend loopbackBackend = { "loopback", loopbackOpen, loopbackClose, loopbackSend, loopbackReceive, loopbackFlush };
+const HddClientBackend uringBackend = { "uring", uringOpen, uringClose, uringSend, uringReceive, uringFlush };
+
+// check for a loopback[:<file>] address
+int loopbackAddress(const char *addr){
+	return (addr != NULL && strncmp(addr, HDD_LOOPBACK_ADDRESS, strlen(HDD_LOOPBACK_ADDRESS)) == 0 &&
+		(addr[strlen(HDD_LOOPBACK_ADDRESS)] == '\0' || addr[strlen(HDD_LOOPBACK_ADDRESS)] == ':'));
+}
+
+// connect to the configured store through the backend its address selects
+int connectServer(HddConnection *c){
+	c->backend = loopbackAddress((const char *)hdd_network_address) ? &loopbackBackend :
+		(hdd_network_uring ? &uringBackend : &socketBackend);	// open may fall back to socketBackend
+	if(c->backend->open(c)){
+		return(-1);
+	}
+	c->txCount = c->rxStart = c->rxEnd = 0;
+	c->connected = 1;
+	return 0;
+}
+
+// close a connection, dropping anything buffered on it
+void closeConnection(HddConnection *c){
+	if(c->connected){
+		c->backend->close(c);
+	}
+	c->connected = 0;
+	c->txCount = c->rxStart = c->rxEnd = 0;
+}
+
+// bytes of data sent with a command
+uint32_t requestBytes(HddBitCmd cmd){
+	return hdd_store_request_bytes(cmd);
+}
+
+// the statistics a command is timed under
+HddStatsId requestStat(HddBitCmd cmd){
+	uint8_t op = (cmd >> 62) & 0x3, flag = (cmd >> 33) & 0x7;
+
+	if(op == HDD_DEVICE && flag != HDD_NULL_FLAG && flag != HDD_META_BLOCK){
+		return HDD_STATS_DEVICE;
+	}
+	return HDD_STATS_BLOCK_CREATE + op;
+}
+
+// bytes of data the server sends back for a command
+uint32_t responseBytes(HddBitCmd cmd){
+	if(((cmd >> 62) & 0x3) == HDD_BLOCK_READ){
+		return (cmd >> 36) & 0x3ffffff;
+	}
+	return 0;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : hdd_client_operation
-// Description  : This the client operation that sends a request to the CRUD
-//                server.   It will:
+// Function     : hdd_client_set_depth
+// Description  : set the most requests that may be in flight at once, 1
+//                makes every request synchronous.
 //
-//                1) if INIT make a connection to the server
-//                2) send any request to the server, returning results
-//                3) if CLOSE, will close the connection
+// Inputs       : depth - the queue depth (1 to HDD_CLIENT_MAX_DEPTH)
+// Outputs      : 0 on success or -1 on failure
+int hdd_client_set_depth(uint32_t depth) {
+	if(depth == 0 || depth > HDD_CLIENT_MAX_DEPTH){
+		hdd_log(LOG_ERROR_LEVEL, "HDD client : bad queue depth [%u], must be 1 to %d.", depth, HDD_CLIENT_MAX_DEPTH);
+		return(-1);
+	}
+	clientDepth = depth;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_client_set_connections
+// Description  : set the most server connections the pool opens.  Only
+//                servers that serve several connections at once can use
+//                more than one.
+//
+// Inputs       : count - the number of connections (1 to HDD_CLIENT_MAX_CONNECTIONS)
+// Outputs      : 0 on success or -1 on failure
+int hdd_client_set_connections(uint32_t count) {
+	if(count == 0 || count > HDD_CLIENT_MAX_CONNECTIONS){
+		hdd_log(LOG_ERROR_LEVEL, "HDD client : bad connection count [%u], must be 1 to %d.", count, HDD_CLIENT_MAX_CONNECTIONS);
+		return(-1);
+	}
+	pthread_mutex_lock(&poolLock);
+	poolSize = count;
+	pthread_mutex_unlock(&poolLock);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_client_acquire
+// Description  : bind a connection of the pool to the calling thread, so
+//                its requests (and pipelined completions) stay on one
+//                connection.  Waits while every connection is in use.
+//                Calls nest, each needs a hdd_client_release.
+//
+// Inputs       : none
+// Outputs      : 0 on success or -1 on failure
+int hdd_client_acquire(void) {
+	HddConnection *c = NULL;
+	uint32_t i;
+
+	if(conn != NULL){	// already bound
+		connHolds++;
+		return(0);
+	}
+
+	pthread_mutex_lock(&poolLock);
+	while(c == NULL){
+		for(i = 0; i < poolOpen; i++){	// an idle open connection
+			if(!pool[i].busy && (i == 0 || pool[i].connected)){
+				c = &pool[i];
+				break;
+			}
+		}
+		if(c == NULL && poolOpen < poolSize && pool[0].connected){	// open another one
+			c = &pool[poolOpen];
+			if(connectServer(c)){
+				pthread_mutex_unlock(&poolLock);
+				return(-1);
+			}
+			poolOpen++;
+		}
+		if(c == NULL){
+			pthread_cond_wait(&poolFree, &poolLock);
+		}
+	}
+	c->busy = 1;
+	pthread_mutex_unlock(&poolLock);
+
+	conn = c;
+	connHolds = 1;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_client_release
+// Description  : give the connection of the calling thread back to the pool
+//                (once the outermost hdd_client_acquire is released).  Its
+//                requests must all be completed.
+//
+// Inputs       : none
+// Outputs      : none
+void hdd_client_release(void) {
+	if(conn == NULL || --connHolds > 0){
+		return;
+	}
+	if(conn->inflightCount > 0){	// still owed responses, keep it
+		connHolds = 1;
+		hdd_log(LOG_ERROR_LEVEL, "HDD client : connection released with %u requests in flight.", conn->inflightCount);
+		return;
+	}
+	pthread_mutex_lock(&poolLock);
+	conn->busy = 0;
+	pthread_cond_signal(&poolFree);
+	pthread_mutex_unlock(&poolLock);
+	conn = NULL;
+	connImplicit = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_client_pending
+// Description  : get the number of requests in flight
+//
+// Inputs       : none
+// Outputs      : the number of requests submitted but not completed
+uint32_t hdd_client_pending(void) {
+	return((conn != NULL) ? conn->inflightCount : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_client_ready
+// Description  : check if a command can be submitted without waiting for
+//                older requests.  Besides the queue depth the response data
+//                in flight is bounded, and a request carrying a block waits
+//                until no block reads are in flight, so the client can never
+//                block writing while the server is blocked writing to it.
+//
+// Inputs       : cmd - the command to submit
+// Outputs      : 1 if it can be submitted, 0 if requests must complete first
+int hdd_client_ready(HddBitCmd cmd) {
+	if(conn == NULL || conn->inflightCount == 0){	// an idle connection takes anything
+		return(1);
+	}
+	if(requestBytes(cmd) > 0 && conn->inflightBytes > 0){	// block sent behind block reads
+		return(0);
+	}
+	return((conn->inflightCount < clientDepth) &&
+		(conn->inflightBytes + responseBytes(cmd) <= HDD_CLIENT_WINDOW_BYTES));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_client_submit
+// Description  : send a request to the server without waiting for the
+//                response.  Requests are gathered into one frame until a
+//                response is waited for.  The buffer must stay valid until
+//                the request is completed, and the caller must check
+//                hdd_client_ready first when other requests are in flight.
+//                A thread without a connection is bound to one until its
+//                requests are completed.
 //
 // Inputs       : cmd - the request opcode for the command
 //                buf - the block to be read/written from (READ/WRITE)
-// Outputs      : the response structure encoded as needed
-HddBitResp hdd_client_operation(HddBitCmd cmd, void *buf) {
-	uint8_t op, flag;
-	op = (uint8_t) ((cmd >> 62) & 0x3);	//op
-	flag = (uint8_t) ((cmd >> 33) & 0x7);	//flag
-    
+// Outputs      : the tag of the request or -1 on failure
+int32_t hdd_client_submit(HddBitCmd cmd, void *buf) {
+	return(hdd_client_submit_range(cmd, 0, buf));
+}
 
-    struct sockaddr_in caddr;
-    HddBitResp responseValue;
+// a submit failed before queueing its request, give back the connection
+// it bound (nothing is in flight, so no completion would release it)
+int32_t submitFailed(int acquired){
+	if(acquired){
+		hdd_client_release();
+	}
+	return(-1);
+}
 
-    
-    if(flag == HDD_INIT){    	// connect to the server if HDD_INIT
-        caddr.sin_family = AF_INET;
-        caddr.sin_port = htons(HDD_DEFAULT_PORT);
-        if(inet_aton(HDD_DEFAULT_IP, &(caddr.sin_addr)) == 0){
-            return(-1);
-        }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_client_submit_range
+// Description  : send a request without waiting (see hdd_client_submit),
+//                a HDD_RANGE READ or OVERWRITE moves the (cmd) size bytes
+//                of the block from offset.  Only servers that implement
+//                HDD_RANGE (hdd_network_ranged) may be sent one.
+//
+// Inputs       : cmd - the request opcode for the command
+//                offset - the start of the range in the block (HDD_RANGE)
+//                buf - the data to be read/written from (READ/WRITE)
+// Outputs      : the tag of the request or -1 on failure
+int32_t hdd_client_submit_range(HddBitCmd cmd, uint32_t offset, void *buf) {
+	uint8_t flag;
+	HddClientRequest *req;
+	int acquired = 0;
+	flag = (uint8_t) ((cmd >> 33) & 0x7);	//flag
 
-        else{	//create socket 
-		sockfd = socket(PF_INET, SOCK_STREAM, 0);
-		if(sockfd == -1){	//check during the creation
-		    printf("failed when create socket [%s]\n", strerror(errno));
-		    return(-1);
+	if(!hdd_client_ready(cmd)){	// the window is full
+		hdd_log(LOG_ERROR_LEVEL, "HDD client : request submitted to a full queue.");
+		return(-1);
+	}
+	if(conn == NULL){	// held until the requests are completed
+		if(hdd_client_acquire()){
+			return(-1);
 		}
-
-		if(connect(sockfd, (const struct sockaddr *)&caddr, sizeof(struct sockaddr)) == -1){	//check if the connection is correct
-		    printf("failed when connect socket [%s]\n", strerror(errno));
-		    return(-1);
+		connImplicit = 1;
+		acquired = 1;
+	}
+	if(flag == HDD_INIT || flag == HDD_FORMAT || flag == HDD_SAVE_AND_CLOSE){	// device commands go on connection 0
+		if(conn != &pool[0]){
+			hdd_log(LOG_ERROR_LEVEL, "HDD client : device command on a pooled connection.");
+			return(submitFailed(acquired));
 		}
-	  }			 
-     }
-
-    int request_length = sizeof(HddBitCmd);
-    int request_write;
-    HddBitCmd *network_request = malloc(request_length);
-    int buffer_write;
-    int buffer_length = (cmd >> 36) & 0x3ffffff;
+	}
+	if(flag == HDD_INIT && connectServer(conn)){	// connect to the server if HDD_INIT
+		return(submitFailed(acquired));
+	}
 
+	// the header is sent from the queue entry, which lives until completion
+	req = &conn->inflight[(conn->inflightHead + conn->inflightCount) % HDD_CLIENT_MAX_DEPTH];
+	req->tag = conn->nextTag;
+	req->cmd = cmd;
+	req->wire = htonll64(cmd);
+	req->offset = offset;
+	req->range = htonll64((uint64_t)offset);
+	req->buf = buf;
+	req->start = hdd_stats_now();
+	if(conn->backend->send(conn, req)){
+		return(submitFailed(acquired));
+	}
+	conn->inflightCount++;
+	conn->inflightBytes += responseBytes(cmd);
+	conn->nextTag = (conn->nextTag + 1) & 0x7fffffff;
+	return(req->tag);
+}
 
-    *network_request = htonll64(cmd);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_client_complete
+// Description  : wait for the response to the oldest request in flight,
+//                any block read is stored in the buffer it was submitted with.
+//
+// Inputs       : resp - set to the response of the request
+// Outputs      : the tag of the completed request or -1 on failure
+int32_t hdd_client_complete(HddBitResp *resp) {
+	HddClientRequest *req;
+	HddBitResp host_response;
+	uint32_t i;
+	int32_t tag;
 
-    request_write = write(sockfd, network_request, request_length);
+	if(conn == NULL || conn->inflightCount == 0){
+		hdd_log(LOG_ERROR_LEVEL, "HDD client : no request in flight to complete.");
+		return(-1);
+	}
+	req = &conn->inflight[conn->inflightHead];
+	tag = req->tag;
+	conn->inflightHead = (conn->inflightHead + 1) % HDD_CLIENT_MAX_DEPTH;
+	conn->inflightCount--;
+	conn->inflightBytes -= responseBytes(req->cmd);
 
-    while(request_write < request_length){	//when the write is less then the request length
-        request_write += write(sockfd, &((char *)network_request)[request_write], request_length - request_write);
+	if(conn->backend->receive(conn, req, &host_response)){	// sends what is gathered first
+		*resp = (HddBitResp)-1;
+		return(-1);
+	}
 
-    }
-    free(network_request);		//free the buffer
+	if(((req->cmd >> 33) & 0x7) == HDD_SAVE_AND_CLOSE){		//check the flag to save and close
+		pthread_mutex_lock(&poolLock);
+		for(i = 0; i < poolOpen; i++){	// close the socket and the rest of the pool
+			closeConnection(&pool[i]);
+		}
+		poolOpen = 1;
+		pthread_mutex_unlock(&poolLock);
+	}
 
-    // check if needs to send buffer as well for create block and write block
-    if(op == HDD_BLOCK_CREATE || op == HDD_BLOCK_OVERWRITE){
-        if(flag == HDD_NULL_FLAG || flag == HDD_META_BLOCK){
-            buffer_write = write(sockfd, buf, buffer_length);
-            while(buffer_write < buffer_length){
-                buffer_write += write(sockfd, &((char *)buf)[buffer_write], buffer_length - buffer_write);
-            }
-        }
-    }
-    
-    HddBitResp host_response;
-    int response_length = HDD_NET_HEADER_SIZE, response_read;
-    HddBitResp *response = malloc(response_length);
-    int buffer_read;
-    int response_op;
+	hdd_stats_record(requestStat(req->cmd), req->start);
+	*resp = host_response;
+	if(connImplicit && conn->inflightCount == 0){	// bound by the submit, give it back
+		hdd_client_release();
+	}
+	return(tag);
+}
 
-    response_read = read(sockfd, response, response_length);
-    while(response_read < response_length){		////when the read is less then the request length
-        response_read += read(sockfd, &((char *)response)[response_read], response_length - response_read);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_client_flush
+// Description  : send the requests gathered so far without waiting for any
+//                response, so the server can work on them while the caller
+//                does something else (e.g., read-ahead).
+//
+// Inputs       : none
+// Outputs      : 0 on success or -1 on failure
+int hdd_client_flush(void) {
+	if(conn == NULL || !conn->connected){	// nothing gathered
+		return(0);
+	}
+	return(conn->backend->flush(conn));
+}
 
-    }
-    
-    host_response = ntohll64(*response);
-    free(response);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_client_operation
+// Description  : This the client operation that sends a request to the CRUD
+//                server.   It will:
+//
+//                1) if INIT make a connection to the server
+//                2) send any request to the server, returning results
+//                3) if CLOSE, will close the connection
+//
+//                It is a submit followed by its completion, so it must not be
+//                used while pipelined requests are in flight.
+//
+// Inputs       : cmd - the request opcode for the command
+//                buf - the block to be read/written from (READ/WRITE)
+// Outputs      : the response structure encoded as needed
+HddBitResp hdd_client_operation(HddBitCmd cmd, void *buf) {
+	return(hdd_client_range_operation(cmd, 0, buf));
+}
 
-    response_op = ((host_response >> 62) & 0x3);
-    buffer_length = ((host_response >> 36) & 0x3ffffff);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_client_range_operation
+// Description  : a client operation (see hdd_client_operation) that may be
+//                a HDD_RANGE READ or OVERWRITE of the (cmd) size bytes of a
+//                block from offset.
+//
+// Inputs       : cmd - the request opcode for the command
+//                offset - the start of the range in the block (HDD_RANGE)
+//                buf - the data to be read/written from (READ/WRITE)
+// Outputs      : the response structure encoded as needed
+HddBitResp hdd_client_range_operation(HddBitCmd cmd, uint32_t offset, void *buf) {
+	HddBitResp responseValue = (HddBitResp)-1;
 
+	if(hdd_client_acquire()){
+		return(-1);
+	}
+	if(conn->inflightCount > 0){	// the response would be queued behind the others
+		hdd_log(LOG_ERROR_LEVEL, "HDD client : synchronous request with %u requests in flight.", conn->inflightCount);
+	}
+	else if(hdd_client_submit_range(cmd, offset, buf) == -1 || hdd_client_complete(&responseValue) == -1){
+		responseValue = (HddBitResp)-1;
+	}
+	hdd_client_release();
+	return responseValue;
 
-    if(response_op == HDD_BLOCK_READ){		    // check if needs to receive buffer as well
-        buffer_read = read(sockfd, buf, buffer_length);
-        while(buffer_read < buffer_length){
-            buffer_read += read(sockfd, &((char *)buf)[buffer_read], buffer_length - buffer_read);
-        }
-    }
+}
 
-    responseValue = host_response;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_client_batch
+// Description  : send a batch of requests in as few frames as the queue
+//                allows and collect all of their responses.  The requests
+//                are carried out by the server in order.
+//
+// Inputs       : count - the number of requests
+//                cmds - the request commands
+//                bufs - the block of each request (READ/WRITE, else NULL)
+//                resps - set to the response of each request
+// Outputs      : 0 if every request was carried out, -1 on failure
+int hdd_client_batch(int count, HddBitCmd *cmds, void **bufs, HddBitResp *resps) {
+	HddBitResp resp;
+	int32_t first, tag;
+	int i = 0, ret = 0;
 
-    if(flag == HDD_SAVE_AND_CLOSE){		//check the flag to save and close
-        close(sockfd);		//close the socket
-        sockfd = -1;
-    }
+	if(hdd_client_acquire()){
+		return(-1);
+	}
+	if(conn->inflightCount > 0){	// the responses would be queued behind the others
+		hdd_log(LOG_ERROR_LEVEL, "HDD client : batch with %u requests in flight.", conn->inflightCount);
+		hdd_client_release();
+		return(-1);
+	}
+	first = conn->nextTag;
+	while(i < count || conn->inflightCount > 0){
+		if(i < count && hdd_client_ready(cmds[i])){
+			if(hdd_client_submit(cmds[i], bufs[i]) == -1){
+				ret = -1;
+				break;
+			}
+			i++;
+			continue;
+		}
+		tag = hdd_client_complete(&resp);	// tags of the batch are consecutive
+		if(tag == -1){
+			ret = -1;
+			break;
+		}
+		resps[(tag - first) & 0x7fffffff] = resp;
+		if((resp >> 32) & 0x1){	// check the result bit
+			ret = -1;
+		}
+	}
+	hdd_client_release();
+	return(ret);
+}
 
-    return responseValue;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_client_check_address
+// Description  : check a server address: an IP address, unix:<path> for a
+//                Unix-domain socket, or loopback[:<file>] for the
+//                in-process block store (saved to <file>).
+//
+// Inputs       : addr - the address
+// Outputs      : 0 if the address is usable, -1 if not
+int hdd_client_check_address(const char *addr) {
+	if(strncmp(addr, HDD_UNIX_PREFIX, strlen(HDD_UNIX_PREFIX)) == 0 || loopbackAddress(addr) ||
+		inet_addr(addr) != INADDR_NONE){
+		return(0);
+	}
+	return(-1);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_client_transport
+// Description  : get the name of the backend carrying the device commands,
+//                so a uring connection that fell back to blocking sockets
+//                can be told apart.
+//
+// Inputs       : none
+// Outputs      : the backend name, or NULL when not connected
+const char *hdd_client_transport(void) {
+	return(pool[0].connected ? pool[0].backend->name : NULL);
 }
@@ -35,7 +35,8 @@ typedef enum {
     HDD_META_BLOCK = 1,     // Flag indicating that block is the "meta block"
     HDD_FORMAT = 2,         // Flag indicating device should be formatted--used with HDD_DEVICE
     HDD_SAVE_AND_CLOSE = 3, // Flag indicating device info to save in hdd_content.svd and close HDD interface--used with HDD_DEVICE
-    HDD_INIT = 4            // Flag to initialize the device
+    HDD_INIT = 4,           // Flag to initialize the device
+    HDD_RANGE = 5           // Flag for a READ or OVERWRITE of part of a block (see below)
 }   HDD_FLAG_TYPES;
 
 // HDD block ID type (unique to each block)
@@ -61,6 +62,14 @@ typedef uint64_t HddBitResp;
  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
  |Op |                   Block Size                      |Flags|R|                             Block                             |
  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+ HDD_RANGE requests (an extension, the shipped hdd_server does not implement them)
+
+  A READ or OVERWRITE with the HDD_RANGE flag moves part of a block.  The
+  command is followed by a 64-bit range word (network byte order) with the
+  offset in the block in bits 0-31, the rest are 0.  Block Size is the
+  length of the range, which must lie inside the block, and is the size
+  of the data that follows an OVERWRITE or the response to a READ.
 */
 
 
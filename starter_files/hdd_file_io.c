@@ -8,18 +8,38 @@
 
 // Includes
 #include <malloc.h>
+#include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 // Project Includes
 #include <hdd_file_io.h>
 #include <hdd_driver.h>
 #include <cmpsc311_log.h>
+#include <hdd_log.h>
 #include <cmpsc311_util.h>
 #include <hdd_network.h>
+#include <hdd_cache.h>
+#include <hdd_slab.h>
+#include <cmpsc311_hashtable.h>
 
 // Defines
 #define CIO_UNIT_TEST_MAX_WRITE_SIZE 1024
 #define HDD_IO_UNIT_TEST_ITERATIONS 10240
+#define HDD_IO_UNIT_TEST_SEGMENTS 8
+#define HDD_IO_UNIT_TEST_SCAN_EXTENTS 8	// extents of the file scanned cold for read-ahead
+#define HDD_WRITE_BACK_LIMIT (4 * 1024 * 1024)	// dirty bytes before a forced flush
+#define HDD_EXTENT_SIZE 0x10000	// size of a full extent block (64 KB)
+#define HDD_MIN_EXTENT_SIZE 64	// smallest size class of a tail extent
+#define HDD_NAME_INDEX_BITS 14	// width of the file name index
+#define HDD_META_MAGIC 0x48444d31	// "HDM1", marks a compact meta block
+#define HDD_META_VERSION 1
+#define HDD_META_SEGMENT_SIZE 0x10000	// target size of a metadata segment block
+#define HDD_META_MAX_JOURNAL 16	// journal segments before a new checkpoint
+#define HDD_READ_AHEAD 4	// pending op type of a read-ahead (beyond the block ops)
+#define HDD_READ_AHEAD_TRIGGER 2	// reads following a pattern before reading ahead
+#define HDD_READ_AHEAD_MAX 4	// most extents read ahead of a sequential scan
+#define HDD_VECTOR_BATCH 16	// extents fetched together by a vectored read or write
 
 
 // Type for UNIT test interface
@@ -35,22 +55,92 @@ char *cio_utest_buffer = NULL;  // Unit test buffer
 
 typedef struct hdd_file{
 	int32_t cp;	//current position
-	uint32_t blockId;	//block id
-	uint64_t blockSize;	//block size
+	uint32_t extentCount;	//number of extent blocks on the device
+	uint64_t fileSize;	//file size
 	char fileName[MAX_FILENAME_LENGTH];	//file name
 	int status;	//file status
 
 } fileData;
 
-int fh;		//file handler
+// in-memory extent map and write-back buffers of a file
+typedef struct hdd_file_extents{
+	HddBlockID *blocks;	// device block of each extent
+	char **dirty;	// buffered contents of each extent, NULL if clean
+	uint32_t slots;	// allocated entries in blocks and dirty
+	uint32_t dirtyCount;	// number of dirty extents
+	uint64_t flushedSize;	// file size when the extents were last written
+	int metaDirty;	// entry changed since the metadata was last saved
+	uint32_t generation;	// extent writes done, read-aheads sent before one are stale
+	int64_t lastRead;	// position of the last read
+	int64_t lastEnd;	// position after the last read
+	int64_t stride;	// distance between the last two reads
+	uint32_t streak;	// reads in a row that followed a pattern
+	uint32_t window;	// extents read ahead of a sequential scan
+} fileExtents;
+
+// The meta block holds this header and a list of metadata segments.  The
+// segments hold variable length file records, the first "checkpoints" of
+// them describe every file and the rest are a journal of changed files
+// that are replayed in order at mount.
+typedef struct hdd_meta_header{
+	uint32_t magic;	// HDD_META_MAGIC
+	uint16_t version;	// HDD_META_VERSION
+	uint16_t checkpoints;	// leading segments that form the checkpoint
+	uint32_t segments;	// number of segments listed after the header
+	uint32_t checkpointBytes;	// bytes of records in the checkpoint
+	uint32_t journalBytes;	// bytes of records in the journal
+} metaHeader;
+
+typedef struct hdd_meta_segment{
+	HddBlockID bid;	// block holding the records
+	uint32_t size;	// size of the block
+} metaSegment;
+
+// A file record, followed by the name and the extent block ids
+typedef struct hdd_meta_record{
+	uint16_t fileId;	// entry in the file table
+	uint16_t nameLength;	// bytes of name (no terminator)
+	uint32_t extentCount;	// number of extent block ids
+	uint64_t fileSize;	// file size
+} metaRecord;
+
+// A block operation in flight, indexed by its tag
+typedef struct hdd_pending_op{
+	uint8_t op;	// HDD_BLOCK_CREATE, HDD_BLOCK_OVERWRITE, HDD_BLOCK_READ, HDD_BLOCK_DELETE or HDD_READ_AHEAD
+	int16_t fh;	// file of the extent
+	uint32_t idx;	// extent in the file
+	char *buf;	// block read into or written from
+	HddBlockID bid;	// block read ahead or deleted
+	uint32_t size;	// its size
+	uint32_t generation;	// the generation of the file when it was sent
+} pendingOp;
+
 int init = 0;	//initialization set to 0
-int number = 0;	//set the file number
-HddBitCmd command;
 fileData file[MAX_HDD_FILEDESCR];
+fileExtents extent[MAX_HDD_FILEDESCR];
+uint64_t dirtyBytes = 0;	// bytes held in dirty buffers (updated atomically)
+uint32_t metaSize = 0;	// size of the meta block on the device
+HTable nameIndex;	// file name hash -> file handle (table owns the values)
+int nameIndexInit = 0;	// is the name index built
+int nextFreeFile = 0;	// lowest unused entry in the file table
+int fileCount = 0;	// entries of the file table in use (files are never removed)
+metaHeader meta;	// meta block header as on the device
+metaSegment *metaSegments = NULL;	// segment list as on the device
+__thread pendingOp pending[HDD_CLIENT_MAX_DEPTH];	// pipelined block operations of this thread
+
+// Locking: tableLock covers the file table, name index and metadata (open,
+// format, mount, unmount), and fileLock[fh] covers the contents, position
+// and extents of one file.  tableLock is always taken before a fileLock.
+// Format, mount and unmount expect no other thread to be using files.
+pthread_mutex_t tableLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t fileLock[MAX_HDD_FILEDESCR] = { [0 ... MAX_HDD_FILEDESCR-1] = PTHREAD_MUTEX_INITIALIZER };
+
+int submitOp(HddBitCmd cmd, void *buf, uint8_t type, int16_t fh, uint32_t idx);
 
 // function that helps to accomplish the tasks
 ///////////////////////////////////////////////////////////////////////////////
 HddBitCmd setCmd(uint8_t op, uint32_t block_size, uint8_t flag, uint8_t R, uint32_t block_id){
+HddBitCmd command;
 
 command = (uint64_t) 0; 	// initialize all bits of the comment to 0
 command = command | ((uint64_t) op << 62); 	// op
@@ -62,377 +152,1733 @@ return command;
 
 }
 
-//
-// Implementation
+// size of the block holding extent idx of a file of the given size, the
+// tail extent is rounded up to a power of two so appends rarely resize it
+uint32_t extentCapacity(uint64_t size, uint32_t idx){
+	uint64_t start = (uint64_t)idx * HDD_EXTENT_SIZE;
+	uint32_t capacity = HDD_MIN_EXTENT_SIZE;
 
-////////////////////////////////////////////////////////////////////////////////
-//
-// Function     : hdd_format
-// Description  : sends a format request to the device delete all blocks
-// Inputs       : void
-// Outputs      : 0 on success or -1 on failure
-//
-uint16_t hdd_format(void) {
-	HddBitCmd cmd1, fcmd, cmetacmd;
-	HddBitResp resp1, fResp, cmetaResp;
-	if(init == 0){		//check the initalization
-		cmd1 = setCmd(HDD_DEVICE, 0, HDD_INIT, 0, 0);
-		resp1 = hdd_client_operation(cmd1, NULL);
-		resp1 = (resp1 >> 32) & 0x1;
-		if(resp1){
-			printf("initialize the block incorrectly\n");
+	if(size <= start){	// past the end of the file
+		return 0;
+	}
+	if(size - start >= HDD_EXTENT_SIZE){	// full extent
+		return HDD_EXTENT_SIZE;
+	}
+	while(capacity < size - start){
+		capacity *= 2;
+	}
+	return capacity;
+}
+
+// number of extents needed to hold size bytes
+uint32_t extentsFor(uint64_t size){
+	return (size + HDD_EXTENT_SIZE - 1) / HDD_EXTENT_SIZE;
+}
+
+// make room for count extents in the extent map of a file
+void reserveExtents(int16_t fh, uint32_t count){
+	uint32_t slots = (extent[fh].slots > 0) ? extent[fh].slots : 4;
+
+	if(count <= extent[fh].slots){
+		return;
+	}
+	while(slots < count){
+		slots *= 2;
+	}
+	extent[fh].blocks = (HddBlockID*)realloc(extent[fh].blocks, slots * sizeof(HddBlockID));
+	extent[fh].dirty = (char**)realloc(extent[fh].dirty, slots * sizeof(char*));
+	memset(&extent[fh].blocks[extent[fh].slots], 0, (slots - extent[fh].slots) * sizeof(HddBlockID));
+	memset(&extent[fh].dirty[extent[fh].slots], 0, (slots - extent[fh].slots) * sizeof(char*));
+	extent[fh].slots = slots;
+}
+
+// drop the extent map and buffers of a file without writing them out
+void dropExtents(int16_t fh){
+	uint32_t i;
+
+	for(i = 0; i < extent[fh].slots; i++){
+		if(extent[fh].dirty[i] != NULL){
+			__sync_fetch_and_sub(&dirtyBytes, extentCapacity(file[fh].fileSize, i));
+			hdd_slab_free(extent[fh].dirty[i]);
+		}
+	}
+	free(extent[fh].blocks);
+	free(extent[fh].dirty);
+	memset(&extent[fh], 0, sizeof(fileExtents));
+}
+
+// fetch partly read extents as ranges: whole extents are worth caching only
+// while the cache has room, once it evicts they would mostly be wasted
+int rangedReads(void){
+	return hdd_network_ranged && full_hdd_cache();
+}
+
+// copy part of an extent on the device, from the cache or else the device
+int readExtent(int16_t fh, uint32_t idx, uint32_t offset, uint32_t length, char *dst){
+	HddBitCmd rcmd;
+	HddBitResp rResp;
+	uint32_t size = extentCapacity(extent[fh].flushedSize, idx);
+	char *block;
+
+	if(copy_hdd_cache(extent[fh].blocks[idx], offset, length, dst) == 0){	// cache hit, no device traffic
+		return 0;
+	}
+	if(length < size && rangedReads()){	// fetch only the bytes asked for
+		rcmd = setCmd(HDD_BLOCK_READ, length, HDD_RANGE, 0, extent[fh].blocks[idx]);
+		rResp = hdd_client_range_operation(rcmd, offset, dst);
+		return (((rResp >> 32) & 0x1) || ((rResp >> 36) & 0x3ffffff) != length) ? -1 : 0;
+	}
+
+	if((block = (char*)hdd_slab_alloc(size)) == NULL){
+		return -1;
+	}
+	rcmd = setCmd(HDD_BLOCK_READ, size, 0, 0, extent[fh].blocks[idx]);
+	rResp = hdd_client_operation(rcmd, block);
+	if((rResp >> 32) & 0x1){	// check if read the block correctly
+		hdd_slab_free(block);
+		return -1;
+	}
+	memcpy(dst, &block[offset], length);
+	put_hdd_cache(extent[fh].blocks[idx], block, size);	// cache owns the block now
+	return 0;
+}
+
+// overwrite part of a clean extent on the device in place, and in the cache
+int writeExtentRange(int16_t fh, uint32_t idx, uint32_t offset, uint32_t length, char *src){
+	HddBitCmd wcmd;
+	HddBitResp wResp;
+
+	wcmd = setCmd(HDD_BLOCK_OVERWRITE, length, HDD_RANGE, 0, extent[fh].blocks[idx]);
+	wResp = hdd_client_range_operation(wcmd, offset, src);
+	if((wResp >> 32) & 0x1){
+		return -1;
+	}
+	extent[fh].generation++;
+	update_hdd_cache(extent[fh].blocks[idx], offset, length, src);
+	return 0;
+}
+
+// get the write-back buffer of an extent, starting it from the extent on the device
+char *dirtyExtent(int16_t fh, uint32_t idx, uint32_t capacity){
+	uint32_t deviceSize;
+	char *buf;
+
+	if(extent[fh].dirty[idx] != NULL){
+		return extent[fh].dirty[idx];
+	}
+
+	if((buf = (char*)hdd_slab_alloc(capacity)) == NULL){
+		return NULL;
+	}
+	deviceSize = 0;
+	if(idx < file[fh].extentCount){	// copy what is on the device
+		deviceSize = extentCapacity(extent[fh].flushedSize, idx);
+		if(readExtent(fh, idx, 0, deviceSize, buf)){
+			hdd_slab_free(buf);
+			return NULL;
+		}
+	}
+	memset(&buf[deviceSize], 0, capacity - deviceSize);
+	extent[fh].dirty[idx] = buf;
+	extent[fh].dirtyCount++;
+	__sync_fetch_and_add(&dirtyBytes, capacity);
+	return buf;
+}
+
+// move the tail extent of a file into the size class for its new size
+int growTail(int16_t fh, uint64_t newSize){
+	uint32_t last, oldCapacity, newCapacity;
+	char *buf;
+
+	if(file[fh].fileSize == 0){	// no tail yet
+		return 0;
+	}
+	last = extentsFor(file[fh].fileSize) - 1;
+	oldCapacity = extentCapacity(file[fh].fileSize, last);
+	newCapacity = extentCapacity(newSize, last);
+	if(oldCapacity == newCapacity){
+		return 0;
+	}
+
+	if(extent[fh].dirty[last] == NULL){	// start buffering it at the new size
+		return (dirtyExtent(fh, last, newCapacity) == NULL) ? -1 : 0;
+	}
+	buf = (char*)hdd_slab_realloc(extent[fh].dirty[last], newCapacity);
+	if(buf == NULL){
+		return -1;
+	}
+	extent[fh].dirty[last] = buf;
+	memset(&extent[fh].dirty[last][oldCapacity], 0, newCapacity - oldCapacity);
+	__sync_fetch_and_add(&dirtyBytes, newCapacity - oldCapacity);
+	return 0;
+}
+
+// wait for the oldest pipelined block operation and apply its result
+int completeOp(void){
+	HddBitResp resp;
+	pendingOp done, *op = &done;
+	HddBlockID old = HDD_NO_BLOCK;
+	int32_t tag;
+	uint32_t capacity;
+
+	tag = hdd_client_complete(&resp);
+	if(tag == -1){
+		return -1;
+	}
+	done = pending[tag % HDD_CLIENT_MAX_DEPTH];	// the slot is reused by the next submit
+	if(((resp >> 32) & 0x1) && op->op == HDD_BLOCK_DELETE){	// the extent already uses its new block
+		printf("failed to delete replaced block %u, leaked [extent %u]\n", op->bid, op->idx);
+		return 0;
+	}
+	if((resp >> 32) & 0x1){	// check if the operation succeeded
+		printf("block operation failed [op %d, extent %u]\n", op->op, op->idx);
+		if(op->op == HDD_BLOCK_READ || op->op == HDD_READ_AHEAD){
+			hdd_slab_free(op->buf);
+		}
+		return -1;
+	}
+
+	switch(op->op){
+	case HDD_BLOCK_CREATE:	// new extent or new size class
+		if(op->idx < file[op->fh].extentCount){	// the block it replaces goes now the new one is written
+			old = extent[op->fh].blocks[op->idx];
+			delete_hdd_cache(old);
+		}
+		extent[op->fh].blocks[op->idx] = resp & 0xffffffff;
+		extent[op->fh].metaDirty = 1;
+		// fall through, the flushed contents become the cached copy of the block
+	case HDD_BLOCK_OVERWRITE:
+		extent[op->fh].generation++;
+		capacity = extentCapacity(file[op->fh].fileSize, op->idx);
+		__sync_fetch_and_sub(&dirtyBytes, capacity);
+		put_hdd_cache(extent[op->fh].blocks[op->idx], extent[op->fh].dirty[op->idx], capacity);
+		extent[op->fh].dirty[op->idx] = NULL;
+		extent[op->fh].dirtyCount--;
+		break;
+	case HDD_BLOCK_READ:	// extent fetched for a miss
+		fill_hdd_cache(extent[op->fh].blocks[op->idx], op->buf, extentCapacity(extent[op->fh].flushedSize, op->idx));
+		break;
+	case HDD_READ_AHEAD:	// left over, cannot be checked without its file lock
+		hdd_slab_free(op->buf);
+		prefetch_hdd_cache(op->bid, NULL, op->size);
+		break;
+	}
+	if(old != HDD_NO_BLOCK){	// drained with the rest of the flush
+		return submitOp(setCmd(HDD_BLOCK_DELETE, 0, 0, 0, old), NULL, HDD_BLOCK_DELETE, op->fh, op->idx);
+	}
+	return 0;
+}
+
+// pipeline a block operation, waiting for older ones while the queue is full
+int submitOp(HddBitCmd cmd, void *buf, uint8_t type, int16_t fh, uint32_t idx){
+	pendingOp *op;
+	int32_t tag;
+	int ret = 0;
+
+	while(!hdd_client_ready(cmd)){
+		if(completeOp()){
+			ret = -1;
+		}
+	}
+	tag = hdd_client_submit(cmd, buf);
+	if(tag == -1){
+		if(type == HDD_BLOCK_READ){	// nobody else will give the read buffer back
+			hdd_slab_free(buf);
+		}
+		return -1;
+	}
+	op = &pending[tag % HDD_CLIENT_MAX_DEPTH];
+	op->op = type;
+	op->fh = fh;
+	op->idx = idx;
+	op->buf = buf;
+	op->bid = (HddBlockID)(cmd & 0xffffffff);
+	return ret;
+}
+
+// wait for every pipelined block operation
+int drainOps(void){
+	int ret = 0;
+
+	while(hdd_client_pending() > 0){
+		if(completeOp()){
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+// queue the writes of the dirty extents of a file, completeOp hands the
+// blocks to the cache and releases the buffers as they finish
+int submitFlush(int16_t fh){
+	HddBitCmd cmd;
+	uint32_t idx, count, capacity;
+	int ret = 0;
+
+	count = extentsFor(file[fh].fileSize);
+	for(idx = 0; idx < count; idx++){
+		if(extent[fh].dirty[idx] == NULL){	// clean extent
+			continue;
+		}
+		capacity = extentCapacity(file[fh].fileSize, idx);
+
+		if(idx < file[fh].extentCount && extentCapacity(extent[fh].flushedSize, idx) == capacity){	// same size, overwrite in place
+			cmd = setCmd(HDD_BLOCK_OVERWRITE, capacity, 0, 0, extent[fh].blocks[idx]);
+			if(submitOp(cmd, extent[fh].dirty[idx], HDD_BLOCK_OVERWRITE, fh, idx)){
+				ret = -1;
+			}
+		}
+		else{	// new extent or new size class, create a block for it (completeOp deletes the old one)
+			cmd = setCmd(HDD_BLOCK_CREATE, capacity, 0, 0, 0);
+			if(submitOp(cmd, extent[fh].dirty[idx], HDD_BLOCK_CREATE, fh, idx)){
+				ret = -1;
+			}
+		}
+	}
+	return ret;
+}
+
+// record the new size and extent count of a file once its writes are done
+void finishFlush(int16_t fh){
+	uint32_t count = extentsFor(file[fh].fileSize);
+
+	if(file[fh].extentCount != count || extent[fh].flushedSize != file[fh].fileSize){
+		extent[fh].metaDirty = 1;
+	}
+	file[fh].extentCount = count;
+	extent[fh].flushedSize = file[fh].fileSize;
+}
+
+// write the dirty extents of a file to the device
+int flushBuffer(int16_t fh){
+	int ret;
+
+	if(extent[fh].dirtyCount == 0){	// nothing to write
+		return 0;
+	}
+	ret = submitFlush(fh);
+	if(drainOps() || ret || extent[fh].dirtyCount > 0){
+		return -1;
+	}
+	finishFlush(fh);
+	return 0;
+}
+
+// write out buffers when too much is buffered, starting with the file the
+// caller holds; other files are only flushed if they are not in use
+int flushForSpace(int16_t fh){
+	int i, ret;
+
+	ret = flushBuffer(fh);
+	for(i = 0; i < __atomic_load_n(&fileCount, __ATOMIC_ACQUIRE) && __atomic_load_n(&dirtyBytes, __ATOMIC_RELAXED) > HDD_WRITE_BACK_LIMIT; i++){
+		if(i == fh || pthread_mutex_trylock(&fileLock[i])){
+			continue;
+		}
+		if(flushBuffer(i)){
+			ret = -1;
+		}
+		pthread_mutex_unlock(&fileLock[i]);
+	}
+	return ret;
+}
+
+// pipeline a read of a whole extent of a file unless it is buffered or cached,
+// completeOp puts it in the cache
+int fetchExtent(int16_t fh, uint32_t idx){
+	HddBitCmd cmd;
+	uint32_t size;
+	void *buf;
+
+	if(idx >= file[fh].extentCount || extent[fh].dirty[idx] != NULL || probe_hdd_cache(extent[fh].blocks[idx])){
+		return 0;
+	}
+	size = extentCapacity(extent[fh].flushedSize, idx);
+	if((buf = hdd_slab_alloc(size)) == NULL){
+		return -1;
+	}
+	cmd = setCmd(HDD_BLOCK_READ, size, 0, 0, extent[fh].blocks[idx]);
+	return submitOp(cmd, buf, HDD_BLOCK_READ, fh, idx);
+}
+
+// read the uncached extents first to last of a file with pipelined reads
+int loadExtents(int16_t fh, uint32_t first, uint32_t last){
+	uint32_t idx;
+	int ret = 0;
+
+	for(idx = first; idx <= last && idx < file[fh].extentCount; idx++){
+		if(fetchExtent(fh, idx)){
+			ret = -1;
+		}
+	}
+	if(drainOps()){
+		ret = -1;
+	}
+	return ret;
+}
+
+// order extent indexes for qsort
+int compareExtents(const void *a, const void *b){
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+
+	return (x > y) - (x < y);
+}
+
+// list the extents the segments touch below limit, in order and once each, with
+// the number of segment pieces falling in each; the caller frees both lists
+int segmentExtents(HddIoSegment *segs, int count, uint64_t limit, uint32_t **idxs, uint32_t **pieces, uint32_t *n){
+	uint64_t end;
+	uint32_t idx, total = 0, used = 0;
+	int i;
+
+	for(i = 0; i < count; i++){	// size the list
+		end = ((uint64_t)segs[i].off + segs[i].len < limit) ? (uint64_t)segs[i].off + segs[i].len : limit;
+		if(end > segs[i].off){
+			total += (end - 1) / HDD_EXTENT_SIZE - segs[i].off / HDD_EXTENT_SIZE + 1;
+		}
+	}
+	*n = 0;
+	*idxs = (uint32_t*)malloc((total + 1) * sizeof(uint32_t));
+	*pieces = (uint32_t*)malloc((total + 1) * sizeof(uint32_t));
+	if(*idxs == NULL || *pieces == NULL){
+		return -1;
+	}
+
+	for(i = 0; i < count; i++){	// every extent of every segment, then count the repeats
+		end = ((uint64_t)segs[i].off + segs[i].len < limit) ? (uint64_t)segs[i].off + segs[i].len : limit;
+		for(idx = segs[i].off / HDD_EXTENT_SIZE; end > segs[i].off && idx <= (end - 1) / HDD_EXTENT_SIZE; idx++){
+			(*idxs)[used++] = idx;
+		}
+	}
+	qsort(*idxs, total, sizeof(uint32_t), compareExtents);
+	for(used = 0; used < total; used++){
+		if(*n > 0 && (*idxs)[*n - 1] == (*idxs)[used]){
+			(*pieces)[*n - 1]++;
+			continue;
+		}
+		(*idxs)[*n] = (*idxs)[used];
+		(*pieces)[(*n)++] = 1;
+	}
+	return 0;
+}
+
+// follow the reads of a file and, once they form a sequential or strided
+// scan, send reads for the extents the next read will want.  They are left
+// in flight (the caller holds fileLock[fh] but no connection), and the next
+// call of this thread puts them in the cache with finishReadAhead.
+void readAhead(int16_t fh, int64_t start, int32_t count){
+	fileExtents *ex = &extent[fh];
+	int64_t next, stride = start - ex->lastRead;
+	uint32_t idx, first, last, size;
+	HddBitCmd cmd;
+	pendingOp *op;
+	int32_t tag;
+	char *buf;
+
+	if(start == ex->lastEnd){	// sequential, read ahead a growing window
+		next = start + count;
+		ex->streak++;
+		if(ex->window == 0){	// a scan from the start of a file just opened
+			ex->window = 1;
+		}
+		first = next / HDD_EXTENT_SIZE;
+		last = first + ex->window - 1;
+		if(ex->window < HDD_READ_AHEAD_MAX){
+			ex->window *= 2;
+		}
+	}
+	else if(stride != 0 && stride == ex->stride){	// strided, read ahead the next read
+		next = start + stride;
+		ex->streak++;
+		first = next / HDD_EXTENT_SIZE;
+		last = (next + count - 1) / HDD_EXTENT_SIZE;
+	}
+	else{	// no pattern yet
+		next = -1;
+		first = last = 0;
+		ex->streak = 0;
+		ex->window = 1;
+	}
+	ex->stride = stride;
+	ex->lastRead = start;
+	ex->lastEnd = start + count;
+	if(ex->streak < HDD_READ_AHEAD_TRIGGER || next < 0 || (uint64_t)next >= file[fh].fileSize){
+		return;
+	}
+	if(last >= file[fh].extentCount){	// nothing past the end of the file
+		last = file[fh].extentCount - 1;
+	}
+
+	for(idx = first; idx <= last && idx < file[fh].extentCount; idx++){
+		if(ex->dirty[idx] != NULL || probe_hdd_cache(ex->blocks[idx])){	// already local
+			continue;
+		}
+		size = extentCapacity(ex->flushedSize, idx);
+		cmd = setCmd(HDD_BLOCK_READ, size, 0, 0, ex->blocks[idx]);
+		if(!hdd_client_ready(cmd) || (buf = hdd_slab_alloc(size)) == NULL){	// never wait to read ahead
+			break;
+		}
+		if((tag = hdd_client_submit(cmd, buf)) == -1){
+			hdd_slab_free(buf);
+			break;
+		}
+		op = &pending[tag % HDD_CLIENT_MAX_DEPTH];
+		op->op = HDD_READ_AHEAD;
+		op->fh = fh;
+		op->idx = idx;
+		op->buf = buf;
+		op->bid = ex->blocks[idx];
+		op->size = size;
+		op->generation = ex->generation;
+	}
+	hdd_client_flush();	// start them now, not when a response is waited for
+}
+
+// finish the read-aheads this thread left in flight, caching the ones whose
+// extent has not been written since.  Called before taking any lock, all of
+// the responses are collected first so the connection is given back before
+// waiting for a file lock.
+void finishReadAhead(void){
+	pendingOp done[HDD_CLIENT_MAX_DEPTH], *op;
+	HddBitResp resps[HDD_CLIENT_MAX_DEPTH];
+	uint32_t count = 0, i;
+	int32_t tag;
+
+	while(hdd_client_pending() > 0 && count < HDD_CLIENT_MAX_DEPTH){
+		if((tag = hdd_client_complete(&resps[count])) == -1){
+			break;
+		}
+		done[count++] = pending[tag % HDD_CLIENT_MAX_DEPTH];
+	}
+	for(i = 0; i < count; i++){
+		op = &done[i];
+		if(op->op != HDD_READ_AHEAD){	// only read-aheads are left between calls
+			continue;
+		}
+		pthread_mutex_lock(&fileLock[op->fh]);
+		if(!((resps[i] >> 32) & 0x1) && extent[op->fh].generation == op->generation &&
+		   op->idx < file[op->fh].extentCount && extent[op->fh].blocks[op->idx] == op->bid &&
+		   extent[op->fh].dirty[op->idx] == NULL){
+			prefetch_hdd_cache(op->bid, op->buf, op->size);
+		}
+		else{	// failed, or the extent changed while it was in flight
+			hdd_slab_free(op->buf);
+			prefetch_hdd_cache(op->bid, NULL, op->size);
+		}
+		pthread_mutex_unlock(&fileLock[op->fh]);
+	}
+}
+
+// add a file to the name index, colliding hashes take the next free key
+void indexName(int16_t fh){
+	HtIndexValue key = hdd_name_hash(file[fh].fileName);
+	int16_t *value;
+
+	while(findValueInHashTable(&nameIndex, key) != NULL){
+		key++;
+	}
+	value = (int16_t*)malloc(sizeof(int16_t));	// freed by cleanupHashTable
+	*value = fh;
+	insertValueInHashTable(&nameIndex, key, value);
+}
+
+// find a file in the name index, -1 if there is no such file
+int16_t lookupName(const char *path){
+	HtIndexValue key = hdd_name_hash(path);
+	int16_t *value;
+
+	while((value = findValueInHashTable(&nameIndex, key)) != NULL){
+		if(strcmp(file[*value].fileName, path) == 0){
+			return *value;
+		}
+		key++;
+	}
+	return -1;
+}
+
+// rebuild the name index from the file table (after format and mount)
+int buildNameIndex(void){
+	int i;
+
+	if(nameIndexInit){
+		cleanupHashTable(&nameIndex);
+	}
+	if(initHashTable(&nameIndex, HDD_NAME_INDEX_BITS)){
+		printf("name index created incorrectly\n");
+		return -1;
+	}
+	nameIndexInit = 1;
+	for(i = 0; i < fileCount; i++){
+		if(file[i].fileName[0] != '\0'){
+			indexName(i);
+		}
+	}
+	nextFreeFile = 0;
+	while(nextFreeFile < MAX_HDD_FILEDESCR && file[nextFreeFile].fileName[0] != '\0'){
+		nextFreeFile++;
+	}
+	return 0;
+}
+
+// flush every dirty file, used at unmount and under memory pressure
+int flushAllBuffers(void){
+	int i, ret = 0;
+	for(i = 0; i < fileCount; i++){	// queue the writes of every file together
+		if(extent[i].dirtyCount > 0 && submitFlush(i)){
+			ret = -1;
+		}
+	}
+	if(drainOps()){
+		ret = -1;
+	}
+	for(i = 0; i < fileCount; i++){
+		if(extent[i].dirtyCount > 0){
+			ret = -1;
+		}
+		else{
+			finishFlush(i);
+		}
+	}
+	return ret;
+}
+
+// size of the metadata record of a file
+uint32_t metaRecordSize(int16_t fh){
+	return sizeof(metaRecord) + strlen(file[fh].fileName) + file[fh].extentCount * sizeof(HddBlockID);
+}
+
+// write the meta block (header and segment list), it is recreated when its size changes
+int writeMetaBlock(void){
+	HddBitCmd metacmd;
+	HddBitResp metaResp;
+	uint32_t size = sizeof(metaHeader) + meta.segments * sizeof(metaSegment);
+	char *buf;
+
+	if((buf = (char*)hdd_slab_alloc(size)) == NULL){
+		return -1;
+	}
+	memcpy(buf, &meta, sizeof(metaHeader));
+	memcpy(&buf[sizeof(metaHeader)], metaSegments, meta.segments * sizeof(metaSegment));
+	if(size == metaSize){
+		metacmd = setCmd(HDD_BLOCK_OVERWRITE, size, HDD_META_BLOCK, 0, 0);
+		metaResp = hdd_client_operation(metacmd, buf);
+	}
+	else{
+		metacmd = setCmd(HDD_BLOCK_DELETE, 0, HDD_META_BLOCK, 0, 0);
+		metaResp = hdd_client_operation(metacmd, NULL);
+		if(!((metaResp >> 32) & 0x1)){
+			metacmd = setCmd(HDD_BLOCK_CREATE, size, HDD_META_BLOCK, 0, 0);
+			metaResp = hdd_client_operation(metacmd, buf);
+		}
+	}
+	hdd_slab_free(buf);
+	if((metaResp >> 32) & 0x1){	// check if the meta block is saved
+		return -1;
+	}
+	metaSize = size;
+	return 0;
+}
+
+// write the records of the listed files into new segment blocks appended
+// to the segment list, the segments are created in one batch
+int writeMetaSegments(int16_t *files, int count){
+	HddBitCmd *cmds;
+	HddBitResp *resps;
+	metaRecord rec;
+	uint32_t used, size;
+	char **bufs;
+	int i, j, first, segments = 0, ret = 0;
+
+	cmds = (HddBitCmd*)malloc((count + 1) * sizeof(HddBitCmd));
+	resps = (HddBitResp*)malloc((count + 1) * sizeof(HddBitResp));
+	bufs = (char**)malloc((count + 1) * sizeof(char*));
+	for(i = 0; i < count; i = j){
+		// pack as many records as fit in a segment (always at least one)
+		used = 0;
+		if((bufs[segments] = (char*)hdd_slab_alloc(HDD_MAX_BLOCK_SIZE)) == NULL){
+			ret = -1;
+			break;
+		}
+		for(j = i; j < count; j++){
+			size = metaRecordSize(files[j]);
+			if(j > i && used + size > HDD_META_SEGMENT_SIZE){
+				break;
+			}
+			if(used + size > HDD_MAX_BLOCK_SIZE){	// a record can never be larger than a block
+				printf("metadata record too large\n");
+				ret = -1;
+				break;
+			}
+			rec.fileId = files[j];
+			rec.nameLength = strlen(file[files[j]].fileName);
+			rec.extentCount = file[files[j]].extentCount;
+			rec.fileSize = extent[files[j]].flushedSize;
+			memcpy(&bufs[segments][used], &rec, sizeof(metaRecord));
+			memcpy(&bufs[segments][used + sizeof(metaRecord)], file[files[j]].fileName, rec.nameLength);
+			first = sizeof(metaRecord) + rec.nameLength;
+			memcpy(&bufs[segments][used + first], extent[files[j]].blocks, rec.extentCount * sizeof(HddBlockID));
+			used += size;
+		}
+		cmds[segments++] = setCmd(HDD_BLOCK_CREATE, used, 0, 0, 0);
+		if(ret){
+			break;
+		}
+	}
+
+	if(ret == 0 && hdd_client_batch(segments, cmds, (void**)bufs, resps)){	// check if the segments are created
+		printf("metadata segment created incorrectly\n");
+		ret = -1;
+	}
+	if(ret == 0){
+		metaSegments = (metaSegment*)realloc(metaSegments, (meta.segments + segments) * sizeof(metaSegment));
+		for(i = 0; i < segments; i++){
+			metaSegments[meta.segments].bid = resps[i] & 0xffffffff;
+			metaSegments[meta.segments].size = (cmds[i] >> 36) & 0x3ffffff;
+			meta.segments++;
+		}
+	}
+	for(i = 0; i < segments; i++){
+		hdd_slab_free(bufs[i]);
+	}
+	free(bufs);
+	free(resps);
+	free(cmds);
+	return ret;
+}
+
+// save the changed file entries, either as a new journal segment or, once
+// the journal has grown past the checkpoint, as a fresh checkpoint
+int saveMeta(void){
+	HddBitCmd *dcmds;
+	HddBitResp *dresps;
+	metaSegment *old;
+	void **dbufs;
+	uint32_t journalBytes = 0, liveBytes = 0;
+	int16_t *files;
+	int i, count = 0, oldCount;
+
+	files = (int16_t*)malloc((fileCount + 1) * sizeof(int16_t));
+	for(i = 0; i < fileCount; i++){
+		liveBytes += metaRecordSize(i);
+		if(extent[i].metaDirty){
+			files[count++] = i;
+			journalBytes += metaRecordSize(i);
+		}
+	}
+	if(count == 0){	// nothing changed since the last save
+		free(files);
+		return 0;
+	}
+
+	if(meta.segments - meta.checkpoints < HDD_META_MAX_JOURNAL &&
+	   meta.journalBytes + journalBytes <= meta.checkpointBytes){	// append to the journal
+		if(writeMetaSegments(files, count)){
+			free(files);
+			return -1;
+		}
+		meta.journalBytes += journalBytes;
+		if(writeMetaBlock()){
+			free(files);
+			return -1;
+		}
+	}
+	else{	// write a checkpoint of every file, then drop the old segments
+		old = metaSegments;
+		oldCount = meta.segments;
+		metaSegments = NULL;
+		meta.segments = 0;
+		for(i = 0; i < fileCount; i++){
+			files[i] = i;
+		}
+		if(writeMetaSegments(files, fileCount)){
+			free(files);
+			free(old);
+			return -1;
+		}
+		meta.checkpoints = meta.segments;
+		meta.checkpointBytes = liveBytes;
+		meta.journalBytes = 0;
+		if(writeMetaBlock()){
+			free(files);
+			free(old);
+			return -1;
+		}
+		// the old segments are no longer referenced, delete them in one batch
+		dcmds = (HddBitCmd*)malloc((oldCount + 1) * sizeof(HddBitCmd));
+		dbufs = (void**)calloc(oldCount + 1, sizeof(void*));
+		dresps = (HddBitResp*)malloc((oldCount + 1) * sizeof(HddBitResp));
+		for(i = 0; i < oldCount; i++){
+			dcmds[i] = setCmd(HDD_BLOCK_DELETE, 0, 0, 0, old[i].bid);
+		}
+		hdd_client_batch(oldCount, dcmds, dbufs, dresps);
+		free(dcmds);
+		free(dbufs);
+		free(dresps);
+		free(old);
+		count = fileCount;	// files[] now lists every file, all of them are clean
+	}
+	for(i = 0; i < count; i++){
+		extent[files[i]].metaDirty = 0;
+	}
+	free(files);
+	return 0;
+}
+
+// replay the metadata segments into the file table
+int loadMeta(void){
+	HddBitCmd rcmd;
+	HddBitResp rResp;
+	metaRecord rec;
+	uint32_t s, off;
+	char *buf;
+
+	for(s = 0; s < meta.segments; s++){
+		if((buf = (char*)hdd_slab_alloc(metaSegments[s].size)) == NULL){
+			return -1;
+		}
+		rcmd = setCmd(HDD_BLOCK_READ, metaSegments[s].size, 0, 0, metaSegments[s].bid);
+		rResp = hdd_client_operation(rcmd, buf);
+		if((rResp >> 32) & 0x1){	// check if the segment is read
+			printf("metadata segment read incorrectly\n");
+			hdd_slab_free(buf);
+			return -1;
+		}
+		for(off = 0; off + sizeof(metaRecord) <= metaSegments[s].size; ){
+			memcpy(&rec, &buf[off], sizeof(metaRecord));
+			if(rec.fileId >= MAX_HDD_FILEDESCR || rec.nameLength >= MAX_FILENAME_LENGTH){
+				printf("metadata record is corrupt\n");
+				hdd_slab_free(buf);
+				return -1;
+			}
+			off += sizeof(metaRecord);
+			memset(file[rec.fileId].fileName, '\0', MAX_FILENAME_LENGTH);
+			memcpy(file[rec.fileId].fileName, &buf[off], rec.nameLength);
+			off += rec.nameLength;
+			file[rec.fileId].extentCount = rec.extentCount;
+			file[rec.fileId].fileSize = rec.fileSize;
+			reserveExtents(rec.fileId, rec.extentCount);
+			memcpy(extent[rec.fileId].blocks, &buf[off], rec.extentCount * sizeof(HddBlockID));
+			off += rec.extentCount * sizeof(HddBlockID);
+			extent[rec.fileId].flushedSize = rec.fileSize;
+			if(rec.fileId >= fileCount){
+				fileCount = rec.fileId + 1;
+			}
+		}
+		hdd_slab_free(buf);
+	}
+	return 0;
+}
+
+// forget every file in the in-memory table
+void resetFiles(void){
+	int j = 0;
+	while (j < fileCount){		//initialize by loop
+		dropExtents(j);	// pending writes are for the old file system
+		memset(&file[j], 0, sizeof(fileData));
+		j++;
+	}
+	fileCount = 0;
+}
+
+//
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_name_hash
+// Description  : hash a file name (64-bit FNV-1a) for the hash table indexes
+//
+// Inputs       : name  - the file name
+// Outputs      : the hash value
+//
+HtIndexValue hdd_name_hash(const char *name) {
+	uint64_t hash = 0xcbf29ce484222325ULL;	// FNV offset basis
+
+	while(*name != '\0'){
+		hash ^= (uint8_t)*name++;
+		hash *= 0x100000001b3ULL;	// FNV prime
+	}
+	return (HtIndexValue)hash;
+}
+
+// format the device, called with tableLock held
+uint16_t formatDevice(void) {
+	HddBitCmd cmd1, fcmd, cmetacmd;
+	HddBitResp resp1, fResp, cmetaResp;
+	if(init == 0){		//check the initalization
+		cmd1 = setCmd(HDD_DEVICE, 0, HDD_INIT, 0, 0);
+		resp1 = hdd_client_operation(cmd1, NULL);
+		resp1 = (resp1 >> 32) & 0x1;
+		if(resp1){
+			printf("initialize the block incorrectly\n");
+			return -1;
+		}
+		else{
+	
+			init = 1;
+		}
+	}
+	
+		fcmd = setCmd(HDD_DEVICE, 0, HDD_FORMAT, 0, 0);
+		fResp = hdd_client_operation(fcmd, NULL);
+		fResp = (fResp >> 32) & 0x1;		//if condition
+		if(fResp){	//check the format
+			printf("format debug1\n");
+			return -1;
+		}	
+		if(init_hdd_cache()){	// drop anything cached from before the format
+			return -1;
+		}
+		resetFiles();
+
+		// an empty meta block has no segments
+		memset(&meta, 0, sizeof(metaHeader));
+		meta.magic = HDD_META_MAGIC;
+		meta.version = HDD_META_VERSION;
+		free(metaSegments);
+		metaSegments = NULL;
+		cmetacmd = setCmd(HDD_BLOCK_CREATE, sizeof(metaHeader), HDD_META_BLOCK, 0, 0);
+		cmetaResp = hdd_client_operation(cmetacmd, &meta);
+		cmetaResp = (cmetaResp >> 32) & 0x1;
+		if(cmetaResp){	//check if meta block is created correctly
+			printf("Meta block created incorrectly\n");	//for debug
+			return -1; 
+		}
+		else{		
+			metaSize = sizeof(metaHeader);
+			return buildNameIndex();
+		}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_format
+// Description  : sends a format request to the device delete all blocks
+// Inputs       : void
+// Outputs      : 0 on success or -1 on failure
+//
+uint16_t hdd_format(void) {
+	uint16_t ret;
+
+	finishReadAhead();
+	pthread_mutex_lock(&tableLock);
+	ret = formatDevice();
+	pthread_mutex_unlock(&tableLock);
+	return ret;
+}
+
+// mount the file system, called with tableLock held
+uint16_t mountDevice(void) {
+	HddBitCmd cmd1, rmetacmd;
+	HddBitResp resp1, rmetaResp;
+	char *buf;
+	if(init == 0){		// check the  initialization
+		cmd1 = setCmd(HDD_DEVICE, 0, HDD_INIT, 0, 0);
+		resp1 = hdd_client_operation(cmd1, NULL);
+		resp1 = (resp1 >> 32) & 0x1;
+		if(resp1){	//check the block if initalized correctly
+			printf("initialize the block incorrectly\n");		
+			return -1;
+		}
+		else{
+			init = 1;	//if correct, set the init to 1
+		}
+	}
+
+	if(init_hdd_cache()){	// start with an empty block cache
+		return -1;
+	}
+
+	// the meta block is a header and the list of metadata segments
+	if((buf = (char*)hdd_slab_alloc(HDD_MAX_BLOCK_SIZE)) == NULL){
+		return -1;
+	}
+	rmetacmd = setCmd(HDD_BLOCK_READ, HDD_MAX_BLOCK_SIZE, HDD_META_BLOCK, 0, 0);
+	rmetaResp = hdd_client_operation(rmetacmd, buf);
+	metaSize = (rmetaResp >> 36) & 0x3ffffff;
+	memcpy(&meta, buf, sizeof(metaHeader));
+	if(((rmetaResp >> 32) & 0x1) || metaSize < sizeof(metaHeader) || meta.magic != HDD_META_MAGIC ||
+	   meta.version != HDD_META_VERSION || metaSize != sizeof(metaHeader) + meta.segments * sizeof(metaSegment)){		// check if meta block is correct
+		printf("meta block read incorrectly\n");
+		hdd_slab_free(buf);
+		return -1;
+	}
+	free(metaSegments);
+	metaSegments = (metaSegment*)malloc(meta.segments * sizeof(metaSegment) + 1);
+	memcpy(metaSegments, &buf[sizeof(metaHeader)], meta.segments * sizeof(metaSegment));
+	hdd_slab_free(buf);
+
+	resetFiles();
+	if(loadMeta()){
+		return -1;
+	}
+	return buildNameIndex();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_mount
+// Description  : read from the meta block to populate global data.
+// Inputs       : void
+// Outputs      : return 0 on success and -1 on failure
+//
+uint16_t hdd_mount(void) {
+	uint16_t ret;
+
+	finishReadAhead();
+	pthread_mutex_lock(&tableLock);
+	ret = mountDevice();
+	pthread_mutex_unlock(&tableLock);
+	return ret;
+}
+
+// unmount the file system, called with tableLock held
+uint16_t unmountDevice(void) {
+	HddBitCmd sccmd;
+	HddBitResp scResp;
+	if(flushAllBuffers()){	// write out any buffered file contents
+		printf("incorrectly flushed the file buffers\n");
+		return -1;
+	}
+	// save the changed file entries
+	if(saveMeta()){	//check if the table saves correctly
+		printf("incorrectly saved the meta block\n");
+		return -1;
+	}
+	else{
+		close_hdd_cache();	// log the cache statistics and release the blocks
+		hdd_slab_report();
+		sccmd = setCmd(HDD_DEVICE, 0, HDD_SAVE_AND_CLOSE, 0, 0);
+		scResp = hdd_client_operation(sccmd, NULL);
+		if((scResp >> 32) & 0x1){	//check if save and close correctly
+			printf("incorrectly save and close the mata block\n");	//for debug
+			return -1;
+		}
+		else{
+			init = 0;	// connection is closed, next format or mount reconnects
+			return 0; 	//if correctly
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_unmount(void)
+// Description  : read from the meta block to populate your global data.
+//
+// Inputs       : void
+// Outputs      : return 0 on success and -1 on failure
+//
+uint16_t hdd_unmount(void) {
+	uint16_t ret;
+
+	finishReadAhead();
+	pthread_mutex_lock(&tableLock);
+	ret = unmountDevice();
+	pthread_mutex_unlock(&tableLock);
+	return ret;
+}
+
+// open a file, called with tableLock held
+int16_t openFile(char *path) {
+	HddBitCmd cmd1;
+	HddBitResp resp1;
+	int i, fh; 
+	if (path == NULL){
+		printf("empty file\n");
+        	return -1;
+	}
+	else if(path != NULL){	//check if the path is empty
+		if(init == 0){		//check if it's init
+			cmd1 = setCmd(HDD_DEVICE, 0, HDD_INIT, 0, 0);
+			resp1 = hdd_client_operation(cmd1, NULL);
+			if((resp1 >> 32) & 0x1){
+				printf("initialize the block incorrectly\n");	//for debug
+				return -1; 
+			}
+			init = 1; 	//initalized to 1 when success
+		}
+		if(strlen(path) >= MAX_FILENAME_LENGTH || path[0] == '\0'){		//check the path is valid
+			printf("The requested path is incorrect\n");	//for debug
+			return -1;
+		}
+		if(!nameIndexInit && buildNameIndex()){	// opened before a mount
+			return -1;
+		}
+
+		i = lookupName(path);		//find the filename in the table
+		if(i != -1){
+			pthread_mutex_lock(&fileLock[i]);
+			if(file[i].status == 1){	//check if it's opened
+				pthread_mutex_unlock(&fileLock[i]);
+				printf("File already opened\n");
+				return -1;
+			}
+			file[i].status = 1;	//when it's not opened
+			file[i].cp = 0; 
+			pthread_mutex_unlock(&fileLock[i]);
+			return i;
+		}
+
+		fh = nextFreeFile; 
+		if(fh == MAX_HDD_FILEDESCR){		//when it's full
+			printf("Max out. Debug2\n");	//for debug
+			return -1;
+		}
+		nextFreeFile++;
+		while(nextFreeFile < MAX_HDD_FILEDESCR && file[nextFreeFile].fileName[0] != '\0'){
+			nextFreeFile++;
+		}
+		if(fh >= fileCount){
+			__atomic_store_n(&fileCount, fh + 1, __ATOMIC_RELEASE);
+		}
+		dropExtents(fh);
+		extent[fh].metaDirty = 1;	// new entry to save
+		file[fh].extentCount = 0;
+		file[fh].cp = 0;
+		file[fh].fileSize = 0;
+		strcpy(file[fh].fileName, path); 
+		indexName(fh);
+		file[fh].status = 1;
+		return fh;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_open(char*)
+// Description  : hdd_open will open a file and return an integer file handle.
+//                and it return -1 on failure and integer on sucess.
+//
+// Inputs       : path  - the given filename
+// Outputs      : fileHandle    - the unique integer that needed to be returned.
+//
+int16_t hdd_open(char *path) {
+	int16_t ret;
+
+	finishReadAhead();
+	pthread_mutex_lock(&tableLock);
+	ret = openFile(path);
+	pthread_mutex_unlock(&tableLock);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_exists(char*)
+// Description  : look a file up by name without creating it
+//
+// Inputs       : path  - the given filename
+// Outputs      : 1 if the file exists, 0 if it does not
+//
+int16_t hdd_exists(char *path) {
+	int16_t ret = 0;
+
+	pthread_mutex_lock(&tableLock);
+	if(nameIndexInit || buildNameIndex() == 0){
+		ret = (lookupName(path) != -1);
+	}
+	pthread_mutex_unlock(&tableLock);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_close(int16_t)
+// Description  : close the file reference by the file handle
+//
+// Inputs       : fh    -file handle
+// Outputs      : 0 sucess     -1 failure
+//
+int16_t hdd_close(int16_t fh) {
+
+	finishReadAhead();
+	if(fh >= MAX_HDD_FILEDESCR || fh < 0){	// check if file handle is valid
+		printf("Invalid file handle\n");		
+		return -1;
+	}
+	pthread_mutex_lock(&fileLock[fh]);
+	if(file[fh].status == 0){		// check if file is closed
+		pthread_mutex_unlock(&fileLock[fh]);
+		printf("File is closed\n");
+		return -1;
+	}
+	else{
+		if(flushBuffer(fh)){	// write out the buffered contents
+			pthread_mutex_unlock(&fileLock[fh]);
+			return -1;
+		}
+		file[fh].status = 0;
+		file[fh].cp = 0;
+		pthread_mutex_unlock(&fileLock[fh]);
+		return 0;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_fsync(int16_t)
+// Description  : write any buffered contents of the file to the device
+//
+// Inputs       : fh    -file handle
+// Outputs      : 0 sucess     -1 failure
+//
+int16_t hdd_fsync(int16_t fh) {
+	int16_t ret;
+
+	finishReadAhead();
+	if(fh >= MAX_HDD_FILEDESCR || fh < 0){	// check if file handle is valid
+		printf("Invalid file handle\n");
+		return -1;
+	}
+	pthread_mutex_lock(&fileLock[fh]);
+	if(file[fh].status == 0){		// check if file is closed
+		pthread_mutex_unlock(&fileLock[fh]);
+		printf("File is closed\n");
+		return -1;
+	}
+	ret = flushBuffer(fh);
+	pthread_mutex_unlock(&fileLock[fh]);
+	return ret;
+}
+
+// copy count bytes of a file at pos, from the write-back buffers, the cache or
+// else the device, called with fileLock[fh] held
+int copyOut(int16_t fh, char *data, uint32_t count, uint64_t pos){
+	uint32_t idx, offset, bytes, done = 0;
+	char *block;
+
+	while(done < count){	// copy out of each extent in turn
+		idx = (pos + done) / HDD_EXTENT_SIZE;
+		offset = (pos + done) % HDD_EXTENT_SIZE;
+		bytes = HDD_EXTENT_SIZE - offset;
+		if(bytes > count - done){
+			bytes = count - done;
+		}
+
+		block = extent[fh].dirty[idx];	// unflushed contents are the latest
+		if(block != NULL){
+			memcpy(&data[done], &block[offset], bytes);
+		}
+		else if(readExtent(fh, idx, offset, bytes, &data[done])){	// served from the cache when possible
+			return -1;
+		}
+		done += bytes;
+	}
+	return 0;
+}
+
+// read from a file at pos without moving its cursor, called with fileLock[fh] held
+int32_t readFileAt(int16_t fh, void * data, int32_t count, uint32_t pos) {
+	int64_t first, last;
+
+	if(init == 0){		// check if block is initialized
+		printf("It is not initialized\n");
+		return -1;
+	}
+	if(file[fh].fileSize == 0){	// check if there is anything to read from
+		printf("block id is empty\n");
+		return -1;
+	}
+
+	if(pos + count > file[fh].fileSize){		// only read up to the end of the file
+		count = file[fh].fileSize - pos;
+	}
+	first = pos / HDD_EXTENT_SIZE;
+	last = ((int64_t)pos + count - 1) / HDD_EXTENT_SIZE;
+	if(count > 0 && rangedReads()){	// partly read extents are fetched as ranges, not whole
+		if(pos % HDD_EXTENT_SIZE != 0){
+			first++;
+		}
+		if(((uint64_t)pos + count) % HDD_EXTENT_SIZE != 0 && (uint64_t)pos + count < file[fh].fileSize){
+			last--;
+		}
+	}
+	if(count > 0 && first <= last && loadExtents(fh, first, last)){	// fetch the missing extents together
+		printf("read block incorrectly\n");
+		return -1;
+	}
+	if(copyOut(fh, data, count, pos)){
+		printf("read block incorrectly\n");
+		return -1;
+	}
+	return count;
+}
+
+// read from a file at its cursor, called with fileLock[fh] held
+int32_t readFile(int16_t fh, void * data, int32_t count) {
+	int32_t ret;
+
+	ret = readFileAt(fh, data, count, file[fh].cp);
+	if(ret > 0){
+		file[fh].cp += ret;
+	}
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_read(int16_t, void *, int32_t)
+// Description  : read a count number and places them into buffer
+//
+// Inputs       : fh    -file handle    data    -the file content that needed to put in
+//                count -count number of bytes from the current position
+// Outputs      : --1 failure   -number of bytes read sucess
+//
+int32_t hdd_read(int16_t fh, void * data, int32_t count) {
+	int64_t start;
+	int32_t ret;
+
+	finishReadAhead();
+	if(fh >= MAX_HDD_FILEDESCR || fh < 0){	// check if file handle is valid
+		printf("Invalid file handle\n");
+		return -1;
+	}
+	pthread_mutex_lock(&fileLock[fh]);
+	start = file[fh].cp;
+	hdd_client_acquire();	// keep the pipelined requests on one connection
+	ret = readFile(fh, data, count);
+	hdd_client_release();
+	if(ret > 0){	// look for a scan to read ahead of
+		readAhead(fh, start, ret);
+	}
+	pthread_mutex_unlock(&fileLock[fh]);
+	return ret;
+}
+
+// write to a file at pos without moving its cursor, called with fileLock[fh] held
+int32_t writeFileAt(int16_t fh, void *data, int32_t count, uint32_t pos) {
+	uint64_t end;
+	uint32_t idx, offset, bytes;
+	int32_t done = 0;
+	char *buf;
+	if(init == 0){		// check if the block is initialized
+		printf("It is not initialized\n");
+		return -1;
+        }
+
+	end = (uint64_t)pos + count;
+	if(end > file[fh].fileSize){	// file grows, extend the extent map and the tail
+		reserveExtents(fh, extentsFor(end));
+		if(growTail(fh, end)){
+			printf("read bug 5\n");
 			return -1;
 		}
-		else{
-	
-			init = 1;
-		}
+		file[fh].fileSize = end;
 	}
-	
-		fcmd = setCmd(HDD_DEVICE, 0, HDD_FORMAT, 0, 0);
-		fResp = hdd_client_operation(fcmd, NULL);
-		fResp = (fResp >> 32) & 0x1;		//if condition
-		if(fResp){	//check the format
-			printf("format debug1\n");
-			return -1;
-		}	
-		int j = 0;
-		while (j < MAX_HDD_FILEDESCR){		//initialize by loop
-			file[j].cp = 0;
-			file[j].blockId = 0;
-			file[j].blockSize = 0;
-			memset(file[j].fileName, '\0', sizeof(file[j].fileName));
-			file[j].status = 0; 
-			j++;
-		}
 
+	while(done < count){	// copy into each extent in turn
+		idx = (pos + done) / HDD_EXTENT_SIZE;
+		offset = (pos + done) % HDD_EXTENT_SIZE;
+		bytes = HDD_EXTENT_SIZE - offset;
+		if(bytes > count - done){
+			bytes = count - done;
+		}
 
-		cmetacmd = setCmd(HDD_BLOCK_CREATE, sizeof(fileData) * MAX_HDD_FILEDESCR, HDD_META_BLOCK, 0, 0);
-		cmetaResp = hdd_client_operation(cmetacmd, file);
-		cmetaResp = (cmetaResp >> 32) & 0x1;
-		if(cmetaResp){	//check if meta block is created correctly
-			printf("Meta block created incorrectly\n");	//for debug
-			return -1; 
+		if(hdd_network_ranged && extent[fh].dirty[idx] == NULL && idx < file[fh].extentCount && end <= extent[fh].flushedSize &&
+			extentCapacity(extent[fh].flushedSize, idx) == extentCapacity(file[fh].fileSize, idx) &&
+			!probe_hdd_cache(extent[fh].blocks[idx])){	// send just these bytes, not read and write the extent
+			if(writeExtentRange(fh, idx, offset, bytes, &((char*)data)[done])){
+				printf("read bug 5\n");
+				return -1;
+			}
+			done += bytes;
+			continue;
 		}
-		else{		
-			return 0;
+		buf = dirtyExtent(fh, idx, extentCapacity(file[fh].fileSize, idx));
+		if(buf == NULL){
+			printf("read bug 5\n");
+			return -1;
 		}
+		memcpy(&buf[offset], &((char*)data)[done], bytes);
+		done += bytes;
+	}
+
+	if(__atomic_load_n(&dirtyBytes, __ATOMIC_RELAXED) > HDD_WRITE_BACK_LIMIT && flushForSpace(fh)){	// too much buffered, write it out
+		return -1;
+	}
+	return count;
+}
+
+// write to a file at its cursor, called with fileLock[fh] held
+int32_t writeFile(int16_t fh, void *data, int32_t count) {
+	int32_t ret;
+
+	ret = writeFileAt(fh, data, count, file[fh].cp);
+	if(ret > 0){
+		file[fh].cp += ret;
+	}
+	return ret;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : hdd_mount
-// Description  : read from the meta block to populate global data.
-// Inputs       : void
-// Outputs      : return 0 on success and -1 on failure
+// Function     : hdd_write(int16_t, void *, int 32_t)
+// Description  : write a count number of bytes at the current position, growing the file as needed.
+//                Only the extents that are touched are buffered, and they are held until the file
+//                is closed or synced, the file system is unmounted, or too many bytes are buffered.
 //
-uint16_t hdd_mount(void) {
-	HddBitCmd cmd1, rmetacmd;
-	HddBitResp resp1, rmetaResp;
-	if(init == 0){		// check the  initialization
-		cmd1 = setCmd(HDD_DEVICE, 0, HDD_INIT, 0, 0);
-		resp1 = hdd_client_operation(cmd1, NULL);
-		resp1 = (resp1 >> 32) & 0x1;
-		if(resp1){	//check the block if initalized correctly
-			printf("initialize the block incorrectly\n");		
-			return -1;
-		}
-		else{
-			init = 1;	//if correct, set the init to 1
-		}
+// Inputs       : fh    -file handle    data    - the file content that needed to put in
+//                count -count number of bytes from the current position
+// Outputs      : --1 if failure -number of written read if sucess
+//
+int32_t hdd_write(int16_t fh, void *data, int32_t count) {
+	int32_t ret;
+
+	finishReadAhead();
+	if(fh >= MAX_HDD_FILEDESCR || fh < 0){	// check if file handle is valid
+		printf("Invalid file handle\n");
+		return -1;
 	}
+	pthread_mutex_lock(&fileLock[fh]);
+	hdd_client_acquire();	// keep the pipelined requests on one connection
+	ret = writeFile(fh, data, count);
+	hdd_client_release();
+	pthread_mutex_unlock(&fileLock[fh]);
+	return ret;
+}
 
-	rmetacmd = setCmd(HDD_BLOCK_READ, sizeof(fileData) * MAX_HDD_FILEDESCR, HDD_META_BLOCK, 0, 0);
-	rmetaResp = hdd_client_operation(rmetacmd, file);
-	rmetaResp = (rmetaResp >> 32) & 0x1;
-	if(rmetaResp){		// check if meta block is correct
-		printf("meta block read incorrectly\n");
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_pread(int16_t, void *, int32_t, uint32_t)
+// Description  : read a count number of bytes at offset off without moving the current position,
+//                so threads sharing a file handle do not race on a seek followed by a read
+//
+// Inputs       : fh    -file handle    data    -the buffer the file content is put in
+//                count -count number of bytes    off -the position to read from
+// Outputs      : --1 failure   -number of bytes read sucess
+//
+int32_t hdd_pread(int16_t fh, void *data, int32_t count, uint32_t off) {
+	int32_t ret;
+
+	finishReadAhead();
+	if(fh >= MAX_HDD_FILEDESCR || fh < 0){	// check if file handle is valid
+		printf("Invalid file handle\n");
 		return -1;
 	}
-	else{
-		return 0;
+	pthread_mutex_lock(&fileLock[fh]);
+	if(file[fh].status == 0){	// check if the file is openning
+		pthread_mutex_unlock(&fileLock[fh]);
+		printf("File is not opened\n");
+		return -1;
+	}
+	if(off > file[fh].fileSize){	// the same range a seek accepts
+		pthread_mutex_unlock(&fileLock[fh]);
+		printf("read out of range.\n");
+		return -1;
 	}
+	hdd_client_acquire();	// keep the pipelined requests on one connection
+	ret = readFileAt(fh, data, count, off);
+	hdd_client_release();
+	if(ret > 0){	// look for a scan to read ahead of
+		readAhead(fh, off, ret);
+	}
+	pthread_mutex_unlock(&fileLock[fh]);
+	return ret;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : hdd_unmount(void)
-// Description  : read from the meta block to populate your global data.
+// Function     : hdd_pwrite(int16_t, void *, int32_t, uint32_t)
+// Description  : write a count number of bytes at offset off without moving the current position,
+//                growing the file as needed, buffered the same way as hdd_write
 //
-// Inputs       : void
-// Outputs      : return 0 on success and -1 on failure
+// Inputs       : fh    -file handle    data    - the file content that needed to put in
+//                count -count number of bytes    off -the position to write at
+// Outputs      : --1 if failure -number of written read if sucess
 //
-uint16_t hdd_unmount(void) {
-	HddBitCmd metacmd, sccmd;
-	HddBitResp metaResp, scResp;
-	// save tables to meta block request
-	metacmd = setCmd(HDD_BLOCK_OVERWRITE, sizeof(fileData) * MAX_HDD_FILEDESCR, HDD_META_BLOCK, 0, 0);
-	metaResp = hdd_client_operation(metacmd, file);
-	metaResp = (metaResp >> 32) & 0x1;
-	if(metaResp){	//check if the table saves correctly
-		printf("incorrectly saved the meta block\n");
+int32_t hdd_pwrite(int16_t fh, void *data, int32_t count, uint32_t off) {
+	int32_t ret;
+
+	finishReadAhead();
+	if(fh >= MAX_HDD_FILEDESCR || fh < 0){	// check if file handle is valid
+		printf("Invalid file handle\n");
 		return -1;
 	}
-	else{
-		sccmd = setCmd(HDD_DEVICE, 0, HDD_SAVE_AND_CLOSE, 0, 0);
-		scResp = hdd_client_operation(sccmd, NULL);
-		if((scResp >> 32) & 0x1){	//check if save and close correctly
-			printf("incorrectly save and close the mata block\n");	//for debug
-			return -1;
-		}
-		else{
-			return 0; 	//if correctly
-		}
+	pthread_mutex_lock(&fileLock[fh]);
+	if(file[fh].status == 0){	// check if the file is openning
+		pthread_mutex_unlock(&fileLock[fh]);
+		printf("File is not opened\n");
+		return -1;
+	}
+	if(off > file[fh].fileSize){	// no holes, the same range a seek accepts
+		pthread_mutex_unlock(&fileLock[fh]);
+		printf("write out of range.\n");
+		return -1;
 	}
+	hdd_client_acquire();	// keep the pipelined requests on one connection
+	ret = writeFileAt(fh, data, count, off);
+	hdd_client_release();
+	pthread_mutex_unlock(&fileLock[fh]);
+	return ret;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : hdd_open(char*)
-// Description  : hdd_open will open a file and return an integer file handle.
-//                and it return -1 on failure and integer on sucess.
+// Function     : hdd_readv(int16_t, HddIoSegment *, int)
+// Description  : read a list of segments of a file without moving the current position.  An
+//                extent that several segments fall in is read whole once and the reads are
+//                pipelined; segments running past the end of the file are cut short.
 //
-// Inputs       : path  - the given filename
-// Outputs      : fileHandle    - the unique integer that needed to be returned.
+// Inputs       : fh    -file handle    segs    -the segments to read
+//                count -number of segments
+// Outputs      : --1 failure   -number of bytes read sucess
 //
-int16_t hdd_open(char *path) {
-	HddBitCmd cmd1;
-	HddBitResp resp1;
-	int i; 
-	if (path == NULL){
-		printf("empty file\n");
-        	return -1;
+int32_t hdd_readv(int16_t fh, HddIoSegment *segs, int count) {
+	uint32_t *idxs, *pieces, n, b, e, j;
+	uint64_t lo, hi, start, end;
+	int32_t total = 0;
+	int i, ret = 0;
+
+	finishReadAhead();
+	if(fh >= MAX_HDD_FILEDESCR || fh < 0 || count < 0){	// check if file handle is valid
+		printf("Invalid file handle\n");
+		return -1;
 	}
-	else if(path != NULL){	//check if the path is empty
-		if(init == 0){		//check if it's init
-			cmd1 = setCmd(HDD_DEVICE, 0, HDD_INIT, 0, 0);
-			resp1 = hdd_client_operation(cmd1, NULL);
-			if((resp1 >> 32) & 0x1){
-				printf("initialize the block incorrectly\n");	//for debug
-				return -1; 
-			}
-			init = 1; 	//initalized to 1 when success
-		}
-		if(strlen(path) > MAX_FILENAME_LENGTH){		//check the path is valid
-			printf("The requested path is incorrect\n");	//for debug
+	pthread_mutex_lock(&fileLock[fh]);
+	if(file[fh].status == 0){	// check if the file is openning
+		pthread_mutex_unlock(&fileLock[fh]);
+		printf("File is not opened\n");
+		return -1;
+	}
+	for(i = 0; i < count; i++){	// the same range a seek accepts
+		if(segs[i].len < 0 || segs[i].off > file[fh].fileSize){
+			pthread_mutex_unlock(&fileLock[fh]);
+			printf("read out of range.\n");
 			return -1;
 		}
+	}
+	if(segmentExtents(segs, count, file[fh].fileSize, &idxs, &pieces, &n)){
+		pthread_mutex_unlock(&fileLock[fh]);
+		free(idxs);
+		free(pieces);
+		return -1;
+	}
 
-		for(i = 0; i < MAX_HDD_FILEDESCR; i++){		//find the filename in the table
-			if(strcmp(file[i].fileName, path) == 0){	//check if it's opened
-				if(file[i].status == 1){
-					printf("File already opened\n");
-					return -1;
-				}
-				else if(file[i].status != 1){	//when it's not opened
-					fh = i;
-					file[i].status = 1;
-					file[i].cp = 0; 
-					return fh;
-				}
+	hdd_client_acquire();	// keep the pipelined requests on one connection
+	for(b = 0; b < n && ret == 0; b = e){	// fetch a batch of extents, then copy the segments in them
+		e = (n - b > HDD_VECTOR_BATCH) ? b + HDD_VECTOR_BATCH : n;
+		for(j = b; j < e; j++){
+			if((pieces[j] > 1 || !rangedReads()) && fetchExtent(fh, idxs[j])){	// lone pieces may be read as ranges
+				ret = -1;
 			}
 		}
-		int fh = 0; 
-		
-		while(strcmp(file[fh].fileName, "") != 0){	//when it's empty
-			fh++;
-			if(fh == MAX_FILENAME_LENGTH){		//when it's full
-				printf("Max out. Debug2\n");	//for debug
-				return -1;
+		if(drainOps()){
+			ret = -1;
+		}
+
+		lo = (uint64_t)idxs[b] * HDD_EXTENT_SIZE;
+		hi = ((uint64_t)idxs[e - 1] + 1) * HDD_EXTENT_SIZE;
+		if(hi > file[fh].fileSize){
+			hi = file[fh].fileSize;
+		}
+		for(i = 0; i < count && ret == 0; i++){
+			start = (segs[i].off > lo) ? segs[i].off : lo;
+			end = ((uint64_t)segs[i].off + segs[i].len < hi) ? (uint64_t)segs[i].off + segs[i].len : hi;
+			if(start < end && copyOut(fh, &((char*)segs[i].buf)[start - segs[i].off], end - start, start)){
+				ret = -1;
+			}
+			if(start < end){
+				total += end - start;
 			}
 		}
-		number = fh;
-		file[fh].blockId = 0;
-		file[fh].cp = 0;
-		file[fh].blockSize = 0;
-		strcpy(file[fh].fileName, path); 
-		file[fh].status = 1;
-		fh += 1;
-		return number;
 	}
+	hdd_client_release();
+	pthread_mutex_unlock(&fileLock[fh]);
+	free(idxs);
+	free(pieces);
+	if(ret){
+		printf("read block incorrectly\n");
+		return -1;
+	}
+	return total;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : hdd_close(int16_t)
-// Description  : close the file reference by the file handle
+// Function     : hdd_writev(int16_t, HddIoSegment *, int)
+// Description  : write a list of segments of a file in order without moving the current position.
+//                An extent that several segments fall in is buffered, so its changes reach the
+//                device in one overwrite when the file is flushed.
 //
-// Inputs       : fh    -file handle
-// Outputs      : 0 sucess     -1 failure
+// Inputs       : fh    -file handle    segs    -the segments to write
+//                count -number of segments
+// Outputs      : --1 if failure -number of bytes written if sucess
 //
-int16_t hdd_close(int16_t fh) {
-
-	if(fh > MAX_HDD_FILEDESCR || fh < 0){	// check if file handle is valid
-		printf("Invalid file handle\n");		
+int32_t hdd_writev(int16_t fh, HddIoSegment *segs, int count) {
+	uint32_t *idxs, *pieces, n, b, e, j;
+	uint64_t size;
+	int32_t total = 0;
+	int i, ret = 0;
+
+	finishReadAhead();
+	if(fh >= MAX_HDD_FILEDESCR || fh < 0 || count < 0){	// check if file handle is valid
+		printf("Invalid file handle\n");
 		return -1;
 	}
-	if(file[fh].status == 0){		// check if file is closed
-		printf("File is closed\n");
+	pthread_mutex_lock(&fileLock[fh]);
+	if(file[fh].status == 0){	// check if the file is openning
+		pthread_mutex_unlock(&fileLock[fh]);
+		printf("File is not opened\n");
 		return -1;
 	}
-	else{
-		file[fh].status = 0;
-		file[fh].cp = 0;
-		return 0;
+	size = file[fh].fileSize;
+	for(i = 0; i < count; i++){	// no holes, each segment may start where the ones before it end
+		if(segs[i].len < 0 || segs[i].off > size){
+			pthread_mutex_unlock(&fileLock[fh]);
+			printf("write out of range.\n");
+			return -1;
+		}
+		if((uint64_t)segs[i].off + segs[i].len > size){
+			size = (uint64_t)segs[i].off + segs[i].len;
+		}
+	}
+	if(segmentExtents(segs, count, size, &idxs, &pieces, &n)){
+		pthread_mutex_unlock(&fileLock[fh]);
+		free(idxs);
+		free(pieces);
+		return -1;
+	}
+
+	hdd_client_acquire();	// keep the pipelined requests on one connection
+	for(b = 0; b < n && ret == 0; b = e){	// buffer the shared extents, their device contents fetched together
+		e = (n - b > HDD_VECTOR_BATCH) ? b + HDD_VECTOR_BATCH : n;
+		for(j = b; j < e; j++){
+			if((pieces[j] > 1 || !hdd_network_ranged) && fetchExtent(fh, idxs[j])){
+				ret = -1;
+			}
+		}
+		if(drainOps()){
+			ret = -1;
+		}
+		for(j = b; j < e && ret == 0; j++){
+			if(pieces[j] > 1 && idxs[j] < file[fh].extentCount &&
+				dirtyExtent(fh, idxs[j], extentCapacity(file[fh].fileSize, idxs[j])) == NULL){
+				ret = -1;
+			}
+		}
+	}
+	for(i = 0; i < count && ret == 0; i++){	// lone pieces of clean extents may go as ranges
+		if(segs[i].len > 0 && writeFileAt(fh, segs[i].buf, segs[i].len, segs[i].off) != segs[i].len){
+			ret = -1;
+		}
+		total += segs[i].len;
+	}
+	hdd_client_release();
+	pthread_mutex_unlock(&fileLock[fh]);
+	free(idxs);
+	free(pieces);
+	if(ret){
+		printf("write block incorrectly\n");
+		return -1;
 	}
+	return total;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : hdd_read(int16_t, void *, int32_t)
-// Description  : read a count number and places them into buffer
+// Function     : hdd_read_view(int16_t, uint32_t, int32_t, HddReadView *)
+// Description  : borrow up to count bytes of a file at offset off without copying them and without
+//                moving the current position.  The view points into the cached extent, which stays
+//                unchanged for the reader until hdd_release_view even if the file is written meanwhile
+//                (writers get a copy of the block).  A view stops at the end of its extent, and bytes
+//                not yet written to the device are viewed through a private copy.
 //
-// Inputs       : fh    -file handle    data    -the file content that needed to put in
-//                count -count number of bytes from the current position
-// Outputs      : --1 failure   -number of bytes read sucess
+// Inputs       : fh    -file handle    off -the position to read from
+//                count -most bytes to view    view -set to the view
+// Outputs      : --1 failure   -number of bytes viewed (0 at the end of the file)
 //
-int32_t hdd_read(int16_t fh, void * data, int32_t count) {
-	HddBitResp rResp;
-	HddBitCmd rcmd;
-
-	if(init == 0){		// check if block is initialized
-		printf("It is not initialized\n");
+int32_t hdd_read_view(int16_t fh, uint32_t off, int32_t count, HddReadView *view) {
+	uint32_t idx, offset;
+	const char *block = NULL;
+	char *copy;
+	int32_t ret;
+
+	finishReadAhead();
+	view->data = NULL;
+	view->len = 0;
+	view->ref = NULL;
+	if(fh >= MAX_HDD_FILEDESCR || fh < 0){	// check if file handle is valid
+		printf("Invalid file handle\n");
 		return -1;
 	}
-	if(file[fh].blockId == 0){	// check if the block to read from is existing
-		printf("block id is empty\n");
+	pthread_mutex_lock(&fileLock[fh]);
+	if(init == 0 || file[fh].status == 0){	// check if the file is openning
+		pthread_mutex_unlock(&fileLock[fh]);
+		printf("File is not opened\n");
+		return -1;
+	}
+	if(off > file[fh].fileSize || count < 0){	// the same range a seek accepts
+		pthread_mutex_unlock(&fileLock[fh]);
+		printf("read out of range.\n");
 		return -1;
 	}
+	idx = off / HDD_EXTENT_SIZE;
+	offset = off % HDD_EXTENT_SIZE;
+	if(count > file[fh].fileSize - off){	// only up to the end of the file
+		count = file[fh].fileSize - off;
+	}
+	if(count > HDD_EXTENT_SIZE - offset){	// and of the extent
+		count = HDD_EXTENT_SIZE - offset;
+	}
+	if(count == 0){
+		pthread_mutex_unlock(&fileLock[fh]);
+		return 0;
+	}
 
-	if(file[fh].cp + count > file[fh].blockSize){		// read the buffer when it's not over the size
-		char *newData;
-		newData = (char*)malloc(file[fh].blockSize);
-		rcmd = setCmd(HDD_BLOCK_READ, file[fh].blockSize, 0, 0, file[fh].blockId);
-		rResp = hdd_client_operation(rcmd, newData);
-		rResp = (rResp >> 32) & 0x1;
-		if(rResp){		// check if read and send data successful
-			printf("read block incorrectly\n");
-			return -1;
+	hdd_client_acquire();	// keep the pipelined requests on one connection
+	ret = count;
+	if(extent[fh].dirty[idx] == NULL){	// hold the extent in the cache, reading it whole if missing
+		if(loadExtents(fh, idx, idx)){
+			ret = -1;
 		}
 		else{
-			memcpy(data, &newData[file[fh].cp], file[fh].blockSize - file[fh].cp);
-			int32_t expectedCount = file[fh].blockSize - file[fh].cp;
-			file[fh].cp = file[fh].blockSize;
-			free(newData);
-			return expectedCount;
-		}
-	}
-
-	else{		//get more memory for buffer
-		char *newData; 
-		newData = (char*)malloc(file[fh].blockSize);
-		// request read and copy content into the new data buffer
-		rcmd = setCmd(HDD_BLOCK_READ, file[fh].blockSize, 0, 0, file[fh].blockId);
-		// check if read and send data successful
-		rResp = hdd_client_operation(rcmd, newData);
-		rResp = (rResp >> 32) & 0x1;
-		if(rResp){		// when read the block incorrectly
-			printf("Read block incorrectly\n");
-			return -1;
+			block = view_hdd_cache(extent[fh].blocks[idx], NULL, &view->ref);
 		}
-		else{		//when correctly
-			memcpy(data, &newData[file[fh].cp], count);
-			file[fh].cp += count;
-			free(newData);
-			return count;
+	}
+	if(ret > 0 && block != NULL){
+		view->data = &block[offset];
+	}
+	else if(ret > 0){	// unflushed, or the cache could not keep it
+		if((copy = hdd_slab_alloc(count)) == NULL || copyOut(fh, copy, count, off)){
+			hdd_slab_free(copy);
+			ret = -1;
 		}
+		view->data = copy;
+	}
+	hdd_client_release();
+	if(ret > 0){	// look for a scan to read ahead of
+		view->len = ret;
+		readAhead(fh, off, ret);
 	}
+	else{
+		view->data = NULL;
+		printf("read block incorrectly\n");
+	}
+	pthread_mutex_unlock(&fileLock[fh]);
+	return ret;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : hdd_write(int16_t, void *, int 32_t)
-// Description  : write a count number of bytes at the current position, and create new blocks when number of bytes are exceeded.
+// Function     : hdd_release_view(HddReadView *)
+// Description  : give back a view from hdd_read_view, its bytes must not be used afterwards
 //
-// Inputs       : fh    -file handle    data    - the file content that needed to put in
-//                count -count number of bytes from the current position
-// Outputs      : --1 if failure -number of written read if sucess
+// Inputs       : view -the view
+// Outputs      : none
 //
-int32_t hdd_write(int16_t fh, void *data, int32_t count) {
-	HddBitCmd ccmd, rcmd, wcmd, ccmd1, dcmd;
-	HddBlockID bid, bid1;
-	HddBitResp rResp, wResp, dResp;
-	if(init == 0){		// check if the block is initialized
-		printf("It is not initialized\n");
-		return -1;
-        }
-        // create a block if no block exist
-        if(file[fh].blockId == HDD_NO_BLOCK){	// if block is empty
-		ccmd = setCmd(HDD_BLOCK_CREATE, count, 0, 0, 0);
-		bid = hdd_client_operation(ccmd, data);
-                file[fh].cp = count;
-                file[fh].blockId = bid; 
-                file[fh].blockSize = count;
-                file[fh].status = 1;
-                return count;
-        }
-        else{		//when the content size is less than the total size
-                if(count + file[fh].cp <= file[fh].blockSize){                       
-			char *ori_data;
-                        ori_data = (char*)malloc(file[fh].blockSize);              
-                        rcmd = setCmd(HDD_BLOCK_READ, file[fh].blockSize, 0, 0, file[fh].blockId);
-                        rResp = hdd_client_operation(rcmd, ori_data);
-			//rResp = 
-                        if((rResp >> 32) & 0x1){		//check if read correctly
-                                printf("read bug 5\n");
-                                return -1;
-                        }
-                        	memcpy(&ori_data[file[fh].cp], data, count);
-		                wcmd = setCmd(HDD_BLOCK_OVERWRITE, file[fh].blockSize, 0, 0, file[fh].blockId);
-		                wResp = hdd_client_operation(wcmd, ori_data);
-				wResp = (wResp >> 32) & 0x1;
-		                if(wResp){		// check if write successful
-		                        printf("write bug6\n");
-		                        return -1;
-		                }
-				else{
-				        file[fh].cp = file[fh].cp + count;
-				        free(ori_data);
-				        return count;
-				}
-
-                }
-                else{		//when the content size is larger than the total number                 
-			char *oldData;
-                        char *newData;
-			oldData = (char*)malloc(file[fh].blockSize);
-                        newData = (char*)malloc(file[fh].cp + count);
-			rcmd = setCmd(HDD_BLOCK_READ, file[fh].blockSize, 0, 0, file[fh].blockId);
-                        rResp = hdd_client_operation(rcmd, oldData);
-			rResp = (rResp >> 32) & 0x1;
-                        if(rResp){		//check if read successfully
-                                printf("Read bug3\n");
-                                return -1;
-                        }
-			else{
-				memcpy(newData, oldData, file[fh].blockSize);
-				free(oldData);
-		                memcpy(&newData[file[fh].cp], data, count);
-		                ccmd1 = setCmd(HDD_BLOCK_CREATE, file[fh].cp + count, 0, 0, 0);
-	       			bid1 = hdd_client_operation(ccmd1, newData);
-				free(newData);
-				dcmd = setCmd(HDD_BLOCK_DELETE, 0, 0, 0, file[fh].blockId);		// delete the command
-
-		                dResp = hdd_client_operation(dcmd, NULL);
-				dResp = (dResp >> 32) & 0x1;	// check if read to buffer successful
-		                if(dResp){	// check if delete successfully
-		                        printf("delete bug4\n");
-		                        return -1;
-		                }
-				else{
-				        // update metadata
-				        file[fh].cp = file[fh].cp + count;
-				        file[fh].blockId = bid1;
-					file[fh].blockSize = file[fh].cp;
-				        return count;
-				}
-		        }
-		}
-		return -1;
+void hdd_release_view(HddReadView *view) {
+	if(view->ref != NULL){
+		release_hdd_cache(view->ref);
+	}
+	else{	// a private copy
+		hdd_slab_free((void *)view->data);
 	}
+	view->data = NULL;
+	view->len = 0;
+	view->ref = NULL;
 }
 
-
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : hdd_seek
@@ -448,22 +1894,26 @@ int32_t hdd_seek(int16_t fh, uint32_t loc) {
 		return -1;
 	}
 
-	if(fh > MAX_HDD_FILEDESCR || fh < 0){	// check if the file handle is matched
+	if(fh >= MAX_HDD_FILEDESCR || fh < 0){	// check if the file handle is matched
 		printf("file handler not correct\n");
 		return -1;
 	}
 	
+	pthread_mutex_lock(&fileLock[fh]);
 	if(file[fh].status == 0){	// check if the file is openning 
+		pthread_mutex_unlock(&fileLock[fh]);
 		printf("File is not opened\n");
 		return -1;
 	}
 
         // change current position to loc
-        if(loc <= file[fh].blockSize){
+        if(loc <= file[fh].fileSize){
                 file[fh].cp = loc;
+		pthread_mutex_unlock(&fileLock[fh]);
                 return 0;
         }
         else{	//return -1 when out of range
+		pthread_mutex_unlock(&fileLock[fh]);
                 printf("seek out of range.\n");
                 return -1;
         }
@@ -471,6 +1921,20 @@ int32_t hdd_seek(int16_t fh, uint32_t loc) {
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_io_idle
+// Description  : finish the read-aheads the calling thread left in flight, so it holds no
+//                server connection while it waits for other work (the next file call would
+//                otherwise finish them)
+//
+// Inputs       : none
+// Outputs      : none
+//
+void hdd_io_idle(void) {
+	finishReadAhead();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : hddIOUnitTest
@@ -484,8 +1948,11 @@ int hddIOUnitTest(void) {
 	// Local variables
 	uint8_t ch;
 	int16_t fh, i;
-	int32_t cio_utest_length, cio_utest_position, count, bytes, expected;
+	int32_t cio_utest_length, cio_utest_position, count, bytes, expected, offset;
+	HddIoSegment segs[HDD_IO_UNIT_TEST_SEGMENTS];
 	char *cio_utest_buffer, *tbuf;
+	HddReadView view, copied;
+	HddCachePrefetchStats ahead, scanned;
 	HDD_UNIT_TEST_TYPE cmd;
 	char lstr[1024];
 
@@ -498,14 +1965,14 @@ int hddIOUnitTest(void) {
 
 	// Format and mount the file system
 	if (hdd_format() || hdd_mount()) {
-		logMessage(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : Failure on format or mount operation.");
+		hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : Failure on format or mount operation.");
 		return(-1);
 	}
 
 	// Start by opening a file
 	fh = hdd_open("temp_file.txt");
 	if (fh == -1) {
-		logMessage(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : Failure open operation.");
+		hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : Failure open operation.");
 		return(-1);
 	}
 
@@ -518,17 +1985,17 @@ int hddIOUnitTest(void) {
 		} else {
 			cmd = getRandomValue(CIO_UNIT_TEST_READ, CIO_UNIT_TEST_SEEK);
 		}
-		logMessage(LOG_INFO_LEVEL, "----------");
+		hdd_log(LOG_INFO_LEVEL, "----------");
 
 		// Execute the command
 		switch (cmd) {
 
 		case CIO_UNIT_TEST_READ: // read a random set of data
 			count = getRandomValue(0, cio_utest_length);
-			logMessage(LOG_INFO_LEVEL, "HDD_IO_UNIT_TEST : read %d at position %d", count, cio_utest_position);
+			hdd_log(LOG_INFO_LEVEL, "HDD_IO_UNIT_TEST : read %d at position %d", count, cio_utest_position);
 			bytes = hdd_read(fh, tbuf, count);
 			if (bytes == -1) {
-				logMessage(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : Read failure.");
+				hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : Read failure.");
 				return(-1);
 			}
 
@@ -539,20 +2006,20 @@ int hddIOUnitTest(void) {
 				expected = count;
 			}
 			if (bytes != expected) {
-				logMessage(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : short/long read of [%d!=%d]", bytes, expected);
+				hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : short/long read of [%d!=%d]", bytes, expected);
 				return(-1);
 			}
 			if ( (bytes > 0) && (memcmp(&cio_utest_buffer[cio_utest_position], tbuf, bytes)) ) {
 
 				bufToString((unsigned char *)tbuf, bytes, (unsigned char *)lstr, 1024 );
-				logMessage(LOG_INFO_LEVEL, "CIO_UTEST R: %s", lstr);
+				hdd_log(LOG_INFO_LEVEL, "CIO_UTEST R: %s", lstr);
 				bufToString((unsigned char *)&cio_utest_buffer[cio_utest_position], bytes, (unsigned char *)lstr, 1024 );
-				logMessage(LOG_INFO_LEVEL, "CIO_UTEST U: %s", lstr);
+				hdd_log(LOG_INFO_LEVEL, "CIO_UTEST U: %s", lstr);
 
-				logMessage(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : read data mismatch (%d)", bytes);
+				hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : read data mismatch (%d)", bytes);
 				return(-1);
 			}
-			logMessage(LOG_INFO_LEVEL, "HDD_IO_UNIT_TEST : read %d match", bytes);
+			hdd_log(LOG_INFO_LEVEL, "HDD_IO_UNIT_TEST : read %d match", bytes);
 
 
 			// update the position pointer
@@ -566,10 +2033,10 @@ int hddIOUnitTest(void) {
 			if (cio_utest_length+count >= HDD_MAX_BLOCK_SIZE) {
 
 				// Log, seek to end of file, create random value
-				logMessage(LOG_INFO_LEVEL, "HDD_IO_UNIT_TEST : append of %d bytes [%x]", count, ch);
-				logMessage(LOG_INFO_LEVEL, "HDD_IO_UNIT_TEST : seek to position %d", cio_utest_length);
+				hdd_log(LOG_INFO_LEVEL, "HDD_IO_UNIT_TEST : append of %d bytes [%x]", count, ch);
+				hdd_log(LOG_INFO_LEVEL, "HDD_IO_UNIT_TEST : seek to position %d", cio_utest_length);
 				if (hdd_seek(fh, cio_utest_length)) {
-					logMessage(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : seek failed [%d].", cio_utest_length);
+					hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : seek failed [%d].", cio_utest_length);
 					return(-1);
 				}
 				cio_utest_position = cio_utest_length;
@@ -578,7 +2045,7 @@ int hddIOUnitTest(void) {
 				// Now write
 				bytes = hdd_write(fh, &cio_utest_buffer[cio_utest_position], count);
 				if (bytes != count) {
-					logMessage(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST :append failed [%d].", count);
+					hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST :append failed [%d].", count);
 					return(-1);
 				}
 				cio_utest_length = cio_utest_position += bytes;
@@ -591,11 +2058,11 @@ int hddIOUnitTest(void) {
 			// Check to make sure that the write is not too large
 			if (cio_utest_length+count < HDD_MAX_BLOCK_SIZE) {
 				// Log the write, perform it
-				logMessage(LOG_INFO_LEVEL, "HDD_IO_UNIT_TEST : write of %d bytes [%x]", count, ch);
+				hdd_log(LOG_INFO_LEVEL, "HDD_IO_UNIT_TEST : write of %d bytes [%x]", count, ch);
 				memset(&cio_utest_buffer[cio_utest_position], ch, count);
 				bytes = hdd_write(fh, &cio_utest_buffer[cio_utest_position], count);
 				if (bytes!=count) {
-					logMessage(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : write failed [%d].", count);
+					hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : write failed [%d].", count);
 					return(-1);
 				}
 				cio_utest_position += bytes;
@@ -607,9 +2074,9 @@ int hddIOUnitTest(void) {
 
 		case CIO_UNIT_TEST_SEEK:
 			count = getRandomValue(0, cio_utest_length);
-			logMessage(LOG_INFO_LEVEL, "HDD_IO_UNIT_TEST : seek to position %d", count);
+			hdd_log(LOG_INFO_LEVEL, "HDD_IO_UNIT_TEST : seek to position %d", count);
 			if (hdd_seek(fh, count)) {
-				logMessage(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : seek failed [%d].", count);
+				hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : seek failed [%d].", count);
 				return(-1);
 			}
 			cio_utest_position = count;
@@ -623,9 +2090,126 @@ int hddIOUnitTest(void) {
 
 	}
 
+	// Write and read at random positions, the current position must not move
+	ch = getRandomValue(0, 0xff);
+	offset = getRandomValue(0, cio_utest_length - 1);
+	count = getRandomValue(1, cio_utest_length - offset);
+	hdd_log(LOG_INFO_LEVEL, "HDD_IO_UNIT_TEST : pwrite of %d bytes at position %d [%x]", count, offset, ch);
+	memset(&cio_utest_buffer[offset], ch, count);
+	if (hdd_pwrite(fh, &cio_utest_buffer[offset], count, offset) != count) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : pwrite failed [%d].", count);
+		return(-1);
+	}
+	offset = getRandomValue(0, cio_utest_length - 1);
+	count = getRandomValue(1, cio_utest_length - offset);
+	if ((hdd_pread(fh, tbuf, count, offset) != count) || memcmp(&cio_utest_buffer[offset], tbuf, count)) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : pread of %d bytes at position %d mismatch.", count, offset);
+		return(-1);
+	}
+
+	// Write scattered segments (the source is the mirror, so overlaps agree), then read others back
+	for (i=0; i<HDD_IO_UNIT_TEST_SEGMENTS; i++) {
+		segs[i].off = getRandomValue(0, cio_utest_length - 1);
+		segs[i].len = getRandomValue(1, CIO_UNIT_TEST_MAX_WRITE_SIZE);
+		if (segs[i].off + segs[i].len > cio_utest_length) {
+			segs[i].len = cio_utest_length - segs[i].off;
+		}
+		segs[i].buf = &cio_utest_buffer[segs[i].off];
+		memset(segs[i].buf, getRandomValue(0, 0xff), segs[i].len);
+		bytes = (i == 0) ? segs[i].len : bytes + segs[i].len;
+	}
+	hdd_log(LOG_INFO_LEVEL, "HDD_IO_UNIT_TEST : writev of %d segments, %d bytes", HDD_IO_UNIT_TEST_SEGMENTS, bytes);
+	if (hdd_writev(fh, segs, HDD_IO_UNIT_TEST_SEGMENTS) != bytes) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : writev failed [%d].", bytes);
+		return(-1);
+	}
+	for (i=expected=0; i<HDD_IO_UNIT_TEST_SEGMENTS; i++) {
+		segs[i].off = getRandomValue(0, cio_utest_length);
+		segs[i].len = getRandomValue(0, CIO_UNIT_TEST_MAX_WRITE_SIZE);
+		segs[i].buf = &tbuf[i * CIO_UNIT_TEST_MAX_WRITE_SIZE];
+		expected += (segs[i].off + segs[i].len > cio_utest_length) ? cio_utest_length - segs[i].off : segs[i].len;
+	}
+	if (hdd_readv(fh, segs, HDD_IO_UNIT_TEST_SEGMENTS) != expected) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : readv short/long read [%d].", expected);
+		return(-1);
+	}
+	for (i=0; i<HDD_IO_UNIT_TEST_SEGMENTS; i++) {
+		count = (segs[i].off + segs[i].len > cio_utest_length) ? cio_utest_length - segs[i].off : segs[i].len;
+		if (memcmp(&cio_utest_buffer[segs[i].off], segs[i].buf, count)) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : readv mismatch in segment %d at position %d.", i, segs[i].off);
+			return(-1);
+		}
+	}
+
+	count = cio_utest_length - cio_utest_position;
+	if ((hdd_read(fh, tbuf, count) != count) || memcmp(&cio_utest_buffer[cio_utest_position], tbuf, count)) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : positional or vectored IO moved the position %d.", cio_utest_position);
+		return(-1);
+	}
+	if ((hdd_pread(fh, tbuf, 1, cio_utest_length + 1) != -1) || (hdd_pwrite(fh, tbuf, 1, cio_utest_length + 1) != -1)) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : pread or pwrite past the end of the file succeeded.");
+		return(-1);
+	}
+
+	// View written bytes, overwrite them under the view, which must keep the old bytes until released
+	offset = getRandomValue(0, cio_utest_length - 1);
+	expected = cio_utest_length - offset;
+	if (expected > CIO_UNIT_TEST_MAX_WRITE_SIZE) {
+		expected = CIO_UNIT_TEST_MAX_WRITE_SIZE;
+	}
+	if (expected > HDD_EXTENT_SIZE - offset % HDD_EXTENT_SIZE) {
+		expected = HDD_EXTENT_SIZE - offset % HDD_EXTENT_SIZE;
+	}
+	if (hdd_fsync(fh) || (hdd_read_view(fh, offset, CIO_UNIT_TEST_MAX_WRITE_SIZE, &view) != expected) ||
+		memcmp(&cio_utest_buffer[offset], view.data, expected)) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : view mismatch at position %d.", offset);
+		return(-1);
+	}
+	memcpy(tbuf, view.data, expected);
+	memset(&cio_utest_buffer[offset], getRandomValue(0, 0xff), expected);
+	if ((hdd_pwrite(fh, &cio_utest_buffer[offset], expected, offset) != expected) ||
+		(hdd_read_view(fh, offset, expected, &copied) != expected) || memcmp(&cio_utest_buffer[offset], copied.data, expected)) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : view of unflushed bytes mismatch at position %d.", offset);
+		return(-1);
+	}
+	hdd_release_view(&copied);
+	if (hdd_fsync(fh) || memcmp(tbuf, view.data, expected)) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : view changed by a write at position %d.", offset);
+		return(-1);
+	}
+	hdd_release_view(&view);
+	if ((hdd_read_view(fh, offset, expected, &view) != expected) || memcmp(&cio_utest_buffer[offset], view.data, expected)) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : view after a write mismatch at position %d.", offset);
+		return(-1);
+	}
+	hdd_release_view(&view);
+
 	// Close the files and cleanup buffers, assert on failure
 	if (hdd_close(fh)) {
-		logMessage(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : Failure close close.", fh);
+		hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : Failure close close.", fh);
+		return(-1);
+	}
+
+	// Scan a file from the start after a remount, the extents after the first reads are read ahead
+	for (offset=0; offset<HDD_IO_UNIT_TEST_SCAN_EXTENTS*HDD_EXTENT_SIZE; offset++) {
+		cio_utest_buffer[offset] = (char)(offset * 7 + offset / HDD_EXTENT_SIZE);
+	}
+	if (((fh = hdd_open("cio_utest_scan")) == -1) ||
+		(hdd_write(fh, cio_utest_buffer, HDD_IO_UNIT_TEST_SCAN_EXTENTS*HDD_EXTENT_SIZE) != HDD_IO_UNIT_TEST_SCAN_EXTENTS*HDD_EXTENT_SIZE) ||
+		hdd_close(fh) || hdd_unmount() || hdd_mount() || ((fh = hdd_open("cio_utest_scan")) == -1)) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : failed to setup the read-ahead scan.");
+		return(-1);
+	}
+	hdd_cache_prefetch_stats(&ahead);
+	for (offset=0; offset<HDD_IO_UNIT_TEST_SCAN_EXTENTS*HDD_EXTENT_SIZE; offset+=HDD_EXTENT_SIZE) {
+		if ((hdd_read(fh, tbuf, HDD_EXTENT_SIZE) != HDD_EXTENT_SIZE) || memcmp(&cio_utest_buffer[offset], tbuf, HDD_EXTENT_SIZE)) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : read-ahead scan mismatch at position %d.", offset);
+			return(-1);
+		}
+	}
+	hdd_cache_prefetch_stats(&scanned);
+	if ((scanned.blocks == ahead.blocks) || hdd_close(fh)) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : cold sequential scan read nothing ahead.");
 		return(-1);
 	}
 	free(cio_utest_buffer);
@@ -633,7 +2217,7 @@ int hddIOUnitTest(void) {
 
 	// Format and mount the file system
 	if (hdd_unmount()) {
-		logMessage(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : Failure on unmount operation.");
+		hdd_log(LOG_ERROR_LEVEL, "HDD_IO_UNIT_TEST : Failure on unmount operation.");
 		return(-1);
 	}
 
@@ -16,11 +16,26 @@
 
 // Project include files
 #include <hdd_driver.h>
+#include <cmpsc311_hashtable.h>
 
 // Defines
-#define MAX_HDD_FILEDESCR 1024
+#define MAX_HDD_FILEDESCR 16384
 #define MAX_FILENAME_LENGTH 128
 
+// One range of a vectored read or write
+typedef struct {
+	uint32_t off;   // Position in the file
+	int32_t  len;   // Number of bytes
+	void    *buf;   // The bytes read into or written from
+} HddIoSegment;
+
+// Bytes of a file borrowed from the client cache (hdd_read_view)
+typedef struct {
+	const char *data;  // The bytes, read-only, valid until hdd_release_view
+	int32_t     len;   // Number of bytes
+	void       *ref;   // The cached block held, NULL for a private copy
+} HddReadView;
+
 
 // Management operations
 
@@ -39,6 +54,9 @@ uint16_t hdd_unmount(void);
 int16_t hdd_open(char *path);
 	// This function opens the file and returns a file handle
 
+int16_t hdd_exists(char *path);
+	// This function checks whether a file exists, without creating it
+
 int16_t hdd_close(int16_t fd);
 	// This function closes the file
 
@@ -48,9 +66,39 @@ int32_t hdd_read(int16_t fd, void *buf, int32_t count);
 int32_t hdd_write(int16_t fd, void *buf, int32_t count);
 	// Writes "count" bytes to the file handle "fh" from the buffer  "buf"
 
+int32_t hdd_pread(int16_t fd, void *buf, int32_t count, uint32_t off);
+	// Reads "count" bytes at offset "off" without moving the file position
+
+int32_t hdd_pwrite(int16_t fd, void *buf, int32_t count, uint32_t off);
+	// Writes "count" bytes at offset "off" without moving the file position
+
+int32_t hdd_readv(int16_t fd, HddIoSegment *segs, int count);
+	// Reads "count" segments without moving the file position, the bytes read
+
+int32_t hdd_writev(int16_t fd, HddIoSegment *segs, int count);
+	// Writes "count" segments in order without moving the file position, the bytes written
+
+int32_t hdd_read_view(int16_t fd, uint32_t off, int32_t count, HddReadView *view);
+	// Borrows up to "count" bytes at offset "off" without copying (to the end of an extent), the bytes viewed
+
+void hdd_release_view(HddReadView *view);
+	// Gives back a view from hdd_read_view
+
 int32_t hdd_seek(int16_t fd, uint32_t loc);
 	// Seek to specific point in the file
 
+int16_t hdd_fsync(int16_t fd);
+	// Write any buffered contents of the file to the device
+
+void hdd_io_idle(void);
+	// Finish the read-aheads of the calling thread before it waits idle
+
+//
+// Utility functions
+
+HtIndexValue hdd_name_hash(const char *name);
+	// Hash a file name for use as a hash table index
+
 //
 // Unit testing for the module
 
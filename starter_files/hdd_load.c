@@ -0,0 +1,483 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : hdd_load.c
+//  Description   : This is the HDD server load generator.  For each client
+//                  count it opens that many connections to the server, each
+//                  creates a block and then keeps one request in flight,
+//                  reading or overwriting its block, for a fixed time.  The
+//                  connections are shared out over threads that each drive
+//                  theirs from an epoll event loop, and the aggregate
+//                  ops/sec and latency of each count are reported.
+//
+//   Author : Chuyang Zhang
+//   Last Modified : 2017/12/1
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+
+// Project Includes
+#include <hdd_driver.h>
+#include <hdd_network.h>
+#include <hdd_stats.h>
+#include <cmpsc311_log.h>
+#include <hdd_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define HDD_LOAD_ARGUMENTS "hvl:a:p:c:d:s:w:t:"
+#define HDD_LOAD_MAX_THREADS 64
+#define HDD_LOAD_POLL_MSECS 10
+#define HDD_LOAD_DEFAULT_COUNTS "1,4,16,64,256,1024"
+#define HDD_LOAD_MAX_COUNTS 32
+#define HDD_LOAD_MAX_EVENTS 256
+#define HDD_LOAD_SEED 311
+#define USAGE \
+	"USAGE: hdd_load [-h] [-v] [-l <logfile>] [-a <ip addr|unix:path>] [-p <port>] [-c <counts>] [-d <secs>] [-s <size>] [-w <percent>] [-t <threads>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -a - IP address or unix:<path> of the server (default 127.0.0.1)\n" \
+	"    -p - port number of server to connect to\n" \
+	"    -c - comma separated client counts to measure (default " HDD_LOAD_DEFAULT_COUNTS ")\n" \
+	"    -d - seconds each client count is measured for (default 2)\n" \
+	"    -s - size of the block each client reads and overwrites (default 1024)\n" \
+	"    -w - percent of the requests that are overwrites (default 50)\n" \
+	"    -t - number of threads driving the clients (default 1)\n" \
+	"\n" \
+	"The shipped hdd_server serves one client at a time, measure hdd_ref_server.\n" \
+
+struct HddLoadThread;
+
+// A simulated client
+typedef struct {
+	struct HddLoadThread *thread;  // The thread driving it
+	int        fd;       // The connection
+	HddBlockID bid;      // Its block, 0 until created
+	HddBitCmd  cmd;      // The request in flight
+	uint64_t   start;    // When it was sent
+	uint32_t   sent;     // Bytes of it sent
+	uint32_t   length;   // Bytes of it to send
+	uint32_t   got;      // Bytes of its response received
+	uint32_t   expect;   // Bytes of response expected
+	int        writing;  // Waiting for room to send the rest of it
+	char      *out;      // The request (command and block)
+	char      *in;       // The response (response and block)
+} HddLoadClient;
+
+// A thread driving some of the clients
+typedef struct HddLoadThread {
+	pthread_t      thread;   // The thread
+	int            epoll;    // Its event loop
+	uint32_t       seed;     // Its request mix generator
+	HddLoadClient *clients;  // Its clients
+	uint32_t       count;    // How many
+	unsigned long  ops;      // Requests completed while measuring
+	int            ret;      // 0 if its clients all kept going
+} HddLoadThread;
+
+//
+// Global data
+
+uint16_t loadPort = HDD_DEFAULT_PORT;	// the server TCP port
+uint32_t loadBlockSize = 1024;	// bytes per block
+uint32_t loadWritePercent = 50;	// share of overwrites
+uint32_t loadThreadCount = 1;	// threads driving the clients
+const char *loadAddress = HDD_DEFAULT_IP;	// the server
+int loadMeasuring = 0;	// record the completed requests (set by the main thread)
+int loadStop = 0;	// the threads should stop (set by the main thread)
+pthread_barrier_t loadReady;	// the threads have connected their clients
+
+//
+// Functions
+
+// the next pseudo-random number of a thread (a fixed sequence from its seed)
+static uint32_t loadRandom(HddLoadThread *t) {
+	t->seed = t->seed * 1103515245 + 12345;
+	return((t->seed >> 16) & 0x7fff);
+}
+
+// make a request of the client (command and any block) ready to send
+static void loadPrepare(HddLoadClient *cl, uint8_t op) {
+	HddBitCmd wire;
+	uint32_t size = loadBlockSize;
+
+	cl->cmd = ((uint64_t)op << 62) | ((uint64_t)size << 36) | cl->bid;
+	wire = htonll64(cl->cmd);
+	memcpy(cl->out, &wire, HDD_NET_HEADER_SIZE);
+	cl->length = HDD_NET_HEADER_SIZE + ((op == HDD_BLOCK_READ) ? 0 : size);
+	cl->expect = HDD_NET_HEADER_SIZE + ((op == HDD_BLOCK_READ) ? size : 0);
+	cl->sent = cl->got = 0;
+	cl->start = hdd_stats_now();
+}
+
+// send what the socket will take of the request, watching for room only while it is not all sent
+static int loadSend(HddLoadClient *cl) {
+	struct epoll_event ev;
+	ssize_t ret;
+
+	while (cl->sent < cl->length) {
+		ret = write(cl->fd, &cl->out[cl->sent], cl->length - cl->sent);
+		if (ret == -1 && errno == EINTR) {
+			continue;
+		}
+		if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		}
+		if (ret <= 0) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD_LOAD : send failed [%s].", strerror(errno));
+			return(-1);
+		}
+		cl->sent += ret;
+	}
+	if (cl->writing == (cl->sent < cl->length)) {
+		return(0);
+	}
+	cl->writing = (cl->sent < cl->length);
+	ev.events = cl->writing ? EPOLLIN | EPOLLOUT : EPOLLIN;
+	ev.data.ptr = cl;
+	return(epoll_ctl(cl->thread->epoll, EPOLL_CTL_MOD, cl->fd, &ev));
+}
+
+// receive the response of a client, when it is complete record it and send the next request
+static int loadReceive(HddLoadClient *cl) {
+	HddBitResp resp;
+	ssize_t ret;
+
+	while (cl->got < cl->expect) {
+		ret = read(cl->fd, &cl->in[cl->got], cl->expect - cl->got);
+		if (ret == -1 && errno == EINTR) {
+			continue;
+		}
+		if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return(0);
+		}
+		if (ret <= 0) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD_LOAD : server closed the connection.");
+			return(-1);
+		}
+		cl->got += ret;
+	}
+
+	memcpy(&resp, cl->in, HDD_NET_HEADER_SIZE);
+	resp = ntohll64(resp);
+	if ((resp >> 32) & 0x1) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_LOAD : request failed on block [%u].", cl->bid);
+		return(-1);
+	}
+	if (cl->bid == 0) {	// the block is created
+		cl->bid = resp & 0xffffffff;
+	} else if (__atomic_load_n(&loadMeasuring, __ATOMIC_RELAXED)) {
+		hdd_stats_record(HDD_STATS_BLOCK_CREATE + ((cl->cmd >> 62) & 0x3), cl->start);
+		cl->thread->ops++;
+	}
+	loadPrepare(cl, (loadRandom(cl->thread) % 100 < loadWritePercent) ? HDD_BLOCK_OVERWRITE : HDD_BLOCK_READ);
+	return(loadSend(cl));
+}
+
+// connect a client to the server
+static int loadConnect(HddLoadClient *cl, const char *addr) {
+	struct sockaddr_in caddr;
+	struct sockaddr_un uaddr;
+	struct sockaddr *saddr;
+	struct epoll_event ev;
+	socklen_t slen;
+	int unixPath = (strncmp(addr, HDD_UNIX_PREFIX, strlen(HDD_UNIX_PREFIX)) == 0), on = 1;
+
+	if (unixPath) {
+		memset(&uaddr, 0x0, sizeof(uaddr));
+		uaddr.sun_family = AF_UNIX;
+		snprintf(uaddr.sun_path, sizeof(uaddr.sun_path), "%s", addr + strlen(HDD_UNIX_PREFIX));
+		saddr = (struct sockaddr *)&uaddr;
+		slen = sizeof(uaddr);
+	} else {
+		memset(&caddr, 0x0, sizeof(caddr));
+		caddr.sin_family = AF_INET;
+		caddr.sin_port = htons(loadPort);
+		if (inet_aton(addr, &caddr.sin_addr) == 0) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD_LOAD : bad server address [%s].", addr);
+			return(-1);
+		}
+		saddr = (struct sockaddr *)&caddr;
+		slen = sizeof(caddr);
+	}
+
+	if ((cl->fd = socket(unixPath ? PF_UNIX : PF_INET, SOCK_STREAM, 0)) == -1) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_LOAD : failed to create socket [%s].", strerror(errno));
+		return(-1);
+	}
+	if (!unixPath) {
+		setsockopt(cl->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	}
+	if (connect(cl->fd, saddr, slen) == -1 || fcntl(cl->fd, F_SETFL, O_NONBLOCK) == -1) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_LOAD : failed to connect [%s].", strerror(errno));
+		close(cl->fd);
+		cl->fd = -1;
+		return(-1);
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = cl;
+	return(epoll_ctl(cl->thread->epoll, EPOLL_CTL_ADD, cl->fd, &ev));
+}
+
+// a thread: connect its clients and create their blocks, then run the
+// event loop until told to stop
+static void *loadThread(void *arg) {
+	HddLoadThread *t = (HddLoadThread *)arg;
+	struct epoll_event events[HDD_LOAD_MAX_EVENTS];
+	HddLoadClient *cl;
+	uint32_t i;
+	int count;
+
+	for (i=0; (i<t->count) && (t->ret == 0); i++) {
+		cl = &t->clients[i];
+		cl->thread = t;
+		cl->out = malloc(HDD_NET_HEADER_SIZE + loadBlockSize);
+		cl->in = malloc(HDD_NET_HEADER_SIZE + loadBlockSize);
+		memset(&cl->out[HDD_NET_HEADER_SIZE], 'l', loadBlockSize);
+		if (loadConnect(cl, loadAddress)) {
+			t->ret = -1;
+			break;
+		}
+		loadPrepare(cl, HDD_BLOCK_CREATE);
+		t->ret = loadSend(cl);
+	}
+	pthread_barrier_wait(&loadReady);
+
+	while ((t->ret == 0) && !__atomic_load_n(&loadStop, __ATOMIC_RELAXED)) {
+		count = epoll_wait(t->epoll, events, HDD_LOAD_MAX_EVENTS, HDD_LOAD_POLL_MSECS);
+		if (count == -1 && errno != EINTR) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD_LOAD : epoll_wait failed [%s].", strerror(errno));
+			t->ret = -1;
+		}
+		for (i=0; (int)i<count && (t->ret == 0); i++) {
+			cl = (HddLoadClient *)events[i].data.ptr;
+			if (((events[i].events & EPOLLOUT) && loadSend(cl)) ||
+				((events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && loadReceive(cl))) {
+				t->ret = -1;
+			}
+		}
+	}
+	return NULL;
+}
+
+// sleep for secs seconds
+static void loadSleep(double secs) {
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)secs;
+	ts.tv_nsec = (long)((secs - ts.tv_sec) * 1e9);
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
+}
+
+// measure a number of clients for secs seconds, printing the result
+static int loadMeasure(uint32_t clients, double secs) {
+	HddLoadThread threads[HDD_LOAD_MAX_THREADS];
+	uint32_t nthreads = (clients < loadThreadCount) ? clients : loadThreadCount;
+	HddLoadClient *cls;
+	HddStatsSummary sum;
+	unsigned long ops = 0;
+	uint64_t begin;
+	uint32_t i, j;
+	int ret = 0;
+
+	// Share the clients out over the threads and start them
+	cls = calloc(clients, sizeof(HddLoadClient));
+	for (i=0; i<clients; i++) {
+		cls[i].fd = -1;
+	}
+	memset(threads, 0x0, sizeof(threads));
+	pthread_barrier_init(&loadReady, NULL, nthreads + 1);
+	loadMeasuring = loadStop = 0;
+	for (i=0, j=0; i<nthreads; i++) {
+		threads[i].seed = HDD_LOAD_SEED + i;
+		threads[i].clients = &cls[j];
+		threads[i].count = clients / nthreads + ((i < clients % nthreads) ? 1 : 0);
+		j += threads[i].count;
+		if ( (threads[i].epoll = epoll_create1(0)) == -1 ) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD_LOAD : epoll_create1 failed [%s].", strerror(errno));
+			threads[i].ret = -1;
+		}
+		pthread_create(&threads[i].thread, NULL, loadThread, &threads[i]);
+	}
+
+	// Warm up once connected, then measure
+	pthread_barrier_wait(&loadReady);
+	loadSleep(secs / 4);
+	hdd_stats_reset();
+	__atomic_store_n(&loadMeasuring, 1, __ATOMIC_RELAXED);
+	begin = hdd_stats_now();
+	loadSleep(secs);
+	__atomic_store_n(&loadMeasuring, 0, __ATOMIC_RELAXED);
+	secs = (hdd_stats_now() - begin) / 1e9;
+	__atomic_store_n(&loadStop, 1, __ATOMIC_RELAXED);
+	for (i=0; i<nthreads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		ops += threads[i].ops;
+		ret = ret || threads[i].ret;
+		if (threads[i].epoll != -1) {
+			close(threads[i].epoll);
+		}
+	}
+	pthread_barrier_destroy(&loadReady);
+	if (ret == 0) {
+		hdd_stats_summary(HDD_STATS_BLOCK_READ, HDD_STATS_BLOCK_OVERWRITE, &sum);
+		printf("%8u %10lu %8.3f %10.0f %9.1f %9.1f %9.1f\n", clients, ops, secs, ops / secs,
+			sum.p50 / 1e3, sum.p99 / 1e3, sum.max / 1e3);
+		fflush(stdout);
+	}
+
+	for (i=0; i<clients; i++) {
+		if (cls[i].fd != -1) {
+			close(cls[i].fd);	// the server drops the connection state
+		}
+		free(cls[i].out);
+		free(cls[i].in);
+	}
+	free(cls);
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the load generator
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0, i, ncounts = 0;
+	char *counts = HDD_LOAD_DEFAULT_COUNTS, *tok, *save;
+	uint32_t clients[HDD_LOAD_MAX_COUNTS];
+	double secs = 2.0;
+	struct rlimit rl;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, HDD_LOAD_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'a': // Set the server address
+			loadAddress = optarg;
+			break;
+
+		case 'p': // Set the port
+			if ( sscanf(optarg, "%hu", &loadPort) != 1 ) {
+				hdd_log( LOG_ERROR_LEVEL, "Bad  port number [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'c': // Set the client counts
+			counts = optarg;
+			break;
+
+		case 'd': // Set the time per count
+			if ( (sscanf(optarg, "%lf", &secs) != 1) || (secs <= 0) ) {
+				hdd_log( LOG_ERROR_LEVEL, "Bad  duration [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 's': // Set the block size
+			if ( (sscanf(optarg, "%u", &loadBlockSize) != 1) || (loadBlockSize == 0) || (loadBlockSize > HDD_MAX_BLOCK_SIZE) ) {
+				hdd_log( LOG_ERROR_LEVEL, "Bad  block size [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'w': // Set the share of overwrites
+			if ( (sscanf(optarg, "%u", &loadWritePercent) != 1) || (loadWritePercent > 100) ) {
+				hdd_log( LOG_ERROR_LEVEL, "Bad  write percent [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 't': // Set the number of threads
+			if ( (sscanf(optarg, "%u", &loadThreadCount) != 1) || (loadThreadCount == 0) ||
+				(loadThreadCount > HDD_LOAD_MAX_THREADS) ) {
+				hdd_log( LOG_ERROR_LEVEL, "Bad  thread count [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	if ( verbose ) {
+		enableLogLevels( LOG_INFO_LEVEL );
+	}
+
+	// Parse the client counts
+	counts = strdup( counts );
+	for (tok=strtok_r(counts, ",", &save); tok != NULL; tok=strtok_r(NULL, ",", &save)) {
+		if ( (ncounts == HDD_LOAD_MAX_COUNTS) || (sscanf(tok, "%u", &clients[ncounts]) != 1) || (clients[ncounts] == 0) ) {
+			hdd_log( LOG_ERROR_LEVEL, "Bad  client counts [%s]", tok );
+			free( counts );
+			return(-1);
+		}
+		ncounts ++;
+	}
+	free( counts );
+
+	// Allow a socket per client
+	signal( SIGPIPE, SIG_IGN );
+	if ( (getrlimit(RLIMIT_NOFILE, &rl) == 0) && (rl.rlim_cur < rl.rlim_max) ) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit( RLIMIT_NOFILE, &rl );
+	}
+
+	// Measure each count in turn
+	printf( "%8s %10s %8s %10s %9s %9s %9s\n", "clients", "ops", "secs", "ops/sec", "p50 us", "p99 us", "max us" );
+	for (i=0; i<ncounts; i++) {
+		if ( loadMeasure(clients[i], secs) ) {
+			hdd_log( LOG_ERROR_LEVEL, "HDD_LOAD : %u clients failed.", clients[i] );
+			return( -1 );
+		}
+	}
+
+	// Return successfully
+	return( 0 );
+}
@@ -0,0 +1,45 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : hdd_log.c
+//  Description   : This is the thread safe front of the cmpsc311 log, which
+//                  keeps its line buffer and time string in shared storage.
+//                  Messages of levels that are off skip the lock.
+//
+//  Author         : Chuyang Zhang
+//  Last Modified  : 2017/12/1
+//
+
+// Includes
+#include <stdarg.h>
+#include <pthread.h>
+
+// Project Includes
+#include <hdd_log.h>
+#include <cmpsc311_log.h>
+
+// Serializes the calls into the log
+pthread_mutex_t logLock = PTHREAD_MUTEX_INITIALIZER;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_log
+// Description  : log a message from any thread, one message at a time
+//
+// Inputs       : lvl - the log level of the message
+//                fmt - the "printf"-style format, followed by its arguments
+// Outputs      : what the log returned, 0 if the level is off
+//
+int hdd_log(unsigned long lvl, const char *fmt, ...) {
+	va_list args;
+	int ret;
+
+	if(!levelEnabled(lvl)){
+		return(0);
+	}
+	va_start(args, fmt);
+	pthread_mutex_lock(&logLock);
+	ret = vlogMessage(lvl, fmt, args);
+	pthread_mutex_unlock(&logLock);
+	va_end(args);
+	return(ret);
+}
@@ -0,0 +1,21 @@
+#ifndef HDD_LOG_INCLUDED
+#define HDD_LOG_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : hdd_log.h
+//  Description    : This is the interface for logging from code that runs
+//                   on several threads.  The cmpsc311 log is not thread
+//                   safe, so messages are passed to it one at a time.
+//
+//  Author         : Chuyang Zhang
+//  Last Modified  : 2017/12/1
+//
+
+//
+// Logging interface
+
+int hdd_log(unsigned long lvl, const char *fmt, ...);
+	// Log a "printf"-style message (logMessage), safe from any thread
+
+#endif
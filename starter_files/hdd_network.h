@@ -11,6 +11,7 @@
 //
 
 // Include Files
+#include <stdint.h>
 
 // Project Include Files
 #include <hdd_driver.h>
@@ -18,14 +19,64 @@
 // Defines
 #define HDD_MAX_BACKLOG 5
 #define HDD_NET_HEADER_SIZE sizeof(HddBitResp)
+#define HDD_NET_RANGE_SIZE sizeof(uint64_t)	// the range word after a HDD_RANGE command
 #define HDD_DEFAULT_IP "127.0.0.1"
 #define HDD_DEFAULT_PORT 19876
+#define HDD_UNIX_PREFIX "unix:"	// an address of unix:<path> names a Unix-domain socket
+#define HDD_LOOPBACK_ADDRESS "loopback"	// an address of loopback[:<file>] runs an in-process store
+#define HDD_CLIENT_MAX_DEPTH 64 // Most requests in flight on a connection
+#define HDD_CLIENT_DEFAULT_DEPTH 16 // Default queue depth of the client
+#define HDD_CLIENT_WINDOW_BYTES 0x40000 // Most block read data in flight
+#define HDD_CLIENT_FRAME_SIZE 0x10000 // Size of the send and receive frames
+#define HDD_CLIENT_MAX_CONNECTIONS 16 // Most connections in the client pool
 
 //
 // Functional Prototypes
 HddBitResp hdd_client_operation(HddBitCmd cmd, void *buf);
     // This is the implementation of the client operation (hdd_client.c)
 
+HddBitResp hdd_client_range_operation(HddBitCmd cmd, uint32_t offset, void *buf);
+    // A client operation on the range of a block starting at offset (HDD_RANGE)
+
+int32_t hdd_client_submit(HddBitCmd cmd, void *buf);
+    // Send a request without waiting, returns its tag (hdd_client.c)
+
+int32_t hdd_client_submit_range(HddBitCmd cmd, uint32_t offset, void *buf);
+    // Send a request on the range of a block starting at offset (HDD_RANGE)
+
+int32_t hdd_client_complete(HddBitResp *resp);
+    // Wait for the oldest request in flight, returns its tag (hdd_client.c)
+
+int hdd_client_flush(void);
+    // Send the gathered requests now rather than when a response is waited for
+
+int hdd_client_ready(HddBitCmd cmd);
+    // Check if a request can be submitted without completing others first
+
+uint32_t hdd_client_pending(void);
+    // Get the number of requests in flight
+
+int hdd_client_batch(int count, HddBitCmd *cmds, void **bufs, HddBitResp *resps);
+    // Send a batch of requests together and collect their responses
+
+int hdd_client_set_depth(uint32_t depth);
+    // Set the most requests in flight, 1 makes the client synchronous
+
+int hdd_client_set_connections(uint32_t count);
+    // Set the most connections in the client pool
+
+int hdd_client_acquire(void);
+    // Bind a pooled connection to the calling thread (calls nest)
+
+void hdd_client_release(void);
+    // Give the connection of the calling thread back to the pool
+
+int hdd_client_check_address(const char *addr);
+    // Check a server address (IP address, unix:<path> or loopback[:<file>])
+
+const char *hdd_client_transport(void);
+    // Get the name of the backend of the connection (socket, uring or loopback)
+
 int hdd_server( void );
     // This is the implementation of the server application (hdd_server.c)
 
@@ -34,5 +85,9 @@ int hdd_server( void );
 extern int            hdd_network_shutdown; // Flag indicating shutdown
 extern unsigned char *hdd_network_address;  // Address of HDD server 
 extern unsigned short hdd_network_port;     // Port of HDD server
+extern int            hdd_network_nodelay;  // Set TCP_NODELAY on TCP connections
+extern int            hdd_network_quickack; // Set TCP_QUICKACK on TCP connections for each batch sent
+extern int            hdd_network_ranged;   // The server implements HDD_RANGE requests
+extern int            hdd_network_uring;    // Carry socket requests over io_uring
 
 #endif
@@ -0,0 +1,512 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : hdd_ref_server.c
+//  Description   : This is the reference HDD server.  It serves the block
+//                  store (hdd_store) over TCP or a Unix-domain socket with
+//                  the HDD protocol, including the HDD_RANGE requests that
+//                  the shipped hdd_server does not implement.  Any number
+//                  of clients are served at once by a pool of workers, each
+//                  running an epoll event loop over the non-blocking sockets
+//                  of the connections it is handed (in turn, as they are
+//                  accepted): each connection reads requests into its input
+//                  buffer, carries out the complete ones in order and
+//                  queues their responses, and stops reading while the
+//                  responses cannot be written.  The store is sharded, so
+//                  the workers' requests run in parallel.
+//
+//   Author : Chuyang Zhang
+//   Last Modified : 2017/12/1
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// Project Includes
+#include <hdd_driver.h>
+#include <hdd_network.h>
+#include <hdd_store.h>
+#include <cmpsc311_log.h>
+#include <hdd_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define HDD_REF_SERVER_ARGUMENTS "hvl:p:a:s:w:"
+#define HDD_REF_SERVER_MAX_WORKERS 64
+#define HDD_REF_SERVER_MAX_EVENTS 256
+#define HDD_REF_SERVER_BUFFER 0x4000	// size a connection buffer starts at and shrinks back to
+#define USAGE \
+	"USAGE: hdd_ref_server [-h] [-v] [-l <logfile>] [-p <port>] [-a unix:<path>] [-s <store-file>] [-w <workers>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -p - listen on TCP port <port> (default 19876)\n" \
+	"    -a - listen on the Unix-domain socket unix:<path> instead\n" \
+	"    -s - save the device to <store-file> (default hdd_store.svd)\n" \
+	"    -w - number of worker threads serving the clients (default: one per CPU)\n" \
+	"\n" \
+
+// The state of a connection
+typedef enum {
+	HDD_CONN_READING = 0,	// Waiting for (the rest of) a request
+	HDD_CONN_WRITING = 1,	// Responses are queued that the socket would not take
+	HDD_CONN_CLOSING = 2,	// The client went away or broke the protocol
+} HddConnState;
+
+// A growable byte buffer, bytes start to end are pending
+typedef struct {
+	char    *data;      // The buffer
+	uint32_t capacity;  // Its size
+	uint32_t start;     // The first pending byte
+	uint32_t end;       // One past the last pending byte
+} HddConnBuffer;
+
+// A worker, serving its connections from its own event loop
+typedef struct {
+	pthread_t     thread;  // The thread
+	int           epoll;   // The event loop
+	char         *block;   // Where a READ is copied before it is queued
+} HddWorker;
+
+// A client connection
+typedef struct {
+	HddWorker    *worker; // The worker serving it
+	int           fd;     // The socket
+	HddConnState  state;  // What the connection is waiting for
+	HddConnBuffer in;     // Request bytes received and not yet carried out
+	HddConnBuffer out;    // Response bytes not yet sent
+} HddConn;
+
+//
+// Global data
+
+HddStore serverStore;	// the device
+HddWorker serverWorkers[HDD_REF_SERVER_MAX_WORKERS];	// the worker pool
+int serverWorkerCount = 0;	// workers in the pool
+unsigned long serverClients = 0;	// connections open (updated atomically)
+
+//
+// Functions
+
+// make a socket non-blocking
+static int serverNonBlocking(int fd) {
+	int flags = fcntl(fd, F_GETFL, 0);
+
+	return((flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) ? -1 : 0);
+}
+
+// make room for length more bytes at the end of a buffer, moving the
+// pending bytes to the front first
+static int bufferReserve(HddConnBuffer *b, uint32_t length) {
+	uint32_t capacity = (b->capacity > 0) ? b->capacity : HDD_REF_SERVER_BUFFER;
+	char *data;
+
+	if (b->start > 0 && b->capacity - b->end < length) {
+		memmove(b->data, &b->data[b->start], b->end - b->start);
+		b->end -= b->start;
+		b->start = 0;
+	}
+	while (capacity - b->end < length) {
+		capacity *= 2;
+	}
+	if (capacity != b->capacity) {
+		if ((data = realloc(b->data, capacity)) == NULL) {
+			return(-1);
+		}
+		b->data = data;
+		b->capacity = capacity;
+	}
+	return(0);
+}
+
+// drop the consumed bytes of a buffer, returning a large empty one to its first size
+static void bufferCompact(HddConnBuffer *b) {
+	if (b->start < b->end) {
+		return;
+	}
+	b->start = b->end = 0;
+	if (b->capacity > HDD_REF_SERVER_BUFFER) {
+		free(b->data);
+		b->data = NULL;
+		b->capacity = 0;
+	}
+}
+
+// watch a connection for requests, or for room to write its responses
+static int connWatch(HddConn *c, int op) {
+	struct epoll_event ev;
+
+	ev.events = (c->state == HDD_CONN_WRITING) ? EPOLLOUT : EPOLLIN;
+	ev.data.ptr = c;
+	return(epoll_ctl(c->worker->epoll, op, c->fd, &ev));
+}
+
+// carry out the complete requests received on a connection, queueing the
+// responses, 0 if all were carried out and -1 if the protocol was broken
+static int connExecute(HddConn *c) {
+	HddBitCmd cmd, wire;
+	HddBitResp resp;
+	uint64_t range;
+	uint32_t need, bytes, offset, size;
+	char *req;
+
+	while (c->in.end - c->in.start >= HDD_NET_HEADER_SIZE) {
+		req = &c->in.data[c->in.start];
+		memcpy(&wire, req, HDD_NET_HEADER_SIZE);
+		cmd = ntohll64(wire);
+		need = HDD_NET_HEADER_SIZE;
+		offset = 0;
+		if (((cmd >> 33) & 0x7) == HDD_RANGE) {	// the range word follows the command
+			need += HDD_NET_RANGE_SIZE;
+		}
+		if ((bytes = hdd_store_request_bytes(cmd)) > HDD_MAX_BLOCK_SIZE) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD_REF_SERVER : request of %u bytes too large, dropping client.", bytes);
+			return(-1);
+		}
+		if (c->in.end - c->in.start < need + bytes) {	// wait for the rest, with room to receive it
+			return(bufferReserve(&c->in, need + bytes - (c->in.end - c->in.start)));
+		}
+		if (need > HDD_NET_HEADER_SIZE) {
+			memcpy(&range, &req[HDD_NET_HEADER_SIZE], HDD_NET_RANGE_SIZE);
+			offset = (uint32_t)ntohll64(range);
+		}
+
+		resp = hdd_store_execute(&serverStore, cmd, offset, (bytes > 0) ? &req[need] : c->worker->block);
+		c->in.start += need + bytes;
+		size = (((resp >> 62) & 0x3) == HDD_BLOCK_READ) ? (resp >> 36) & 0x3ffffff : 0;
+		if (bufferReserve(&c->out, HDD_NET_HEADER_SIZE + size)) {
+			return(-1);
+		}
+		wire = htonll64(resp);
+		memcpy(&c->out.data[c->out.end], &wire, HDD_NET_HEADER_SIZE);
+		memcpy(&c->out.data[c->out.end + HDD_NET_HEADER_SIZE], c->worker->block, size);
+		c->out.end += HDD_NET_HEADER_SIZE + size;
+	}
+	return(0);
+}
+
+// send the queued responses of a connection, 0 if sent (or the socket is
+// full) and -1 on failure
+static int connSend(HddConn *c) {
+	ssize_t ret;
+
+	while (c->out.start < c->out.end) {
+		ret = write(c->fd, &c->out.data[c->out.start], c->out.end - c->out.start);
+		if (ret == -1 && errno == EINTR) {
+			continue;
+		}
+		if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return(0);
+		}
+		if (ret <= 0) {
+			return(-1);
+		}
+		c->out.start += ret;
+	}
+	bufferCompact(&c->out);
+	return(0);
+}
+
+// receive what the client has sent into the room left in the input buffer
+// (the event loop comes back for the rest), 0 if received and -1 if the
+// client went away
+static int connReceive(HddConn *c) {
+	ssize_t ret;
+
+	if (c->in.end == c->in.capacity && bufferReserve(&c->in, HDD_REF_SERVER_BUFFER / 2)) {
+		return(-1);
+	}
+	while (c->in.end < c->in.capacity) {
+		ret = read(c->fd, &c->in.data[c->in.end], c->in.capacity - c->in.end);
+		if (ret == -1 && errno == EINTR) {
+			continue;
+		}
+		if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return(0);
+		}
+		if (ret <= 0) {
+			return(-1);
+		}
+		c->in.end += ret;
+		if (c->in.end < c->in.capacity) {	// a short read means nothing more is waiting
+			return(0);
+		}
+	}
+	return(0);
+}
+
+// advance a connection after its socket is ready: receive, carry out the
+// complete requests and send the responses, then wait for whatever it
+// needs next
+static void connStep(HddConn *c, uint32_t events) {
+	HddConnState was = c->state;
+
+	if ((events & (EPOLLERR | EPOLLHUP)) && !(events & EPOLLIN)) {
+		c->state = HDD_CONN_CLOSING;
+	}
+	if (c->state == HDD_CONN_READING && connReceive(c)) {
+		c->state = HDD_CONN_CLOSING;
+	}
+	while (c->state != HDD_CONN_CLOSING) {
+		if (connSend(c)) {
+			c->state = HDD_CONN_CLOSING;
+		} else if (c->out.start < c->out.end) {	// the socket is full, stop reading until it drains
+			c->state = HDD_CONN_WRITING;
+			break;
+		} else {
+			c->state = HDD_CONN_READING;
+			if (connExecute(c)) {
+				c->state = HDD_CONN_CLOSING;
+			} else if (c->out.start == c->out.end) {	// nothing more to send
+				break;
+			}
+		}
+	}
+
+	if (c->state == HDD_CONN_CLOSING) {
+		epoll_ctl(c->worker->epoll, EPOLL_CTL_DEL, c->fd, NULL);
+		close(c->fd);
+		free(c->in.data);
+		free(c->out.data);
+		free(c);
+		hdd_log(LOG_INFO_LEVEL, "HDD_REF_SERVER : client disconnected, %lu connected.",
+			__sync_sub_and_fetch(&serverClients, 1));
+		return;
+	}
+	bufferCompact(&c->in);
+	if (c->state != was) {
+		connWatch(c, EPOLL_CTL_MOD);
+	}
+}
+
+// serve the connections of a worker as their sockets become ready
+static void *serverWorker(void *arg) {
+	HddWorker *w = (HddWorker *)arg;
+	struct epoll_event events[HDD_REF_SERVER_MAX_EVENTS];
+	int i, count;
+
+	while (1) {
+		if ((count = epoll_wait(w->epoll, events, HDD_REF_SERVER_MAX_EVENTS, -1)) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			hdd_log(LOG_ERROR_LEVEL, "HDD_REF_SERVER : epoll_wait failed [%s].", strerror(errno));
+			break;
+		}
+		for (i = 0; i < count; i++) {
+			connStep((HddConn *)events[i].data.ptr, events[i].events);
+		}
+	}
+	return NULL;
+}
+
+// hand an accepted client to a worker
+static void serverAdd(int fd, HddWorker *w, int tcp) {
+	HddConn *c;
+	int on = 1;
+
+	if (tcp) {	// the responses are small and must not wait
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	}
+	if (serverNonBlocking(fd) || (c = calloc(1, sizeof(HddConn))) == NULL) {
+		close(fd);
+		return;
+	}
+	c->worker = w;
+	c->fd = fd;
+	c->state = HDD_CONN_READING;
+	if (connWatch(c, EPOLL_CTL_ADD)) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_REF_SERVER : failed to watch client [%s].", strerror(errno));
+		close(fd);
+		free(c);
+		return;
+	}
+	hdd_log(LOG_INFO_LEVEL, "HDD_REF_SERVER : client connected, %lu connected.",
+		__sync_add_and_fetch(&serverClients, 1));
+}
+
+// create the listening socket for a port or a unix:<path> address
+static int serverListen(const char *addr, uint16_t port) {
+	struct sockaddr_in caddr;
+	struct sockaddr_un uaddr;
+	struct sockaddr *saddr;
+	socklen_t slen;
+	int fd, on = 1;
+
+	if (addr != NULL) {
+		addr += strlen(HDD_UNIX_PREFIX);
+		if (addr[0] == '\0' || strlen(addr) >= sizeof(uaddr.sun_path)) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD_REF_SERVER : bad unix socket path [%s].", addr);
+			return(-1);
+		}
+		memset(&uaddr, 0x0, sizeof(uaddr));
+		uaddr.sun_family = AF_UNIX;
+		strcpy(uaddr.sun_path, addr);
+		unlink(addr);	// a stale socket from an earlier run
+		saddr = (struct sockaddr *)&uaddr;
+		slen = sizeof(uaddr);
+	} else {
+		memset(&caddr, 0x0, sizeof(caddr));
+		caddr.sin_family = AF_INET;
+		caddr.sin_port = htons(port);
+		caddr.sin_addr.s_addr = htonl(INADDR_ANY);
+		saddr = (struct sockaddr *)&caddr;
+		slen = sizeof(caddr);
+	}
+
+	if ((fd = socket((addr != NULL) ? PF_UNIX : PF_INET, SOCK_STREAM, 0)) == -1) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_REF_SERVER : failed to create socket [%s].", strerror(errno));
+		return(-1);
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (bind(fd, saddr, slen) == -1 || listen(fd, SOMAXCONN) == -1) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_REF_SERVER : failed to listen [%s].", strerror(errno));
+		close(fd);
+		return(-1);
+	}
+	return(fd);
+}
+
+// allow as many open sockets as the hard limit does
+static void serverRaiseLimit(void) {
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the reference server
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0, lfd, fd, i, next = 0;
+	uint16_t port = HDD_DEFAULT_PORT;
+	char *addr = NULL, *path = HDD_STORE_DEFAULT_FILE;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, HDD_REF_SERVER_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'p': // Set the port
+			port = (uint16_t)atoi( optarg );
+			break;
+
+		case 'a': // Listen on a Unix-domain socket
+			if ( strncmp(optarg, HDD_UNIX_PREFIX, strlen(HDD_UNIX_PREFIX)) != 0 ) {
+				fprintf( stderr, "Bad listen address (%s), use unix:<path>, aborting.\n", optarg );
+				return( -1 );
+			}
+			addr = optarg;
+			break;
+
+		case 's': // Set the store file
+			path = optarg;
+			break;
+
+		case 'w': // Set the number of workers
+			if ( (sscanf(optarg, "%d", &serverWorkerCount) != 1) || (serverWorkerCount < 1) ||
+				(serverWorkerCount > HDD_REF_SERVER_MAX_WORKERS) ) {
+				fprintf( stderr, "Bad worker count (%s), aborting.\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	if ( verbose ) {
+		enableLogLevels( LOG_INFO_LEVEL );
+	}
+
+	// Setup the store, the listening socket and the workers
+	signal( SIGPIPE, SIG_IGN );	// a client that goes away is seen as a failed write
+	serverRaiseLimit();
+	if ( serverWorkerCount == 0 ) {
+		serverWorkerCount = (cpus < 1) ? 1 : (cpus > HDD_REF_SERVER_MAX_WORKERS) ? HDD_REF_SERVER_MAX_WORKERS : (int)cpus;
+	}
+	if ( hdd_store_init(&serverStore, path) || ((lfd = serverListen(addr, port)) == -1) ) {
+		hdd_log( LOG_ERROR_LEVEL, "HDD_REF_SERVER : server setup failed." );
+		return( -1 );
+	}
+	for (i=0; i<serverWorkerCount; i++) {
+		if ( ((serverWorkers[i].block = malloc(HDD_MAX_BLOCK_SIZE)) == NULL) ||
+			((serverWorkers[i].epoll = epoll_create1(0)) == -1) ||
+			pthread_create(&serverWorkers[i].thread, NULL, serverWorker, &serverWorkers[i]) ) {
+			hdd_log( LOG_ERROR_LEVEL, "HDD_REF_SERVER : failed to start worker %d.", i );
+			return( -1 );
+		}
+	}
+	if ( addr != NULL ) {
+		hdd_log( LOG_OUTPUT_LEVEL, "HDD_REF_SERVER : serving [%s] on %s with %d workers", path, addr, serverWorkerCount );
+	} else {
+		hdd_log( LOG_OUTPUT_LEVEL, "HDD_REF_SERVER : serving [%s] on port %u with %d workers", path, port, serverWorkerCount );
+	}
+
+	// Accept the clients, handing them to the workers in turn
+	while ( 1 ) {
+		if ( (fd = accept(lfd, NULL, NULL)) == -1 ) {
+			if ( errno == EINTR || errno == ECONNABORTED ) {
+				continue;
+			}
+			hdd_log( LOG_ERROR_LEVEL, "HDD_REF_SERVER : accept failed [%s].", strerror(errno) );
+			if ( errno == EMFILE || errno == ENFILE ) {	// wait for clients to leave
+				usleep( 100000 );
+				continue;
+			}
+			break;
+		}
+		serverAdd( fd, &serverWorkers[next], addr == NULL );
+		next = (next + 1) % serverWorkerCount;
+	}
+
+	// Cleanup and return (the workers are left serving until exit)
+	close( lfd );
+	return( -1 );
+}
@@ -20,48 +20,79 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <pthread.h>
+#include <sys/time.h>
 
 // Project Includes
 #include <hdd_driver.h>
 #include <hdd_network.h>
 #include <hdd_file_io.h>
+#include <hdd_async.h>
+#include <hdd_cache.h>
+#include <hdd_slab.h>
+#include <hdd_workload.h>
+#include <hdd_stats.h>
+#include <hdd_store.h>
 #include <cmpsc311_log.h>
+#include <hdd_log.h>
 #include <cmpsc311_util.h>
-#include <cmpsc311_hashtable.h>
 
 // Defines
-#define HDD_SIM_MAX_OPEN_FILES 128
-#define HDD_ARGUMENTS "hvul:x:a:p:"
+#define HDD_SIM_MAX_THREADS 64
+#define HDD_ARGUMENTS "hvul:c:q:t:s:n:x:a:p:dkrbij:"
 #define USAGE \
-	"USAGE: hdd [-h] [-v] [-l <logfile>] [-c <sz>] [-x <file>] [-a <ip addr>] [-p <port>] <workload-file>\n" \
+	"USAGE: hdd [-h] [-v] [-l <logfile>] [-c <sz>] [-q <depth>] [-t <threads>] [-s <depth>] [-n <conns>] [-x <file>] [-a <ip addr|unix:path|loopback>] [-d] [-k] [-r] [-i] [-p <port>] [-b] [-j <file>] <workload-file>\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
 	"    -u - run the unit tests instead of the simulator\n" \
 	"    -v - verbose output\n" \
 	"    -l - write log messages to the filename <logfile>\n" \
+	"    -c - size of the client block cache in blocks (default 1024)\n" \
+	"    -q - number of block requests kept in flight to the server (default 16)\n" \
+	"    -t - run the workload on <threads> threads, split by filename (default 1)\n" \
+	"    -s - replay asynchronously from one thread, <depth> file commands in flight\n" \
+	"    -n - most connections to the server (default 1, the server must serve them at once)\n" \
 	"    -x - extract a file <file> from the hdd filesystem\n" \
-	"    -a - IP address of server to connect to.\n" \
+	"    -a - IP address of server to connect to, or unix:<path> for a Unix-domain socket.\n" \
+	"         loopback[:<file>] runs an in-process store instead, saved to <file> (default hdd_store.svd).\n" \
+	"    -d - set TCP_NODELAY on the server connections.\n" \
+	"    -k - ACK server responses at once (TCP_QUICKACK), for a server that holds them until ACKed (the shipped hdd_server)\n" \
+	"    -r - the server implements ranged block requests (hdd_ref_server, not the shipped hdd_server)\n" \
+	"    -i - carry the server requests over io_uring (blocking sockets where it is unavailable)\n" \
 	"    -p - port number of server to connect to.\n" \
+	"    -b - the workload file is a binary trace compiled by hdd_wlc\n" \
+	"    -j - write the latency histograms and byte counts of the run as JSON to <file> (- for stdout)\n" \
 	"\n" \
 	"    <workload-file> - file contain the workload to simulate\n" \
 	"\n" \
 
-// This is the file table
+// The file commands of a workload phase given to one simulation thread
 typedef struct {
-	char     *filename;  // This is the filename for the test file
-	int16_t   fhandle;   // This is a file handle for the opened file
-} HddSimulationTable;
+	HddWorkload    *wl;     // The workload
+	HddWorkloadOp **ops;    // The operations of the thread
+	int             count;  // The number of operations
+	int             slots;  // The allocated entries in ops
+	HddWorkloadFiles files; // The files opened by the thread
+	int             result; // 0 if the operations were carried out, -1 on failure
+} HddSimulationThread;
 
 //
 // Global Data
 int verbose;
+int binary_trace = 0; // The workload file is a compiled trace (-b)
+char *stats_file = NULL; // Where the run statistics are written (-j)
+uint32_t async_depth = 0; // File commands in flight of an asynchronous replay (-s), 0 for none
 
 //
 // Functional Prototypes
 
 int simulate_HDD( char *wload );
+int simulate_HDD_threaded( char *wload, int threads );
+void * simulate_thread( void *arg );
+int run_sim_threads( HddSimulationThread *thr, int threads );
 int extract_file_from_hdd(char *ex_file);
+void log_workload( HddWorkload *wl );
 
 //
 // Functions
@@ -78,7 +109,10 @@ int extract_file_from_hdd(char *ex_file);
 int main( int argc, char *argv[] ) {
 	// Local variables
 	int ch, verbose = 0, unit_tests = 0, log_initialized = 0, extract_file = 0;
-	uint32_t cache_size = 1024; // Defaults to 1024 cache lines
+	uint32_t cache_size = HDD_DEFAULT_CACHE_SIZE; // Defaults to 1024 cache lines
+	uint32_t queue_depth = HDD_CLIENT_DEFAULT_DEPTH; // Defaults to 16 requests in flight
+	uint32_t connections = 1; // Defaults to a single server connection
+	int threads = 1; // Defaults to a single simulation thread
 	char *ex_file = NULL;
 
 	// Process the command line parameters
@@ -109,22 +143,74 @@ int main( int argc, char *argv[] ) {
 
 		case 'c': // Set cache line size
 			if ( sscanf( optarg, "%u", &cache_size ) != 1 ) {
-			    logMessage( LOG_ERROR_LEVEL, "Bad  cache size [%s]", argv[optind] );
+			    hdd_log( LOG_ERROR_LEVEL, "Bad  cache size [%s]", argv[optind] );
                 return(-1);
 			}
 			break;
 
+		case 'q': // Set the client queue depth
+			if ( sscanf( optarg, "%u", &queue_depth ) != 1 ) {
+				hdd_log( LOG_ERROR_LEVEL, "Bad  queue depth [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 't': // Set the number of simulation threads
+			if ( (sscanf( optarg, "%d", &threads ) != 1) || (threads < 1) || (threads > HDD_SIM_MAX_THREADS) ) {
+				hdd_log( LOG_ERROR_LEVEL, "Bad  thread count [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 's': // Replay through the asynchronous queue
+			if ( (sscanf( optarg, "%u", &async_depth ) != 1) || (async_depth < 1) || (async_depth > HDD_ASYNC_MAX_DEPTH) ) {
+				hdd_log( LOG_ERROR_LEVEL, "Bad  async depth [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'n': // Set the number of server connections
+			if ( sscanf( optarg, "%u", &connections ) != 1 ) {
+				hdd_log( LOG_ERROR_LEVEL, "Bad  connection count [%s]", optarg );
+				return(-1);
+			}
+			break;
+
         case 'a': // Get the IP address
-            if (inet_addr(optarg) == INADDR_NONE) {
-			    logMessage( LOG_ERROR_LEVEL, "Bad  cache size [%s]", argv[optind] );
+            if ( hdd_client_check_address(optarg) ) {
+			    hdd_log( LOG_ERROR_LEVEL, "Bad  server address [%s]", optarg );
                 return(-1);
             } 
             hdd_network_address = (unsigned char *)strdup(optarg);
 			break;
 
+        case 'd': // Disable Nagle on TCP connections
+			hdd_network_nodelay = 1;
+			break;
+
+        case 'k': // ACK the server responses at once
+			hdd_network_quickack = 1;
+			break;
+
+        case 'r': // Send ranged block requests
+			hdd_network_ranged = 1;
+			break;
+
+        case 'i': // Carry the requests over io_uring
+			hdd_network_uring = 1;
+			break;
+
+        case 'b': // The workload is a compiled trace
+			binary_trace = 1;
+			break;
+
+        case 'j': // Write the run statistics
+			stats_file = optarg;
+			break;
+
         case 'p': // Set the network port number
 			if ( sscanf(optarg, "%hu", &hdd_network_port) != 1 ) {
-			    logMessage( LOG_ERROR_LEVEL, "Bad  port number [%s]", argv[optind] );
+			    hdd_log( LOG_ERROR_LEVEL, "Bad  port number [%s]", argv[optind] );
                 return(-1);
 			}
             break;
@@ -143,24 +229,36 @@ int main( int argc, char *argv[] ) {
 		enableLogLevels( LOG_INFO_LEVEL );
 	}
 
+	// Size the client block cache
+	if ( set_hdd_cache_size(cache_size) ) {
+		hdd_log( LOG_ERROR_LEVEL, "Bad cache size [%u]", cache_size );
+		return( -1 );
+	}
+
+	// Set how many requests are pipelined to the server
+	if ( hdd_client_set_depth(queue_depth) || hdd_client_set_connections(connections) ) {
+		return( -1 );
+	}
+
 	// If we are running the unit tests, do that
 	if ( unit_tests ) {
 
 		// Enable verbose, run the tests and check the results
 		enableLogLevels( LOG_INFO_LEVEL );
-		if ( b64UnitTest() || hddIOUnitTest() ) {
-			logMessage( LOG_ERROR_LEVEL, "HDD unit tests failed.\n\n" );
+		if ( b64UnitTest() || hddSlabUnitTest() || hddCacheUnitTest() || hddStatsUnitTest() || hddStoreUnitTest() || hddWorkloadUnitTest() || hddIOUnitTest() || hddAsyncUnitTest() ) {
+			hdd_log( LOG_ERROR_LEVEL, "HDD unit tests failed.\n\n" );
 		} else {
-			logMessage( LOG_INFO_LEVEL, "HDD unit tests completed successfully.\n\n" );
+			hdd_log( LOG_INFO_LEVEL, "HDD unit tests completed successfully.\n\n" );
 		}
 
 	} else if (extract_file) {
 
 		// Extracting a file from the hdd file systems
 		if (extract_file_from_hdd(ex_file) == 0) {
-			logMessage(LOG_INFO_LEVEL, "File [%s] extracted from hdd successfully.\n\n", ex_file);
+			hdd_log(LOG_INFO_LEVEL, "File [%s] extracted from hdd successfully.\n\n", ex_file);
 		} else {
-			logMessage(LOG_ERROR_LEVEL, "File [%s] extraction failed, aborting.\n\n");
+			hdd_log(LOG_ERROR_LEVEL, "File [%s] extraction failed, aborting.\n\n", ex_file);
+			return( -1 );
 		}
 
 	} else {
@@ -175,10 +273,14 @@ int main( int argc, char *argv[] ) {
 		}
 
 		// Run the simulation
-		if ( simulate_HDD(argv[optind]) == 0 ) {
-			logMessage( LOG_INFO_LEVEL, "HDD simulation completed successfully.\n\n" );
+		hdd_stats_reset();
+		if ( (((threads > 1) && (async_depth == 0)) ? simulate_HDD_threaded(argv[optind], threads) : simulate_HDD(argv[optind])) == 0 ) {
+			hdd_log( LOG_INFO_LEVEL, "HDD simulation completed successfully.\n\n" );
 		} else {
-			logMessage( LOG_INFO_LEVEL, "HDD simulation failed.\n\n" );
+			hdd_log( LOG_INFO_LEVEL, "HDD simulation failed.\n\n" );
+		}
+		if ( (stats_file != NULL) && hdd_stats_write_json(stats_file) ) {
+			return( -1 );
 		}
 	}
 
@@ -190,7 +292,9 @@ int main( int argc, char *argv[] ) {
 //
 // Function     : simulate_HDD
 // Description  : The main control loop for the processing of the HDD
-//                simulation.
+//                simulation.  The workload is compiled up front and the
+//                operations are replayed, the compile and replay times are
+//                reported separately.
 //
 // Inputs       : wload - the name of the workload file
 // Outputs      : 0 if successful test, -1 if failure
@@ -198,238 +302,187 @@ int main( int argc, char *argv[] ) {
 int simulate_HDD( char *wload ) {
 
 	// Local variables
-	char line[2048], fname[128], command[128], text[2048], *sep, *rbuf;
-	FILE *fhandle = NULL;
-	int32_t err=0, len, off, fields, linecount;
-	HddSimulationTable ftable[HDD_SIM_MAX_OPEN_FILES];
-	int idx, i;
-
-	// Setup the file table
-	memset(ftable, 0x0, sizeof(HddSimulationTable)*HDD_SIM_MAX_OPEN_FILES);
-
-	// Open the workload file
-	linecount = 0;
-	if ( (fhandle=fopen(wload, "r")) == NULL ) {
-		logMessage( LOG_ERROR_LEVEL, "Failure opening the workload file [%s], error: %s.\n",
-			wload, strerror(errno) );
+	HddWorkload wl;
+	struct timeval start, end;
+	int ret;
+	double secs;
+
+	// Compile the workload
+	if ( (binary_trace ? hdd_workload_load_trace(&wl, wload) : hdd_workload_load(&wl, wload)) ) {
 		return( -1 );
 	}
+	log_workload( &wl );
+
+	// Replay the operations, in order or through the asynchronous queue
+	gettimeofday( &start, NULL );
+	ret = (async_depth > 0) ? hdd_workload_replay_async( &wl, async_depth ) : hdd_workload_replay( &wl );
+	gettimeofday( &end, NULL );
+
+	// Report the replay, release the workload
+	secs = (double)compareTimes(&start, &end) / 1000000.0;
+	hdd_log( LOG_OUTPUT_LEVEL, "HDD_SIM : replayed %u commands in %.3f secs (%.0f commands/sec)",
+		wl.count, secs, (secs > 0) ? wl.count / secs : 0.0 );
+	hdd_workload_free( &wl );
+	return( ret );
+}
 
-	// While file not done
-	while (!feof(fhandle)) {
-
-		// Get the line and bail out on fail
-		if (fgets(line, 2048, fhandle) != NULL) {
-
-			// Parse out the string
-			linecount ++;
-			fields = sscanf(line, "%s %s %d %d", fname, command, &len, &off);
-			sep = strchr(line, ':');
-			if ( (fields != 4) || (sep == NULL) ) {
-				logMessage( LOG_ERROR_LEVEL, "HDD un-parsable workload string, aborting [%s], line %d",
-						line, linecount );
-				fclose( fhandle );
-				return( -1 );
-			}
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : simulate_HDD_threaded
+// Description  : Run the simulation on several threads.  The file commands
+//                are split by file so each file is used by one thread in
+//                workload order, the threads run until the next FORMAT,
+//                MOUNT or UNMOUNT (closing their files), which is then done
+//                by the main thread.  Reports the rate of file commands.
+//
+// Inputs       : wload - the name of the workload file
+//                threads - the number of threads
+// Outputs      : 0 if successful test, -1 if failure
 
-			// Just log the contents
-			logMessage(LOG_INFO_LEVEL, "File [%s], command [%s], len=%d, offset=%d",
-					fname, command, len, off);
-
-			// Now process the commands
-			if (strncmp(command, "FORMAT", 6) == 0) {
-
-				// Log the command executed
-				logMessage(LOG_INFO_LEVEL, "HDD_SIM : Formatting HDD filesystem");
-
-				// Now perform the format
-				if (hdd_format() != len) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Formatting failed, aborting simulation.");
-					return(-1);
-				}
-
-			} else if (strncmp(command, "MOUNT", 5) == 0) {
-
-				// Log the command executed
-				logMessage(LOG_INFO_LEVEL, "HDD_SIM : Mounting HDD filesystem");
-
-				// Now perform the filesystem mount
-				if (hdd_mount() != len) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Mount failed, aborting simulation.");
-					return(-1);
-				}
-
-			} else if (strncmp(command, "UNMOUNT", 5) == 0) {
-
-				// Log the command executed
-				logMessage(LOG_INFO_LEVEL, "HDD_SIM : Un-mounting HDD filesystem");
-
-				// Finished, close all of the files
-				for (idx=0; idx<HDD_SIM_MAX_OPEN_FILES; idx++) {
-
-					// If file in use, close if
-					if (ftable[idx].filename != NULL) {
-						// Log the file close
-						logMessage(LOG_INFO_LEVEL, "HDD_SIM : Closing file [%s]", ftable[idx].filename);
-						if (hdd_close(ftable[idx].fhandle) == -1) {
-							// Failed, error out
-							logMessage(LOG_ERROR_LEVEL, "Close file [%s] failed, aborting simulation.", ftable[idx].filename);
-							return(-1);
-						}
-						free(ftable[idx].filename);
-						ftable[idx].filename = NULL;
-					}
-
-				}
-
-				// Now perform the filesystem unmount
-				if (hdd_unmount() != len) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Mount failed, aborting simulation.");
-					return(-1);
-				}
-
-
-			} else {
-
-				//
-				// File operations
-
-				// Now walk the the table looking for the file
-				idx = -1;
-				i = 0;
-				while ( (i < HDD_SIM_MAX_OPEN_FILES) && (idx == -1) ) {
-					if ( (ftable[i].filename != NULL) && (strcmp(ftable[i].filename,fname) == 0) ) {
-						idx = i;
-					}
-					i++;
-				}
-
-				// File is not found, open the file
-				if (idx == -1) {
-
-					// Log message, find unused index and save filename for later use
-					logMessage(LOG_INFO_LEVEL, "HDD_SIM : Opening file [%s]", fname);
-					idx = 0;
-					while ((ftable[idx].filename != NULL) && (idx < HDD_SIM_MAX_OPEN_FILES)) {
-						idx++;
-					}
-					CMPSC_ASSERT1(idx<HDD_SIM_MAX_OPEN_FILES, "Too many open files on HDD sim [%d]", idx);
-					ftable[idx].filename = strdup(fname);
-
-					// Now perform the open
-					ftable[idx].fhandle = hdd_open(ftable[idx].filename);
-					if (ftable[idx].fhandle == -1) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "Open of new file [%s] failed, aborting simulation.", fname);
-						return(-1);
-					}
-
-				}
-
-				// Now execute the specific command
-				if (strncmp(command, "WRITEAT", 7) == 0) {
-
-					// Log the command executed
-					logMessage(LOG_INFO_LEVEL, "HDD_SIM : Writing %d bytes at position %d from file [%s]", len, off, fname);
-
-					// First perform the seek
-					if (hdd_seek(ftable[idx].fhandle, off)) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "Seek/WriteAt file [%s] to position %d failed, aborting simulation.", fname, off);
-						return(-1);
-					}
-
-					// Now see if we need more data to fill, terminate the lines
-					CMPSC_ASSERT1(len<1024, "Simulated workload command text too large [%d]", len);
-					CMPSC_ASSERT2((strlen(sep+1)>=len), "Workload str [%d<%d]", strlen(sep+1), len);
-					strncpy(text, sep+1, len);
-					text[len] = 0x0;
-					for (i=0; i<strlen(text); i++) {
-						if (text[i] == '*') {
-							text[i] = '\n';
-						}
-					}
-
-					// Now perform the write
-					if (hdd_write(ftable[idx].fhandle, text, len) != len) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "WriteAt of file [%s], length %d failed, aborting simulation.", fname, len);
-						return(-1);
-					}
-
-				} else if (strncmp(command, "WRITE", 5) == 0) {
-
-					// Now see if we need more data to fill, terminate the lines
-					CMPSC_ASSERT1(len<1024, "Simulated workload command text too large [%d]", len);
-					CMPSC_ASSERT2((strlen(sep+1)>=len), "Workload str [%d<%d]", strlen(sep+1), len);
-					strncpy(text, sep+1, len);
-					text[len] = 0x0;
-					for (i=0; i<strlen(text); i++) {
-						if (text[i] == '*') {
-							text[i] = '\n';
-						}
-					}
-
-					// Log the command executed
-					logMessage(LOG_INFO_LEVEL, "HDD_SIM : Writing %d bytes to file [%s]", len, fname);
-
-					// Now perform the write
-					if (hdd_write(ftable[idx].fhandle, text, len) != len) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "Write of file [%s], length %d failed, aborting simulation.", fname, len);
-						return(-1);
-					}
-
-				} else if (strncmp(command, "SEEK", 4) == 0) {
-
-					// Log the command executed
-					logMessage(LOG_INFO_LEVEL, "HDD_SIM : Seeking to position %d in file [%s]", off, fname);
-
-					// Now perform the seek
-					if (hdd_seek(ftable[idx].fhandle, off) != len) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "Seek in file [%s] to position %d failed, aborting simulation.", fname, off);
-						return(-1);
-					}
-
-				} else if (strncmp(command, "READ", 4) == 0) {
-
-					// Log the command executed
-					logMessage(LOG_INFO_LEVEL, "HDD_SIM : Reading %d bytes from file [%s]", len, fname);
-
-					// Now perform the read
-					rbuf = malloc(len);
-					if (hdd_read(ftable[idx].fhandle, rbuf, len) != len) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "Read file [%s] of length %d failed, aborting simulation.", fname, off);
-						return(-1);
-					}
-					free(rbuf);
-					rbuf = NULL;
-
-				} else {
-
-					// Bomb out, don't understand the command
-					CMPSC_ASSERT1(0, "HDD_SIM : Failed, unknown command [%s]", command);
-
-				}
-			}
+int simulate_HDD_threaded( char *wload, int threads ) {
+
+	// Local variables
+	HddSimulationThread thr[HDD_SIM_MAX_THREADS], *t;
+	struct timeval start, end;
+	HddWorkload wl;
+	int16_t *fhandle = NULL;
+	int32_t ops = 0, ret = 0;
+	uint64_t opStart;
+	uint32_t i;
+	double secs;
+
+	// Compile the workload, each thread gets its own file table over the shared handles
+	if ( (binary_trace ? hdd_workload_load_trace(&wl, wload) : hdd_workload_load(&wl, wload)) ) {
+		return( -1 );
+	}
+	log_workload( &wl );
+	memset(thr, 0x0, sizeof(thr));
+	for (i=0; i<threads; i++) {
+		thr[i].wl = &wl;
+		if ( (ret == 0) && hdd_workload_init_files(&thr[i].files, &wl, fhandle) ) {
+			ret = -1;
+		}
+		fhandle = thr[0].files.fhandle;
+	}
 
-			// Check for the virtual level failing
-			if ( err ) {
-				logMessage( LOG_ERROR_LEVEL, "HDD system failed, aborting [%d]", err );
-				fclose( fhandle );
-				return( -1 );
+	gettimeofday( &start, NULL );
+	for (i=0; (i<wl.count) && (ret == 0); i++) {
+
+		// File commands go to the thread that owns the file
+		if ( wl.ops[i].op > HDD_WL_UNMOUNT ) {
+			t = &thr[wl.ops[i].file % threads];
+			if ( t->count == t->slots ) {
+				t->slots = (t->slots > 0) ? t->slots * 2 : 1024;
+				t->ops = realloc( t->ops, t->slots * sizeof(HddWorkloadOp *) );
 			}
+			t->ops[t->count++] = &wl.ops[i];
+			ops ++;
+			continue;
+		}
+
+		// Device commands wait for the threads to finish their commands
+		if ( run_sim_threads(thr, threads) ) {
+			ret = -1;
+		} else {
+			opStart = hdd_stats_now();
+			ret = hdd_workload_device_op( &wl.ops[i] );
+			hdd_stats_record( HDD_STATS_FORMAT + wl.ops[i].op, opStart );
 		}
 	}
+	if ( (ret == 0) && run_sim_threads(thr, threads) ) {
+		ret = -1;
+	}
+	gettimeofday( &end, NULL );
 
-	// Close the workload file, successfully
-	fclose( fhandle );
-	return( 0 );
+	// Release the thread command lists, report the rate
+	for (i=0; i<threads; i++) {
+		free( thr[i].ops );
+		hdd_workload_free_files( &thr[i].files );
+	}
+	hdd_workload_free( &wl );
+	secs = (double)compareTimes(&start, &end) / 1000000.0;
+	hdd_log( LOG_OUTPUT_LEVEL, "HDD_SIM : %d threads, %d file commands in %.3f secs (%.0f commands/sec)",
+		threads, ops, secs, (secs > 0) ? ops / secs : 0.0 );
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : run_sim_threads
+// Description  : Run the gathered file commands of each thread and wait for
+//                them, the command lists are emptied afterwards.
+//
+// Inputs       : thr - the simulation threads
+//                threads - the number of threads
+// Outputs      : 0 if successful, -1 if failure
+
+int run_sim_threads( HddSimulationThread *thr, int threads ) {
+
+	// Local variables
+	pthread_t tid[HDD_SIM_MAX_THREADS];
+	int started[HDD_SIM_MAX_THREADS];
+	int i, ret = 0;
+
+	for (i=0; i<threads; i++) {
+		started[i] = (pthread_create(&tid[i], NULL, simulate_thread, &thr[i]) == 0);
+		if ( ! started[i] ) {
+			hdd_log( LOG_ERROR_LEVEL, "HDD_SIM : failed to start thread %d.", i );
+			thr[i].result = -1;
+		}
+	}
+	for (i=0; i<threads; i++) {
+		if ( started[i] ) {
+			pthread_join( tid[i], NULL );
+		}
+		if ( thr[i].result ) {
+			ret = -1;
+		}
+		thr[i].count = 0;
+	}
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : simulate_thread
+// Description  : Carry out the file commands of one simulation thread,
+//                closing its files at the end.
+//
+// Inputs       : arg - the HddSimulationThread of the thread
+// Outputs      : NULL (the result is left in the thread structure)
+
+void * simulate_thread( void *arg ) {
+
+	// Local variables
+	HddSimulationThread *thr = arg;
+	uint64_t start;
+	int i;
+
+	// Run the commands, then close the files
+	thr->result = 0;
+	for (i=0; (i<thr->count) && (thr->result == 0); i++) {
+		start = hdd_stats_now();
+		thr->result = hdd_workload_file_op( &thr->files, thr->wl, thr->ops[i] );
+		hdd_stats_record( HDD_STATS_FORMAT + thr->ops[i]->op, start );
+	}
+	if ( hdd_workload_close_files(&thr->files, thr->wl) ) {
+		thr->result = -1;
+	}
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_workload
+// Description  : Report the cost of compiling a workload
+//
+// Inputs       : wl - the workload
+// Outputs      : none
+
+void log_workload( HddWorkload *wl ) {
+	hdd_log( LOG_OUTPUT_LEVEL, "HDD_SIM : parsed %u commands (%u files, %lu bytes) in %.3f secs (%.1f MB/s)",
+		wl->count, wl->fileCount, (unsigned long)wl->mapSize, wl->parseSecs,
+		(wl->parseSecs > 0) ? wl->mapSize / wl->parseSecs / (1024 * 1024) : 0.0 );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -445,15 +498,25 @@ int extract_file_from_hdd(char *ex_file) {
 	// Local variables
 	int16_t fd;
 	int32_t len;
-	char buf[HDD_MAX_BLOCK_SIZE];
+	uint32_t off = 0;
+	HddReadView view;
     int fhandle, flags;
     mode_t mode;
-	// Open the file, read from it, close it
-	if ( (hdd_mount()) || ((fd = hdd_open(ex_file)) == -1) ||
-		 ((len = hdd_read(fd, buf, HDD_MAX_BLOCK_SIZE)) == -1) ||
-		 (hdd_close(fd) == -1)	) {
+	// Check the file was written, hdd_open would create an empty one
+	if ( hdd_mount() ) {
+		hdd_log(LOG_INFO_LEVEL, "HDD : extraction failed on hdd interface [%s].", ex_file);
+		return(-1);
+	}
+	if ( !hdd_exists(ex_file) ) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD : extraction failed, no file [%s] on the hdd.", ex_file);
+		hdd_unmount();
+		return(-1);
+	}
+
+	// Open the file, it is read through views of the cached blocks (no copies)
+	if ( (fd = hdd_open(ex_file)) == -1 ) {
 		// Error out
-		logMessage(LOG_INFO_LEVEL, "HDD : extraction failed on hdd interface [%s].", ex_file);
+		hdd_log(LOG_INFO_LEVEL, "HDD : extraction failed on hdd interface [%s].", ex_file);
 		return(-1);
 	}
 
@@ -466,9 +529,18 @@ int extract_file_from_hdd(char *ex_file) {
         return( -1 );
     }
 
-    // Now write the read bytes to the file, then close
-    if (write(fhandle, buf, len) != len) {
-        fprintf( stderr, "HDD: extraction write() failed, error=%s\n", strerror(errno) );
+    // Now write the viewed bytes to the file, files can span many blocks so keep viewing
+    while ( (len = hdd_read_view(fd, off, HDD_MAX_BLOCK_SIZE, &view)) > 0 ) {
+        if (write(fhandle, view.data, len) != len) {
+            fprintf( stderr, "HDD: extraction write() failed, error=%s\n", strerror(errno) );
+            hdd_release_view(&view);
+            return( -1 );
+        }
+        hdd_release_view(&view);
+        off += len;
+    }
+    if ( (len == -1) || (hdd_close(fd) == -1) ) {
+        hdd_log(LOG_INFO_LEVEL, "HDD : extraction failed on hdd interface [%s].", ex_file);
         return( -1 );
     }
     close( fhandle );
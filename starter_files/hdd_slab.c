@@ -0,0 +1,403 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : hdd_slab.c
+//  Description   : This is the buffer allocator for block payloads.  Sizes
+//                  are rounded up to a power of two class (64 bytes to
+//                  1 MB) and every buffer carries a small header naming
+//                  its class.  Given back buffers go on a free list of
+//                  their class, up to HDD_SLAB_CLASS_IDLE bytes each, and
+//                  are handed out again before the heap is asked for more,
+//                  so once a workload has warmed up it allocates nothing.
+//                  Each class has its own lock.
+//
+//  Author         : Chuyang Zhang
+//  Last Modified  : 2017/12/1
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Project Includes
+#include <hdd_slab.h>
+#include <cmpsc311_log.h>
+#include <hdd_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define HDD_SLAB_LIVE 0x534c4231	// "SLB1", marks a buffer that is handed out
+#define HDD_SLAB_IDLE 0x534c4230	// "SLB0", marks a buffer on a free list
+#define HDD_SLAB_CLASS_IDLE (16 * 1024 * 1024)	// idle bytes kept per class
+#define HDD_SLAB_MIN_IDLE 4	// idle buffers always kept per class
+#define HDD_SLAB_UNIT_TEST_ITERATIONS 4096
+#define HDD_SLAB_UNIT_TEST_BUFFERS 64
+
+// The header in front of every buffer (16 bytes, so buffers stay aligned)
+typedef struct hdd_slab_header {
+	uint32_t magic;	// HDD_SLAB_LIVE or HDD_SLAB_IDLE
+	uint32_t cls;	// the size class
+	struct hdd_slab_header *next;	// the next idle buffer of the class
+} __attribute__((aligned(16))) HddSlabHeader;
+
+// A size class
+typedef struct {
+	pthread_mutex_t lock;	// guards the free list and the counters
+	HddSlabHeader *idle;	// the free list
+	uint32_t idleCount;	// buffers on it
+	uint64_t allocs;	// buffers handed out
+	uint64_t reuses;	// of those, taken from the free list
+	uint64_t frees;	// buffers given back
+} HddSlabClass;
+
+HddSlabClass slabClasses[HDD_SLAB_CLASSES] = {
+	[0 ... HDD_SLAB_CLASSES-1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+uint64_t slabLive = 0;	// bytes handed out
+uint64_t slabPeak = 0;	// the most bytes handed out at once
+
+//
+// Functions
+
+// the buffer size of a class
+static uint32_t slabSize(uint32_t cls) {
+	return (uint32_t)1 << (cls + HDD_SLAB_MIN_SHIFT);
+}
+
+// the smallest class holding size bytes
+static uint32_t slabClass(uint32_t size) {
+	if (size <= ((uint32_t)1 << HDD_SLAB_MIN_SHIFT)) {
+		return 0;
+	}
+	return (32 - __builtin_clz(size - 1)) - HDD_SLAB_MIN_SHIFT;
+}
+
+// count bytes handed out (negative when given back), tracking the peak
+static void slabAddLive(int64_t bytes) {
+	uint64_t live = __sync_add_and_fetch(&slabLive, bytes), peak;
+
+	while (live > (peak = __atomic_load_n(&slabPeak, __ATOMIC_RELAXED)) &&
+		!__sync_bool_compare_and_swap(&slabPeak, peak, live));
+}
+
+// the header of a handed out buffer, NULL (and logged) if it is not one
+static HddSlabHeader *slabHeader(void *buf) {
+	HddSlabHeader *hdr = (HddSlabHeader *)buf - 1;
+
+	if (hdr->magic != HDD_SLAB_LIVE || hdr->cls >= HDD_SLAB_CLASSES) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_SLAB : bad buffer [%p]%s.", buf,
+			(hdr->magic == HDD_SLAB_IDLE) ? " (already given back)" : "");
+		return NULL;
+	}
+	return hdr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_slab_alloc
+// Description  : Get a buffer from the class for size, recycling a given
+//                back one if there is one
+//
+// Inputs       : size - the bytes needed (at most 1 << HDD_SLAB_MAX_SHIFT)
+// Outputs      : the buffer, or NULL on failure
+
+void * hdd_slab_alloc(uint32_t size) {
+	HddSlabClass *c;
+	HddSlabHeader *hdr;
+	uint32_t cls;
+
+	if (size > ((uint32_t)1 << HDD_SLAB_MAX_SHIFT)) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_SLAB : buffer too large [%u].", size);
+		return(NULL);
+	}
+	cls = slabClass(size);
+	c = &slabClasses[cls];
+
+	pthread_mutex_lock(&c->lock);
+	if ((hdr = c->idle) != NULL) {	// reuse a given back buffer
+		c->idle = hdr->next;
+		c->idleCount--;
+		c->reuses++;
+	} else if ((hdr = malloc(sizeof(HddSlabHeader) + slabSize(cls))) != NULL) {
+		hdr->cls = cls;
+	} else {
+		pthread_mutex_unlock(&c->lock);
+		hdd_log(LOG_ERROR_LEVEL, "HDD_SLAB : out of memory [%u].", slabSize(cls));
+		return(NULL);
+	}
+	c->allocs++;
+	pthread_mutex_unlock(&c->lock);
+
+	hdr->magic = HDD_SLAB_LIVE;
+	hdr->next = NULL;
+	slabAddLive(slabSize(cls));
+	return(hdr + 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_slab_realloc
+// Description  : Resize a buffer, keeping its contents.  A buffer whose
+//                class still holds size is returned as it is.
+//
+// Inputs       : buf - the buffer (NULL for a new one)
+//                size - the bytes needed
+// Outputs      : the buffer, or NULL on failure (buf is then untouched)
+
+void * hdd_slab_realloc(void *buf, uint32_t size) {
+	HddSlabHeader *hdr;
+	void *nbuf;
+
+	if (buf == NULL) {
+		return(hdd_slab_alloc(size));
+	}
+	if ((hdr = slabHeader(buf)) == NULL) {
+		return(NULL);
+	}
+	if (size <= slabSize(hdr->cls)) {	// still fits
+		return(buf);
+	}
+	if ((nbuf = hdd_slab_alloc(size)) == NULL) {
+		return(NULL);
+	}
+	memcpy(nbuf, buf, slabSize(hdr->cls));
+	hdd_slab_free(buf);
+	return(nbuf);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_slab_free
+// Description  : Give back a buffer, it is kept for reuse unless its class
+//                already holds enough idle buffers
+//
+// Inputs       : buf - the buffer (NULL is ignored)
+// Outputs      : none
+
+void hdd_slab_free(void *buf) {
+	HddSlabHeader *hdr;
+	HddSlabClass *c;
+	uint32_t size;
+
+	if (buf == NULL || (hdr = slabHeader(buf)) == NULL) {
+		return;
+	}
+	c = &slabClasses[hdr->cls];
+	size = slabSize(hdr->cls);
+	slabAddLive(-(int64_t)size);
+
+	hdr->magic = HDD_SLAB_IDLE;
+	pthread_mutex_lock(&c->lock);
+	c->frees++;
+	if (c->idleCount < HDD_SLAB_MIN_IDLE || (uint64_t)(c->idleCount + 1) * size <= HDD_SLAB_CLASS_IDLE) {
+		hdr->next = c->idle;
+		c->idle = hdr;
+		c->idleCount++;
+		hdr = NULL;
+	}
+	pthread_mutex_unlock(&c->lock);
+	free(hdr);	// the class has enough idle buffers
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_slab_stats
+// Description  : Get the allocator statistics
+//
+// Inputs       : stats - where to put them
+// Outputs      : none
+
+void hdd_slab_stats(HddSlabStats *stats) {
+	HddSlabClass *c;
+	uint32_t i;
+
+	memset(stats, 0x0, sizeof(HddSlabStats));
+	for (i = 0; i < HDD_SLAB_CLASSES; i++) {
+		c = &slabClasses[i];
+		pthread_mutex_lock(&c->lock);
+		stats->classes[i].size = slabSize(i);
+		stats->classes[i].idle = c->idleCount;
+		stats->classes[i].allocs = c->allocs;
+		stats->classes[i].reuses = c->reuses;
+		stats->classes[i].frees = c->frees;
+		stats->heapAllocs += c->allocs - c->reuses;
+		pthread_mutex_unlock(&c->lock);
+		stats->idle += (uint64_t)stats->classes[i].idle * slabSize(i);
+	}
+	stats->live = __atomic_load_n(&slabLive, __ATOMIC_RELAXED);
+	stats->peak = __atomic_load_n(&slabPeak, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_slab_report
+// Description  : Log the allocator statistics, the totals and then each
+//                class that was used
+//
+// Inputs       : none
+// Outputs      : none
+
+void hdd_slab_report(void) {
+	HddSlabStats stats;
+	HddSlabClassStats *cs;
+	uint32_t i;
+
+	hdd_slab_stats(&stats);
+	hdd_log(LOG_INFO_LEVEL, "HDD slab : %lu bytes live (peak %lu), %lu bytes idle, %lu heap allocations",
+		stats.live, stats.peak, stats.idle, stats.heapAllocs);
+	for (i = 0; i < HDD_SLAB_CLASSES; i++) {
+		cs = &stats.classes[i];
+		if (cs->allocs > 0) {
+			hdd_log(LOG_INFO_LEVEL, "HDD slab : %7u byte class, %lu allocs, %.1f%% reused, %u idle",
+				cs->size, cs->allocs, 100.0 * cs->reuses / cs->allocs, cs->idle);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_slab_trim
+// Description  : Return every idle buffer to the heap
+//
+// Inputs       : none
+// Outputs      : the number of buffers returned
+
+int hdd_slab_trim(void) {
+	HddSlabHeader *hdr, *next;
+	HddSlabClass *c;
+	uint32_t i;
+	int count = 0;
+
+	for (i = 0; i < HDD_SLAB_CLASSES; i++) {
+		c = &slabClasses[i];
+		pthread_mutex_lock(&c->lock);
+		hdr = c->idle;
+		c->idle = NULL;
+		c->idleCount = 0;
+		pthread_mutex_unlock(&c->lock);
+		for (; hdr != NULL; hdr = next, count++) {
+			next = hdr->next;
+			free(hdr);
+		}
+	}
+	return(count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hddSlabUnitTest
+// Description  : Perform a test of the allocator: random allocations,
+//                resizes and frees with their contents checked, the live
+//                byte count checked against the classes of the buffers
+//                held, and a second round that must be served entirely
+//                from recycled buffers.
+//
+// Inputs       : None
+// Outputs      : 0 if successful or -1 if failure
+
+int hddSlabUnitTest(void) {
+
+	// Local variables
+	uint8_t *bufs[HDD_SLAB_UNIT_TEST_BUFFERS], fill[HDD_SLAB_UNIT_TEST_BUFFERS];
+	uint32_t sizes[HDD_SLAB_UNIT_TEST_BUFFERS], size, i, j;
+	HddSlabStats before, after;
+	uint64_t held = 0;
+
+	hdd_slab_stats(&before);
+	memset(bufs, 0x0, sizeof(bufs));
+
+	// Sizes beyond the largest class are refused
+	if (hdd_slab_alloc(((uint32_t)1 << HDD_SLAB_MAX_SHIFT) + 1) != NULL) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_SLAB_UNIT_TEST : oversized buffer allocated.");
+		return(-1);
+	}
+
+	for (i = 0; i < HDD_SLAB_UNIT_TEST_ITERATIONS; i++) {
+		j = getRandomValue(0, HDD_SLAB_UNIT_TEST_BUFFERS-1);
+		size = getRandomValue(1, (getRandomValue(0, 7) == 0) ? (1 << HDD_SLAB_MAX_SHIFT) : 4096);
+
+		// Every buffer held must still have its contents
+		if (bufs[j] != NULL && (bufs[j][0] != fill[j] || bufs[j][sizes[j]-1] != fill[j])) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD_SLAB_UNIT_TEST : buffer [%u] corrupt.", j);
+			return(-1);
+		}
+
+		switch (getRandomValue(0, 2)) {
+		case 0: // Replace the buffer
+			if (bufs[j] != NULL) {
+				held -= slabSize(slabClass(sizes[j]));
+			}
+			hdd_slab_free(bufs[j]);
+			bufs[j] = hdd_slab_alloc(size);
+			break;
+
+		case 1: // Grow or shrink it, the contents carry over
+			if (bufs[j] != NULL) {
+				held -= slabSize(slabClass(sizes[j]));
+				if (size > slabSize(slabClass(sizes[j]))) {	// moves to the bigger class
+					bufs[j] = hdd_slab_realloc(bufs[j], size);
+					if (bufs[j] == NULL || bufs[j][sizes[j]-1] != fill[j]) {
+						hdd_log(LOG_ERROR_LEVEL, "HDD_SLAB_UNIT_TEST : resize lost contents [%u].", j);
+						return(-1);
+					}
+				} else {	// stays where it is, keeping its class
+					if (hdd_slab_realloc(bufs[j], size) != bufs[j]) {
+						hdd_log(LOG_ERROR_LEVEL, "HDD_SLAB_UNIT_TEST : resize within class moved [%u].", j);
+						return(-1);
+					}
+					size = sizes[j];
+				}
+			} else {
+				bufs[j] = hdd_slab_realloc(NULL, size);
+			}
+			break;
+
+		case 2: // Give it back
+			if (bufs[j] != NULL) {
+				held -= slabSize(slabClass(sizes[j]));
+			}
+			hdd_slab_free(bufs[j]);
+			bufs[j] = NULL;
+			continue;
+		}
+
+		if (bufs[j] == NULL) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD_SLAB_UNIT_TEST : allocation failed [%u].", size);
+			return(-1);
+		}
+		sizes[j] = size;
+		fill[j] = getRandomValue(0, 0xff);
+		memset(bufs[j], fill[j], size);
+		held += slabSize(slabClass(size));
+
+		hdd_slab_stats(&after);
+		if (after.live - before.live != held) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD_SLAB_UNIT_TEST : live bytes wrong [%lu!=%lu].",
+				after.live - before.live, held);
+			return(-1);
+		}
+	}
+
+	// Give everything back, then take the same sizes again: all reused
+	for (j = 0; j < HDD_SLAB_UNIT_TEST_BUFFERS; j++) {
+		hdd_slab_free(bufs[j]);
+	}
+	hdd_slab_stats(&before);
+	for (j = 0; j < HDD_SLAB_UNIT_TEST_BUFFERS; j++) {
+		bufs[j] = (bufs[j] != NULL) ? hdd_slab_alloc(sizes[j]) : NULL;
+	}
+	hdd_slab_stats(&after);
+	for (j = 0; j < HDD_SLAB_UNIT_TEST_BUFFERS; j++) {
+		hdd_slab_free(bufs[j]);
+	}
+	if (after.heapAllocs != before.heapAllocs) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_SLAB_UNIT_TEST : %lu buffers not reused.",
+			after.heapAllocs - before.heapAllocs);
+		return(-1);
+	}
+
+	// Return successfully
+	hdd_slab_trim();
+	hdd_log(LOG_INFO_LEVEL, "HDD_SLAB_UNIT_TEST : slab tests completed successfully.");
+	return(0);
+}
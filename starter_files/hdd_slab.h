@@ -0,0 +1,70 @@
+#ifndef HDD_SLAB_INCLUDED
+#define HDD_SLAB_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : hdd_slab.h
+//  Description    : This is the interface for the buffer allocator the file
+//                   IO layer and the block cache draw block payloads from.
+//                   Buffers come in power of two size classes up to the
+//                   largest block and are recycled rather than returned to
+//                   the heap.
+//
+//  Author         : Chuyang Zhang
+//  Last Modified  : 2017/12/1
+//
+
+// Include files
+#include <stdint.h>
+
+// Defines
+#define HDD_SLAB_MIN_SHIFT 6     // The smallest class (64 bytes)
+#define HDD_SLAB_MAX_SHIFT 20    // The largest class (1 MB, holds HDD_MAX_BLOCK_SIZE)
+#define HDD_SLAB_CLASSES (HDD_SLAB_MAX_SHIFT - HDD_SLAB_MIN_SHIFT + 1)
+
+// The statistics of one size class
+typedef struct {
+	uint32_t size;           // The buffer size of the class
+	uint32_t idle;           // Buffers waiting to be reused
+	uint64_t allocs;         // Buffers handed out
+	uint64_t reuses;         // Of those, the ones recycled rather than from the heap
+	uint64_t frees;          // Buffers given back
+} HddSlabClassStats;
+
+// The allocator statistics
+typedef struct {
+	uint64_t live;           // Bytes handed out and not given back
+	uint64_t peak;           // The most bytes live at once
+	uint64_t idle;           // Bytes waiting to be reused
+	uint64_t heapAllocs;     // Buffers taken from the heap
+	HddSlabClassStats classes[HDD_SLAB_CLASSES];
+} HddSlabStats;
+
+//
+// Allocator interface
+
+void * hdd_slab_alloc(uint32_t size);
+	// Get a buffer of at least size bytes, NULL on failure
+
+void * hdd_slab_realloc(void *buf, uint32_t size);
+	// Resize a buffer (kept in place while size fits its class), NULL on failure
+
+void hdd_slab_free(void *buf);
+	// Give back a buffer from hdd_slab_alloc (NULL is ignored)
+
+void hdd_slab_stats(HddSlabStats *stats);
+	// Get the allocator statistics
+
+void hdd_slab_report(void);
+	// Log the allocator statistics
+
+int hdd_slab_trim(void);
+	// Return the idle buffers to the heap, the number returned
+
+//
+// Unit testing for the module
+
+int hddSlabUnitTest(void);
+	// Perform a test of the allocator
+
+#endif
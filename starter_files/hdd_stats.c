@@ -0,0 +1,315 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : hdd_stats.c
+//  Description   : This is the run statistics module.  Each timed operation
+//                  has a log-scale latency histogram: values below 8ns get
+//                  their own bucket, above that every power of two is split
+//                  into 8 linear buckets, so percentiles are within 12.5%.
+//                  The histograms are updated with atomic operations so any
+//                  thread may record.
+//
+//  Author         : Chuyang Zhang
+//  Last Modified  : 2017/12/1
+//
+
+// Includes
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Project Includes
+#include <hdd_stats.h>
+#include <cmpsc311_log.h>
+#include <hdd_log.h>
+
+// Defines
+#define HDD_STATS_SUB_BITS 3
+#define HDD_STATS_SUB_BUCKETS (1 << HDD_STATS_SUB_BITS)
+#define HDD_STATS_BUCKETS (64 * HDD_STATS_SUB_BUCKETS)
+#define HDD_STATS_JSON_VERSION 1
+
+// A latency histogram (nanoseconds)
+typedef struct {
+	uint64_t count;                        // The operations recorded
+	uint64_t total;                        // Their summed time
+	uint64_t min;                          // The fastest (when count > 0)
+	uint64_t max;                          // The slowest
+	uint64_t buckets[HDD_STATS_BUCKETS];   // The operations in each bucket
+} HddStatsHistogram;
+
+// The names the operations are reported under
+const char *statsNames[HDD_STATS_MAX_ID] = {
+	"FORMAT", "MOUNT", "UNMOUNT", "WRITEAT", "WRITE", "SEEK", "READ",
+	"BLOCK_CREATE", "BLOCK_READ", "BLOCK_OVERWRITE", "BLOCK_DELETE", "DEVICE"
+};
+
+HddStatsHistogram statsHistograms[HDD_STATS_MAX_ID];	// one per operation
+uint64_t statsBytesSent = 0;	// bytes written to the server
+uint64_t statsBytesReceived = 0;	// bytes read from the server
+uint64_t statsStart = 0;	// when the statistics were last reset
+
+//
+// Functions
+
+// the bucket of a value
+static uint32_t statsBucket(uint64_t value) {
+	uint32_t e;
+
+	if (value < HDD_STATS_SUB_BUCKETS) {
+		return (uint32_t)value;
+	}
+	e = 63 - __builtin_clzll(value);	// the highest bit set
+	return ((e - HDD_STATS_SUB_BITS + 1) << HDD_STATS_SUB_BITS) +
+		(uint32_t)((value >> (e - HDD_STATS_SUB_BITS)) & (HDD_STATS_SUB_BUCKETS - 1));
+}
+
+// the largest value of a bucket
+static uint64_t statsBucketTop(uint32_t bucket) {
+	uint32_t e;
+
+	if (bucket < HDD_STATS_SUB_BUCKETS) {
+		return bucket;
+	}
+	e = (bucket >> HDD_STATS_SUB_BITS) + HDD_STATS_SUB_BITS - 1;
+	return ((uint64_t)(HDD_STATS_SUB_BUCKETS + (bucket & (HDD_STATS_SUB_BUCKETS - 1)) + 1) << (e - HDD_STATS_SUB_BITS)) - 1;
+}
+
+// the value below which a fraction of the operations fall (clamped to the max)
+static uint64_t statsPercentile(HddStatsHistogram *h, double fraction) {
+	uint64_t rank, seen = 0, top;
+	uint32_t i;
+
+	if (h->count == 0) {
+		return 0;
+	}
+	rank = (uint64_t)(fraction * h->count + 0.5);
+	rank = (rank < 1) ? 1 : rank;
+	for (i = 0; i < HDD_STATS_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank) {
+			top = statsBucketTop(i);
+			return (top < h->max) ? top : h->max;
+		}
+	}
+	return h->max;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_stats_now
+// Description  : Get the current monotonic time for timing operations
+//
+// Inputs       : none
+// Outputs      : the time in nanoseconds
+
+uint64_t hdd_stats_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return( (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_stats_record
+// Description  : Record the latency of an operation in its histogram
+//
+// Inputs       : id - the operation
+//                start - when the operation started (from hdd_stats_now)
+// Outputs      : none
+
+void hdd_stats_record(HddStatsId id, uint64_t start) {
+
+	// Local variables
+	HddStatsHistogram *h = &statsHistograms[id];
+	uint64_t value = hdd_stats_now() - start, seen;
+
+	__sync_fetch_and_add(&h->buckets[statsBucket(value)], 1);
+	__sync_fetch_and_add(&h->total, value);
+	seen = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	while (value > seen && !__atomic_compare_exchange_n(&h->max, &seen, value, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	seen = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+	while ((seen == 0 || value < seen) && !__atomic_compare_exchange_n(&h->min, &seen, value, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	__sync_fetch_and_add(&h->count, 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_stats_add_bytes
+// Description  : Count bytes moved to and from the server
+//
+// Inputs       : sent - bytes written to the server
+//                received - bytes read from the server
+// Outputs      : none
+
+void hdd_stats_add_bytes(uint64_t sent, uint64_t received) {
+	if (sent > 0) {
+		__sync_fetch_and_add(&statsBytesSent, sent);
+	}
+	if (received > 0) {
+		__sync_fetch_and_add(&statsBytesReceived, received);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_stats_bytes
+// Description  : Get the bytes moved to and from the server since the reset
+//
+// Inputs       : sent - set to the bytes written to the server
+//                received - set to the bytes read from the server
+// Outputs      : none
+
+void hdd_stats_bytes(uint64_t *sent, uint64_t *received) {
+	*sent = __atomic_load_n(&statsBytesSent, __ATOMIC_RELAXED);
+	*received = __atomic_load_n(&statsBytesReceived, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_stats_summary
+// Description  : Merge the histograms of a range of operations and get the
+//                count, time and percentiles of the merged operations.
+//
+// Inputs       : first, last - the operations (inclusive)
+//                sum - set to the summary
+// Outputs      : none
+
+void hdd_stats_summary(HddStatsId first, HddStatsId last, HddStatsSummary *sum) {
+
+	// Local variables
+	HddStatsHistogram merged, *h;
+	int i, b;
+
+	memset(&merged, 0x0, sizeof(merged));
+	for (i = first; i <= last; i++) {
+		h = &statsHistograms[i];
+		if (h->count == 0) {
+			continue;
+		}
+		for (b = 0; b < HDD_STATS_BUCKETS; b++) {
+			merged.buckets[b] += h->buckets[b];
+		}
+		merged.min = (merged.count == 0 || h->min < merged.min) ? h->min : merged.min;
+		merged.max = (h->max > merged.max) ? h->max : merged.max;
+		merged.count += h->count;
+		merged.total += h->total;
+	}
+	sum->count = merged.count;
+	sum->total = merged.total;
+	sum->min = merged.min;
+	sum->p50 = statsPercentile(&merged, 0.50);
+	sum->p90 = statsPercentile(&merged, 0.90);
+	sum->p99 = statsPercentile(&merged, 0.99);
+	sum->p999 = statsPercentile(&merged, 0.999);
+	sum->max = merged.max;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_stats_reset
+// Description  : Clear all of the statistics, the run time starts now
+//
+// Inputs       : none
+// Outputs      : none
+
+void hdd_stats_reset(void) {
+	memset(statsHistograms, 0x0, sizeof(statsHistograms));
+	statsBytesSent = statsBytesReceived = 0;
+	statsStart = hdd_stats_now();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_stats_write_json
+// Description  : Write the statistics as a JSON object: the run time, the
+//                bytes moved and, for each operation, its count and the
+//                latency mean, min, p50, p90, p99, p999 and max in
+//                nanoseconds.
+//
+// Inputs       : path - the file to write, "-" for stdout
+// Outputs      : 0 if successful, -1 if failure
+
+int hdd_stats_write_json(const char *path) {
+
+	// Local variables
+	double secs = (statsStart > 0) ? (hdd_stats_now() - statsStart) / 1e9 : 0.0;
+	HddStatsSummary sum;
+	FILE *fp;
+	int i;
+
+	if ((fp = (strcmp(path, "-") == 0) ? stdout : fopen(path, "w")) == NULL) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_STATS : failed to create [%s].", path);
+		return(-1);
+	}
+
+	fprintf(fp, "{\n  \"version\": %d,\n  \"elapsed_secs\": %.6f,\n", HDD_STATS_JSON_VERSION, secs);
+	fprintf(fp, "  \"bytes_sent\": %lu,\n  \"bytes_received\": %lu,\n",
+		(unsigned long)statsBytesSent, (unsigned long)statsBytesReceived);
+	fprintf(fp, "  \"operations\": {\n");
+	for (i = 0; i < HDD_STATS_MAX_ID; i++) {
+		hdd_stats_summary(i, i, &sum);
+		fprintf(fp, "    \"%s\": {\"count\": %lu, \"total_ns\": %lu, \"mean_ns\": %lu, \"min_ns\": %lu, "
+			"\"p50_ns\": %lu, \"p90_ns\": %lu, \"p99_ns\": %lu, \"p999_ns\": %lu, \"max_ns\": %lu, "
+			"\"ops_per_sec\": %.1f}%s\n",
+			statsNames[i], (unsigned long)sum.count, (unsigned long)sum.total,
+			(unsigned long)((sum.count > 0) ? sum.total / sum.count : 0), (unsigned long)sum.min,
+			(unsigned long)sum.p50, (unsigned long)sum.p90, (unsigned long)sum.p99, (unsigned long)sum.p999,
+			(unsigned long)sum.max, (secs > 0) ? sum.count / secs : 0.0,
+			(i + 1 < HDD_STATS_MAX_ID) ? "," : "");
+	}
+	fprintf(fp, "  }\n}\n");
+
+	if (fp == stdout) {
+		fflush(fp);
+	} else if (fclose(fp)) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_STATS : failed to write [%s].", path);
+		return(-1);
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hddStatsUnitTest
+// Description  : Check that every value lands in a bucket whose range
+//                holds it, and that percentiles of a known set are right.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int hddStatsUnitTest(void) {
+
+	// Local variables
+	HddStatsHistogram *h = &statsHistograms[HDD_STATS_SEEK];
+	uint64_t value, top;
+	uint32_t bucket, i;
+
+	// Bucket ranges must hold their values and not overlap
+	for (value = 0; value < (1ULL << 40); value = value * 3 / 2 + 1) {
+		bucket = statsBucket(value);
+		top = statsBucketTop(bucket);
+		if (bucket >= HDD_STATS_BUCKETS || value > top || (bucket > 0 && value <= statsBucketTop(bucket - 1)) ||
+			(value > 8 && top > value + value / HDD_STATS_SUB_BUCKETS)) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD_STATS_UNIT_TEST : value %lu in bad bucket %u.", (unsigned long)value, bucket);
+			return(-1);
+		}
+	}
+
+	// 1..1000 should give percentiles within a bucket of the exact value
+	hdd_stats_reset();
+	for (i = 1; i <= 1000; i++) {
+		__sync_fetch_and_add(&h->buckets[statsBucket(i)], 1);
+		h->count++;
+		h->max = i;
+	}
+	if (statsPercentile(h, 0.5) < 500 || statsPercentile(h, 0.5) > 500 + 500 / HDD_STATS_SUB_BUCKETS ||
+		statsPercentile(h, 0.99) < 990 || statsPercentile(h, 0.999) != 1000) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_STATS_UNIT_TEST : bad percentiles.");
+		return(-1);
+	}
+	hdd_stats_reset();
+
+	hdd_log(LOG_INFO_LEVEL, "HDD_STATS_UNIT_TEST : statistics tests completed successfully.");
+	return(0);
+}
@@ -0,0 +1,77 @@
+#ifndef HDD_STATS_INCLUDED
+#define HDD_STATS_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : hdd_stats.h
+//  Description    : This is the interface for the run statistics: latency
+//                   histograms of the workload commands and of the block
+//                   requests sent to the server, and the bytes moved.
+//
+//  Author         : Chuyang Zhang
+//  Last Modified  : 2017/12/1
+//
+
+// Include files
+#include <stdint.h>
+
+// The timed operations
+typedef enum {
+	HDD_STATS_FORMAT    = 0,   // Workload commands (in HddWorkloadOpcode order)
+	HDD_STATS_MOUNT     = 1,
+	HDD_STATS_UNMOUNT   = 2,
+	HDD_STATS_WRITEAT   = 3,
+	HDD_STATS_WRITE     = 4,
+	HDD_STATS_SEEK      = 5,
+	HDD_STATS_READ      = 6,
+	HDD_STATS_BLOCK_CREATE    = 7,   // Block requests, from submit to response
+	HDD_STATS_BLOCK_READ      = 8,
+	HDD_STATS_BLOCK_OVERWRITE = 9,
+	HDD_STATS_BLOCK_DELETE    = 10,
+	HDD_STATS_DEVICE          = 11,  // INIT, FORMAT and SAVE_AND_CLOSE requests
+	HDD_STATS_MAX_ID          = 12,
+} HddStatsId;
+
+// The latency summary of one or more operations (nanoseconds)
+typedef struct {
+	uint64_t count;   // The operations recorded
+	uint64_t total;   // Their summed time
+	uint64_t min;     // The fastest
+	uint64_t p50;     // The percentiles
+	uint64_t p90;
+	uint64_t p99;
+	uint64_t p999;
+	uint64_t max;     // The slowest
+} HddStatsSummary;
+
+//
+// Statistics interface
+
+uint64_t hdd_stats_now(void);
+	// Get the time (monotonic nanoseconds) for timing an operation
+
+void hdd_stats_record(HddStatsId id, uint64_t start);
+	// Record an operation that started at start (from hdd_stats_now)
+
+void hdd_stats_add_bytes(uint64_t sent, uint64_t received);
+	// Count bytes sent to and received from the server
+
+void hdd_stats_bytes(uint64_t *sent, uint64_t *received);
+	// Get the bytes sent to and received from the server
+
+void hdd_stats_summary(HddStatsId first, HddStatsId last, HddStatsSummary *sum);
+	// Summarize the operations first to last together
+
+void hdd_stats_reset(void);
+	// Clear all of the statistics
+
+int hdd_stats_write_json(const char *path);
+	// Write the statistics as JSON to path ("-" for stdout), -1 on failure
+
+//
+// Unit testing for the module
+
+int hddStatsUnitTest(void);
+	// Perform a test of the histograms
+
+#endif
@@ -0,0 +1,600 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : hdd_store.c
+//  Description   : This is the in-memory block store.  Blocks are spread
+//                  over HDD_STORE_SHARDS shards by id (modulo the shard
+//                  count), each with its own lock, block array and id
+//                  allocator (ids are not reused until a format), so
+//                  requests on different shards do not wait on each other.
+//                  The meta block is kept on its own.  Requests the HDD server would refuse (a
+//                  missing block, a read into a smaller buffer, an
+//                  overwrite that changes the block size, a second meta
+//                  block) fail with the R bit set.  SAVE_AND_CLOSE writes
+//                  the device to the store file and the first INIT reads it
+//                  back, so a device outlives the process like the
+//                  server's hdd_content.svd.
+//
+//  Author         : Chuyang Zhang
+//  Last Modified  : 2017/12/1
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Project Includes
+#include <hdd_store.h>
+#include <cmpsc311_log.h>
+#include <hdd_log.h>
+
+// Defines
+#define HDD_STORE_MAGIC 0x31534448	// "HDS1", marks a saved store
+#define HDD_STORE_VERSION 1
+#define HDD_STORE_TEST_THREADS 4
+#define HDD_STORE_TEST_BLOCKS 1024
+
+// The header of a saved store, followed by a record (id, size and
+// contents) for the meta block (id 0) and every block
+typedef struct {
+	uint32_t magic;	// HDD_STORE_MAGIC
+	uint32_t version;	// HDD_STORE_VERSION
+	uint32_t nextId;	// the id of the next block created
+	uint32_t count;	// the records that follow
+} HddStoreHeader;
+
+//
+// Functions
+
+// the response to a request, a failure carries no block data
+static HddBitResp storeResponse(HddBitCmd cmd, uint32_t size, HddBlockID bid, int failed) {
+	if (failed) {
+		size = 0;
+	}
+	return (cmd & (((uint64_t)0x3 << 62) | ((uint64_t)0x7 << 33))) |
+		((uint64_t)(size & 0x3ffffff) << 36) | ((uint64_t)(failed != 0) << 32) | bid;
+}
+
+// make a block holding size bytes of buf
+static HddStoreBlock *storeBlock(void *buf, uint32_t size) {
+	HddStoreBlock *blk = malloc(sizeof(HddStoreBlock) + size);
+
+	if (blk != NULL) {
+		blk->size = size;
+		memcpy(blk->data, buf, size);
+	}
+	return blk;
+}
+
+// the shard holding a block id
+static HddStoreShard *storeShard(HddStore *st, HddBlockID bid) {
+	return &st->shards[(bid - HDD_STORE_FIRST_BLOCK) % HDD_STORE_SHARDS];
+}
+
+// the slot of a block id in its shard, NULL if the id was never handed out
+static HddStoreBlock **storeSlot(HddStore *st, HddBlockID bid) {
+	HddStoreShard *sh;
+	uint32_t idx;
+
+	if (bid < HDD_STORE_FIRST_BLOCK) {
+		return NULL;
+	}
+	sh = storeShard(st, bid);
+	idx = (bid - HDD_STORE_FIRST_BLOCK) / HDD_STORE_SHARDS;
+	return (idx < sh->count) ? &sh->blocks[idx] : NULL;
+}
+
+// the id of the next block a shard hands out
+static HddBlockID storeNextId(HddStore *st, HddStoreShard *sh) {
+	return HDD_STORE_FIRST_BLOCK + sh->count * HDD_STORE_SHARDS + (uint32_t)(sh - st->shards);
+}
+
+// hand out the next block id of a shard, growing its block array as needed
+static HddBlockID storeNewId(HddStore *st, HddStoreShard *sh) {
+	HddStoreBlock **blocks;
+	uint32_t capacity;
+
+	if (sh->count == sh->capacity) {
+		capacity = (sh->capacity == 0) ? 64 : sh->capacity * 2;
+		if ((blocks = realloc(sh->blocks, capacity * sizeof(HddStoreBlock *))) == NULL) {
+			return HDD_NO_BLOCK;
+		}
+		memset(&blocks[sh->capacity], 0x0, (capacity - sh->capacity) * sizeof(HddStoreBlock *));
+		sh->blocks = blocks;
+		sh->capacity = capacity;
+	}
+	sh->count++;
+	return storeNextId(st, sh) - HDD_STORE_SHARDS;
+}
+
+// take the device lock and every shard lock, for the device requests
+static void storeLockAll(HddStore *st) {
+	int s;
+
+	pthread_mutex_lock(&st->lock);
+	for (s = 0; s < HDD_STORE_SHARDS; s++) {
+		pthread_mutex_lock(&st->shards[s].lock);
+	}
+}
+
+// release the locks taken by storeLockAll
+static void storeUnlockAll(HddStore *st) {
+	int s;
+
+	for (s = HDD_STORE_SHARDS - 1; s >= 0; s--) {
+		pthread_mutex_unlock(&st->shards[s].lock);
+	}
+	pthread_mutex_unlock(&st->lock);
+}
+
+// drop every block and the meta block
+static void storeClear(HddStore *st) {
+	HddStoreShard *sh;
+	uint32_t i;
+	int s;
+
+	for (s = 0; s < HDD_STORE_SHARDS; s++) {
+		sh = &st->shards[s];
+		for (i = 0; i < sh->count; i++) {
+			free(sh->blocks[i]);
+			sh->blocks[i] = NULL;
+		}
+		sh->count = 0;
+		sh->bytes = 0;
+	}
+	free(st->meta);
+	st->meta = NULL;
+	st->nextShard = 0;
+}
+
+// write a record of the saved store
+static int storeWriteRecord(FILE *fp, uint32_t id, HddStoreBlock *blk) {
+	return (fwrite(&id, sizeof(id), 1, fp) != 1 || fwrite(&blk->size, sizeof(blk->size), 1, fp) != 1 ||
+		fwrite(blk->data, 1, blk->size, fp) != blk->size) ? -1 : 0;
+}
+
+// save the store to its file, written aside and renamed over the old one,
+// the saved next id is past every id any shard has handed out
+static int storeSave(HddStore *st) {
+	HddStoreHeader hdr;
+	HddStoreShard *sh;
+	char tmp[512];
+	uint32_t i;
+	FILE *fp;
+	int s, ret = 0;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", st->path);
+	if ((fp = fopen(tmp, "w")) == NULL) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_STORE : failed to create [%s].", tmp);
+		return -1;
+	}
+	hdr.magic = HDD_STORE_MAGIC;
+	hdr.version = HDD_STORE_VERSION;
+	hdr.nextId = HDD_STORE_FIRST_BLOCK;
+	hdr.count = (st->meta != NULL);
+	for (s = 0; s < HDD_STORE_SHARDS; s++) {
+		sh = &st->shards[s];
+		if (sh->count > 0 && storeNextId(st, sh) > hdr.nextId) {
+			hdr.nextId = storeNextId(st, sh);
+		}
+		for (i = 0; i < sh->count; i++) {
+			hdr.count += (sh->blocks[i] != NULL);
+		}
+	}
+	ret = (fwrite(&hdr, sizeof(hdr), 1, fp) != 1) ? -1 : 0;
+	if (ret == 0 && st->meta != NULL) {
+		ret = storeWriteRecord(fp, 0, st->meta);
+	}
+	for (s = 0; ret == 0 && s < HDD_STORE_SHARDS; s++) {
+		sh = &st->shards[s];
+		for (i = 0; ret == 0 && i < sh->count; i++) {
+			if (sh->blocks[i] != NULL) {
+				ret = storeWriteRecord(fp, HDD_STORE_FIRST_BLOCK + i * HDD_STORE_SHARDS + s, sh->blocks[i]);
+			}
+		}
+	}
+	if (fclose(fp) || ret || rename(tmp, st->path)) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_STORE : failed to save [%s].", st->path);
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+// load the store from its file (a missing file is an empty device)
+static int storeLoad(HddStore *st) {
+	HddStoreHeader hdr;
+	HddStoreBlock *blk, **slot;
+	uint32_t i, id, size;
+	FILE *fp;
+	int s;
+
+	storeClear(st);
+	if ((fp = fopen(st->path, "r")) == NULL) {
+		return 0;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != HDD_STORE_MAGIC ||
+		hdr.version != HDD_STORE_VERSION || hdr.nextId < HDD_STORE_FIRST_BLOCK) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_STORE : [%s] is not a saved store.", st->path);
+		fclose(fp);
+		return -1;
+	}
+	for (s = 0; s < HDD_STORE_SHARDS; s++) {	// hand out the ids below the saved next id
+		while (storeNextId(st, &st->shards[s]) < hdr.nextId) {
+			if (storeNewId(st, &st->shards[s]) == HDD_NO_BLOCK) {
+				fclose(fp);
+				return -1;
+			}
+		}
+	}
+	for (i = 0; i < hdr.count; i++) {
+		if (fread(&id, sizeof(id), 1, fp) != 1 || fread(&size, sizeof(size), 1, fp) != 1 ||
+			size > HDD_MAX_BLOCK_SIZE || (id != 0 && storeSlot(st, id) == NULL) ||
+			(blk = malloc(sizeof(HddStoreBlock) + size)) == NULL) {
+			break;
+		}
+		blk->size = size;
+		slot = (id == 0) ? &st->meta : storeSlot(st, id);
+		if (fread(blk->data, 1, size, fp) != size || *slot != NULL) {
+			free(blk);
+			break;
+		}
+		*slot = blk;
+		if (id != 0) {
+			storeShard(st, id)->bytes += size;
+		}
+	}
+	fclose(fp);
+	if (i < hdr.count) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_STORE : [%s] is truncated or corrupt.", st->path);
+		storeClear(st);
+		return -1;
+	}
+	return 0;
+}
+
+// carry out a request on a block of shard sh (the meta block for
+// HDD_META_BLOCK, sh is then NULL), with the lock of the shard (or the
+// store, for the meta block) held
+static HddBitResp storeBlockOp(HddStore *st, HddStoreShard *sh, HddBitCmd cmd, uint32_t offset, void *buf) {
+	uint8_t op = (cmd >> 62) & 0x3, flag = (cmd >> 33) & 0x7;
+	uint32_t size = (cmd >> 36) & 0x3ffffff;
+	HddBlockID bid = cmd & 0xffffffff;
+	HddStoreBlock **slot, *blk;
+
+	if (flag == HDD_META_BLOCK) {
+		slot = &st->meta;
+		bid = 0;
+	} else if (op == HDD_BLOCK_CREATE) {
+		slot = NULL;
+	} else if ((slot = storeSlot(st, bid)) == NULL) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_STORE : request for non-existent block [%u].", bid);
+		return storeResponse(cmd, 0, bid, 1);
+	}
+	blk = (slot != NULL) ? *slot : NULL;
+
+	if (flag == HDD_RANGE) {	// part of the block
+		if (blk == NULL || (op != HDD_BLOCK_READ && op != HDD_BLOCK_OVERWRITE) || size == 0 ||
+			(uint64_t)offset + size > blk->size) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD_STORE : bad range [%u+%u] of block [%u].", offset, size, bid);
+			return storeResponse(cmd, 0, bid, 1);
+		}
+		if (op == HDD_BLOCK_READ) {
+			memcpy(buf, &blk->data[offset], size);
+		} else {
+			memcpy(&blk->data[offset], buf, size);
+		}
+		return storeResponse(cmd, size, bid, 0);
+	}
+	if (flag != HDD_NULL_FLAG && flag != HDD_META_BLOCK) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_STORE : bad request flag [%u].", flag);
+		return storeResponse(cmd, 0, bid, 1);
+	}
+
+	switch (op) {
+	case HDD_BLOCK_CREATE:
+		if (size == 0 || size > HDD_MAX_BLOCK_SIZE || (flag == HDD_META_BLOCK && blk != NULL)) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD_STORE : bad block create [size %u].", size);
+			return storeResponse(cmd, 0, bid, 1);
+		}
+		if (slot == NULL && (bid = storeNewId(st, sh)) != HDD_NO_BLOCK) {
+			slot = storeSlot(st, bid);
+		}
+		if (slot == NULL || (*slot = storeBlock(buf, size)) == NULL) {
+			return storeResponse(cmd, 0, bid, 1);
+		}
+		if (sh != NULL) {
+			sh->bytes += size;
+		}
+		return storeResponse(cmd, size, bid, 0);
+
+	case HDD_BLOCK_READ:
+		if (blk == NULL || blk->size > size) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD_STORE : bad read of block [%u].", bid);
+			return storeResponse(cmd, 0, bid, 1);
+		}
+		memcpy(buf, blk->data, blk->size);
+		return storeResponse(cmd, blk->size, bid, 0);
+
+	case HDD_BLOCK_OVERWRITE:
+		if (blk == NULL || blk->size != size) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD_STORE : bad overwrite of block [%u].", bid);
+			return storeResponse(cmd, 0, bid, 1);
+		}
+		memcpy(blk->data, buf, size);
+		return storeResponse(cmd, size, bid, 0);
+
+	default:	// HDD_BLOCK_DELETE
+		if (blk == NULL) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD_STORE : delete of non-existent block [%u].", bid);
+			return storeResponse(cmd, 0, bid, 1);
+		}
+		if (sh != NULL) {
+			sh->bytes -= blk->size;
+		}
+		free(blk);
+		*slot = NULL;
+		return storeResponse(cmd, 0, bid, 0);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_store_init
+// Description  : Setup an empty block store, the saved device is read by
+//                the first INIT request
+//
+// Inputs       : st - the store
+//                path - the file the device is saved to (NULL for the default)
+// Outputs      : 0 if successful, -1 if failure
+
+int hdd_store_init(HddStore *st, const char *path) {
+	int s;
+
+	memset(st, 0x0, sizeof(HddStore));
+	st->path = strdup((path != NULL) ? path : HDD_STORE_DEFAULT_FILE);
+	if (st->path == NULL || pthread_mutex_init(&st->lock, NULL)) {
+		free(st->path);
+		return(-1);
+	}
+	for (s = 0; s < HDD_STORE_SHARDS; s++) {
+		pthread_mutex_init(&st->shards[s].lock, NULL);
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_store_execute
+// Description  : Carry out a request on the store.  CREATE, OVERWRITE and
+//                READ move (cmd) size bytes to or from buf, a READ answers
+//                with the size of the block.  A HDD_RANGE READ or OVERWRITE
+//                moves size bytes of the block from offset.  Any thread may
+//                call: a block request holds only the lock of its shard
+//                (creates take the shards in turn), the meta block and
+//                device requests hold the store lock, and the device
+//                requests every shard lock as well.
+//
+// Inputs       : st - the store
+//                cmd - the request
+//                offset - the start of a HDD_RANGE request in the block
+//                buf - the block written or the buffer read into
+// Outputs      : the response, with the R bit set on failure
+
+HddBitResp hdd_store_execute(HddStore *st, HddBitCmd cmd, uint32_t offset, void *buf) {
+
+	// Local variables
+	uint8_t op = (cmd >> 62) & 0x3, flag = (cmd >> 33) & 0x7;
+	HddBlockID bid = cmd & 0xffffffff;
+	HddStoreShard *sh;
+	HddBitResp resp;
+	int failed = 0;
+
+	if (op == HDD_DEVICE && (flag == HDD_INIT || flag == HDD_FORMAT || flag == HDD_SAVE_AND_CLOSE)) {
+		storeLockAll(st);
+		if (flag == HDD_INIT && !st->loaded) {
+			failed = storeLoad(st);
+			st->loaded = (failed == 0);
+		} else if (flag == HDD_FORMAT) {
+			storeClear(st);
+		} else if (flag == HDD_SAVE_AND_CLOSE) {
+			failed = storeSave(st);
+		}
+		storeUnlockAll(st);
+		return(storeResponse(cmd, 0, 0, failed));
+	}
+
+	if (flag == HDD_META_BLOCK) {
+		pthread_mutex_lock(&st->lock);
+		resp = storeBlockOp(st, NULL, cmd, offset, buf);
+		pthread_mutex_unlock(&st->lock);
+		return(resp);
+	}
+	if (op != HDD_BLOCK_CREATE && bid < HDD_STORE_FIRST_BLOCK) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_STORE : request for non-existent block [%u].", bid);
+		return(storeResponse(cmd, 0, bid, 1));
+	}
+	sh = (op == HDD_BLOCK_CREATE) ?
+		&st->shards[__sync_fetch_and_add(&st->nextShard, 1) % HDD_STORE_SHARDS] : storeShard(st, bid);
+	pthread_mutex_lock(&sh->lock);
+	resp = storeBlockOp(st, sh, cmd, offset, buf);
+	pthread_mutex_unlock(&sh->lock);
+	return(resp);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_store_request_bytes
+// Description  : Get the size of the block data that follows a request on
+//                the wire: the block of a CREATE or OVERWRITE, or the range
+//                of a HDD_RANGE OVERWRITE.
+//
+// Inputs       : cmd - the request
+// Outputs      : the number of bytes
+
+uint32_t hdd_store_request_bytes(HddBitCmd cmd) {
+	uint8_t op = (cmd >> 62) & 0x3, flag = (cmd >> 33) & 0x7;
+
+	if ((op == HDD_BLOCK_CREATE && (flag == HDD_NULL_FLAG || flag == HDD_META_BLOCK)) ||
+		(op == HDD_BLOCK_OVERWRITE && (flag == HDD_NULL_FLAG || flag == HDD_META_BLOCK || flag == HDD_RANGE))) {
+		return((cmd >> 36) & 0x3ffffff);
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_store_free
+// Description  : Release the blocks of a store (it is not saved)
+//
+// Inputs       : st - the store
+// Outputs      : none
+
+void hdd_store_free(HddStore *st) {
+	int s;
+
+	storeClear(st);
+	for (s = 0; s < HDD_STORE_SHARDS; s++) {
+		free(st->shards[s].blocks);
+		pthread_mutex_destroy(&st->shards[s].lock);
+	}
+	free(st->path);
+	pthread_mutex_destroy(&st->lock);
+	memset(st, 0x0, sizeof(HddStore));
+}
+
+// carry out a unit test request, 0 if it failed (or not) as expected
+static int storeExpect(HddStore *st, uint8_t op, uint32_t size, uint8_t flag, HddBlockID bid,
+	void *buf, int fail, HddBitResp *resp) {
+	HddBitCmd cmd = ((uint64_t)op << 62) | ((uint64_t)size << 36) | ((uint64_t)flag << 33) | bid;
+	HddBitResp r = hdd_store_execute(st, cmd, 0, buf);
+
+	if (resp != NULL) {
+		*resp = r;
+	}
+	return (((r >> 32) & 0x1) != (HddBitResp)fail) ? -1 : 0;
+}
+
+// a unit test thread: create, overwrite, read back and delete blocks of
+// its own while other threads do the same, the result is left in *arg
+static void *storeTestThread(void *arg) {
+	HddStore *st = *(HddStore **)arg;
+	HddBlockID bids[HDD_STORE_TEST_BLOCKS];
+	uint32_t i, word, got;
+	HddBitResp resp;
+	int ret = 0;
+
+	for (i = 0; ret == 0 && i < HDD_STORE_TEST_BLOCKS; i++) {
+		word = (uint32_t)(uintptr_t)&bids[i];	// distinct to the thread and block
+		ret = storeExpect(st, HDD_BLOCK_CREATE, sizeof(word), 0, 0, &word, 0, &resp);
+		bids[i] = resp & 0xffffffff;
+	}
+	for (i = 0; ret == 0 && i < HDD_STORE_TEST_BLOCKS; i++) {
+		word = ~(uint32_t)(uintptr_t)&bids[i];
+		ret = storeExpect(st, HDD_BLOCK_OVERWRITE, sizeof(word), 0, bids[i], &word, 0, NULL) ||
+			storeExpect(st, HDD_BLOCK_READ, sizeof(got), 0, bids[i], &got, 0, NULL) || (got != word) ||
+			storeExpect(st, HDD_BLOCK_DELETE, 0, 0, bids[i], NULL, 0, NULL);
+	}
+	*(int *)arg = ret;
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hddStoreUnitTest
+// Description  : Create, read, overwrite and delete blocks and the meta
+//                block, read and overwrite ranges of a block, check the
+//                requests the server refuses fail, run threads on the
+//                shards at once, then save the store and check a new
+//                store reads it back.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int hddStoreUnitTest(void) {
+
+	// Local variables
+	char path[] = "/tmp/hdd_store_XXXXXX", buf[64];
+	union { HddStore *st; int ret; } args[HDD_STORE_TEST_THREADS];
+	pthread_t threads[HDD_STORE_TEST_THREADS];
+	HddBitResp resp;
+	HddBlockID a, b;
+	HddStore st;
+	int fd, ret, i;
+
+	// A missing store file is an empty device
+	if ((fd = mkstemp(path)) == -1) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_STORE_UNIT_TEST : failed to create test file.");
+		return(-1);
+	}
+	close(fd);
+	unlink(path);
+	if (hdd_store_init(&st, path)) {
+		return(-1);
+	}
+
+	// Create two blocks and the meta block, overwrite one and read it back
+	ret = storeExpect(&st, HDD_DEVICE, 0, HDD_INIT, 0, NULL, 0, NULL) ||
+		storeExpect(&st, HDD_DEVICE, 0, HDD_FORMAT, 0, NULL, 0, NULL) ||
+		storeExpect(&st, HDD_BLOCK_CREATE, 4, HDD_META_BLOCK, 0, "meta", 0, NULL) ||
+		storeExpect(&st, HDD_BLOCK_CREATE, 5, 0, 0, "hello", 0, &resp);
+	a = resp & 0xffffffff;
+	ret = ret || storeExpect(&st, HDD_BLOCK_CREATE, 3, 0, 0, "abc", 0, &resp);
+	b = resp & 0xffffffff;
+	ret = ret || (a < HDD_STORE_FIRST_BLOCK) || (b == a) ||
+		storeExpect(&st, HDD_BLOCK_OVERWRITE, 5, 0, a, "world", 0, NULL) ||
+		storeExpect(&st, HDD_BLOCK_READ, sizeof(buf), 0, a, buf, 0, &resp) ||
+		(((resp >> 36) & 0x3ffffff) != 5) || memcmp(buf, "world", 5);
+
+	// Ranges move part of a block, and must lie inside it
+	resp = hdd_store_execute(&st, ((uint64_t)HDD_BLOCK_OVERWRITE << 62) | (2ULL << 36) |
+		((uint64_t)HDD_RANGE << 33) | a, 1, "ee");
+	resp |= hdd_store_execute(&st, ((uint64_t)HDD_BLOCK_READ << 62) | (3ULL << 36) |
+		((uint64_t)HDD_RANGE << 33) | a, 2, buf);
+	ret = ret || ((resp >> 32) & 0x1) || (((resp >> 36) & 0x3ffffff) != 3) || memcmp(buf, "eld", 3) ||
+		!((hdd_store_execute(&st, ((uint64_t)HDD_BLOCK_READ << 62) | (3ULL << 36) |
+		((uint64_t)HDD_RANGE << 33) | a, 3, buf) >> 32) & 0x1) ||
+		storeExpect(&st, HDD_BLOCK_OVERWRITE, 5, 0, a, "world", 0, NULL);
+
+	// The server refuses a short read, a resize, a missing block and a second meta block
+	ret = ret || storeExpect(&st, HDD_BLOCK_READ, 2, 0, a, buf, 1, NULL) ||
+		storeExpect(&st, HDD_BLOCK_OVERWRITE, 4, 0, a, "four", 1, NULL) ||
+		storeExpect(&st, HDD_BLOCK_READ, sizeof(buf), 0, 999, buf, 1, NULL) ||
+		storeExpect(&st, HDD_BLOCK_CREATE, 1, HDD_META_BLOCK, 0, "x", 1, NULL) ||
+		storeExpect(&st, HDD_BLOCK_DELETE, 0, 0, b, NULL, 0, NULL) ||
+		storeExpect(&st, HDD_BLOCK_DELETE, 0, 0, b, NULL, 1, NULL);
+
+	// Threads on the shards at once must not disturb each other's blocks
+	for (i = 0; i < HDD_STORE_TEST_THREADS; i++) {
+		args[i].st = &st;
+		pthread_create(&threads[i], NULL, storeTestThread, &args[i]);
+	}
+	for (i = 0; i < HDD_STORE_TEST_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+		ret = ret || args[i].ret;
+	}
+
+	// Save, then a new store must read the device back
+	ret = ret || storeExpect(&st, HDD_DEVICE, 0, HDD_SAVE_AND_CLOSE, 0, NULL, 0, NULL);
+	hdd_store_free(&st);
+	if (hdd_store_init(&st, path)) {
+		unlink(path);
+		return(-1);
+	}
+	ret = ret || storeExpect(&st, HDD_DEVICE, 0, HDD_INIT, 0, NULL, 0, NULL) ||
+		storeExpect(&st, HDD_BLOCK_READ, sizeof(buf), 0, a, buf, 0, NULL) || memcmp(buf, "world", 5) ||
+		storeExpect(&st, HDD_BLOCK_READ, sizeof(buf), 0, b, buf, 1, NULL) ||
+		storeExpect(&st, HDD_BLOCK_READ, sizeof(buf), HDD_META_BLOCK, 0, buf, 0, &resp) ||
+		(((resp >> 36) & 0x3ffffff) != 4) || memcmp(buf, "meta", 4) ||
+		storeExpect(&st, HDD_BLOCK_CREATE, 1, 0, 0, "x", 0, &resp) || ((resp & 0xffffffff) <= b);
+	hdd_store_free(&st);
+	unlink(path);
+
+	if (ret) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_STORE_UNIT_TEST : store requests carried out incorrectly.");
+		return(-1);
+	}
+	hdd_log(LOG_INFO_LEVEL, "HDD_STORE_UNIT_TEST : store tests completed successfully.");
+	return(0);
+}
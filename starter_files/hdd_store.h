@@ -0,0 +1,78 @@
+#ifndef HDD_STORE_INCLUDED
+#define HDD_STORE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : hdd_store.h
+//  Description    : This is the interface for the in-memory block store.  It
+//                   carries out HddBitCmd requests with the semantics of the
+//                   HDD server (block create, read, overwrite and delete, the
+//                   meta block, and the INIT, FORMAT and SAVE_AND_CLOSE
+//                   device commands) and the HDD_RANGE extension, saving
+//                   the device to a file.  The blocks are sharded by id so
+//                   requests on different shards run in parallel.
+//
+//  Author         : Chuyang Zhang
+//  Last Modified  : 2017/12/1
+//
+
+// Include files
+#include <stdint.h>
+#include <pthread.h>
+
+// Project include files
+#include <hdd_driver.h>
+
+// Defines
+#define HDD_STORE_DEFAULT_FILE "hdd_store.svd" // Where the device is saved
+#define HDD_STORE_FIRST_BLOCK 4096             // The first block id handed out
+#define HDD_STORE_SHARDS 16                    // Shards the blocks are spread over
+
+// A stored block
+typedef struct {
+	uint32_t size;   // The size of the block
+	char     data[]; // The block contents
+} HddStoreBlock;
+
+// A shard of the store, holding the blocks whose id is its number
+// (modulo HDD_STORE_SHARDS) and handing out their ids
+typedef struct {
+	HddStoreBlock **blocks;     // The blocks, by (id - HDD_STORE_FIRST_BLOCK) / HDD_STORE_SHARDS
+	uint32_t        capacity;   // The size of the blocks array
+	uint32_t        count;      // The ids handed out
+	uint64_t        bytes;      // The bytes stored
+	pthread_mutex_t lock;       // Serializes the requests on the shard
+} HddStoreShard;
+
+// A block store
+typedef struct {
+	char           *path;       // The file the device is saved to
+	int             loaded;     // The saved device has been read (by INIT)
+	HddStoreShard   shards[HDD_STORE_SHARDS];  // The blocks
+	uint32_t        nextShard;  // Where the next block is created (round robin)
+	HddStoreBlock  *meta;       // The meta block, NULL if there is none
+	pthread_mutex_t lock;       // Serializes the device requests and the meta block
+} HddStore;
+
+//
+// Store interface
+
+int hdd_store_init(HddStore *st, const char *path);
+	// Setup an empty store saved to path, 0 if successful and -1 on failure
+
+HddBitResp hdd_store_execute(HddStore *st, HddBitCmd cmd, uint32_t offset, void *buf);
+	// Carry out a request (offset is the start of a HDD_RANGE), a READ is copied into buf
+
+uint32_t hdd_store_request_bytes(HddBitCmd cmd);
+	// Get the bytes of block data that follow a request on the wire
+
+void hdd_store_free(HddStore *st);
+	// Release a store (without saving it)
+
+//
+// Unit testing for the module
+
+int hddStoreUnitTest(void);
+	// Perform a test of the block store
+
+#endif
@@ -0,0 +1,736 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : hdd_trace.c
+//  Description   : This is the workload compiler for the HDD simulator.  The
+//                  workload file is mapped privately and tokenized in place
+//                  (names are terminated and '*' payload bytes turned into
+//                  newlines inside the mapping), then each line becomes a
+//                  compact operation that refers to its file by id and to its
+//                  payload by pointer, so replaying copies nothing.
+//
+//                  A compiled workload can be saved as a binary trace and
+//                  replayed from it without any text handling.  The trace
+//                  is (in host byte order):
+//
+//                    HddTraceHeader
+//                    HddTracePayload[payloadCount]  distinct payloads
+//                    HddTraceRun[runCount]          their bytes, run-length
+//                    HddTraceOp[opCount]            the operations
+//                    char literals[literalBytes]    bytes not worth a run
+//                    char names[nameBytes]          file names, by id
+//
+//                  the checksum covers everything after the header.  Nothing
+//                  here touches the device, so hdd_wlc links without the
+//                  client (the replay is in hdd_workload.c).
+//
+//  Author         : Chuyang Zhang
+//  Last Modified  : 2017/12/1
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+// Project Includes
+#include <hdd_workload.h>
+#include <cmpsc311_log.h>
+#include <hdd_log.h>
+#include <cmpsc311_util.h>
+#include <cmpsc311_hashtable.h>
+
+// Defines
+#define HDD_WL_INDEX_BITS 12
+#define HDD_WL_MIN_OPS 1024
+#define HDD_TRACE_MAGIC 0x4c574448	// "HDWL"
+#define HDD_TRACE_VERSION 1
+#define HDD_TRACE_NO_PAYLOAD 0xffffffff
+#define HDD_TRACE_LITERAL 0x80000000	// run length flag for literal bytes
+#define HDD_TRACE_MIN_RUN 4	// shorter repeats stay in literals
+#define HDD_WL_FNV_OFFSET 0xcbf29ce484222325ULL
+#define HDD_WL_FNV_PRIME 0x100000001b3ULL
+
+// The command names, matched by prefix in this order as the simulator did
+typedef struct {
+	const char *name;    // The command prefix
+	size_t      length;  // The number of characters compared
+	uint8_t     op;      // The operation
+} HddWorkloadCommand;
+
+HddWorkloadCommand workloadCommands[] = {
+	{ "FORMAT", 6, HDD_WL_FORMAT },
+	{ "MOUNT", 5, HDD_WL_MOUNT },
+	{ "UNMOUNT", 5, HDD_WL_UNMOUNT },
+	{ "WRITEAT", 7, HDD_WL_WRITEAT },
+	{ "WRITE", 5, HDD_WL_WRITE },
+	{ "SEEK", 4, HDD_WL_SEEK },
+	{ "READ", 4, HDD_WL_READ },
+	{ NULL, 0, 0 }
+};
+
+// The trace header
+typedef struct {
+	uint32_t magic;         // HDD_TRACE_MAGIC
+	uint32_t version;       // HDD_TRACE_VERSION
+	uint32_t opCount;       // The number of operations
+	uint32_t fileCount;     // The number of file names
+	uint32_t nameBytes;     // The size of the file names
+	uint32_t payloadCount;  // The number of distinct payloads
+	uint32_t runCount;      // The number of runs of the payloads
+	uint32_t literalBytes;  // The size of the literal bytes
+	int32_t  maxLength;     // The longest read or write
+	uint32_t pad;
+	uint64_t checksum;      // FNV-1a of everything after the header
+} HddTraceHeader;
+
+// A distinct payload, the runs from firstRun
+typedef struct {
+	uint32_t firstRun;      // The index of the first run
+	uint32_t runCount;      // The number of runs
+} HddTracePayload;
+
+// A run of payload bytes, either one repeated byte or literal bytes
+typedef struct {
+	uint32_t length;        // The number of bytes, HDD_TRACE_LITERAL set for literals
+	uint32_t value;         // The repeated byte, or the offset of the literal bytes
+} HddTraceRun;
+
+// A trace operation
+typedef struct {
+	uint8_t  op;            // The HddWorkloadOpcode
+	uint8_t  pad[3];
+	uint32_t file;          // The file id
+	int32_t  len;           // The length
+	int32_t  off;           // The offset
+	uint32_t payload;       // The payload index, HDD_TRACE_NO_PAYLOAD if none
+} HddTraceOp;
+
+// The growing sections of a trace being saved
+typedef struct {
+	HddTracePayload *payloads;  // The distinct payloads
+	uint32_t        *origins;   // The first op with each payload (for dedup)
+	uint32_t         payloadSlots;
+	HddTraceRun     *runs;      // The runs of the payloads
+	uint32_t         runSlots;
+	char            *literals;  // The literal bytes
+	uint32_t         literalSlots;
+} HddTraceBuilder;
+
+//
+// Functions
+
+// fold bytes into an FNV-1a checksum
+static uint64_t traceChecksum(uint64_t sum, const void *data, size_t length) {
+	const uint8_t *p = data;
+	size_t i;
+
+	for (i = 0; i < length; i++) {
+		sum = (sum ^ p[i]) * HDD_WL_FNV_PRIME;
+	}
+	return sum;
+}
+
+// skip blanks (not the end of the line)
+static char * skipBlanks(char *p, char *end) {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+		p++;
+	}
+	return p;
+}
+
+// parse a decimal integer in place, NULL if there is none
+static char * parseNumber(char *p, char *end, int32_t *value) {
+	int64_t v = 0;
+	int neg = 0;
+	char *start;
+
+	p = skipBlanks(p, end);
+	if (p < end && (*p == '-' || *p == '+')) {
+		neg = (*p == '-');
+		p++;
+	}
+	for (start = p; p < end && *p >= '0' && *p <= '9'; p++) {
+		v = v * 10 + (*p - '0');
+	}
+	if (p == start || v > INT32_MAX) {
+		return NULL;
+	}
+	*value = (int32_t)(neg ? -v : v);
+	return p;
+}
+
+// give the file its id, the first use of a name allocates the next one
+static uint32_t internFile(HddWorkload *wl, HTable *index, char *name) {
+	HtIndexValue key = (HtIndexValue)traceChecksum(HDD_WL_FNV_OFFSET, name, strlen(name));
+	uint32_t *value;
+
+	while ((value = findValueInHashTable(index, key)) != NULL) {	// colliding hashes use the next key
+		if (strcmp(wl->files[*value], name) == 0) {
+			return *value;
+		}
+		key++;
+	}
+	if ((wl->fileCount & (wl->fileCount - 1)) == 0) {	// grow at powers of two
+		wl->files = realloc(wl->files, (wl->fileCount ? wl->fileCount * 2 : 16) * sizeof(char *));
+	}
+	value = malloc(sizeof(uint32_t));	// the table frees it on cleanup
+	*value = wl->fileCount;
+	insertValueInHashTable(index, key, value);
+	wl->files[wl->fileCount] = name;
+	return wl->fileCount++;
+}
+
+// compile the line [line, end) into an operation, -1 if it cannot be parsed
+static int compileLine(HddWorkload *wl, HTable *index, char *line, char *end, HddWorkloadOp *op) {
+	char *name, *command, *p, *sep;
+	size_t commandLength;
+	int32_t available, i;
+
+	// The file name and the command
+	name = skipBlanks(line, end);
+	for (p = name; p < end && (unsigned char)*p > ' '; p++);
+	if (p == name || p >= end) {
+		return -1;
+	}
+	*p = '\0';	// terminate the name in place
+	command = skipBlanks(p + 1, end);
+	for (p = command; p < end && (unsigned char)*p > ' '; p++);
+	commandLength = p - command;
+
+	// The length and offset, then the payload after the first ':'
+	if ((p = parseNumber(p, end, &op->len)) == NULL || (p = parseNumber(p, end, &op->off)) == NULL ||
+		(sep = memchr(line, ':', end - line)) == NULL) {
+		return -1;
+	}
+	for (i = 0; workloadCommands[i].name != NULL; i++) {
+		if (commandLength >= workloadCommands[i].length &&
+			memcmp(command, workloadCommands[i].name, workloadCommands[i].length) == 0) {
+			break;
+		}
+	}
+	if (workloadCommands[i].name == NULL) {
+		return -1;
+	}
+	op->op = workloadCommands[i].op;
+	op->file = 0;
+	op->payload = NULL;
+	if (op->op <= HDD_WL_UNMOUNT) {	// device commands have no file
+		return 0;
+	}
+
+	op->file = internFile(wl, index, name);
+	if (op->op == HDD_WL_WRITE || op->op == HDD_WL_WRITEAT) {
+		available = end - (sep + 1);	// the payload may run up to the newline
+		if (op->len < 0 || op->len > available) {
+			return -1;
+		}
+		op->payload = sep + 1;
+		for (i = 0; i < op->len; i++) {
+			if (op->payload[i] == '*') {
+				op->payload[i] = '\n';
+			}
+		}
+	}
+	if (op->op == HDD_WL_READ && op->len < 0) {
+		return -1;
+	}
+	if (op->op != HDD_WL_SEEK && op->len > wl->maxLength) {	// the buffer replay needs
+		wl->maxLength = op->len;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_workload_load
+// Description  : Map a workload file and compile it into its operations,
+//                the time taken is kept in parseSecs.
+//
+// Inputs       : wl - the workload to fill in
+//                path - the workload file
+// Outputs      : 0 if successful, -1 if failure
+
+int hdd_workload_load(HddWorkload *wl, const char *path) {
+
+	// Local variables
+	struct timeval start, end;
+	uint32_t slots, linecount = 0;
+	char *line, *next, *stop;
+	struct stat st;
+	HTable index;
+	int fd;
+
+	// Map the file privately so it can be tokenized in place
+	gettimeofday(&start, NULL);
+	memset(wl, 0x0, sizeof(HddWorkload));
+	if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+		hdd_log(LOG_ERROR_LEVEL, "Failure opening the workload file [%s], error: %s.\n", path, strerror(errno));
+		if (fd != -1) {
+			close(fd);
+		}
+		return(-1);
+	}
+	wl->mapSize = st.st_size;
+	if (wl->mapSize > 0) {
+		wl->map = mmap(NULL, wl->mapSize, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (wl->map == MAP_FAILED) {
+			hdd_log(LOG_ERROR_LEVEL, "Failure mapping the workload file [%s], error: %s.\n", path, strerror(errno));
+			wl->map = NULL;
+			close(fd);
+			return(-1);
+		}
+		madvise(wl->map, wl->mapSize, MADV_SEQUENTIAL);
+	}
+	close(fd);
+	if (initHashTable(&index, HDD_WL_INDEX_BITS)) {
+		hdd_log(LOG_ERROR_LEVEL, "Failure creating the workload file index.\n");
+		hdd_workload_free(wl);
+		return(-1);
+	}
+
+	// Compile each line, lines keep their newline so payloads can reach it
+	slots = 0;
+	stop = wl->map + wl->mapSize;
+	for (line = wl->map; line < stop; line = next) {
+		next = memchr(line, '\n', stop - line);
+		next = (next != NULL) ? next + 1 : stop;
+		linecount++;
+		if (wl->count == slots) {
+			slots = (slots > 0) ? slots * 2 : HDD_WL_MIN_OPS;
+			wl->ops = realloc(wl->ops, slots * sizeof(HddWorkloadOp));
+		}
+		if (compileLine(wl, &index, line, next, &wl->ops[wl->count])) {
+			hdd_log(LOG_ERROR_LEVEL, "HDD un-parsable workload string, aborting [%.*s], line %u",
+				(int)(next - line), line, linecount);
+			cleanupHashTable(&index);
+			hdd_workload_free(wl);
+			return(-1);
+		}
+		wl->count++;
+	}
+	cleanupHashTable(&index);
+
+	gettimeofday(&end, NULL);
+	wl->parseSecs = (double)compareTimes(&start, &end) / 1000000.0;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_workload_free
+// Description  : Release the operations and mapping of a loaded workload
+//
+// Inputs       : wl - the workload
+// Outputs      : none
+
+void hdd_workload_free(HddWorkload *wl) {
+	if (wl->map != NULL) {
+		munmap(wl->map, wl->mapSize);
+	}
+	free(wl->ops);
+	free(wl->files);
+	free(wl->payloads);
+	memset(wl, 0x0, sizeof(HddWorkload));
+}
+
+// write a section of the trace, folding it into the checksum
+static int writeSection(FILE *fp, uint64_t *sum, const void *data, size_t length) {
+	*sum = traceChecksum(*sum, data, length);
+	return (length == 0 || fwrite(data, length, 1, fp) == 1) ? 0 : -1;
+}
+
+// add a run to the trace, literal runs copy their bytes
+static void addRun(HddTraceBuilder *tb, HddTraceHeader *hdr, const char *bytes, uint32_t length, int literal) {
+	HddTraceRun *r;
+
+	if (hdr->runCount == tb->runSlots) {
+		tb->runSlots = (tb->runSlots > 0) ? tb->runSlots * 2 : HDD_WL_MIN_OPS;
+		tb->runs = realloc(tb->runs, tb->runSlots * sizeof(HddTraceRun));
+	}
+	r = &tb->runs[hdr->runCount++];
+	r->length = length;
+	r->value = (uint8_t)bytes[0];
+	if (literal) {
+		while (hdr->literalBytes + length > tb->literalSlots) {
+			tb->literalSlots = (tb->literalSlots > 0) ? tb->literalSlots * 2 : HDD_WL_MIN_OPS;
+			tb->literals = realloc(tb->literals, tb->literalSlots);
+		}
+		memcpy(tb->literals + hdr->literalBytes, bytes, length);
+		r->length |= HDD_TRACE_LITERAL;
+		r->value = hdr->literalBytes;
+		hdr->literalBytes += length;
+	}
+}
+
+// encode a new payload, repeated bytes become runs and the rest literals
+static uint32_t addPayload(HddTraceBuilder *tb, HddTraceHeader *hdr, HddWorkload *wl, uint32_t origin) {
+	char *p = wl->ops[origin].payload, *end = p + wl->ops[origin].len, *literal = p;
+	uint32_t n;
+
+	if (hdr->payloadCount == tb->payloadSlots) {
+		tb->payloadSlots = (tb->payloadSlots > 0) ? tb->payloadSlots * 2 : HDD_WL_MIN_OPS;
+		tb->payloads = realloc(tb->payloads, tb->payloadSlots * sizeof(HddTracePayload));
+		tb->origins = realloc(tb->origins, tb->payloadSlots * sizeof(uint32_t));
+	}
+	tb->payloads[hdr->payloadCount].firstRun = hdr->runCount;
+	tb->origins[hdr->payloadCount] = origin;
+	while (p < end) {
+		for (n = 1; p + n < end && p[n] == *p; n++);
+		if (n < HDD_TRACE_MIN_RUN) {	// too short, leave it in the literal
+			p += n;
+			continue;
+		}
+		if (literal < p) {
+			addRun(tb, hdr, literal, p - literal, 1);
+		}
+		addRun(tb, hdr, p, n, 0);
+		literal = p = p + n;
+	}
+	if (literal < end) {
+		addRun(tb, hdr, literal, end - literal, 1);
+	}
+	tb->payloads[hdr->payloadCount].runCount = hdr->runCount - tb->payloads[hdr->payloadCount].firstRun;
+	return hdr->payloadCount++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_workload_save
+// Description  : Save a loaded workload as a binary trace.  Each distinct
+//                payload is stored once, as runs of a repeated byte and
+//                literal bytes.
+//
+// Inputs       : wl - the workload
+//                path - the trace file to create
+// Outputs      : 0 if successful, -1 if failure
+
+int hdd_workload_save(HddWorkload *wl, const char *path) {
+
+	// Local variables
+	HddTraceBuilder tb;
+	HddTraceHeader hdr;
+	HddTraceOp *ops = NULL;
+	uint32_t *value, i;
+	HtIndexValue key;
+	HTable index;
+	FILE *fp;
+	int ret = 0;
+
+	memset(&hdr, 0x0, sizeof(hdr));
+	memset(&tb, 0x0, sizeof(tb));
+	hdr.magic = HDD_TRACE_MAGIC;
+	hdr.version = HDD_TRACE_VERSION;
+	hdr.opCount = wl->count;
+	hdr.fileCount = wl->fileCount;
+	hdr.maxLength = wl->maxLength;
+	for (i = 0; i < wl->fileCount; i++) {
+		hdr.nameBytes += strlen(wl->files[i]) + 1;
+	}
+	ops = calloc(wl->count + 1, sizeof(HddTraceOp));
+	if (ops == NULL || initHashTable(&index, HDD_WL_INDEX_BITS)) {
+		hdd_log(LOG_ERROR_LEVEL, "Failure creating the trace tables.\n");
+		free(ops);
+		return(-1);
+	}
+
+	// Give each op its payload, identical payloads are encoded once
+	for (i = 0; i < wl->count; i++) {
+		ops[i].op = wl->ops[i].op;
+		ops[i].file = wl->ops[i].file;
+		ops[i].len = wl->ops[i].len;
+		ops[i].off = wl->ops[i].off;
+		ops[i].payload = HDD_TRACE_NO_PAYLOAD;
+		if (wl->ops[i].payload == NULL) {
+			continue;
+		}
+
+		// Look for the same bytes stored before (colliding hashes use the next key)
+		key = traceChecksum(HDD_WL_FNV_OFFSET, wl->ops[i].payload, wl->ops[i].len);
+		while ((value = findValueInHashTable(&index, key)) != NULL) {
+			if (wl->ops[tb.origins[*value]].len == wl->ops[i].len &&
+				memcmp(wl->ops[tb.origins[*value]].payload, wl->ops[i].payload, wl->ops[i].len) == 0) {
+				break;
+			}
+			key++;
+		}
+		if (value == NULL) {
+			value = malloc(sizeof(uint32_t));	// the table frees it on cleanup
+			*value = addPayload(&tb, &hdr, wl, i);
+			insertValueInHashTable(&index, key, value);
+		}
+		ops[i].payload = *value;
+	}
+	cleanupHashTable(&index);
+
+	// Write the checksummed sections, then the header in front of them
+	if ((fp = fopen(path, "w")) == NULL) {
+		hdd_log(LOG_ERROR_LEVEL, "Failure creating the trace file [%s], error: %s.\n", path, strerror(errno));
+		ret = -1;
+	} else {
+		hdr.checksum = HDD_WL_FNV_OFFSET;
+		if (fseek(fp, sizeof(hdr), SEEK_SET) ||
+			writeSection(fp, &hdr.checksum, tb.payloads, hdr.payloadCount * sizeof(HddTracePayload)) ||
+			writeSection(fp, &hdr.checksum, tb.runs, hdr.runCount * sizeof(HddTraceRun)) ||
+			writeSection(fp, &hdr.checksum, ops, hdr.opCount * sizeof(HddTraceOp)) ||
+			writeSection(fp, &hdr.checksum, tb.literals, hdr.literalBytes)) {
+			ret = -1;
+		}
+		for (i = 0; i < wl->fileCount && ret == 0; i++) {
+			ret = writeSection(fp, &hdr.checksum, wl->files[i], strlen(wl->files[i]) + 1);
+		}
+		if (ret == 0 && (fseek(fp, 0, SEEK_SET) || fwrite(&hdr, sizeof(hdr), 1, fp) != 1)) {
+			ret = -1;
+		}
+		if (fclose(fp) || ret) {
+			hdd_log(LOG_ERROR_LEVEL, "Failure writing the trace file [%s], error: %s.\n", path, strerror(errno));
+			ret = -1;
+		}
+	}
+	if (ret == 0) {
+		hdd_log(LOG_INFO_LEVEL, "HDD_WORKLOAD : saved %u commands, %u distinct payloads in %u runs (%u literal bytes)",
+			hdr.opCount, hdr.payloadCount, hdr.runCount, hdr.literalBytes);
+	}
+
+	free(tb.payloads);
+	free(tb.origins);
+	free(tb.runs);
+	free(tb.literals);
+	free(ops);
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_workload_load_trace
+// Description  : Map a binary trace (see hdd_workload_save) and check it,
+//                then expand its payloads.  Nothing is parsed per line.
+//
+// Inputs       : wl - the workload to fill in
+//                path - the trace file
+// Outputs      : 0 if successful, -1 if failure
+
+int hdd_workload_load_trace(HddWorkload *wl, const char *path) {
+
+	// Local variables
+	struct timeval start, end;
+	HddTraceHeader *hdr;
+	HddTracePayload *payloads;
+	HddTraceRun *runs, *r;
+	HddTraceOp *ops;
+	char **expanded = NULL, *p, *literals, *names, *stop;
+	uint64_t poolBytes = 0, length;
+	struct stat st;
+	uint32_t i, j;
+	int fd;
+
+	// Map the trace
+	gettimeofday(&start, NULL);
+	memset(wl, 0x0, sizeof(HddWorkload));
+	if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+		hdd_log(LOG_ERROR_LEVEL, "Failure opening the trace file [%s], error: %s.\n", path, strerror(errno));
+		if (fd != -1) {
+			close(fd);
+		}
+		return(-1);
+	}
+	wl->mapSize = st.st_size;
+	if (wl->mapSize < sizeof(HddTraceHeader) ||
+		(wl->map = mmap(NULL, wl->mapSize, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		hdd_log(LOG_ERROR_LEVEL, "Failure mapping the trace file [%s].\n", path);
+		wl->map = NULL;
+		close(fd);
+		return(-1);
+	}
+	close(fd);
+
+	// Check the header, section sizes and checksum
+	hdr = (HddTraceHeader *)wl->map;
+	payloads = (HddTracePayload *)(hdr + 1);
+	runs = (HddTraceRun *)(payloads + hdr->payloadCount);
+	ops = (HddTraceOp *)(runs + hdr->runCount);
+	literals = (char *)(ops + hdr->opCount);
+	names = literals + hdr->literalBytes;
+	stop = wl->map + wl->mapSize;
+	if (hdr->magic != HDD_TRACE_MAGIC || hdr->version != HDD_TRACE_VERSION ||
+		sizeof(HddTraceHeader) + (uint64_t)hdr->payloadCount * sizeof(HddTracePayload) +
+		(uint64_t)hdr->runCount * sizeof(HddTraceRun) + (uint64_t)hdr->opCount * sizeof(HddTraceOp) +
+		(uint64_t)hdr->literalBytes + hdr->nameBytes != wl->mapSize ||
+		traceChecksum(HDD_WL_FNV_OFFSET, payloads, stop - (char *)payloads) != hdr->checksum) {
+		hdd_log(LOG_ERROR_LEVEL, "Bad trace file [%s] (not a version %d trace, or corrupt).\n",
+			path, HDD_TRACE_VERSION);
+		hdd_workload_free(wl);
+		return(-1);
+	}
+
+	// Find the file names
+	wl->fileCount = hdr->fileCount;
+	wl->files = malloc((wl->fileCount + 1) * sizeof(char *));
+	for (i = 0, p = names; i < wl->fileCount; i++, p += strlen(p) + 1) {
+		if (p >= stop || memchr(p, '\0', stop - p) == NULL) {
+			hdd_log(LOG_ERROR_LEVEL, "Bad trace file [%s] (file names).\n", path);
+			hdd_workload_free(wl);
+			return(-1);
+		}
+		wl->files[i] = p;
+	}
+
+	// Check the runs, then expand the payloads into one pool
+	for (i = 0; i < hdr->runCount; i++) {
+		length = runs[i].length & ~HDD_TRACE_LITERAL;
+		if ((runs[i].length & HDD_TRACE_LITERAL) && (uint64_t)runs[i].value + length > hdr->literalBytes) {
+			hdd_log(LOG_ERROR_LEVEL, "Bad trace file [%s] (literal run %u).\n", path, i);
+			hdd_workload_free(wl);
+			return(-1);
+		}
+	}
+	for (i = 0; i < hdr->payloadCount; i++) {
+		if ((uint64_t)payloads[i].firstRun + payloads[i].runCount > hdr->runCount) {
+			hdd_log(LOG_ERROR_LEVEL, "Bad trace file [%s] (payload runs).\n", path);
+			hdd_workload_free(wl);
+			return(-1);
+		}
+		for (j = 0; j < payloads[i].runCount; j++) {
+			poolBytes += runs[payloads[i].firstRun + j].length & ~HDD_TRACE_LITERAL;
+		}
+	}
+	expanded = malloc((hdr->payloadCount + 1) * sizeof(char *));
+	wl->payloads = malloc(poolBytes + 1);
+	for (i = 0, p = wl->payloads; i < hdr->payloadCount; i++) {
+		expanded[i] = p;
+		for (j = 0, r = &runs[payloads[i].firstRun]; j < payloads[i].runCount; j++, r++) {
+			length = r->length & ~HDD_TRACE_LITERAL;
+			if (r->length & HDD_TRACE_LITERAL) {
+				memcpy(p, literals + r->value, length);
+			} else {
+				memset(p, r->value, length);
+			}
+			p += length;
+		}
+	}
+	expanded[hdr->payloadCount] = p;	// the end of the last payload
+
+	// Copy out the operations
+	wl->count = hdr->opCount;
+	wl->maxLength = hdr->maxLength;
+	wl->ops = malloc((wl->count + 1) * sizeof(HddWorkloadOp));
+	for (i = 0; i < wl->count; i++) {
+		wl->ops[i].op = ops[i].op;
+		wl->ops[i].file = ops[i].file;
+		wl->ops[i].len = ops[i].len;
+		wl->ops[i].off = ops[i].off;
+		wl->ops[i].payload = NULL;
+		length = 0;
+		if (ops[i].payload < hdr->payloadCount) {
+			wl->ops[i].payload = expanded[ops[i].payload];
+			length = expanded[ops[i].payload + 1] - expanded[ops[i].payload];
+		}
+		if (ops[i].op > HDD_WL_READ || (ops[i].op > HDD_WL_UNMOUNT && ops[i].file >= wl->fileCount) ||
+			(ops[i].op == HDD_WL_READ && (ops[i].len < 0 || ops[i].len > wl->maxLength)) ||
+			((ops[i].op == HDD_WL_WRITE || ops[i].op == HDD_WL_WRITEAT) &&
+			 (wl->ops[i].payload == NULL || ops[i].len < 0 || (uint64_t)ops[i].len != length))) {
+			hdd_log(LOG_ERROR_LEVEL, "Bad trace file [%s] (operation %u).\n", path, i);
+			free(expanded);
+			hdd_workload_free(wl);
+			return(-1);
+		}
+	}
+	free(expanded);
+
+	gettimeofday(&end, NULL);
+	wl->parseSecs = (double)compareTimes(&start, &end) / 1000000.0;
+	return(0);
+}
+
+// check the operations of the unit test workload
+static int checkTestWorkload(HddWorkload *wl) {
+	return (wl->count != 6 || wl->fileCount != 2 || wl->maxLength != 5 ||
+		wl->ops[0].op != HDD_WL_FORMAT || wl->ops[5].op != HDD_WL_UNMOUNT ||
+		wl->ops[1].op != HDD_WL_WRITE || memcmp(wl->ops[1].payload, "ab\ncd", 5) != 0 ||
+		wl->ops[2].op != HDD_WL_READ || wl->ops[2].file != 1 || strcmp(wl->files[1], "b.txt") != 0 ||
+		wl->ops[3].op != HDD_WL_WRITEAT || wl->ops[3].file != 0 || wl->ops[3].off != 7 ||
+		memcmp(wl->ops[3].payload, "zz", 2) != 0 ||
+		wl->ops[4].op != HDD_WL_SEEK || wl->ops[4].off != 4) ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hddWorkloadUnitTest
+// Description  : Compile a small workload and check the operations, save
+//                it as a trace and check the replayed trace matches, then
+//                check that a truncated payload and a corrupt trace are
+//                refused.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int hddWorkloadUnitTest(void) {
+
+	// Local variables
+	const char *good = "x FORMAT 0 0:\n"
+		"a.txt WRITE 5 0 :ab*cd\n"
+		"b.txt READ 3 0 :\n"
+		"a.txt WRITEAT 2 7 :zz\n"
+		"a.txt SEEK 0 4 :\n"
+		"x UNMOUNT 0 0:";
+	const char *bad = "a.txt WRITE 9 0 :ab\n";
+	char path[] = "/tmp/hdd_workload_XXXXXX", trace[64];
+	HddWorkload wl;
+	int fd, ret;
+
+	// Write and compile the good workload, then save and load it as a trace
+	if ((fd = mkstemp(path)) == -1 || write(fd, good, strlen(good)) != (ssize_t)strlen(good)) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_WORKLOAD_UNIT_TEST : failed to create test workload.");
+		return(-1);
+	}
+	close(fd);
+	snprintf(trace, sizeof(trace), "%s.trc", path);
+	ret = hdd_workload_load(&wl, path);
+	if (ret == 0) {
+		ret = checkTestWorkload(&wl) || hdd_workload_save(&wl, trace);
+		hdd_workload_free(&wl);
+	}
+	if (ret == 0 && (ret = hdd_workload_load_trace(&wl, trace)) == 0) {
+		ret = checkTestWorkload(&wl);
+		hdd_workload_free(&wl);
+	}
+
+	// A corrupt trace must be refused
+	if (ret == 0 && ((fd = open(trace, O_WRONLY)) == -1 || pwrite(fd, "?", 1, sizeof(HddTraceHeader) + 1) != 1)) {
+		ret = -1;
+	}
+	if (fd != -1) {
+		close(fd);
+	}
+	if (ret == 0 && hdd_workload_load_trace(&wl, trace) == 0) {
+		hdd_workload_free(&wl);
+		ret = -1;
+	}
+	unlink(trace);
+
+	// A payload shorter than its length must be refused
+	if (ret == 0 && ((fd = open(path, O_WRONLY|O_TRUNC)) == -1 ||
+		write(fd, bad, strlen(bad)) != (ssize_t)strlen(bad))) {
+		ret = -1;
+	}
+	if (fd != -1) {
+		close(fd);
+	}
+	if (ret == 0 && hdd_workload_load(&wl, path) == 0) {
+		hdd_workload_free(&wl);
+		ret = -1;
+	}
+	unlink(path);
+
+	if (ret) {
+		hdd_log(LOG_ERROR_LEVEL, "HDD_WORKLOAD_UNIT_TEST : workload compiled incorrectly.");
+		return(-1);
+	}
+	hdd_log(LOG_INFO_LEVEL, "HDD_WORKLOAD_UNIT_TEST : workload tests completed successfully.");
+	return(0);
+}
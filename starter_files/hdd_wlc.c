@@ -0,0 +1,106 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : hdd_wlc.c
+//  Description   : This is the workload compiler.  It compiles a text
+//                  workload (e.g., workload-one.txt) into the binary trace
+//                  that hdd_client -b replays.
+//
+//   Author : Chuyang Zhang
+//   Last Modified : 2017/12/1
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Project Includes
+#include <hdd_workload.h>
+#include <cmpsc311_log.h>
+#include <hdd_log.h>
+
+// Defines
+#define HDD_WLC_ARGUMENTS "hvl:"
+#define USAGE \
+	"USAGE: hdd_wlc [-h] [-v] [-l <logfile>] <workload-file> <trace-file>\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"\n" \
+	"    <workload-file> - the text workload to compile\n" \
+	"    <trace-file> - the binary trace to create\n" \
+	"\n" \
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the workload compiler
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0;
+	HddWorkload wl;
+	struct stat st;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, HDD_WLC_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	if ( verbose ) {
+		enableLogLevels( LOG_INFO_LEVEL );
+	}
+	if ( optind + 2 != argc ) {
+		fprintf( stderr, "Missing command line parameters, use -h to see usage, aborting.\n" );
+		return( -1 );
+	}
+
+	// Compile the workload and save the trace
+	if ( hdd_workload_load(&wl, argv[optind]) ) {
+		return( -1 );
+	}
+	if ( hdd_workload_save(&wl, argv[optind+1]) ) {
+		hdd_workload_free( &wl );
+		return( -1 );
+	}
+	hdd_log( LOG_OUTPUT_LEVEL, "HDD_WLC : %s -> %s, %u commands, %u files, %lu -> %lu bytes",
+		argv[optind], argv[optind+1], wl.count, wl.fileCount, (unsigned long)wl.mapSize,
+		(stat(argv[optind+1], &st) == 0) ? (unsigned long)st.st_size : 0UL );
+	hdd_workload_free( &wl );
+
+	// Return successfully
+	return( 0 );
+}
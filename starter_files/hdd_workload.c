@@ -0,0 +1,473 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : hdd_workload.c
+//  Description   : This is the workload replay for the HDD simulator.  The
+//                  operations compiled by hdd_trace.c (from a workload file
+//                  or a binary trace) are carried out through the file
+//                  interface, on the calling thread, as asynchronous file
+//                  commands, or split across threads by the simulator.
+//
+//  Author         : Chuyang Zhang
+//  Last Modified  : 2017/12/1
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+
+// Project Includes
+#include <hdd_workload.h>
+#include <hdd_file_io.h>
+#include <hdd_async.h>
+#include <hdd_stats.h>
+#include <cmpsc311_log.h>
+#include <hdd_log.h>
+
+// Defines
+#define HDD_WL_ASYNC_REAP 64	// completions taken off the queue at once
+
+// The commands in flight of an asynchronous replay
+typedef struct {
+	HddWorkloadFiles files;     // The files and their replay positions
+	char            *rbufs;     // The buffers reads land in, one per command in flight
+	uint32_t         length;    // The size of each
+	uint32_t        *slots;     // The free read buffers
+	uint32_t         freeSlots; // How many
+	uint32_t        *reads;     // The reads in flight of each file id
+	uint8_t         *writing;   // A write of each file id is in flight
+	uint64_t        *started;   // The submit time of each operation (for the statistics)
+} HddAsyncReplay;
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_workload_device_op
+// Description  : Carry out a FORMAT, MOUNT or UNMOUNT of the workload (the
+//                files must already be closed for an UNMOUNT).
+//
+// Inputs       : op - the workload operation
+// Outputs      : 0 if successful, -1 if failure
+
+int hdd_workload_device_op( HddWorkloadOp *op ) {
+
+	if (op->op == HDD_WL_FORMAT) {
+
+		// Log the command executed
+		hdd_log(LOG_INFO_LEVEL, "HDD_SIM : Formatting HDD filesystem");
+
+		// Now perform the format
+		if (hdd_format() != op->len) {
+			// Failed, error out
+			hdd_log(LOG_ERROR_LEVEL, "Formatting failed, aborting simulation.");
+			return(-1);
+		}
+
+	} else if (op->op == HDD_WL_MOUNT) {
+
+		// Log the command executed
+		hdd_log(LOG_INFO_LEVEL, "HDD_SIM : Mounting HDD filesystem");
+
+		// Now perform the filesystem mount
+		if (hdd_mount() != op->len) {
+			// Failed, error out
+			hdd_log(LOG_ERROR_LEVEL, "Mount failed, aborting simulation.");
+			return(-1);
+		}
+
+	} else {
+
+		// Log the command executed
+		hdd_log(LOG_INFO_LEVEL, "HDD_SIM : Un-mounting HDD filesystem");
+
+		// Now perform the filesystem unmount
+		if (hdd_unmount() != op->len) {
+			// Failed, error out
+			hdd_log(LOG_ERROR_LEVEL, "Mount failed, aborting simulation.");
+			return(-1);
+		}
+	}
+
+	return( 0 );
+}
+
+// the handle of the file of an operation, opening the file the first time it is used
+static int16_t openWorkloadFile( HddWorkloadFiles *sf, HddWorkload *wl, HddWorkloadOp *op ) {
+	char *fname = wl->files[op->file];
+	int16_t fh = sf->fhandle[op->file];
+
+		// File is not open, open the file
+		if (fh == -1) {
+
+			// Log message, remember the file so it is closed at unmount
+			hdd_log(LOG_INFO_LEVEL, "HDD_SIM : Opening file [%s]", fname);
+			sf->opened[sf->used++] = op->file;
+
+			// Now perform the open
+			fh = sf->fhandle[op->file] = hdd_open(fname);
+			if (fh == -1) {
+				// Failed, error out
+				hdd_log(LOG_ERROR_LEVEL, "Open of new file [%s] failed, aborting simulation.", fname);
+				return(-1);
+			}
+			sf->pos[op->file] = 0;
+
+		}
+	return( fh );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_workload_file_op
+// Description  : Carry out one file command of the workload (WRITEAT, WRITE,
+//                SEEK or READ), opening the file the first time it is used.
+//
+// Inputs       : sf - the simulation file table
+//                wl - the workload
+//                op - the workload operation
+// Outputs      : 0 if successful, -1 if failure
+
+int hdd_workload_file_op( HddWorkloadFiles *sf, HddWorkload *wl, HddWorkloadOp *op ) {
+
+	// Local variables
+	char *fname = wl->files[op->file];
+	int16_t fh = openWorkloadFile(sf, wl, op);
+
+		// The file could not be opened
+		if (fh == -1) {
+			return(-1);
+		}
+
+		// Now execute the specific command, the position is kept here rather than in the
+		// file handle so a SEEK and the READ or WRITE after it make one positional call
+		if (op->op == HDD_WL_WRITEAT) {
+
+			// Log the command executed
+			hdd_log(LOG_INFO_LEVEL, "HDD_SIM : Writing %d bytes at position %d from file [%s]", op->len, op->off, fname);
+
+			// Now perform the write at the position, straight from the workload mapping
+			if (hdd_pwrite(fh, op->payload, op->len, op->off) != op->len) {
+				// Failed, error out
+				hdd_log(LOG_ERROR_LEVEL, "WriteAt of file [%s], length %d at position %d failed, aborting simulation.", fname, op->len, op->off);
+				return(-1);
+			}
+			sf->pos[op->file] = op->off + op->len;
+
+		} else if (op->op == HDD_WL_WRITE) {
+
+			// Log the command executed
+			hdd_log(LOG_INFO_LEVEL, "HDD_SIM : Writing %d bytes to file [%s]", op->len, fname);
+
+			// Now perform the write, straight from the workload mapping
+			if (hdd_pwrite(fh, op->payload, op->len, sf->pos[op->file]) != op->len) {
+				// Failed, error out
+				hdd_log(LOG_ERROR_LEVEL, "Write of file [%s], length %d failed, aborting simulation.", fname, op->len);
+				return(-1);
+			}
+			sf->pos[op->file] += op->len;
+
+		} else if (op->op == HDD_WL_SEEK) {
+
+			// Log the command executed
+			hdd_log(LOG_INFO_LEVEL, "HDD_SIM : Seeking to position %d in file [%s]", op->off, fname);
+
+			// Only a seek expected to fail is made, the range of the others is checked by the next read or write
+			if (op->len == 0) {
+				sf->pos[op->file] = op->off;
+			} else if (hdd_seek(fh, op->off) != op->len) {
+				// Failed, error out
+				hdd_log(LOG_ERROR_LEVEL, "Seek in file [%s] to position %d failed, aborting simulation.", fname, op->off);
+				return(-1);
+			}
+
+		} else {
+
+			// Log the command executed
+			hdd_log(LOG_INFO_LEVEL, "HDD_SIM : Reading %d bytes from file [%s]", op->len, fname);
+
+			// Now perform the read
+			if (hdd_pread(fh, sf->rbuf, op->len, sf->pos[op->file]) != op->len) {
+				// Failed, error out
+				hdd_log(LOG_ERROR_LEVEL, "Read file [%s] of length %d failed, aborting simulation.", fname, op->len);
+				return(-1);
+			}
+			sf->pos[op->file] += op->len;
+
+		}
+
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_workload_init_files
+// Description  : Setup a simulation file table for the files of a workload
+//
+// Inputs       : sf - the file table
+//                wl - the workload
+//                fhandle - handles shared with another table, NULL for new
+// Outputs      : 0 if successful, -1 if failure
+
+int hdd_workload_init_files( HddWorkloadFiles *sf, HddWorkload *wl, int16_t *fhandle ) {
+
+	// Local variables
+	uint32_t i;
+
+	sf->used = 0;
+	sf->fhandle = fhandle;
+	sf->shared = (fhandle != NULL);
+	if ( sf->fhandle == NULL ) {
+		sf->fhandle = malloc( (wl->fileCount + 1) * sizeof(int16_t) );
+		for (i=0; i<wl->fileCount; i++) {
+			sf->fhandle[i] = -1;
+		}
+	}
+	sf->opened = malloc( (wl->fileCount + 1) * sizeof(uint32_t) );
+	sf->pos = malloc( (wl->fileCount + 1) * sizeof(uint32_t) );
+	sf->rbuf = malloc( wl->maxLength + 1 );
+	if ( (sf->fhandle == NULL) || (sf->opened == NULL) || (sf->pos == NULL) || (sf->rbuf == NULL) ) {
+		hdd_log( LOG_ERROR_LEVEL, "Failure creating the file table.\n" );
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_workload_close_files
+// Description  : Close the files opened through a simulation file table
+//
+// Inputs       : sf - the file table
+//                wl - the workload
+// Outputs      : 0 if successful, -1 if failure
+
+int hdd_workload_close_files( HddWorkloadFiles *sf, HddWorkload *wl ) {
+
+	// Local variables
+	uint32_t file;
+
+	while ( sf->used > 0 ) {
+
+		// If file in use, close it
+		file = sf->opened[--sf->used];
+		hdd_log(LOG_INFO_LEVEL, "HDD_SIM : Closing file [%s]", wl->files[file]);
+		if (hdd_close(sf->fhandle[file]) == -1) {
+			// Failed, error out
+			hdd_log(LOG_ERROR_LEVEL, "Close file [%s] failed, aborting simulation.", wl->files[file]);
+			return(-1);
+		}
+		sf->fhandle[file] = -1;
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_workload_free_files
+// Description  : Release a simulation file table
+//
+// Inputs       : sf - the file table
+// Outputs      : none
+
+void hdd_workload_free_files( HddWorkloadFiles *sf ) {
+	if ( ! sf->shared ) {
+		free( sf->fhandle );
+	}
+	free( sf->opened );
+	free( sf->pos );
+	free( sf->rbuf );
+	sf->fhandle = NULL;
+	sf->opened = NULL;
+	sf->pos = NULL;
+	sf->rbuf = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_workload_replay
+// Description  : Replay the operations of a workload in order on the
+//                calling thread, timing each in the run statistics.  The
+//                files are closed before an UNMOUNT.
+//
+// Inputs       : wl - the workload
+// Outputs      : 0 if successful, -1 if failure
+
+int hdd_workload_replay( HddWorkload *wl ) {
+
+	// Local variables
+	HddWorkloadFiles files;
+	uint64_t start;
+	uint32_t i;
+	int ret = 0;
+
+	if ( hdd_workload_init_files(&files, wl, NULL) ) {
+		hdd_workload_free_files( &files );
+		return( -1 );
+	}
+	for (i=0; (i<wl->count) && (ret == 0); i++) {
+		start = hdd_stats_now();
+		if ( wl->ops[i].op == HDD_WL_UNMOUNT ) {
+			// Finished, close all of the files
+			ret = hdd_workload_close_files( &files, wl );
+		}
+		if ( ret == 0 ) {
+			ret = ( wl->ops[i].op <= HDD_WL_UNMOUNT ) ? hdd_workload_device_op( &wl->ops[i] ) :
+				hdd_workload_file_op( &files, wl, &wl->ops[i] );
+		}
+		hdd_stats_record( HDD_STATS_FORMAT + wl->ops[i].op, start );
+	}
+	hdd_workload_free_files( &files );
+	return( ret );
+}
+
+// take the completed commands of an asynchronous replay off the queue, waiting
+// for at least one, and check each did what the workload says
+static int reapAsyncReplay( HddAsyncReplay *ar, HddWorkload *wl ) {
+	HddAsyncCompletion comps[HDD_WL_ASYNC_REAP];
+	HddWorkloadOp *op;
+	uint32_t idx;
+	int i, n, ret = 0;
+
+	n = hdd_async_wait( comps, HDD_WL_ASYNC_REAP, 1 );
+	for (i=0; i<n; i++) {
+		idx = comps[i].tag & 0xffffffff;
+		op = &wl->ops[idx];
+		hdd_stats_record( HDD_STATS_FORMAT + op->op, ar->started[idx] );
+		if ( op->op == HDD_WL_READ ) {
+			ar->slots[ar->freeSlots++] = comps[i].tag >> 32;
+			ar->reads[op->file]--;
+		} else {
+			ar->writing[op->file] = 0;
+		}
+		if ( comps[i].result != op->len ) {
+			hdd_log( LOG_ERROR_LEVEL, "%s of file [%s], length %d failed [%d], aborting simulation.",
+				(op->op == HDD_WL_READ) ? "Read" : "Write", wl->files[op->file], op->len, comps[i].result );
+			ret = -1;
+		}
+	}
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hdd_workload_replay_async
+// Description  : Replay a workload from the calling thread through the
+//                asynchronous queue, keeping up to depth READ, WRITE and
+//                WRITEAT commands in flight.  A command waits only for the
+//                ones of its file it depends on (a READ for a write in
+//                flight, a write or SEEK for anything in flight), FORMAT,
+//                MOUNT and UNMOUNT wait for all of them.
+//
+// Inputs       : wl - the workload
+//                depth - the most commands in flight (1 to HDD_ASYNC_MAX_DEPTH)
+// Outputs      : 0 if successful, -1 if failure
+
+int hdd_workload_replay_async( HddWorkload *wl, uint32_t depth ) {
+
+	// Local variables
+	HddAsyncReplay ar;
+	HddAsyncRequest req;
+	HddWorkloadOp *op;
+	uint64_t start;
+	uint32_t i, slot;
+	int16_t fh;
+	int ret = 0;
+
+	// Setup the file table, the read buffers (one per command in flight) and the queue
+	memset( &ar, 0x0, sizeof(ar) );
+	ar.length = wl->maxLength + 1;
+	ar.rbufs = malloc( depth * ar.length );
+	ar.slots = malloc( depth * sizeof(uint32_t) );
+	ar.reads = calloc( wl->fileCount + 1, sizeof(uint32_t) );
+	ar.writing = calloc( wl->fileCount + 1, sizeof(uint8_t) );
+	ar.started = malloc( (wl->count + 1) * sizeof(uint64_t) );
+	if ( hdd_workload_init_files(&ar.files, wl, NULL) || (ar.rbufs == NULL) || (ar.slots == NULL) ||
+		(ar.reads == NULL) || (ar.writing == NULL) || (ar.started == NULL) ||
+		hdd_async_init((depth < HDD_ASYNC_MAX_WORKERS) ? depth : HDD_ASYNC_MAX_WORKERS, depth) ) {
+		hdd_log( LOG_ERROR_LEVEL, "Failure setting up the asynchronous replay." );
+		ret = -1;
+	}
+	for (ar.freeSlots=0; (ret == 0) && (ar.freeSlots < depth); ar.freeSlots++) {
+		ar.slots[ar.freeSlots] = ar.freeSlots;
+	}
+
+	for (i=0; (i<wl->count) && (ret == 0); i++) {
+		op = &wl->ops[i];
+
+		// Device commands wait for everything in flight, then run here
+		if ( op->op <= HDD_WL_UNMOUNT ) {
+			while ( (ret == 0) && (hdd_async_outstanding() > 0) ) {
+				ret = reapAsyncReplay( &ar, wl );
+			}
+			start = hdd_stats_now();
+			if ( (ret == 0) && (op->op == HDD_WL_UNMOUNT) ) {
+				ret = hdd_workload_close_files( &ar.files, wl );
+			}
+			if ( ret == 0 ) {
+				ret = hdd_workload_device_op( op );
+			}
+			hdd_stats_record( HDD_STATS_FORMAT + op->op, start );
+			continue;
+		}
+
+		// Wait for the commands of the file this one depends on, and for room in the queue
+		while ( (ret == 0) && (ar.writing[op->file] || ((op->op != HDD_WL_READ) && (ar.reads[op->file] > 0)) ||
+			(hdd_async_outstanding() >= depth)) ) {
+			ret = reapAsyncReplay( &ar, wl );
+		}
+		if ( ret ) {
+			break;
+		}
+
+		// A SEEK only moves the replay position, it is done here
+		if ( op->op == HDD_WL_SEEK ) {
+			start = hdd_stats_now();
+			ret = hdd_workload_file_op( &ar.files, wl, op );
+			hdd_stats_record( HDD_STATS_FORMAT + op->op, start );
+			continue;
+		}
+		if ( (fh = openWorkloadFile(&ar.files, wl, op)) == -1 ) {
+			ret = -1;
+			break;
+		}
+
+		// Submit the command at the replay position, the tag is the operation and its read buffer
+		req.fh = fh;
+		req.len = op->len;
+		req.off = (op->op == HDD_WL_WRITEAT) ? (uint32_t)op->off : ar.files.pos[op->file];
+		if ( op->op == HDD_WL_READ ) {
+			slot = ar.slots[--ar.freeSlots];
+			req.op = HDD_ASYNC_READ;
+			req.buf = &ar.rbufs[slot * ar.length];
+			ar.reads[op->file]++;
+		} else {
+			slot = 0;
+			req.op = HDD_ASYNC_WRITE;
+			req.buf = op->payload;
+			ar.writing[op->file] = 1;
+		}
+		req.tag = ((uint64_t)slot << 32) | i;
+		ar.files.pos[op->file] = req.off + op->len;
+		ar.started[i] = hdd_stats_now();
+		if ( hdd_async_submit(&req) ) {
+			hdd_log( LOG_ERROR_LEVEL, "Submit of command %u failed, aborting simulation.", i );
+			ret = -1;
+		}
+	}
+
+	// Collect what is left in flight, then release everything
+	while ( hdd_async_outstanding() > 0 ) {
+		if ( reapAsyncReplay(&ar, wl) ) {
+			ret = -1;
+		}
+	}
+	hdd_async_close();
+	hdd_workload_free_files( &ar.files );
+	free( ar.rbufs );
+	free( ar.slots );
+	free( ar.reads );
+	free( ar.writing );
+	free( ar.started );
+	return( ret );
+}
@@ -0,0 +1,111 @@
+#ifndef HDD_WORKLOAD_INCLUDED
+#define HDD_WORKLOAD_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : hdd_workload.h
+//  Description    : This is the interface for the workload loader.  A
+//                   workload file is mapped into memory, tokenized in place
+//                   and compiled into a stream of operations that the
+//                   simulator replays.  A compiled workload can be saved as
+//                   a versioned binary trace (see hdd_wlc) and replayed
+//                   from that.  The compiler and traces are in hdd_trace.c,
+//                   which needs no device, the replay in hdd_workload.c.
+//
+//  Author         : Chuyang Zhang
+//  Last Modified  : 2017/12/1
+//
+
+// Include files
+#include <stdint.h>
+#include <stddef.h>
+
+// Workload operations
+typedef enum {
+	HDD_WL_FORMAT  = 0,  // Format the file system
+	HDD_WL_MOUNT   = 1,  // Mount the file system
+	HDD_WL_UNMOUNT = 2,  // Close the files and unmount the file system
+	HDD_WL_WRITEAT = 3,  // Seek to off and write len bytes of payload
+	HDD_WL_WRITE   = 4,  // Write len bytes of payload
+	HDD_WL_SEEK    = 5,  // Seek to off
+	HDD_WL_READ    = 6,  // Read len bytes
+} HddWorkloadOpcode;
+
+// One compiled workload operation
+typedef struct {
+	uint8_t   op;        // The HddWorkloadOpcode
+	uint32_t  file;      // The file id (index in the workload file names)
+	int32_t   len;       // The length (or expected result of device ops)
+	int32_t   off;       // The offset
+	char     *payload;   // The bytes written (in the mapped file), or NULL
+} HddWorkloadOp;
+
+// A loaded workload
+typedef struct {
+	char          *map;        // The mapped workload or trace file
+	size_t         mapSize;    // The size of the mapping
+	HddWorkloadOp *ops;        // The operations in workload order
+	uint32_t       count;      // The number of operations
+	char         **files;      // The file names (in the mapping), by file id
+	uint32_t       fileCount;  // The number of files
+	int32_t        maxLength;  // The longest read or write
+	char          *payloads;   // The expanded payloads of a trace, NULL for text
+	double         parseSecs;  // The time spent compiling the workload
+} HddWorkload;
+
+// A file table for replaying, workload files are opened on first use
+typedef struct {
+	int16_t  *fhandle;   // The handle of each workload file id, -1 if not open
+	uint32_t *opened;    // The file ids opened through this table
+	uint32_t *pos;       // The replay position of each file id, reads and writes are positional
+	uint32_t  used;      // The number of opened files
+	char     *rbuf;      // The buffer reads land in
+	int       shared;    // The handles belong to another table
+} HddWorkloadFiles;
+
+//
+// Workload interface
+
+int hdd_workload_load(HddWorkload *wl, const char *path);
+	// Map and compile a workload file, 0 if successful and -1 on failure
+
+int hdd_workload_save(HddWorkload *wl, const char *path);
+	// Save a loaded workload as a binary trace, 0 if successful and -1 on failure
+
+int hdd_workload_load_trace(HddWorkload *wl, const char *path);
+	// Map and check a binary trace, 0 if successful and -1 on failure
+
+void hdd_workload_free(HddWorkload *wl);
+	// Release a loaded workload
+
+int hdd_workload_replay(HddWorkload *wl);
+	// Replay a workload on the calling thread, 0 if successful and -1 on failure
+
+int hdd_workload_replay_async(HddWorkload *wl, uint32_t depth);
+	// Replay a workload keeping up to depth file commands in flight, 0 if successful and -1 on failure
+
+//
+// Replay building blocks (for running the file operations on several threads)
+
+int hdd_workload_init_files(HddWorkloadFiles *wf, HddWorkload *wl, int16_t *fhandle);
+	// Setup a file table, sharing the handles of another table unless fhandle is NULL
+
+int hdd_workload_device_op(HddWorkloadOp *op);
+	// Carry out a FORMAT, MOUNT or UNMOUNT (the files must be closed for UNMOUNT)
+
+int hdd_workload_file_op(HddWorkloadFiles *wf, HddWorkload *wl, HddWorkloadOp *op);
+	// Carry out a file operation, opening the file on first use
+
+int hdd_workload_close_files(HddWorkloadFiles *wf, HddWorkload *wl);
+	// Close the files opened through a file table
+
+void hdd_workload_free_files(HddWorkloadFiles *wf);
+	// Release a file table (shared handles are left to their owner)
+
+//
+// Unit testing for the module
+
+int hddWorkloadUnitTest(void);
+	// Perform a test of the workload loader
+
+#endif